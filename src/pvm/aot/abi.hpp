@@ -0,0 +1,43 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include "pvm/jit/context.hpp"
+
+//! Version of the interface between the VM and modules built from the output
+//! of the AOT transpiler. Bump it on any change to the structures below or to
+//! JitContext.
+constexpr u32 aot_abi_version = 1;
+
+//! Native function compiled from a script.
+using AotEntry = void (*)(JitContext*);
+
+//! Executes the instruction at a block offset through the interpreter.
+//! @see VM::jit_step
+using AotStep = bool (*)(JitContext*, u32);
+
+//! Script compiled ahead of time, along with the bytecode it was compiled
+//! from. Instructions without a native translation are interpreted from that
+//! bytecode, so it has to match the offsets the native code refers to.
+struct AotScript
+{
+	const char*  name;
+	u32          local_count;
+	const Block* bytecode;
+	u32          size;
+	AotEntry     entry;
+};
+
+//! Exported as 'pvm_aot_module' by AOT modules.
+struct AotModule
+{
+	u32 abi_version;
+
+	//! Form::bytecode_checksum of the data.win the module was built from.
+	u64 checksum;
+
+	u32              script_count;
+	const AotScript* scripts;
+
+	//! Callback into the interpreter, set by the loader.
+	AotStep* step;
+};
@@ -0,0 +1,76 @@
+#include "pvm/aot/library.hpp"
+
+#include "pvm/config.hpp"
+#include "pvm/vm/vm.hpp"
+#include <dlfcn.h>
+#include <fmt/core.h>
+#include <stdexcept>
+
+AotLibrary::AotLibrary(const std::string& path) :
+	_handle{dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL)}
+{
+	if (_handle == nullptr)
+	{
+		throw std::runtime_error{
+			fmt::format("Failed to load '{}': {}", path, dlerror())};
+	}
+
+	_module = static_cast<const AotModule*>(dlsym(_handle, "pvm_aot_module"));
+
+	if (_module == nullptr || _module->abi_version != aot_abi_version)
+	{
+		dlclose(_handle);
+		throw std::runtime_error{fmt::format(
+			"'{}' is not an AOT module for this version of the VM", path)};
+	}
+
+	*_module->step = &VM::jit_step;
+}
+
+AotLibrary::~AotLibrary()
+{
+	dlclose(_handle);
+}
+
+std::size_t AotLibrary::bind(Form& form)
+{
+	if (_module->checksum != form.bytecode_checksum)
+	{
+		throw std::runtime_error{fmt::format(
+			"AOT module checksum {:016x} does not match the data.win ({:016x})",
+			_module->checksum,
+			form.bytecode_checksum)};
+	}
+
+	std::size_t bound = 0;
+
+	for (u32 i = 0; i < _module->script_count; ++i)
+	{
+		const auto& aot = _module->scripts[i];
+
+		auto& function = *_functions.emplace_back(
+			std::make_unique<NativeFunction>());
+
+		function.entry              = aot.entry;
+		function.script.name        = aot.name;
+		function.script.local_count = aot.local_count;
+		function.script.data.assign(aot.bytecode, aot.bytecode + aot.size);
+
+		for (auto& def : form.func.definitions)
+		{
+			if (!def.is_builtin && def.associated_script != nullptr
+				&& def.associated_script->name == function.script.name)
+			{
+				def.associated_native = &function;
+				++bound;
+
+				if constexpr (check(debug::verbose_bindings))
+				{
+					fmt::print("Bound AOT-compiled '{}'\n", def.name);
+				}
+			}
+		}
+	}
+
+	return bound;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "pvm/aot/abi.hpp"
+#include "pvm/unpack/chunk/form.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+//! Script provided by an AOT module, bound into a FunctionDefinition.
+struct NativeFunction
+{
+	//! Bytecode the native code was compiled from.
+	Script script;
+
+	AotEntry entry;
+};
+
+//! Shared object built from the output of the AOT transpiler (see
+//! write_aot_module()). It has to outlive the forms it is bound into.
+class AotLibrary
+{
+	public:
+	//! @throws std::runtime_error when the library cannot be loaded or was
+	//! built for another version of the VM.
+	explicit AotLibrary(const std::string& path);
+	~AotLibrary();
+
+	AotLibrary(const AotLibrary&) = delete;
+	AotLibrary& operator=(const AotLibrary&) = delete;
+
+	//! Binds the native scripts into the functions of 'form'.
+	//! @throws std::runtime_error when 'form' is not the data.win the module
+	//! was built from.
+	//! @returns the amount of functions bound.
+	std::size_t bind(Form& form);
+
+	private:
+	void*            _handle;
+	const AotModule* _module;
+
+	std::vector<std::unique_ptr<NativeFunction>> _functions;
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+// Support code for the C++ emitted by the AOT transpiler, which is compiled
+// separately from the VM. Keep it free of dependencies on the rest of the VM.
+
+#include "pvm/aot/abi.hpp"
+#include <cstring>
+#include <type_traits>
+
+namespace aot
+{
+inline AotStep step = nullptr;
+
+//! Returns the value of type T represented by 'bits'.
+template<class T, class U>
+inline T bits(U bits)
+{
+	static_assert(sizeof(T) == sizeof(U));
+
+	T value;
+	std::memcpy(&value, &bits, sizeof(T));
+	return value;
+}
+
+template<class T>
+inline void push(JitContext* context, T value)
+{
+	std::memcpy(
+		context->stack_raw + *context->stack_offset, &value, sizeof(T));
+	*context->stack_offset += sizeof(T);
+}
+
+template<class T>
+inline T pop(JitContext* context)
+{
+	*context->stack_offset -= sizeof(T);
+
+	T value;
+	std::memcpy(
+		&value, context->stack_raw + *context->stack_offset, sizeof(T));
+	return value;
+}
+
+template<class T>
+inline T peek(JitContext* context)
+{
+	T value;
+	std::memcpy(
+		&value,
+		context->stack_raw + *context->stack_offset - sizeof(T),
+		sizeof(T));
+	return value;
+}
+
+//! Applies 'op' over the usual arithmetic conversions of 'a' and 'b',
+//! wrapping around on integer overflow rather than relying on UB.
+template<class A, class B, class Op>
+inline auto wrapping(A a, B b, Op op)
+{
+	using R = decltype(a + b);
+
+	if constexpr (std::is_integral_v<R>)
+	{
+		using U = std::make_unsigned_t<R>;
+		return R(op(U(R(a)), U(R(b))));
+	}
+	else
+	{
+		return op(R(a), R(b));
+	}
+}
+
+//! Pops the right-hand side of type B then the left-hand side of type A, and
+//! pushes the result of 'op'.
+template<class A, class B, class Op>
+inline void binary(JitContext* context, Op op)
+{
+	auto b = pop<B>(context);
+	auto a = pop<A>(context);
+	push(context, op(a, b));
+}
+
+struct Add
+{
+	template<class A, class B>
+	auto operator()(A a, B b) const
+	{
+		return wrapping(a, b, [](auto x, auto y) { return x + y; });
+	}
+};
+
+struct Sub
+{
+	template<class A, class B>
+	auto operator()(A a, B b) const
+	{
+		return wrapping(a, b, [](auto x, auto y) { return x - y; });
+	}
+};
+
+struct Mul
+{
+	template<class A, class B>
+	auto operator()(A a, B b) const
+	{
+		return wrapping(a, b, [](auto x, auto y) { return x * y; });
+	}
+};
+
+//! Only used over floating-point operands, see the transpiler.
+struct Div
+{
+	template<class A, class B>
+	auto operator()(A a, B b) const
+	{
+		return a / b;
+	}
+};
+} // namespace aot
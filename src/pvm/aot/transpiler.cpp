@@ -0,0 +1,412 @@
+#include "pvm/aot/transpiler.hpp"
+
+#include "pvm/bc/disasm.hpp"
+#include "pvm/bc/instruction.hpp"
+#include "pvm/bc/opt/constant.hpp"
+#include "pvm/bc/opt/peephole.hpp"
+#include "pvm/bc/opt/typeinference.hpp"
+#include "pvm/config.hpp"
+#include <cstring>
+#include <fmt/format.h>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+//! C++ type of a stack slot of type 'type', if it is a plain number.
+[[nodiscard]] std::optional<std::string> native_type(DataType type)
+{
+	switch (type)
+	{
+	case DataType::i32: return "s32";
+	case DataType::i64: return "s64";
+	case DataType::f32: return "f32";
+	case DataType::f64: return "f64";
+	default: return std::nullopt;
+	}
+}
+
+[[nodiscard]] std::string constant_expression(const Constant& constant)
+{
+	return std::visit(
+		[](auto v) {
+			using T = decltype(v);
+
+			if constexpr (std::is_same_v<T, s32>)
+			{
+				return fmt::format("s32({})", v);
+			}
+			else
+			{
+				// Bit patterns are exact, including for NaN and extremes
+				std::make_unsigned_t<std::conditional_t<
+					sizeof(T) == 8,
+					s64,
+					s32>>
+					bits;
+				std::memcpy(&bits, &v, sizeof(T));
+
+				return fmt::format(
+					"aot::bits<{}>(u{}(0x{:x}))",
+					*native_type(stack_type_of(v)),
+					sizeof(T) * 8,
+					bits);
+			}
+		},
+		constant);
+}
+
+[[nodiscard]] std::string escape(const std::string& text)
+{
+	std::string escaped;
+
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+		}
+
+		escaped += c;
+	}
+
+	return escaped;
+}
+
+//! Returns the C++ statement translating the instruction at 'offset', or
+//! std::nullopt when it has to be interpreted.
+[[nodiscard]] std::optional<std::string>
+translate(const Script& script, std::size_t offset)
+{
+	const Block* block  = &script.data[offset];
+	const auto   opcode = instr_opcode(*block);
+	const auto   t1     = instr_t1(*block);
+	const auto   t2     = instr_t2(*block);
+
+	auto label = [&](s64 target) {
+		return std::size_t(target) == script.data.size()
+			? std::string{"return;"}
+			: fmt::format("goto L_{:08x};", target);
+	};
+
+	switch (opcode)
+	{
+	case Instr::oppushi16:
+	case Instr::oppushcst:
+	{
+		InstructionList::Instruction instruction{
+			{block, block + instruction_size(block)}};
+
+		if (auto constant = constant_of(instruction))
+		{
+			return fmt::format(
+				"aot::push(context, {});", constant_expression(*constant));
+		}
+
+		return std::nullopt;
+	}
+
+	case Instr::opadd:
+	case Instr::opsub:
+	case Instr::opmul:
+	case Instr::opdiv:
+	{
+		auto a = native_type(t2), b = native_type(t1);
+		if (!a || !b)
+		{
+			return std::nullopt;
+		}
+
+		const char* op;
+		switch (opcode)
+		{
+		case Instr::opadd: op = "Add"; break;
+		case Instr::opsub: op = "Sub"; break;
+		case Instr::opmul: op = "Mul"; break;
+		default:
+			// Integer division by zero is left to the interpreter
+			if (*a != "f64" && *a != "f32" && *b != "f64" && *b != "f32")
+			{
+				return std::nullopt;
+			}
+
+			op = "Div";
+		}
+
+		return fmt::format(
+			"aot::binary<{}, {}>(context, aot::{}{{}});", *a, *b, op);
+	}
+
+	case Instr::opcmp:
+	{
+		auto a = native_type(t2), b = native_type(t1);
+		if (!a || !b)
+		{
+			return std::nullopt;
+		}
+
+		const char* op;
+		switch (CompFunc((*block >> 8u) & 0xFFu))
+		{
+		case CompFunc::lt: op = "<"; break;
+		case CompFunc::lte: op = "<="; break;
+		case CompFunc::eq: op = "=="; break;
+		case CompFunc::neq: op = "!="; break;
+		case CompFunc::gte: op = ">="; break;
+		case CompFunc::gt: op = ">"; break;
+		default: return std::nullopt;
+		}
+
+		return fmt::format(
+			"{{ auto b = aot::pop<{}>(context); auto a = aot::pop<{}>(context); "
+			"context->compare_flag = a {} b; }}",
+			*b,
+			*a,
+			op);
+	}
+
+	case Instr::opconv:
+	{
+		auto from = native_type(t1), to = native_type(t2);
+		if (!from || !to)
+		{
+			return std::nullopt;
+		}
+
+		if (from == to)
+		{
+			return std::string{};
+		}
+
+		return fmt::format(
+			"aot::push(context, {}(aot::pop<{}>(context)));", *to, *from);
+	}
+
+	case Instr::opdup:
+	{
+		auto type = native_type(t1);
+		if (!type || (*block & 0xFFu) != 0)
+		{
+			return std::nullopt;
+		}
+
+		return fmt::format(
+			"aot::push(context, aot::peek<{}>(context));", *type);
+	}
+
+	case Instr::oppopz:
+	{
+		auto type = native_type(t1);
+		if (!type)
+		{
+			return std::nullopt;
+		}
+
+		return fmt::format("aot::pop<{}>(context);", *type);
+	}
+
+	case Instr::opb: return label(s64(offset) + branch_offset(*block));
+
+	case Instr::opbt:
+	case Instr::opbf:
+		return fmt::format(
+			"if ({}context->compare_flag) {}",
+			opcode == Instr::opbf ? "!" : "",
+			label(s64(offset) + branch_offset(*block)));
+
+	default: return std::nullopt;
+	}
+}
+} // namespace
+
+std::optional<std::string> transpile_script(
+	const Form& form, const Script& script, const std::string& function_name)
+{
+	const auto& data = script.data;
+
+	if (!script.jump_tables.empty())
+	{
+		return std::nullopt;
+	}
+
+	// Branch targets need labels, and must be instruction boundaries
+	std::vector<bool> starts(data.size() + 1), targets(data.size() + 1);
+
+	for (std::size_t offset = 0; offset < data.size();)
+	{
+		auto size = instruction_size(&data[offset]);
+		if (offset + size > data.size())
+		{
+			return std::nullopt;
+		}
+
+		starts[offset] = true;
+
+		if (is_branch(instr_opcode(data[offset])))
+		{
+			auto target = s64(offset) + branch_offset(data[offset]);
+			if (target < 0 || std::size_t(target) > data.size())
+			{
+				return std::nullopt;
+			}
+
+			targets[std::size_t(target)] = true;
+		}
+
+		offset += size;
+	}
+
+	starts.back() = true;
+	for (std::size_t offset = 0; offset <= data.size(); ++offset)
+	{
+		if (targets[offset] && !starts[offset])
+		{
+			return std::nullopt;
+		}
+	}
+
+	Disassembler disasm{form};
+
+	std::string source = fmt::format(
+		"// {}\nvoid {}(JitContext* context)\n{{\n",
+		script.name,
+		function_name);
+
+	for (std::size_t offset = 0; offset < data.size();)
+	{
+		auto instruction = disasm.disassemble_block(&data[offset], &script);
+
+		if (targets[offset])
+		{
+			source += fmt::format("L_{:08x}:\n", offset);
+		}
+
+		source += fmt::format(
+			"\t// {}{} {}\n",
+			instruction.location,
+			instruction.mnemonic,
+			instruction.params);
+
+		// Identity conversions translate to nothing
+		auto statement = translate(script, offset);
+		if (!statement)
+		{
+			source += fmt::format(
+				"\tif (aot::step(context, {})) return;\n", offset);
+		}
+		else if (!statement->empty())
+		{
+			source += fmt::format("\t{}\n", *statement);
+		}
+
+		offset += instruction_size(&data[offset]);
+	}
+
+	source += "}\n";
+	return source;
+}
+
+std::size_t write_aot_module(
+	const Form&        form,
+	const std::string& directory,
+	const std::string& include_directory)
+{
+	auto write = [&](const std::string& name, const std::string& contents) {
+		std::ofstream file{directory + "/" + name};
+		if (!(file << contents))
+		{
+			throw std::runtime_error{
+				fmt::format("Failed to write '{}/{}'", directory, name)};
+		}
+	};
+
+	const std::string header = "// Generated by phosphorvm-aot, do not edit.\n"
+							   "#include \"pvm/aot/runtime.hpp\"\n\n";
+
+	std::string declarations, bytecodes, entries, sources;
+	std::size_t count = 0;
+
+	for (std::size_t i = 0; i < form.code.elements.size(); ++i)
+	{
+		Script script = form.code.elements[i];
+
+		if (script.data.empty())
+		{
+			continue;
+		}
+
+		// Jump tables cannot be carried over, so leave them out
+		if constexpr (opt::peephole)
+		{
+			peephole_optimize(script);
+		}
+
+		if constexpr (opt::infer_types)
+		{
+			if (infer_types(script) != 0 && opt::peephole)
+			{
+				peephole_optimize(script);
+			}
+		}
+
+		auto function = fmt::format("pvm_aot_{}", i);
+		auto source   = transpile_script(form, script, function);
+
+		if (!source)
+		{
+			continue;
+		}
+
+		auto file_name = fmt::format("script_{}.cpp", i);
+		write(file_name, header + *source);
+
+		declarations += fmt::format("void {}(JitContext* context);\n", function);
+		bytecodes += fmt::format(
+			"const Block bytecode_{}[] = {{{:#010x}}};\n",
+			i,
+			fmt::join(script.data, ", "));
+		entries += fmt::format(
+			"\t{{\"{}\", {}, bytecode_{}, {}, &{}}},\n",
+			escape(script.name),
+			script.local_count,
+			i,
+			script.data.size(),
+			function);
+		sources += fmt::format("\t\"{}\"\n", file_name);
+		++count;
+	}
+
+	if (count == 0)
+	{
+		throw std::runtime_error{"No script could be transpiled"};
+	}
+
+	write(
+		"module.cpp",
+		fmt::format(
+			"{}{}\nnamespace\n{{\n{}\nconst AotScript scripts[] = {{\n{}}};\n}} "
+			"// namespace\n\nextern \"C\" const AotModule pvm_aot_module{{\n\t"
+			"aot_abi_version,\n\t{:#x}u,\n\t{},\n\tscripts,\n\t&aot::step}};\n",
+			header,
+			declarations,
+			bytecodes,
+			entries,
+			form.bytecode_checksum,
+			count));
+
+	write(
+		"CMakeLists.txt",
+		fmt::format(
+			"# Generated by phosphorvm-aot, do not edit.\n"
+			"cmake_minimum_required(VERSION 3.8)\n\n"
+			"project(phosphorvm-aot-module CXX)\n\n"
+			"add_library(\n\tdata.aot\n\tMODULE\n\n\t\"module.cpp\"\n{})\n\n"
+			"set_target_properties(\n\tdata.aot\n\tPROPERTIES\n\n"
+			"\tPREFIX \"\"\n\tCXX_STANDARD 17\n)\n\n"
+			"target_include_directories(\n\tdata.aot\n\tPRIVATE\n\n\t\"{}\"\n)\n\n"
+			"target_compile_options(\n\tdata.aot\n\tPRIVATE\n\n\t\"-O2\"\n)\n",
+			sources,
+			include_directory));
+
+	return count;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "pvm/unpack/chunk/form.hpp"
+#include <optional>
+#include <string>
+
+//! Translates 'script' to C++ source defining 'void <function_name>(
+//! JitContext*)', to be built against "pvm/aot/runtime.hpp". Like the JIT,
+//! typed stack operations and branches get translated, and the remaining
+//! instructions call back into the interpreter.
+//! @returns std::nullopt when the script uses jump tables, which modules
+//! cannot carry over.
+std::optional<std::string> transpile_script(
+	const Form& form, const Script& script, const std::string& function_name);
+
+//! Writes an AOT module for the scripts of 'form' to 'directory': one source
+//! file per script, the module descriptor, and a CMake project building them
+//! into 'data.aot.so'. Scripts are optimized (see optimize()) before being
+//! transpiled. 'include_directory' is the directory holding the 'pvm' headers.
+//! @returns the amount of scripts transpiled.
+std::size_t write_aot_module(
+	const Form&        form,
+	const std::string& directory,
+	const std::string& include_directory);
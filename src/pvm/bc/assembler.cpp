@@ -0,0 +1,1009 @@
+#include "pvm/bc/assembler.hpp"
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/bc/names.hpp"
+#include "pvm/unpack/chunk/form.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fmt/core.h>
+#include <limits>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+constexpr std::string_view script_prefix = "gml_Script_";
+
+//! VARI 'unknown' value of special variables, see ODDITIES.md.
+constexpr u32 special_var_unknown = 0xFFFFFFFAu;
+
+[[nodiscard]] std::string_view trim(std::string_view text)
+{
+	auto begin = text.find_first_not_of(" \t\r");
+	if (begin == std::string_view::npos)
+	{
+		return {};
+	}
+
+	auto end = text.find_last_not_of(" \t\r");
+	return text.substr(begin, end - begin + 1);
+}
+
+//! Removes the comment from 'line', if any, ignoring semicolons in strings.
+[[nodiscard]] std::string_view strip_comment(std::string_view line)
+{
+	bool in_string = false;
+
+	for (std::size_t i = 0; i < line.size(); ++i)
+	{
+		if (in_string && line[i] == '\\')
+		{
+			++i;
+		}
+		else if (line[i] == '"')
+		{
+			in_string = !in_string;
+		}
+		else if (line[i] == ';' && !in_string)
+		{
+			return line.substr(0, i);
+		}
+	}
+
+	return line;
+}
+
+[[nodiscard]] std::optional<DataType> parse_type(std::string_view suffix)
+{
+	static const std::map<std::string_view, DataType> types{
+		{"f64", DataType::f64},
+		{"f32", DataType::f32},
+		{"i32", DataType::i32},
+		{"i64", DataType::i64},
+		{"b32", DataType::b32},
+		{"var", DataType::var},
+		{"str", DataType::str},
+		{"i16", DataType::i16}};
+
+	auto it = types.find(suffix);
+	return it != types.end() ? std::optional{it->second} : std::nullopt;
+}
+
+[[nodiscard]] std::optional<InstType> parse_instance(std::string_view name)
+{
+	static const std::map<std::string_view, InstType> instances{
+		{"(stacktop)", InstType::stack_top_or_global},
+		{"self", InstType::self},
+		{"other", InstType::other},
+		{"all", InstType::all},
+		{"noone", InstType::noone},
+		{"global", InstType::global},
+		{"special", InstType::special},
+		{"local", InstType::local}};
+
+	auto it = instances.find(name);
+	return it != instances.end() ? std::optional{it->second} : std::nullopt;
+}
+
+[[nodiscard]] std::optional<CompFunc> parse_comparator(std::string_view name)
+{
+	static const std::map<std::string_view, CompFunc> comparators{
+		{"<", CompFunc::lt},
+		{"<=", CompFunc::lte},
+		{"==", CompFunc::eq},
+		{"!=", CompFunc::neq},
+		{">=", CompFunc::gte},
+		{">", CompFunc::gt}};
+
+	auto it = comparators.find(name);
+	return it != comparators.end() ? std::optional{it->second} : std::nullopt;
+}
+
+//! Parses the whole of 'text' as a number of type T.
+template<class T>
+[[nodiscard]] std::optional<T> parse_number(std::string_view text)
+{
+	std::string copy{text};
+	char*       end = nullptr;
+	errno           = 0;
+
+	T value;
+	if constexpr (std::is_same_v<T, f32>)
+	{
+		value = std::strtof(copy.c_str(), &end);
+	}
+	else if constexpr (std::is_floating_point_v<T>)
+	{
+		value = std::strtod(copy.c_str(), &end);
+	}
+	else
+	{
+		auto parsed = std::strtoll(copy.c_str(), &end, 0);
+		if (parsed < s64(std::numeric_limits<T>::min())
+			|| parsed > s64(std::numeric_limits<T>::max()))
+		{
+			return std::nullopt;
+		}
+
+		value = T(parsed);
+	}
+
+	if (copy.empty() || end != copy.c_str() + copy.size() || errno == ERANGE)
+	{
+		return std::nullopt;
+	}
+
+	return value;
+}
+
+//! Instructions of the same kind share their syntax.
+enum class Kind
+{
+	binary,
+	compare,
+	unary,
+	dup,
+	breakpoint,
+	branch,
+	push,
+	push_i16,
+	push_local,
+	push_special,
+	pop,
+	call
+};
+
+struct Mnemonic
+{
+	Instr       opcode;
+	Kind        kind;
+	std::size_t type_count;
+};
+
+[[nodiscard]] std::optional<Mnemonic> parse_mnemonic(std::string_view name)
+{
+	static const std::map<std::string_view, Mnemonic> mnemonics{
+		{"conv", {Instr::opconv, Kind::binary, 2}},
+		{"mul", {Instr::opmul, Kind::binary, 2}},
+		{"div", {Instr::opdiv, Kind::binary, 2}},
+		{"rem", {Instr::oprem, Kind::binary, 2}},
+		{"mod", {Instr::opmod, Kind::binary, 2}},
+		{"add", {Instr::opadd, Kind::binary, 2}},
+		{"sub", {Instr::opsub, Kind::binary, 2}},
+		{"and", {Instr::opand, Kind::binary, 2}},
+		{"or", {Instr::opor, Kind::binary, 2}},
+		{"xor", {Instr::opxor, Kind::binary, 2}},
+		{"shl", {Instr::opshl, Kind::binary, 2}},
+		{"shr", {Instr::opshr, Kind::binary, 2}},
+		{"cmp", {Instr::opcmp, Kind::compare, 2}},
+		{"neg", {Instr::opneg, Kind::unary, 1}},
+		{"not", {Instr::opnot, Kind::unary, 1}},
+		{"ret", {Instr::opret, Kind::unary, 1}},
+		{"popz", {Instr::oppopz, Kind::unary, 1}},
+		{"exit", {Instr::opexit, Kind::unary, 1}},
+		{"dup", {Instr::opdup, Kind::dup, 1}},
+		{"break", {Instr::opbreak, Kind::breakpoint, 1}},
+		{"b", {Instr::opb, Kind::branch, 0}},
+		{"bt", {Instr::opbt, Kind::branch, 0}},
+		{"bf", {Instr::opbf, Kind::branch, 0}},
+		{"pushenv", {Instr::oppushenv, Kind::branch, 0}},
+		{"popenv", {Instr::oppopenv, Kind::branch, 0}},
+		{"pushcst", {Instr::oppushcst, Kind::push, 1}},
+		{"pushglb", {Instr::oppushglb, Kind::push, 1}},
+		{"push", {Instr::oppushi16, Kind::push_i16, 1}},
+		{"pushloc", {Instr::oppushloc, Kind::push_local, 1}},
+		{"pushspc", {Instr::oppushspc, Kind::push_special, 0}},
+		{"pop", {Instr::oppop, Kind::pop, 2}},
+		{"call", {Instr::opcall, Kind::call, 1}}};
+
+	auto it = mnemonics.find(name);
+	return it != mnemonics.end() ? std::optional{it->second} : std::nullopt;
+}
+
+class Assembler
+{
+	Form& _form;
+
+	std::size_t _line = 0;
+
+	//! Script being assembled, if any, and its bytecode so far.
+	Script*            _script = nullptr;
+	std::vector<Block> _data;
+
+	//! Output offset of each label and of each '$xxxxxxxx:' location.
+	std::map<std::string, std::size_t, std::less<>> _labels;
+	std::map<std::size_t, std::size_t>              _locations;
+
+	//! Location following the last instruction, which branches to the end
+	//! of the script refer to.
+	std::optional<std::size_t> _end_location;
+
+	struct Fixup
+	{
+		std::size_t offset, line;
+		std::string target;
+	};
+
+	std::vector<Fixup> _fixups;
+
+	//! VARI index of the locals of the script, by name.
+	std::map<std::string, Block, std::less<>> _locals;
+	std::size_t                               _local_count = 0;
+
+	[[noreturn]] void error(const std::string& message) const;
+
+	void begin_script(std::string_view name);
+	void end_script();
+
+	void assemble_line(std::string_view line);
+	void assemble_instruction(
+		std::string_view mnemonic, std::string_view params);
+
+	[[nodiscard]] std::size_t resolve_target(const Fixup& fixup) const;
+
+	//! Encodes a variable operand such as '[array]self.x', returning the
+	//! operand block and the instance type of the main block.
+	[[nodiscard]] std::pair<Block, InstType>
+	variable_operand(std::string_view param);
+
+	[[nodiscard]] Block local_reference(std::string_view name);
+	[[nodiscard]] Block
+	variable_reference(std::string_view name, InstType type);
+	[[nodiscard]] Block special_reference(std::string_view name);
+	[[nodiscard]] Block function_reference(std::string_view name);
+	[[nodiscard]] Block string_reference(std::string_view param);
+
+	public:
+	explicit Assembler(Form& form);
+
+	void operator()(std::string_view source);
+};
+
+Assembler::Assembler(Form& form) : _form{form}
+{
+	auto& vars = _form.vari.definitions;
+
+	// Special variables are referred to by their id, so that they come first,
+	// as process_variables() would arrange for a loaded form
+	if (vars.empty())
+	{
+		for (auto id = std::size_t(SpecialVar::argument0);
+			 id < std::size_t(SpecialVar::none);
+			 ++id)
+		{
+			for (auto& [name, var] : special_var_names)
+			{
+				if (std::size_t(var) == id)
+				{
+					VariableDefinition def;
+					def.special_var   = var;
+					def.name          = std::string{name};
+					def.instance_type = s32(InstType::self);
+					def.unknown       = special_var_unknown;
+					def.occurrences   = 0;
+					def.first_address = 0;
+					vars.push_back(std::move(def));
+				}
+			}
+		}
+	}
+}
+
+void Assembler::error(const std::string& message) const
+{
+	throw std::runtime_error{fmt::format("Line {}: {}", _line, message)};
+}
+
+void Assembler::begin_script(std::string_view name)
+{
+	end_script();
+
+	if (name.empty())
+	{
+		error("Missing script name");
+	}
+
+	auto& scripts = _form.code.elements;
+
+	auto it = std::find_if(scripts.begin(), scripts.end(), [&](auto& script) {
+		return script.name == name;
+	});
+
+	_local_count = 0;
+
+	if (it != scripts.end())
+	{
+		_script      = &*it;
+		_local_count = _script->local_count;
+
+		// Keep referring to the locals the script already uses
+		for (std::size_t offset = 0; offset < _script->data.size();)
+		{
+			const Block* block = &_script->data[offset];
+			offset += instruction_size(block);
+
+			bool is_local
+				= InstType(s16(*block & 0xFFFFu)) == InstType::local
+				&& (instr_opcode(*block) == Instr::oppushloc
+					|| instr_opcode(*block) == Instr::oppop
+					|| ((instr_opcode(*block) == Instr::oppushcst
+						 || instr_opcode(*block) == Instr::oppushglb)
+						&& instr_t1(*block) == DataType::var));
+
+			if (is_local && offset <= _script->data.size())
+			{
+				auto reference = block[1] & 0x00FFFFFFu;
+				if (reference < _form.vari.definitions.size())
+				{
+					const auto& def = _form.vari.definitions[reference];
+					_locals.emplace(def.name, reference);
+
+					// Same as Inliner::first_free_local()
+					_local_count
+						= std::max(_local_count, std::size_t(def.unknown));
+				}
+			}
+		}
+
+		return;
+	}
+
+	// Functions point to scripts, which must not move anymore
+	if (scripts.size() == scripts.capacity()
+		&& std::any_of(
+			_form.func.definitions.begin(),
+			_form.func.definitions.end(),
+			[](auto& def) { return def.associated_script != nullptr; }))
+	{
+		error(fmt::format("Cannot add script '{}' to a finalized form", name));
+	}
+
+	auto& script       = scripts.emplace_back();
+	script.name        = std::string{name};
+	script.file_offset = 0;
+	_script            = &script;
+
+	if (name.substr(0, script_prefix.size()) == script_prefix)
+	{
+		auto  short_name  = name.substr(script_prefix.size());
+		auto& definitions = _form.scpt.elements;
+
+		if (std::none_of(
+				definitions.begin(), definitions.end(), [&](auto& def) {
+					return def.name == short_name;
+				}))
+		{
+			definitions.push_back(
+				{std::string{short_name}, s32(scripts.size() - 1)});
+		}
+	}
+}
+
+void Assembler::end_script()
+{
+	if (_script == nullptr)
+	{
+		return;
+	}
+
+	for (auto& fixup : _fixups)
+	{
+		auto target   = resolve_target(fixup);
+		auto relative = s64(target) - s64(fixup.offset);
+
+		// See branch_offset()
+		if (relative < std::numeric_limits<s16>::min()
+			|| relative > std::numeric_limits<s16>::max())
+		{
+			throw std::runtime_error{fmt::format(
+				"Line {}: Branch to '{}' is too far",
+				fixup.line,
+				fixup.target)};
+		}
+
+		_data[fixup.offset] |= u32(relative) & 0x7FFFFFu;
+	}
+
+	_script->data        = std::move(_data);
+	_script->local_count = _local_count;
+	_script->jump_tables.clear();
+	_script->inlined.clear();
+	_script->cached_cfg.reset();
+	_script->native_code.reset();
+
+	_script = nullptr;
+	_data.clear();
+	_labels.clear();
+	_locations.clear();
+	_end_location.reset();
+	_fixups.clear();
+	_locals.clear();
+}
+
+std::size_t Assembler::resolve_target(const Fixup& fixup) const
+{
+	auto fail = [&] {
+		throw std::runtime_error{fmt::format(
+			"Line {}: Unknown branch target '{}'", fixup.line, fixup.target)};
+	};
+
+	std::string_view target = fixup.target;
+
+	if (target.front() == '+' || target.front() == '-')
+	{
+		auto relative = parse_number<s32>(target.substr(target.front() == '+'));
+		if (!relative || s64(fixup.offset) + *relative < 0)
+		{
+			fail();
+		}
+
+		return std::size_t(s64(fixup.offset) + *relative);
+	}
+
+	if (target.front() == '$')
+	{
+		auto location
+			= parse_number<s64>(fmt::format("0x{}", target.substr(1)));
+		if (!location || *location < 0)
+		{
+			fail();
+		}
+
+		// Without locations, offsets are the ones of the output
+		if (_locations.empty())
+		{
+			return std::size_t(*location);
+		}
+
+		if (auto it = _locations.find(std::size_t(*location));
+			it != _locations.end())
+		{
+			return it->second;
+		}
+
+		if (_end_location && *_end_location == std::size_t(*location))
+		{
+			return _data.size();
+		}
+
+		fail();
+	}
+
+	auto it = _labels.find(target);
+	if (it == _labels.end())
+	{
+		fail();
+	}
+
+	return it->second;
+}
+
+std::pair<Block, InstType> Assembler::variable_operand(std::string_view param)
+{
+	auto var_type = VarType::normal;
+
+	static const std::pair<std::string_view, VarType> prefixes[]{
+		{"[array]", VarType::array},
+		{"[stacktop]", VarType::stack_top},
+		{"[unknown]", VarType::unknown}};
+
+	for (auto& [prefix, type] : prefixes)
+	{
+		if (param.substr(0, prefix.size()) == prefix)
+		{
+			var_type = type;
+			param.remove_prefix(prefix.size());
+		}
+	}
+
+	auto dot = param.find('.');
+	if (dot == std::string_view::npos || dot + 1 == param.size())
+	{
+		error(fmt::format(
+			"Expected a variable such as 'self.x', got '{}'", param));
+	}
+
+	auto instance = param.substr(0, dot);
+	auto name     = param.substr(dot + 1);
+
+	InstType inst_type;
+	if (auto parsed = parse_instance(instance))
+	{
+		inst_type = *parsed;
+	}
+	else if (auto id = parse_number<s16>(instance); id && *id > 0)
+	{
+		inst_type = InstType(*id);
+	}
+	else
+	{
+		error(fmt::format("Unknown instance '{}'", instance));
+	}
+
+	auto reference = inst_type == InstType::local
+		? local_reference(name)
+		: variable_reference(name, inst_type);
+
+	return {(Block(var_type) << 24u) | reference, inst_type};
+}
+
+Block Assembler::local_reference(std::string_view name)
+{
+	if (auto it = _locals.find(name); it != _locals.end())
+	{
+		return it->second;
+	}
+
+	auto& vars = _form.vari.definitions;
+
+	VariableDefinition def;
+	def.name          = std::string{name};
+	def.instance_type = s32(InstType::local);
+	def.unknown       = u32(++_local_count);
+	def.occurrences   = 0;
+	def.first_address = 0;
+
+	auto reference = Block(vars.size());
+	vars.push_back(std::move(def));
+	_locals.emplace(std::string{name}, reference);
+
+	return reference;
+}
+
+Block Assembler::variable_reference(std::string_view name, InstType type)
+{
+	auto& vars = _form.vari.definitions;
+
+	// Variables of other instances are defined for self
+	auto instance_type = s32(
+		type == InstType::global ? InstType::global : InstType::self);
+
+	auto find = [&](auto predicate) {
+		return std::find_if(vars.begin(), vars.end(), [&](auto& def) {
+			return def.name == name
+				&& def.instance_type != s32(InstType::local) && predicate(def);
+		});
+	};
+
+	auto it = find(
+		[&](auto& def) { return def.instance_type == instance_type; });
+	if (it == vars.end())
+	{
+		it = find([](auto&) { return true; });
+	}
+
+	if (it != vars.end())
+	{
+		return Block(std::distance(vars.begin(), it));
+	}
+
+	VariableDefinition def;
+	def.name          = std::string{name};
+	def.instance_type = instance_type;
+	def.unknown       = 0;
+	def.occurrences   = 0;
+	def.first_address = 0;
+
+	vars.push_back(std::move(def));
+	return Block(vars.size() - 1);
+}
+
+Block Assembler::special_reference(std::string_view name)
+{
+	if (special_var_names.find(name) == special_var_names.end())
+	{
+		error(fmt::format("'{}' is not a special variable", name));
+	}
+
+	// Special variables only have a VARI entry once process_variables() moved
+	// it to the index of their id, which is what the VM reads
+	auto& vars = _form.vari.definitions;
+
+	auto it = std::find_if(vars.begin(), vars.end(), [&](auto& def) {
+		return def.name == name;
+	});
+
+	if (it == vars.end())
+	{
+		VariableDefinition def;
+		def.name          = std::string{name};
+		def.instance_type = s32(InstType::self);
+		def.unknown       = special_var_unknown;
+		def.occurrences   = 0;
+		def.first_address = 0;
+
+		vars.push_back(std::move(def));
+		it = vars.end() - 1;
+	}
+
+	return (Block(VarType::normal) << 24u)
+		| Block(std::distance(vars.begin(), it));
+}
+
+Block Assembler::function_reference(std::string_view name)
+{
+	auto& funcs = _form.func.definitions;
+
+	auto it = std::find_if(funcs.begin(), funcs.end(), [&](auto& def) {
+		return def.name == name;
+	});
+
+	if (it != funcs.end())
+	{
+		return Block(std::distance(funcs.begin(), it));
+	}
+
+	// Bound to a script or a builtin by process_functions()
+	FunctionDefinition def;
+	def.name               = std::string{name};
+	def.occurrences        = 0;
+	def.first_address      = 0;
+	def.is_builtin         = true;
+	def.associated_script  = nullptr;
+	def.associated_builtin = nullptr;
+
+	funcs.push_back(std::move(def));
+	return Block(funcs.size() - 1);
+}
+
+Block Assembler::string_reference(std::string_view param)
+{
+	if (param.size() < 2 || param.front() != '"' || param.back() != '"')
+	{
+		error(fmt::format("Expected a string between quotes, got '{}'", param));
+	}
+
+	std::string value;
+	for (std::size_t i = 1; i + 1 < param.size(); ++i)
+	{
+		if (param[i] == '\\' && i + 2 < param.size())
+		{
+			++i;
+			value += param[i] == 'n' ? '\n' : param[i];
+		}
+		else
+		{
+			value += param[i];
+		}
+	}
+
+	auto& strings = _form.strg.elements;
+
+	auto it = std::find_if(strings.begin(), strings.end(), [&](auto& def) {
+		return def.value == value;
+	});
+
+	if (it != strings.end())
+	{
+		return Block(std::distance(strings.begin(), it));
+	}
+
+	strings.push_back({std::move(value)});
+	return Block(strings.size() - 1);
+}
+
+void Assembler::assemble_instruction(
+	std::string_view mnemonic, std::string_view params)
+{
+	// e.g. 'add.i32.var'
+	std::vector<std::string_view> parts;
+	for (;;)
+	{
+		auto dot = mnemonic.find('.');
+		parts.push_back(mnemonic.substr(0, dot));
+
+		if (dot == std::string_view::npos)
+		{
+			break;
+		}
+
+		mnemonic.remove_prefix(dot + 1);
+	}
+
+	auto found = parse_mnemonic(parts.front());
+	if (!found)
+	{
+		error(fmt::format("Unknown instruction '{}'", parts.front()));
+	}
+
+	auto [opcode, kind, type_count] = *found;
+
+	if (parts.size() != type_count + 1)
+	{
+		error(fmt::format(
+			"'{}' takes {} type suffixes", parts.front(), type_count));
+	}
+
+	DataType types[2]{DataType::f64, DataType::f64};
+	for (std::size_t i = 0; i < type_count; ++i)
+	{
+		auto type = parse_type(parts[i + 1]);
+		if (!type)
+		{
+			error(fmt::format("Unknown type '{}'", parts[i + 1]));
+		}
+
+		types[i] = *type;
+	}
+
+	auto [t1, t2] = types;
+	Block main    = with_types(Block(opcode) << 24u, t1, t2);
+
+	auto require_params = [&](bool required) {
+		if (params.empty() == required)
+		{
+			error(
+				required
+					? fmt::format("'{}' expects an operand", parts.front())
+					: fmt::format("Unexpected operand '{}'", params));
+		}
+	};
+
+	auto number = [&](auto type_tag) {
+		using T = decltype(type_tag);
+
+		auto value = parse_number<T>(params);
+		if (!value)
+		{
+			error(fmt::format("Invalid value '{}'", params));
+		}
+
+		return *value;
+	};
+
+	auto immediate = [&](auto value) {
+		Block blocks[sizeof(value) / sizeof(Block)];
+		std::memcpy(blocks, &value, sizeof(value));
+		_data.insert(_data.end(), std::begin(blocks), std::end(blocks));
+	};
+
+	switch (kind)
+	{
+	case Kind::binary:
+	case Kind::unary:
+		require_params(false);
+		_data.push_back(main);
+		break;
+
+	case Kind::compare:
+	{
+		auto comparator = parse_comparator(params);
+		if (!comparator)
+		{
+			error(fmt::format("Unknown comparison '{}'", params));
+		}
+
+		_data.push_back(main | (Block(*comparator) << 8u));
+		break;
+	}
+
+	case Kind::dup:
+		_data.push_back(
+			main | (params.empty() ? 0 : Block(number(u16{}))));
+		break;
+
+	case Kind::breakpoint:
+		require_params(true);
+		_data.push_back(main | u16(number(s16{})));
+		break;
+
+	case Kind::branch:
+		require_params(true);
+		_fixups.push_back({_data.size(), _line, std::string{params}});
+		_data.push_back(Block(opcode) << 24u);
+		break;
+
+	case Kind::push:
+		require_params(true);
+
+		switch (t1)
+		{
+		case DataType::f64:
+			_data.push_back(main);
+			immediate(number(f64{}));
+			break;
+
+		case DataType::f32:
+			_data.push_back(main);
+			immediate(number(f32{}));
+			break;
+
+		case DataType::i32:
+			_data.push_back(main);
+			immediate(number(s32{}));
+			break;
+
+		case DataType::i64:
+			_data.push_back(main);
+			immediate(number(s64{}));
+			break;
+
+		case DataType::i16: _data.push_back(main | u16(number(s16{}))); break;
+
+		case DataType::b32:
+			if (params != "true" && params != "false")
+			{
+				error(fmt::format(
+					"Expected 'true' or 'false', got '{}'", params));
+			}
+
+			_data.push_back(main);
+			_data.push_back(params == "true" ? 1 : 0);
+			break;
+
+		case DataType::str:
+			_data.push_back(main);
+			_data.push_back(string_reference(params));
+			break;
+
+		case DataType::var:
+		{
+			auto [operand, inst_type] = variable_operand(params);
+			_data.push_back(main | u16(inst_type));
+			_data.push_back(operand);
+			break;
+		}
+
+		// Only used on the stack, so it has no suffix
+		case DataType::array: break;
+		}
+		break;
+
+	// push.i16 values are printed unsigned by older versions
+	case Kind::push_i16:
+		require_params(true);
+
+		if (t1 != DataType::i16)
+		{
+			error("Only push.i16 exists, see pushcst for other types");
+		}
+
+		if (auto value = parse_number<u16>(params))
+		{
+			_data.push_back(main | *value);
+		}
+		else
+		{
+			_data.push_back(main | u16(number(s16{})));
+		}
+		break;
+
+	case Kind::push_local:
+	case Kind::pop:
+	{
+		require_params(true);
+
+		auto [operand, inst_type] = variable_operand(params);
+		_data.push_back(main | u16(inst_type));
+		_data.push_back(operand);
+		break;
+	}
+
+	case Kind::push_special:
+		require_params(true);
+		_data.push_back(with_types(
+			main | u16(InstType::self), DataType::var, DataType::f64));
+		_data.push_back(special_reference(params));
+		break;
+
+	case Kind::call:
+	{
+		// e.g. 'script_fibo(1)'
+		auto open = params.find('(');
+		if (open == std::string_view::npos || params.back() != ')')
+		{
+			error(fmt::format(
+				"Expected a call such as 'name(argument count)', got '{}'",
+				params));
+		}
+
+		auto name = trim(params.substr(0, open));
+		params    = params.substr(open + 1, params.size() - open - 2);
+
+		_data.push_back(main | number(u16{}));
+		_data.push_back(function_reference(name));
+		break;
+	}
+	}
+}
+
+void Assembler::assemble_line(std::string_view line)
+{
+	line = trim(strip_comment(line));
+
+	if (line.empty())
+	{
+		return;
+	}
+
+	constexpr std::string_view script_directive = ".script";
+	if (line.substr(0, script_directive.size()) == script_directive)
+	{
+		begin_script(trim(line.substr(script_directive.size())));
+		return;
+	}
+
+	if (_script == nullptr)
+	{
+		error("Expected '.script <name>' before any instruction");
+	}
+
+	// '$0000002a: ' location, as printed by the disassembler
+	std::optional<std::size_t> location;
+	if (line.front() == '$')
+	{
+		auto colon = line.find(':');
+		if (colon == std::string_view::npos)
+		{
+			error("Expected ':' after the location");
+		}
+
+		auto parsed = parse_number<s64>(
+			fmt::format("0x{}", line.substr(1, colon - 1)));
+		if (!parsed || *parsed < 0)
+		{
+			error(fmt::format("Invalid location '{}'", line.substr(0, colon)));
+		}
+
+		location = std::size_t(*parsed);
+		_locations[*location] = _data.size();
+		line = trim(line.substr(colon + 1));
+	}
+
+	// 'label:' on its own
+	if (!line.empty() && line.back() == ':'
+		&& line.find_first_of(" \t") == std::string_view::npos)
+	{
+		auto name = line.substr(0, line.size() - 1);
+		if (!_labels.emplace(std::string{name}, _data.size()).second)
+		{
+			error(fmt::format("Duplicate label '{}'", name));
+		}
+		return;
+	}
+
+	if (line.empty())
+	{
+		return;
+	}
+
+	auto separator = line.find_first_of(" \t");
+	auto mnemonic  = line.substr(0, separator);
+	auto params    = separator == std::string_view::npos
+		   ? std::string_view{}
+		   : trim(line.substr(separator));
+
+	auto begin = _data.size();
+	assemble_instruction(mnemonic, params);
+
+	if (location)
+	{
+		_end_location = *location + (_data.size() - begin);
+	}
+}
+
+void Assembler::operator()(std::string_view source)
+{
+	for (_line = 1; !source.empty(); ++_line)
+	{
+		auto end = source.find('\n');
+		assemble_line(source.substr(0, end));
+
+		source.remove_prefix(
+			end == std::string_view::npos ? source.size() : end + 1);
+	}
+
+	end_script();
+}
+} // namespace
+
+void assemble(Form& form, std::string_view source)
+{
+	Assembler{form}(source);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string_view>
+
+struct Form;
+
+//! Assembles 'source', written in the syntax the Disassembler prints (see
+//! Disassembler::listing()), into 'form'.
+//!
+//! Each '.script <name>' line starts a script, which replaces the bytecode of
+//! the script of the same name when the form already has one. Instructions
+//! may be prefixed by their '$xxxxxxxx:' location, which branches refer to,
+//! or by a 'label:' line. Anything after a ';' is ignored.
+//!
+//! Variables, functions and strings are looked up by name in the VARI, FUNC
+//! and STRG tables of 'form', and added to them when missing. Scripts named
+//! 'gml_Script_<name>' get a SCPT entry, so that calls to '<name>' run them.
+//! The result is what the loader gives before finalize_bytecode(), which is
+//! left to the caller. Scripts must not be added to a finalized form, as
+//! functions point to them.
+//! @throws std::runtime_error on invalid source, with the line number.
+void assemble(Form& form, std::string_view source);
@@ -0,0 +1,466 @@
+#include "pvm/bc/cfg.hpp"
+
+#include "pvm/bc/disasm.hpp"
+#include "pvm/bc/instruction.hpp"
+#include "pvm/unpack/except.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <memory>
+
+namespace
+{
+const JumpTable& jump_table_of(const Script& script, std::size_t offset)
+{
+	auto index = script.data[offset] & 0xFFFFu;
+
+	if (index >= script.jump_tables.size())
+	{
+		throw DecoderError{fmt::format(
+			"Bad jump table index at ${:08x} in '{}'", offset, script.name)};
+	}
+
+	return script.jump_tables[index];
+}
+} // namespace
+
+ControlFlowGraph::ControlFlowGraph(const Script& script)
+{
+	build_blocks(script);
+	compute_dominators();
+	find_loops();
+}
+
+void ControlFlowGraph::build_blocks(const Script& script)
+{
+	const auto& data = script.data;
+
+	std::vector<bool> leaders(data.size() + 1), starts(data.size() + 1);
+
+	auto check_target = [&](std::size_t offset, s64 target) {
+		if (target < 0 || std::size_t(target) > data.size())
+		{
+			throw DecoderError{fmt::format(
+				"Bad branch target at ${:08x} in '{}'", offset, script.name)};
+		}
+
+		return std::size_t(target);
+	};
+
+	leaders[0] = true;
+
+	for (std::size_t offset = 0; offset < data.size();)
+	{
+		auto size   = instruction_size(&data[offset]);
+		auto opcode = instr_opcode(data[offset]);
+
+		if (offset + size > data.size())
+		{
+			throw DecoderError{fmt::format(
+				"Truncated instruction at ${:08x} in '{}'",
+				offset,
+				script.name)};
+		}
+
+		starts[offset] = true;
+
+		if (is_branch(opcode))
+		{
+			leaders[check_target(
+				offset, s64(offset) + branch_offset(data[offset]))]
+				= true;
+		}
+
+		if (opcode == Instr::opswitch)
+		{
+			const auto& table = jump_table_of(script, offset);
+			table.for_each_target(
+				[&](u32 target) { leaders[check_target(offset, target)] = true; });
+		}
+
+		if (is_branch(opcode) || opcode == Instr::opret
+			|| opcode == Instr::opexit || opcode == Instr::opswitch)
+		{
+			leaders[offset + size] = true;
+		}
+
+		offset += size;
+	}
+
+	// Last instruction of each block, to find out its successors
+	std::vector<std::size_t> last_instructions;
+
+	for (std::size_t offset = 0; offset < data.size();)
+	{
+		if (leaders[offset])
+		{
+			if (!blocks.empty())
+			{
+				blocks.back().end = offset;
+			}
+
+			blocks.push_back({offset, 0, {}, {}, none, none});
+			last_instructions.push_back(offset);
+		}
+
+		last_instructions.back() = offset;
+		offset += instruction_size(&data[offset]);
+	}
+
+	if (!blocks.empty())
+	{
+		blocks.back().end = data.size();
+	}
+
+	for (std::size_t offset = 0; offset < data.size(); ++offset)
+	{
+		if (leaders[offset] && !starts[offset])
+		{
+			throw DecoderError{fmt::format(
+				"Branch to the middle of an instruction at ${:08x} in '{}'",
+				offset,
+				script.name)};
+		}
+	}
+
+	for (std::size_t i = 0; i < blocks.size(); ++i)
+	{
+		auto  offset = last_instructions[i];
+		auto  opcode = instr_opcode(data[offset]);
+		auto& block  = blocks[i];
+
+		auto add_edge = [&](std::size_t target_offset) {
+			// Jumping to the end of the script exits it
+			if (target_offset < data.size())
+			{
+				auto target = block_at(target_offset);
+				block.successors.push_back(target);
+				blocks[target].predecessors.push_back(i);
+			}
+		};
+
+		if (is_branch(opcode))
+		{
+			add_edge(std::size_t(s64(offset) + branch_offset(data[offset])));
+		}
+
+		// Switches always jump, the fallthrough case being the default target
+		if (opcode == Instr::opswitch)
+		{
+			std::vector<std::size_t> targets;
+			jump_table_of(script, offset).for_each_target([&](u32 target) {
+				if (std::find(targets.begin(), targets.end(), target)
+					== targets.end())
+				{
+					targets.push_back(target);
+					add_edge(target);
+				}
+			});
+		}
+
+		if (opcode != Instr::opb && opcode != Instr::opret
+			&& opcode != Instr::opexit && opcode != Instr::opswitch)
+		{
+			add_edge(block.end);
+		}
+	}
+}
+
+void ControlFlowGraph::compute_dominators()
+{
+	if (blocks.empty())
+	{
+		return;
+	}
+
+	// Reverse postorder, see "A Simple, Fast Dominance Algorithm" (Cooper,
+	// Harvey, Kennedy)
+	std::vector<std::size_t> postorder, order_of(blocks.size(), none);
+	std::vector<bool>        visited(blocks.size());
+	std::vector<std::pair<std::size_t, std::size_t>> dfs{{0, 0}};
+	visited[0] = true;
+
+	while (!dfs.empty())
+	{
+		auto& [block, next_successor] = dfs.back();
+
+		if (next_successor < blocks[block].successors.size())
+		{
+			auto successor = blocks[block].successors[next_successor++];
+			if (!visited[successor])
+			{
+				visited[successor] = true;
+				dfs.push_back({successor, 0});
+			}
+		}
+		else
+		{
+			order_of[block] = postorder.size();
+			postorder.push_back(block);
+			dfs.pop_back();
+		}
+	}
+
+	auto intersect = [&](std::size_t a, std::size_t b) {
+		while (a != b)
+		{
+			while (order_of[a] < order_of[b])
+			{
+				a = blocks[a].immediate_dominator;
+			}
+
+			while (order_of[b] < order_of[a])
+			{
+				b = blocks[b].immediate_dominator;
+			}
+		}
+
+		return a;
+	};
+
+	blocks[0].immediate_dominator = 0;
+
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+
+		for (auto it = postorder.rbegin(); it != postorder.rend(); ++it)
+		{
+			auto block = *it;
+			if (block == 0)
+			{
+				continue;
+			}
+
+			auto new_idom = none;
+			for (auto predecessor : blocks[block].predecessors)
+			{
+				if (blocks[predecessor].immediate_dominator == none)
+				{
+					continue;
+				}
+
+				new_idom = new_idom == none ? predecessor
+											: intersect(predecessor, new_idom);
+			}
+
+			if (blocks[block].immediate_dominator != new_idom)
+			{
+				blocks[block].immediate_dominator = new_idom;
+				changed                           = true;
+			}
+		}
+	}
+}
+
+void ControlFlowGraph::find_loops()
+{
+	for (std::size_t latch = 0; latch < blocks.size(); ++latch)
+	{
+		for (auto header : blocks[latch].successors)
+		{
+			if (!dominates(header, latch))
+			{
+				continue;
+			}
+
+			auto loop = std::find_if(loops.begin(), loops.end(), [&](Loop& l) {
+				return l.header == header;
+			});
+
+			if (loop == loops.end())
+			{
+				loops.push_back({header, {}, {header}, none});
+				loop = loops.end() - 1;
+			}
+
+			loop->latches.push_back(latch);
+
+			// The body is everything reaching the latch without going through
+			// the header
+			std::vector<std::size_t> worklist{latch};
+			while (!worklist.empty())
+			{
+				auto block = worklist.back();
+				worklist.pop_back();
+
+				auto it = std::lower_bound(
+					loop->body.begin(), loop->body.end(), block);
+				if (it != loop->body.end() && *it == block)
+				{
+					continue;
+				}
+
+				loop->body.insert(it, block);
+				worklist.insert(
+					worklist.end(),
+					blocks[block].predecessors.begin(),
+					blocks[block].predecessors.end());
+			}
+		}
+	}
+
+	auto contains = [](const Loop& loop, std::size_t block) {
+		return std::binary_search(loop.body.begin(), loop.body.end(), block);
+	};
+
+	// Innermost loops are the smallest ones containing a block
+	auto innermost = [&](std::size_t block, std::size_t excluded) {
+		auto best = none;
+		for (std::size_t i = 0; i < loops.size(); ++i)
+		{
+			if (i != excluded && contains(loops[i], block)
+				&& (best == none
+					|| loops[i].body.size() < loops[best].body.size()))
+			{
+				best = i;
+			}
+		}
+
+		return best;
+	};
+
+	for (std::size_t i = 0; i < loops.size(); ++i)
+	{
+		loops[i].parent = innermost(loops[i].header, i);
+	}
+
+	for (auto& loop : loops)
+	{
+		for (auto parent = loop.parent; parent != none;
+			 parent      = loops[parent].parent)
+		{
+			++loop.depth;
+		}
+	}
+
+	for (std::size_t i = 0; i < blocks.size(); ++i)
+	{
+		blocks[i].loop = innermost(i, none);
+	}
+}
+
+std::size_t ControlFlowGraph::block_at(std::size_t offset) const
+{
+	auto it = std::upper_bound(
+		blocks.begin(),
+		blocks.end(),
+		offset,
+		[](std::size_t offset, const BasicBlock& block) {
+			return offset < block.begin;
+		});
+
+	return std::size_t(std::distance(blocks.begin(), it)) - 1;
+}
+
+bool ControlFlowGraph::dominates(std::size_t a, std::size_t b) const
+{
+	if (blocks[b].immediate_dominator == none)
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		if (a == b)
+		{
+			return true;
+		}
+
+		if (b == 0)
+		{
+			return false;
+		}
+
+		b = blocks[b].immediate_dominator;
+	}
+}
+
+bool ControlFlowGraph::is_loop_header(std::size_t block) const
+{
+	return std::any_of(loops.begin(), loops.end(), [&](const Loop& loop) {
+		return loop.header == block;
+	});
+}
+
+std::string
+ControlFlowGraph::to_dot(const Script& script, Disassembler* disasm) const
+{
+	auto escape = [](const std::string& text) {
+		std::string escaped;
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	};
+
+	std::string dot = fmt::format(
+		"digraph \"{}\" {{\n\tnode [shape=box fontname=\"monospace\"];\n",
+		escape(script.name));
+
+	for (std::size_t i = 0; i < blocks.size(); ++i)
+	{
+		auto& block = blocks[i];
+
+		std::string label
+			= fmt::format("#{}: ${:08x}..${:08x}\\l", i, block.begin, block.end);
+
+		if (disasm != nullptr)
+		{
+			for (const Block* it = &script.data[block.begin];
+				 it != script.data.data() + block.end;)
+			{
+				auto instruction = disasm->disassemble_block(it, &script);
+				label += escape(fmt::format(
+							 "{}{} {}",
+							 instruction.location,
+							 instruction.mnemonic,
+							 instruction.params))
+					+ "\\l";
+				it = instruction.end_block;
+			}
+		}
+
+		dot += fmt::format(
+			"\tb{} [label=\"{}\"{}];\n",
+			i,
+			label,
+			is_loop_header(i) ? " style=bold" : "");
+
+		for (auto successor : block.successors)
+		{
+			bool back_edge = dominates(successor, i);
+			dot += fmt::format(
+				"\tb{} -> b{}{};\n",
+				i,
+				successor,
+				back_edge ? " [style=dashed]" : "");
+		}
+	}
+
+	dot += "}\n";
+	return dot;
+}
+
+const ControlFlowGraph& control_flow_graph(const Script& script)
+{
+	// Scripts of a shared form may be queried from several threads at once
+	auto cfg = std::atomic_load(&script.cached_cfg);
+
+	if (cfg == nullptr)
+	{
+		auto built = std::make_shared<const ControlFlowGraph>(script);
+
+		if (std::atomic_compare_exchange_strong(
+				&script.cached_cfg, &cfg, built))
+		{
+			cfg = std::move(built);
+		}
+	}
+
+	return *cfg;
+}
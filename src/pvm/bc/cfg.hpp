@@ -0,0 +1,75 @@
+#pragma once
+
+#include "pvm/unpack/chunk/code.hpp"
+#include <limits>
+#include <string>
+#include <vector>
+
+class Disassembler;
+
+//! Straight-line sequence of instructions with a single entry and exit.
+struct BasicBlock
+{
+	//! Range of block offsets [begin; end[ covered within Script::data.
+	std::size_t begin, end;
+
+	std::vector<std::size_t> successors, predecessors;
+
+	//! Index of the immediate dominator. The entry block is its own
+	//! immediate dominator; unreachable blocks have none.
+	std::size_t immediate_dominator;
+
+	//! Index of the innermost loop containing this block, if any.
+	std::size_t loop;
+};
+
+//! Natural loop, identified by its header.
+struct Loop
+{
+	std::size_t header;
+
+	//! Blocks that jump back to the header.
+	std::vector<std::size_t> latches;
+
+	//! Sorted indices of the blocks of the loop, including the header.
+	std::vector<std::size_t> body;
+
+	//! Index of the immediately enclosing loop, if any.
+	std::size_t parent;
+
+	//! Nesting depth, 1 for outermost loops.
+	std::size_t depth = 1;
+};
+
+class ControlFlowGraph
+{
+	public:
+	static constexpr auto none = std::numeric_limits<std::size_t>::max();
+
+	std::vector<BasicBlock> blocks;
+	std::vector<Loop>       loops;
+
+	explicit ControlFlowGraph(const Script& script);
+
+	//! Index of the basic block containing the instruction at 'offset'.
+	[[nodiscard]] std::size_t block_at(std::size_t offset) const;
+
+	[[nodiscard]] bool dominates(std::size_t a, std::size_t b) const;
+
+	[[nodiscard]] bool is_loop_header(std::size_t block) const;
+
+	//! Returns the graph in the Graphviz DOT format. When 'disasm' is given,
+	//! nodes include the disassembly of their instructions.
+	[[nodiscard]] std::string
+	to_dot(const Script& script, Disassembler* disasm = nullptr) const;
+
+	private:
+	void build_blocks(const Script& script);
+	void compute_dominators();
+	void find_loops();
+};
+
+//! Returns the control flow graph of 'script', which is built on first use
+//! then cached in the script until its bytecode gets rewritten. Safe to call
+//! concurrently on the same script.
+const ControlFlowGraph& control_flow_graph(const Script& script);
@@ -2,16 +2,55 @@
 #include "pvm/bc/enums.hpp"
 #include "pvm/bc/types.hpp"
 #include <fmt/color.h>
+#include <algorithm>
+#include <cstring>
 #include <fmt/core.h>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
 #include <string_view>
+#include <thread>
+
+namespace
+{
+//! Appends 'text' between double quotes to 'into', escaping them along with
+//! backslashes and line breaks.
+void quote(std::string& into, std::string_view text)
+{
+	into += '"';
+	for (char c : text)
+	{
+		switch (c)
+		{
+		case '"': into += "\\\""; break;
+		case '\\': into += "\\\\"; break;
+		case '\n': into += "\\n"; break;
+		default: into += c; break;
+		}
+	}
+	into += '"';
+}
+} // namespace
 
 std::string DisassembledInstruction::as_plain_string() const
 {
-	return fmt::format(
-	    "{}{:15}{:30} ; {}", location, mnemonic, params, comment);
+	std::string text;
+	append_plain_string(text);
+	return text;
+}
+
+void DisassembledInstruction::append_plain_string(std::string& into) const
+{
+	fmt::format_to(
+	    std::back_inserter(into),
+	    "{}{:15}{:30} ; {}",
+	    location,
+	    mnemonic,
+	    params,
+	    comment);
 }
 
-std::string Disassembler::get_string(s32 id)
+std::string_view Disassembler::get_string(s32 id)
 {
 	if (id < 0 || size_t(id) >= _form.strg.elements.size())
 	{
@@ -20,7 +59,7 @@ std::string Disassembler::get_string(s32 id)
 	return _form.strg.elements[id].value;
 }
 
-std::string Disassembler::type_suffix(u32 type)
+std::string_view Disassembler::type_suffix(u32 type)
 {
 	switch (DataType(type))
 	{
@@ -32,6 +71,9 @@ std::string Disassembler::type_suffix(u32 type)
 	case DataType::var: return "var";
 	case DataType::str: return "str";
 	case DataType::i16: return "i16";
+
+	// Only used on the stack
+	case DataType::array: break;
 	}
 
 	return ".???";
@@ -59,7 +101,7 @@ std::string Disassembler::instance_name(InstId id)
 	return "<bad>";
 }
 
-std::string Disassembler::resolve_variable_name(s32 id)
+std::string_view Disassembler::resolve_variable_name(s32 id)
 {
 	id &= 0x00FFFFFF;
 
@@ -74,7 +116,7 @@ std::string Disassembler::resolve_variable_name(s32 id)
 }
 
 // TODO: genericize and merge with resolve_variable_name
-std::string Disassembler::resolve_function_name(s32 func_id)
+std::string_view Disassembler::resolve_function_name(s32 func_id)
 {
 	if (func_id < 0 || size_t(func_id) >= _form.func.definitions.size())
 	{
@@ -84,7 +126,7 @@ std::string Disassembler::resolve_function_name(s32 func_id)
 	return _form.func.definitions[func_id].name;
 }
 
-std::string Disassembler::comparator_name(u8 function)
+std::string_view Disassembler::comparator_name(u8 function)
 {
 	switch (CompFunc(function))
 	{
@@ -103,6 +145,25 @@ DisassembledInstruction
 Disassembler::disassemble_block(const Block* block, const Script* script)
 {
 	DisassembledInstruction disasm;
+	disassemble_block(block, script, disasm);
+	return disasm;
+}
+
+void Disassembler::disassemble_block(
+    const Block* block, const Script* script, DisassembledInstruction& disasm)
+{
+	// Formatted in place, so that reusing 'disasm' reuses its buffers
+	disasm.location.clear();
+	disasm.mnemonic.clear();
+	disasm.params.clear();
+	disasm.comment.clear();
+
+	auto append = [](std::string& into, auto&&... arguments) {
+		fmt::format_to(
+		    std::back_inserter(into),
+		    std::forward<decltype(arguments)>(arguments)...);
+	};
+
 	disasm.begin_block = block;
 
 	const Block* main_block_ptr = block++;
@@ -116,77 +177,127 @@ Disassembler::disassemble_block(const Block* block, const Script* script)
 
 	if (script != nullptr)
 	{
-		disasm.location = fmt::format(
-		    "${:08x}: ", std::distance(script->data.data(), main_block_ptr));
+		append(
+		    disasm.location,
+		    "${:08x}: ",
+		    std::distance(script->data.data(), main_block_ptr));
 	}
 
+	// Variables are shown along with how they are accessed, e.g. 'local.i' or
+	// '[array]self.x', so that the assembler can encode them back
+	auto variable_param = [&](Block reference) {
+		switch (VarType(reference >> 24))
+		{
+		case VarType::normal: break;
+		case VarType::array: disasm.params += "[array]"; break;
+		case VarType::stack_top: disasm.params += "[stacktop]"; break;
+		default: disasm.params += "[unknown]"; break;
+		}
+
+		append(
+		    disasm.params,
+		    "{}.{}",
+		    instance_name(s16(main_block & 0xFFFF)),
+		    resolve_variable_name(reference & 0xFFFFFF));
+	};
+
 	auto read_block_operand = [&](auto& into) {
 		std::memcpy(&into, block, sizeof(decltype(into)));
 		block += sizeof(std::decay_t<decltype(into)>) / sizeof(Block);
 		return into;
 	};
 
-	auto push_param = [&](auto type) -> std::string {
+	auto push_param = [&](auto type) {
 		switch (DataType(type))
 		{
 		case DataType::f64:
 		{
 			f64 v;
-			return fmt::to_string(read_block_operand(v));
+			append(disasm.params, "{}", read_block_operand(v));
+			return;
 		}
 		case DataType::f32:
 		{
 			f32 v;
-			return fmt::to_string(read_block_operand(v));
+			append(disasm.params, "{}", read_block_operand(v));
+			return;
 		}
 		case DataType::i32:
 		{
 			s32 v;
-			return fmt::to_string(read_block_operand(v));
+			append(disasm.params, "{}", read_block_operand(v));
+			return;
 		}
 		case DataType::i64:
 		{
 			s64 v;
-			return fmt::to_string(read_block_operand(v));
+			append(disasm.params, "{}", read_block_operand(v));
+			return;
 		}
 		case DataType::b32:
 		{
 			s32 v;
-			return fmt::to_string(bool(read_block_operand(v)));
+			disasm.params += bool(read_block_operand(v)) ? "true" : "false";
+			return;
 		}
 		case DataType::var:
 		{
 			u32 v;
-			return fmt::to_string(
-			    resolve_variable_name(read_block_operand(v) & 0xFFFFFF));
+			variable_param(read_block_operand(v));
+			return;
 		}
 		case DataType::str:
 		{
 			s32 v;
-			return fmt::format("\"{}\"", get_string(read_block_operand(v)));
+			quote(disasm.params, get_string(read_block_operand(v)));
+			return;
 		}
-		case DataType::i16: return fmt::to_string(main_block & 0xffff);
+		case DataType::i16:
+			append(disasm.params, "{}", s16(main_block & 0xffff));
+			return;
+
+		// Only used on the stack
+		case DataType::array: break;
 		}
 
-		return "<unknown>";
+		disasm.params += "<unknown>";
 	};
 
 	auto generic_1t = [&](auto name) {
-		disasm.mnemonic = fmt::format("{}.{}", name, type_suffix(t1));
+		append(disasm.mnemonic, "{}.{}", name, type_suffix(t1));
 	};
 
 	auto generic_2t = [&](auto name) {
-		disasm.mnemonic
-		    = fmt::format("{}.{}.{}", name, type_suffix(t1), type_suffix(t2));
+		append(
+		    disasm.mnemonic,
+		    "{}.{}.{}",
+		    name,
+		    type_suffix(t1),
+		    type_suffix(t2));
 	};
 
 	auto generic_push = [&](auto name, auto type) {
-		disasm.mnemonic = fmt::format("{}.{}", name, type_suffix(type));
-		disasm.params   = push_param(t1);
+		append(disasm.mnemonic, "{}.{}", name, type_suffix(type));
+		push_param(t1);
 	};
 
-	// TODO: add labels for easier disassembly read
-	auto generic_goto = [&](auto name) { disasm.mnemonic = name; };
+	// Targets are shown as absolute block offsets when the script is known
+	auto generic_goto = [&](auto name) {
+		disasm.mnemonic = name;
+
+		auto offset = s16(main_block & 0xFFFF);
+		if (script != nullptr)
+		{
+			append(
+			    disasm.params,
+			    "${:08x}",
+			    std::distance(script->data.data(), main_block_ptr) + offset);
+		}
+		else
+		{
+			append(disasm.params, "{:+}", offset);
+		}
+	};
 
 	switch (Instr(op))
 	{
@@ -207,9 +318,18 @@ Disassembler::disassemble_block(const Block* block, const Script* script)
 	case Instr::opnot: generic_1t("not"); break;
 	case Instr::opret: generic_1t("ret"); break;
 	case Instr::oppopz: generic_1t("popz"); break;
-	case Instr::opdup: generic_1t("dup"); break;
+	case Instr::opexit: generic_1t("exit"); break;
 
-	case Instr::opexit: disasm.mnemonic = "exit"; break;
+	// The amount of extra values to duplicate is usually 0
+	case Instr::opdup:
+	{
+		generic_1t("dup");
+		if ((main_block & 0xFFFF) != 0)
+		{
+			append(disasm.params, "{}", main_block & 0xFFFF);
+		}
+	}
+	break;
 
 	case Instr::opb: generic_goto("b"); break;
 	case Instr::opbt: generic_goto("bt"); break;
@@ -218,19 +338,25 @@ Disassembler::disassemble_block(const Block* block, const Script* script)
 	case Instr::oppopenv: generic_goto("popenv"); break;
 
 	case Instr::oppushcst: generic_push("pushcst", t1); break;
-	case Instr::oppushloc: generic_push("pushloc", t1); break;
 	case Instr::oppushglb: generic_push("pushglb", t1); break;
 
+	// Typed pushloc (see infer_types) still refer to a local variable
+	case Instr::oppushloc:
+	{
+		append(disasm.mnemonic, "pushloc.{}", type_suffix(t1));
+		variable_param(*(block++));
+	}
+	break;
+
 	case Instr::oppushspc:
 	{
 		disasm.mnemonic = "pushspc";
-		disasm.params   = "<bad>";
 
 		auto reference_block = *(block++);
 
 		auto& defs = _form.vari.definitions;
 		auto  it   = std::find_if(defs.begin(), defs.end(), [&](auto& def) {
-            return (reference_block & 0x00FFFFFF) == s32(def.special_var);
+            return (reference_block & 0x00FFFFFF) == u32(def.special_var);
         });
 
 		if (it != defs.end())
@@ -243,7 +369,9 @@ Disassembler::disassemble_block(const Block* block, const Script* script)
 			// regular variable name if reading the special var fails
 
 			--block;
-			disasm.params = fmt::format("<unimpl:{}>", push_param(t1));
+			disasm.params = "<unimpl:";
+			push_param(t1);
+			disasm.params += '>';
 		}
 	}
 	break;
@@ -251,14 +379,13 @@ Disassembler::disassemble_block(const Block* block, const Script* script)
 	case Instr::oppushi16:
 	{
 		disasm.mnemonic = "push.i16";
-		disasm.params   = fmt::to_string(main_block & 0xFFFF);
+		append(disasm.params, "{}", s16(main_block & 0xFFFF));
 	}
 	break;
 
 	case Instr::opcmp:
 	{
-		disasm.mnemonic
-		    = fmt::format("cmp.{}.{}", type_suffix(t1), type_suffix(t2));
+		generic_2t("cmp");
 		disasm.params = comparator_name(u8((main_block >> 8) & 0xFF));
 	}
 	break;
@@ -266,41 +393,134 @@ Disassembler::disassemble_block(const Block* block, const Script* script)
 		// TODO: pop.i16.var seems to cause issues
 	case Instr::oppop:
 	{
-		disasm.mnemonic = fmt::format("popv.{}", type_suffix(t2));
-		disasm.params   = resolve_variable_name(*(block++));
+		generic_2t("pop");
+		variable_param(*(block++));
+	}
+	break;
+
+	case Instr::opswitch:
+	{
+		auto index = main_block & 0xFFFF;
+		generic_1t("switch");
+		append(disasm.params, "table {}", index);
+
+		if (script != nullptr && index < script->jump_tables.size())
+		{
+			const auto& table = script->jump_tables[index];
+
+			disasm.params += table.dense_targets.empty() ? " (hashed" : " (dense";
+
+			for (std::size_t i = 0; i < table.dense_targets.size(); ++i)
+			{
+				if (table.dense_targets[i] != JumpTable::no_case)
+				{
+					append(
+					    disasm.params,
+					    ", {}: ${:08x}",
+					    table.min_key + s64(i),
+					    table.dense_targets[i]);
+				}
+			}
+
+			// Sorted so that the output does not depend on hashing
+			std::vector<std::pair<s64, u32>> sparse(
+			    table.sparse_targets.begin(), table.sparse_targets.end());
+			std::sort(sparse.begin(), sparse.end());
+
+			for (const auto& [key, target] : sparse)
+			{
+				append(disasm.params, ", {}: ${:08x}", key, target);
+			}
+
+			append(
+			    disasm.params, "; default: ${:08x})", table.default_target);
+		}
 	}
 	break;
 
 	case Instr::opcall:
 	{
-		disasm.mnemonic = fmt::format("call.{}", type_suffix(t1));
-		disasm.params   = resolve_function_name(*(block++));
+		generic_1t("call");
+		append(
+		    disasm.params,
+		    "{}({})",
+		    resolve_function_name(*(block++)),
+		    main_block & 0xFFFF);
 	}
 	break;
 
 	case Instr::opbreak:
 	{
-		disasm.mnemonic = "break";
-		disasm.params   = fmt::to_string(static_cast<s16>(main_block & 0xFFFF));
+		generic_1t("break");
+		append(disasm.params, "{}", static_cast<s16>(main_block & 0xFFFF));
 	}
 	break;
 
 	default:
 	{
 		disasm.mnemonic = "<bad>";
-		disasm.comment  = "!!! This may indicate corruption";
 	}
 	};
 
-	disasm.comment.insert(
-	    0,
-	    fmt::format(
-	        "${:08x} ",
-	        fmt::join(std::vector<Block>(main_block_ptr, block), "'")));
+	disasm.comment += '$';
+	for (const Block* it = main_block_ptr; it != block; ++it)
+	{
+		append(disasm.comment, it == main_block_ptr ? "{:08x}" : "'{:08x}", *it);
+	}
+	disasm.comment += ' ';
+
+	if (disasm.mnemonic == "<bad>")
+	{
+		disasm.comment += "!!! This may indicate corruption";
+	}
+
+	if (script != nullptr)
+	{
+		auto offset = std::size_t(
+		    std::distance(script->data.data(), main_block_ptr));
+
+		auto it = std::lower_bound(
+		    script->inlined.begin(),
+		    script->inlined.end(),
+		    offset,
+		    [](const InlinedInstruction& origin, std::size_t offset) {
+			    return origin.offset < offset;
+		    });
+
+		if (it != script->inlined.end() && it->offset == offset)
+		{
+			append(
+			    disasm.comment,
+			    "(inlined from '{}' at ${:08x})",
+			    it->callee->name,
+			    it->callee_offset);
+		}
+	}
 
 	disasm.end_block = block;
+}
 
-	return disasm;
+std::string Disassembler::listing(const Script& script)
+{
+	std::string text;
+	DisassembledInstruction disasm;
+	append_listing(text, script, disasm);
+	return text;
+}
+
+void Disassembler::append_listing(
+    std::string& into, const Script& script, DisassembledInstruction& disasm)
+{
+	fmt::format_to(std::back_inserter(into), ".script {}\n", script.name);
+
+	for (const Block* block = script.data.data();
+	     block != script.data.data() + script.data.size();)
+	{
+		disassemble_block(block, &script, disasm);
+		disasm.append_plain_string(into);
+		into += '\n';
+		block = disasm.end_block;
+	}
 }
 
 void Disassembler::operator()(const Script& script)
@@ -314,11 +534,12 @@ void Disassembler::operator()(const Script& script)
 	    program.size(),
 	    program.size() * 4);
 
-	const Block* block = script.data.data();
+	const Block*            block = script.data.data();
+	DisassembledInstruction disasm;
 
 	while (block != &(*script.data.end()))
 	{
-		auto disasm = disassemble_block(block, &script);
+		disassemble_block(block, &script, disasm);
 
 		fmt::print(fmt::color::gray, "{}", disasm.location);
 		fmt::print("{:15}", disasm.mnemonic);
@@ -328,3 +549,81 @@ void Disassembler::operator()(const Script& script)
 		block = disasm.end_block;
 	}
 }
+
+void write_disassembly(
+    const Form& form, const std::string& path, std::size_t thread_count)
+{
+	auto& scripts = form.code.elements;
+
+	std::size_t total_blocks = 0;
+	for (auto& script : scripts)
+	{
+		total_blocks += script.data.size();
+	}
+
+	thread_count = std::max<std::size_t>(
+	    std::min(thread_count, scripts.size()), 1);
+
+	// Each thread takes a contiguous range of scripts of about the same size,
+	// so that the output is the concatenation of the buffers in thread order
+	std::vector<std::size_t> range_begins{0};
+	std::size_t              blocks = 0;
+
+	for (std::size_t i = 0; i < scripts.size(); ++i)
+	{
+		if (blocks >= total_blocks * range_begins.size() / thread_count
+		    && range_begins.size() < thread_count && i != range_begins.back())
+		{
+			range_begins.push_back(i);
+		}
+
+		blocks += scripts[i].data.size();
+	}
+
+	range_begins.push_back(scripts.size());
+
+	std::vector<std::string> buffers(range_begins.size() - 1);
+	std::vector<std::thread> threads;
+
+	for (std::size_t i = 0; i < buffers.size(); ++i)
+	{
+		threads.emplace_back([&, i] {
+			Disassembler            disassembler{form};
+			DisassembledInstruction disasm;
+
+			// Lines are usually below 64 bytes per block
+			std::size_t range_blocks = 0;
+			for (auto script = range_begins[i]; script < range_begins[i + 1];
+			     ++script)
+			{
+				range_blocks += scripts[script].data.size();
+			}
+
+			buffers[i].reserve(range_blocks * 64);
+
+			for (auto script = range_begins[i]; script < range_begins[i + 1];
+			     ++script)
+			{
+				disassembler.append_listing(buffers[i], scripts[script], disasm);
+				buffers[i] += '\n';
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	std::ofstream file{path, std::ios::binary};
+
+	for (auto& buffer : buffers)
+	{
+		file.write(buffer.data(), std::streamsize(buffer.size()));
+	}
+
+	if (!file)
+	{
+		throw std::runtime_error{fmt::format("Failed to write '{}'", path)};
+	}
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+#include <string_view>
 #include <vector>
 #include "pvm/unpack/decode.hpp"
 
@@ -9,6 +11,7 @@ struct DisassembledInstruction
 	const Block *begin_block, *end_block;
 
 	[[nodiscard]] std::string as_plain_string() const;
+	void append_plain_string(std::string& into) const;
 };
 
 class Disassembler
@@ -20,15 +23,31 @@ public:
 		_form{form}
 	{}
 
-	[[nodiscard]] static std::string type_suffix(u32 type);
+	[[nodiscard]] static std::string_view type_suffix(u32 type);
 	[[nodiscard]] static std::string instance_name(InstId id);
-	[[nodiscard]] static std::string comparator_name(u8 function);
+	[[nodiscard]] static std::string_view comparator_name(u8 function);
 
-	[[nodiscard]] std::string get_string(s32 id);
-	[[nodiscard]] std::string resolve_variable_name(s32 id);
-	[[nodiscard]] std::string resolve_function_name(s32 id);
+	//! Names point into the form, which outlives them.
+	[[nodiscard]] std::string_view get_string(s32 id);
+	[[nodiscard]] std::string_view resolve_variable_name(s32 id);
+	[[nodiscard]] std::string_view resolve_function_name(s32 id);
 
 	[[nodiscard]] DisassembledInstruction disassemble_block(const Block* block, const Script* script = nullptr);
 
+	//! Same as above, but overwrites 'into', whose buffers get reused.
+	void disassemble_block(const Block* block, const Script* script, DisassembledInstruction& into);
+
+	//! Returns the disassembly of 'script' as text that assemble() accepts.
+	[[nodiscard]] std::string listing(const Script& script);
+
+	//! Appends listing(script) to 'into', using 'disasm' as scratch space.
+	void append_listing(std::string& into, const Script& script, DisassembledInstruction& disasm);
+
 	void operator()(const Script& script);
 };
+
+//! Writes the listing of every script of 'form' to the file at 'path', in
+//! order. Scripts are split between 'thread_count' threads, which disassemble
+//! them into their own buffer.
+//! @throws std::runtime_error when the file cannot be written.
+void write_disassembly(const Form& form, const std::string& path, std::size_t thread_count);
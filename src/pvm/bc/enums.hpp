@@ -15,6 +15,11 @@ enum class DataType : s8
 	b32,
 	var,
 	str,
+
+	//! Not found in the bytecode: tag of the stack variables referencing an
+	//! array (see ArrayReference).
+	array = 0xE,
+
 	i16 = 0xF
 };
 
@@ -111,5 +116,6 @@ enum class Instr : u8
 	oppushglb = 0xC2,
 	oppushspc = 0xC3, //! See ODDITIES.md for details about $C3
 	opcall    = 0xD9,
+	opswitch  = 0xF0, //! Not emitted by GM:S, see build_jump_tables()
 	opbreak   = 0xFF
 };
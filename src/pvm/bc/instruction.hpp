@@ -0,0 +1,101 @@
+#pragma once
+
+#include "pvm/bc/enums.hpp"
+#include "pvm/bc/types.hpp"
+#include <cstddef>
+
+//! Helpers to decode the main block of an instruction, for code that works
+//! over the bytecode outside of the VM (which uses VMState instead).
+
+[[nodiscard]] constexpr Instr instr_opcode(Block block)
+{
+	return Instr(block >> 24u);
+}
+
+[[nodiscard]] constexpr DataType instr_t1(Block block)
+{
+	return DataType((block >> 16u) & 0xFu);
+}
+
+[[nodiscard]] constexpr DataType instr_t2(Block block)
+{
+	return DataType((block >> 20u) & 0xFu);
+}
+
+//! Returns 'block' with its type pair replaced.
+[[nodiscard]] constexpr Block with_types(Block block, DataType t1, DataType t2)
+{
+	return (block & 0xFF00FFFFu) | (Block(u8(t1) & 0xFu) << 16u)
+		| (Block(u8(t2) & 0xFu) << 20u);
+}
+
+//! Returns 'block' with its opcode replaced.
+[[nodiscard]] constexpr Block with_opcode(Block block, Instr opcode)
+{
+	return (block & 0x00FFFFFFu) | (Block(opcode) << 24u);
+}
+
+//! Branch offset, in blocks, relative to the branch instruction itself.
+[[nodiscard]] constexpr s16 branch_offset(Block block)
+{
+	return s16(block & 0xFFFFu);
+}
+
+[[nodiscard]] constexpr bool is_branch(Instr opcode)
+{
+	return opcode == Instr::opb || opcode == Instr::opbt
+		|| opcode == Instr::opbf;
+}
+
+//! Size, in blocks, of a constant of type 'type' stored after the main block.
+[[nodiscard]] constexpr std::size_t operand_size(DataType type)
+{
+	switch (type)
+	{
+	case DataType::f64:
+	case DataType::i64: return 2;
+	case DataType::i16: return 0;
+	default: return 1;
+	}
+}
+
+//! Size, in blocks, of the instruction beginning at 'block'.
+[[nodiscard]] constexpr std::size_t instruction_size(const Block* block)
+{
+	switch (instr_opcode(*block))
+	{
+	case Instr::oppushcst:
+	case Instr::oppushglb: return 1 + operand_size(instr_t1(*block));
+
+	// Typed pushloc (see infer_types) keep the reference to their local, so
+	// their type is not the type of an operand
+	case Instr::oppushloc:
+	case Instr::oppushspc:
+	case Instr::oppop:
+	case Instr::opcall: return 2;
+
+	default: return 1;
+	}
+}
+
+//! Whether the instruction beginning at 'block' reads or writes an element of
+//! an array variable, popping the index and the instance of the element
+//! first.
+[[nodiscard]] constexpr bool is_array_access(const Block* block)
+{
+	switch (instr_opcode(*block))
+	{
+	case Instr::oppushcst:
+	case Instr::oppushglb:
+	case Instr::oppushloc:
+		if (instr_t1(*block) != DataType::var)
+		{
+			return false;
+		}
+		[[fallthrough]];
+
+	case Instr::oppop: return VarType(block[1] >> 24u) == VarType::array;
+
+	default: return false;
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include <unordered_map>
+#include <vector>
+
+//! Targets of a switch instruction, built from compare chains by
+//! build_jump_tables(). Targets are block offsets within the script.
+struct JumpTable
+{
+	//! Marks holes within 'dense_targets'.
+	static constexpr u32 no_case = u32(-1);
+
+	//! Key of the first element of 'dense_targets'.
+	s64 min_key = 0;
+
+	//! Targets of a dense table, indexed by 'key - min_key'.
+	std::vector<u32> dense_targets;
+
+	//! Targets of a sparse table, used when cases are too far apart.
+	std::unordered_map<s64, u32> sparse_targets;
+
+	u32 default_target = 0;
+
+	//! Returns the target for 'key', setting 'matched' to whether a case
+	//! matched it rather than falling back to the default target.
+	[[nodiscard]] u32 find(s64 key, bool& matched) const;
+
+	//! Calls 'f' over each target, which it may modify.
+	template<class F>
+	void for_each_target(F f);
+
+	template<class F>
+	void for_each_target(F f) const;
+
+	private:
+	template<class Table, class F>
+	static void for_each_target_of(Table& table, F f);
+};
+
+inline u32 JumpTable::find(s64 key, bool& matched) const
+{
+	if (!dense_targets.empty())
+	{
+		// Unsigned wraparound takes care of keys below min_key
+		auto index = u64(key) - u64(min_key);
+		if (index < dense_targets.size() && dense_targets[index] != no_case)
+		{
+			matched = true;
+			return dense_targets[index];
+		}
+	}
+	else
+	{
+		auto it = sparse_targets.find(key);
+		if (it != sparse_targets.end())
+		{
+			matched = true;
+			return it->second;
+		}
+	}
+
+	matched = false;
+	return default_target;
+}
+
+template<class F>
+void JumpTable::for_each_target(F f)
+{
+	for_each_target_of(*this, f);
+}
+
+template<class F>
+void JumpTable::for_each_target(F f) const
+{
+	for_each_target_of(*this, f);
+}
+
+template<class Table, class F>
+void JumpTable::for_each_target_of(Table& table, F f)
+{
+	f(table.default_target);
+
+	for (auto& target : table.dense_targets)
+	{
+		if (target != no_case)
+		{
+			f(target);
+		}
+	}
+
+	for (auto& [key, target] : table.sparse_targets)
+	{
+		f(target);
+	}
+}
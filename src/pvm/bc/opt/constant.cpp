@@ -0,0 +1,103 @@
+#include "pvm/bc/opt/constant.hpp"
+
+#include "pvm/vm/traits/datatype.hpp"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+template<class T>
+[[nodiscard]] T read_operand(const InstructionList::Instruction& instruction)
+{
+	T value;
+	std::memcpy(&value, &instruction.blocks[1], sizeof(T));
+	return value;
+}
+} // namespace
+
+DataType stack_type_of(const Constant& constant)
+{
+	return std::visit(
+		[](auto v) { return data_type_for<decltype(v)>::value; }, constant);
+}
+
+bool is_numeric(DataType type)
+{
+	return type == DataType::f64 || type == DataType::f32
+		|| type == DataType::i32 || type == DataType::i64;
+}
+
+std::optional<Constant>
+constant_of(const InstructionList::Instruction& instruction)
+{
+	if (instruction.opcode() == Instr::oppushi16)
+	{
+		return s32(s16(instruction.blocks[0] & 0xFFFFu));
+	}
+
+	if (instruction.opcode() != Instr::oppushcst)
+	{
+		return std::nullopt;
+	}
+
+	switch (instruction.t1())
+	{
+	// Matches VM::run, which does not sign-extend pushcst.i16
+	case DataType::i16: return s32(instruction.blocks[0] & 0xFFFFu);
+	case DataType::i32: return read_operand<s32>(instruction);
+	case DataType::i64: return read_operand<s64>(instruction);
+	case DataType::f32: return read_operand<f32>(instruction);
+	case DataType::f64: return read_operand<f64>(instruction);
+	default: return std::nullopt;
+	}
+}
+
+std::vector<Block> encode_push(const Constant& constant)
+{
+	return std::visit(
+		[](auto v) {
+			using T = decltype(v);
+
+			if constexpr (std::is_same_v<T, s32>)
+			{
+				if (v >= std::numeric_limits<s16>::min()
+					&& v <= std::numeric_limits<s16>::max())
+				{
+					return std::vector<Block>{
+						(Block(Instr::oppushi16) << 24u) | 0x000F0000u
+						| u16(v)};
+				}
+			}
+
+			std::vector<Block> blocks(1 + sizeof(T) / sizeof(Block));
+			blocks[0] = with_types(
+				Block(Instr::oppushcst) << 24u,
+				data_type_for<T>::value,
+				DataType::f64);
+			std::memcpy(&blocks[1], &v, sizeof(T));
+			return blocks;
+		},
+		constant);
+}
+
+std::optional<s64> integral_value(const Constant& constant)
+{
+	return std::visit(
+		[](auto v) -> std::optional<s64> {
+			if constexpr (std::is_integral_v<decltype(v)>)
+			{
+				return s64(v);
+			}
+			else
+			{
+				if (std::trunc(v) == v && v >= -0x1p63 && v < 0x1p63)
+				{
+					return s64(v);
+				}
+
+				return std::nullopt;
+			}
+		},
+		constant);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "pvm/bc/opt/instructionlist.hpp"
+#include <optional>
+#include <variant>
+#include <vector>
+
+//! Value of a constant as it lives on the stack once pushed.
+using Constant = std::variant<s32, s64, f32, f64>;
+
+//! Type of the stack slot holding 'constant'.
+[[nodiscard]] DataType stack_type_of(const Constant& constant);
+
+//! Whether 'type' is a numeric type the VM can operate on.
+[[nodiscard]] bool is_numeric(DataType type);
+
+//! Returns the constant pushed by 'instruction', if it is a constant push.
+[[nodiscard]] std::optional<Constant>
+constant_of(const InstructionList::Instruction& instruction);
+
+//! Returns the shortest instruction pushing 'constant'.
+[[nodiscard]] std::vector<Block> encode_push(const Constant& constant);
+
+//! Returns the integer value of 'constant' when it has one, e.g. for 2.0 but
+//! not for 2.5.
+[[nodiscard]] std::optional<s64> integral_value(const Constant& constant);
@@ -0,0 +1,447 @@
+#include "pvm/bc/opt/inliner.hpp"
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/bc/opt/instructionlist.hpp"
+#include "pvm/config.hpp"
+#include "pvm/unpack/chunk/form.hpp"
+#include "pvm/unpack/except.hpp"
+#include "pvm/vm/variable.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <map>
+#include <optional>
+
+namespace
+{
+using Instruction = InstructionList::Instruction;
+
+constexpr Block local_inst_type = u16(InstType::local);
+
+//! Size of a value of type 'type' on the stack.
+[[nodiscard]] std::optional<std::size_t> stack_size(DataType type)
+{
+	switch (type)
+	{
+	// push.i16 pushes an i32
+	case DataType::i16:
+	case DataType::i32:
+	case DataType::f32: return 4;
+	case DataType::i64:
+	case DataType::f64: return 8;
+	case DataType::var: return Variable::stack_variable_size;
+	default: return std::nullopt;
+	}
+}
+
+//! Size of the result of the binary operation 'opcode' over 'a' and 'b',
+//! following the C++ promotion rules the VM arithmetic handlers end up using.
+[[nodiscard]] std::optional<std::size_t>
+binary_result_size(Instr opcode, DataType a, DataType b)
+{
+	auto any = [&](DataType type) { return a == type || b == type; };
+
+	if (!stack_size(a) || !stack_size(b))
+	{
+		return std::nullopt;
+	}
+
+	if (any(DataType::var))
+	{
+		return Variable::stack_variable_size;
+	}
+
+	if (opcode == Instr::opshl || opcode == Instr::opshr)
+	{
+		return stack_size(a);
+	}
+
+	if (any(DataType::f64) || any(DataType::i64))
+	{
+		return any(DataType::f32) && !any(DataType::f64) ? 4 : 8;
+	}
+
+	return 4;
+}
+
+//! Whether the instruction refers to a local through its operand block.
+[[nodiscard]] bool refers_to_local(const Instruction& instruction)
+{
+	auto inst_type = instruction.blocks[0] & 0xFFFFu;
+
+	switch (instruction.opcode())
+	{
+	case Instr::oppushloc: return true;
+
+	case Instr::oppushcst:
+	case Instr::oppushglb:
+		return instruction.t1() == DataType::var
+			&& inst_type == local_inst_type;
+
+	case Instr::oppop: return inst_type == local_inst_type;
+
+	default: return false;
+	}
+}
+
+//! Script that may be inlined into its callers.
+struct Inlinee
+{
+	const Script* script = nullptr;
+
+	//! Bytecode to insert, i.e. without the final ret.
+	std::vector<Instruction> body;
+
+	//! Highest argument read, plus one.
+	std::size_t arguments_read = 0;
+
+	//! Slot of each local of the callee, by VARI index, after the arguments.
+	std::map<Block, std::size_t> locals;
+};
+
+class Inliner
+{
+	Form& _form;
+
+	std::vector<std::optional<Inlinee>> _inlinees;
+
+	std::size_t _inlined_calls = 0;
+
+	//! VARI index of the local of each id, created on demand.
+	std::vector<Block> _slot_references;
+
+	[[nodiscard]] std::optional<Inlinee> analyze(const Script& script) const;
+
+	[[nodiscard]] Block slot_reference(std::size_t id);
+
+	//! Lowest local id free to use in 'script'.
+	[[nodiscard]] std::size_t first_free_local(const Script& script) const;
+
+	void inline_into(Script& script);
+
+	public:
+	explicit Inliner(Form& form);
+
+	std::size_t operator()();
+};
+
+Inliner::Inliner(Form& form) : _form{form} {}
+
+std::optional<Inlinee> Inliner::analyze(const Script& script) const
+{
+	if (script.data.size() > opt::inline_max_blocks)
+	{
+		return std::nullopt;
+	}
+
+	InstructionList list{script};
+	Inlinee         inlinee;
+	inlinee.script = &script;
+
+	// Stack usage of the callee, which may not touch the stack of the caller
+	std::size_t depth = 0;
+
+	auto pop = [&](std::optional<std::size_t> size) {
+		if (!size || *size > depth)
+		{
+			return false;
+		}
+
+		depth -= *size;
+		return true;
+	};
+
+	auto push = [&](std::optional<std::size_t> size) {
+		depth += size.value_or(0);
+		return size.has_value();
+	};
+
+	std::size_t offset = 0;
+
+	for (std::size_t i = 0; i < list.instructions.size(); ++i)
+	{
+		auto& instruction = list.instructions[i];
+		auto  t1 = instruction.t1(), t2 = instruction.t2();
+
+		// Array accesses would need the stack model to pop their index
+		if (is_array_access(instruction.blocks.data()))
+		{
+			return std::nullopt;
+		}
+
+		bool supported;
+		switch (auto opcode = instruction.opcode())
+		{
+		case Instr::oppushcst:
+		case Instr::oppushglb:
+		case Instr::oppushloc:
+			supported = push(stack_size(t1));
+			break;
+
+		case Instr::oppushi16:
+			supported = push(stack_size(DataType::i16));
+			break;
+
+		case Instr::oppushspc:
+		{
+			auto var = SpecialVar(instruction.blocks[1] & 0x00FFFFFFu);
+			supported = var < SpecialVar::argument_count
+				&& push(stack_size(DataType::var));
+
+			inlinee.arguments_read
+				= std::max(inlinee.arguments_read, std::size_t(var) + 1);
+			break;
+		}
+
+		case Instr::opconv:
+			supported = pop(stack_size(t1)) && push(stack_size(t2));
+			break;
+
+		case Instr::opmul:
+		case Instr::opdiv:
+		case Instr::opadd:
+		case Instr::opsub:
+		case Instr::opand:
+		case Instr::opor:
+		case Instr::opxor:
+		case Instr::opshl:
+		case Instr::opshr:
+			supported = pop(stack_size(t1)) && pop(stack_size(t2))
+				&& push(binary_result_size(opcode, t2, t1));
+			break;
+
+		case Instr::oppop:
+			supported = InstType(s16(instruction.blocks[0] & 0xFFFFu))
+					!= InstType::stack_top_or_global
+				&& pop(stack_size(t2));
+			break;
+
+		case Instr::oppopz: supported = pop(stack_size(t1)); break;
+
+		// The return value has to be the only thing left on the stack, as
+		// the ret gets removed
+		case Instr::opret:
+			supported = i == list.instructions.size() - 1
+				&& t1 == DataType::var
+				&& depth == Variable::stack_variable_size;
+			break;
+
+		default: supported = false; break;
+		}
+
+		if (!supported)
+		{
+			return std::nullopt;
+		}
+
+		instruction.callee        = &script;
+		instruction.callee_offset = offset;
+		offset += instruction.blocks.size();
+
+		if (refers_to_local(instruction))
+		{
+			auto reference = instruction.blocks[1] & 0x00FFFFFFu;
+			inlinee.locals.emplace(reference, inlinee.locals.size());
+		}
+
+		if (instruction.opcode() != Instr::opret)
+		{
+			inlinee.body.push_back(std::move(instruction));
+		}
+	}
+
+	// Falling through the end of the script does not return a value
+	if (list.instructions.empty()
+		|| list.instructions.back().opcode() != Instr::opret)
+	{
+		return std::nullopt;
+	}
+
+	return inlinee;
+}
+
+Block Inliner::slot_reference(std::size_t id)
+{
+	if (id < _slot_references.size())
+	{
+		return _slot_references[id];
+	}
+
+	auto& vars = _form.vari.definitions;
+
+	while (_slot_references.size() <= id)
+	{
+		VariableDefinition def;
+		def.name          = fmt::format("inline.{}", _slot_references.size());
+		def.instance_type = s32(InstType::local);
+		def.unknown       = u32(_slot_references.size() + 1);
+		def.occurrences   = 0;
+		def.first_address = 0;
+
+		_slot_references.push_back(Block(vars.size()));
+		vars.push_back(std::move(def));
+	}
+
+	return _slot_references[id];
+}
+
+std::size_t Inliner::first_free_local(const Script& script) const
+{
+	std::size_t first = script.local_count;
+
+	InstructionList list{script};
+	for (auto& instruction : list.instructions)
+	{
+		if (refers_to_local(instruction))
+		{
+			const auto& def = _form.vari.definitions.at(
+				instruction.blocks[1] & 0x00FFFFFFu);
+			first = std::max(first, std::size_t(def.unknown));
+		}
+	}
+
+	return first;
+}
+
+void Inliner::inline_into(Script& script)
+{
+	InstructionList list{script};
+
+	auto first_slot = first_free_local(script);
+	auto used_slots = std::size_t(0);
+
+	auto local_reference = [&](std::size_t slot) {
+		return (Block(VarType::normal) << 24u)
+			| slot_reference(first_slot + slot);
+	};
+
+	// Backwards, so that splicing does not move the calls yet to be visited
+	for (auto i = list.instructions.size(); i-- > 0;)
+	{
+		auto& call = list.instructions[i];
+		if (call.opcode() != Instr::opcall)
+		{
+			continue;
+		}
+
+		auto& funcs = _form.func.definitions;
+		auto  id    = call.blocks[1] & 0x00FFFFFFu;
+
+		if (id >= funcs.size() || funcs[id].is_builtin
+			|| funcs[id].associated_script == nullptr)
+		{
+			continue;
+		}
+
+		auto  index = std::size_t(
+			funcs[id].associated_script - _form.code.elements.data());
+		auto& inlinee = _inlinees[index];
+
+		std::size_t argument_count = call.blocks[0] & 0xFFFFu;
+		if (!inlinee || inlinee->arguments_read > argument_count)
+		{
+			continue;
+		}
+
+		std::vector<Instruction> replacement;
+
+		// Arguments are pushed in order, so the last one is on top
+		for (auto argument = argument_count; argument-- > 0;)
+		{
+			replacement.push_back(
+				{{with_types(
+					  (Block(Instr::oppop) << 24u) | local_inst_type,
+					  DataType::var,
+					  DataType::var),
+				  local_reference(argument)}});
+		}
+
+		for (auto instruction : inlinee->body)
+		{
+			if (instruction.opcode() == Instr::oppushspc)
+			{
+				auto argument = instruction.blocks[1] & 0x00FFFFFFu;
+
+				instruction.blocks = {
+					with_types(
+						(Block(Instr::oppushloc) << 24u) | local_inst_type,
+						DataType::var,
+						DataType::f64),
+					local_reference(argument)};
+			}
+			else if (refers_to_local(instruction))
+			{
+				auto reference = instruction.blocks[1] & 0x00FFFFFFu;
+				auto slot = argument_count + inlinee->locals.at(reference);
+
+				instruction.blocks[1] = (instruction.blocks[1] & 0xFF000000u)
+					| slot_reference(first_slot + slot);
+			}
+
+			replacement.push_back(std::move(instruction));
+		}
+
+		used_slots = std::max(
+			used_slots, argument_count + inlinee->locals.size());
+
+		list.splice(i, std::move(replacement));
+		++_inlined_calls;
+
+		if constexpr (check(debug::verbose_postprocess))
+		{
+			fmt::print(
+				"Inliner: inlined '{}' into '{}'\n",
+				inlinee->script->name,
+				script.name);
+		}
+	}
+
+	if (used_slots != 0)
+	{
+		list.encode(script);
+		script.local_count
+			= std::max(script.local_count, first_slot + used_slots);
+	}
+}
+
+std::size_t Inliner::operator()()
+{
+	auto& scripts = _form.code.elements;
+
+	_inlinees.resize(scripts.size());
+
+	for (std::size_t i = 0; i < scripts.size(); ++i)
+	{
+		try
+		{
+			_inlinees[i] = analyze(scripts[i]);
+		}
+		catch (const DecoderError&)
+		{
+			_inlinees[i] = std::nullopt;
+		}
+	}
+
+	for (auto& script : scripts)
+	{
+		try
+		{
+			inline_into(script);
+		}
+		catch (const DecoderError& e)
+		{
+			if constexpr (check(debug::verbose_postprocess))
+			{
+				fmt::print(
+					"Inliner: skipped '{}': {}\n", script.name, e.what());
+			}
+		}
+	}
+
+	return _inlined_calls;
+}
+} // namespace
+
+std::size_t inline_calls(Form& form)
+{
+	return Inliner{form}();
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+struct Form;
+
+//! Replaces calls to scripts of at most opt::inline_max_blocks with a copy of
+//! their bytecode. The arguments and locals of the callee become extra locals
+//! of the caller, with argumentN reads rewritten to read them instead.
+//! Only straight-line callees without calls, which leave their return value
+//! alone on the stack, are inlined. The origin of inlined instructions is kept
+//! in Script::inlined.
+//! @returns the amount of inlined calls.
+std::size_t inline_calls(Form& form);
@@ -0,0 +1,231 @@
+#include "pvm/bc/opt/instructionlist.hpp"
+
+#include "pvm/unpack/except.hpp"
+#include <fmt/core.h>
+#include <iterator>
+#include <limits>
+
+InstructionList::InstructionList(const Script& script)
+{
+	constexpr auto no_instruction = std::numeric_limits<std::size_t>::max();
+
+	std::vector<std::size_t> index_at(script.data.size(), no_instruction);
+
+	for (std::size_t offset = 0; offset < script.data.size();)
+	{
+		const Block* block = &script.data[offset];
+		auto         size  = instruction_size(block);
+
+		if (offset + size > script.data.size())
+		{
+			throw DecoderError{fmt::format(
+				"Truncated instruction at ${:08x} in '{}'",
+				offset,
+				script.name)};
+		}
+
+		index_at[offset] = instructions.size();
+		instructions.push_back({{block, block + size}});
+		offset += size;
+	}
+
+	std::size_t offset = 0;
+	for (auto& instruction : instructions)
+	{
+		if (is_branch(instruction.opcode()))
+		{
+			auto target = s64(offset) + branch_offset(instruction.blocks[0]);
+
+			if (target == s64(script.data.size()))
+			{
+				instruction.target = instructions.size();
+			}
+			else if (
+				target < 0 || std::size_t(target) > script.data.size()
+				|| index_at[std::size_t(target)] == no_instruction)
+			{
+				throw DecoderError{fmt::format(
+					"Bad branch target at ${:08x} in '{}'",
+					offset,
+					script.name)};
+			}
+			else
+			{
+				instruction.target = index_at[std::size_t(target)];
+			}
+		}
+
+		offset += instruction.blocks.size();
+	}
+
+	for (auto& origin : script.inlined)
+	{
+		if (origin.offset < index_at.size()
+			&& index_at[origin.offset] != no_instruction)
+		{
+			auto& instruction         = instructions[index_at[origin.offset]];
+			instruction.callee        = origin.callee;
+			instruction.callee_offset = origin.callee_offset;
+		}
+	}
+
+	jump_tables = script.jump_tables;
+	for (auto& table : jump_tables)
+	{
+		table.for_each_target([&](u32& target) {
+			if (target == script.data.size())
+			{
+				target = u32(instructions.size());
+			}
+			else if (
+				target > script.data.size()
+				|| index_at[target] == no_instruction)
+			{
+				throw DecoderError{fmt::format(
+					"Bad jump table target ${:08x} in '{}'",
+					target,
+					script.name)};
+			}
+			else
+			{
+				target = u32(index_at[target]);
+			}
+		});
+	}
+}
+
+std::size_t InstructionList::live(std::size_t index) const
+{
+	while (index < instructions.size() && instructions[index].removed)
+	{
+		++index;
+	}
+
+	return index;
+}
+
+std::size_t InstructionList::next(std::size_t index) const
+{
+	return live(index + 1);
+}
+
+std::vector<bool> InstructionList::branch_targets() const
+{
+	std::vector<bool> targets(instructions.size() + 1);
+
+	for (auto& instruction : instructions)
+	{
+		if (!instruction.removed && is_branch(instruction.opcode()))
+		{
+			targets[live(instruction.target)] = true;
+		}
+	}
+
+	for (auto& table : jump_tables)
+	{
+		table.for_each_target([&](u32 target) { targets[live(target)] = true; });
+	}
+
+	targets.pop_back();
+	return targets;
+}
+
+void InstructionList::splice(
+	std::size_t index, std::vector<Instruction> replacement)
+{
+	auto added = replacement.size() - 1;
+
+	auto shift = [&](std::size_t target) {
+		return target > index ? target + added : target;
+	};
+
+	for (auto& instruction : instructions)
+	{
+		if (is_branch(instruction.opcode()))
+		{
+			instruction.target = shift(instruction.target);
+		}
+	}
+
+	for (auto& table : jump_tables)
+	{
+		table.for_each_target([&](u32& target) { target = u32(shift(target)); });
+	}
+
+	auto it = instructions.erase(instructions.begin() + std::ptrdiff_t(index));
+	instructions.insert(
+		it,
+		std::make_move_iterator(replacement.begin()),
+		std::make_move_iterator(replacement.end()));
+}
+
+void InstructionList::encode(Script& script) const
+{
+	// New offset of each instruction; removed instructions take the offset
+	// of the next live one.
+	std::vector<std::size_t> offsets(instructions.size() + 1);
+
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < instructions.size(); ++i)
+	{
+		offsets[i] = size;
+		if (!instructions[i].removed)
+		{
+			size += instructions[i].blocks.size();
+		}
+	}
+	offsets.back() = size;
+
+	std::vector<Block> data;
+	data.reserve(size);
+
+	std::vector<InlinedInstruction> inlined;
+
+	for (std::size_t i = 0; i < instructions.size(); ++i)
+	{
+		auto& instruction = instructions[i];
+
+		if (instruction.removed)
+		{
+			continue;
+		}
+
+		auto blocks = instruction.blocks;
+
+		if (is_branch(instruction.opcode()))
+		{
+			auto offset = s64(offsets[instruction.target]) - s64(offsets[i]);
+
+			if (offset < std::numeric_limits<s16>::min()
+				|| offset > std::numeric_limits<s16>::max())
+			{
+				throw DecoderError{fmt::format(
+					"Branch offset {} out of range in '{}'",
+					offset,
+					script.name)};
+			}
+
+			// Keep the 23-bit encoding used by GM:S
+			blocks[0] = (blocks[0] & 0xFF800000u) | (u32(offset) & 0x7FFFFFu);
+		}
+
+		if (instruction.callee != nullptr)
+		{
+			inlined.push_back(
+				{offsets[i], instruction.callee, instruction.callee_offset});
+		}
+
+		data.insert(data.end(), blocks.begin(), blocks.end());
+	}
+
+	script.data        = std::move(data);
+	script.jump_tables = jump_tables;
+	script.inlined     = std::move(inlined);
+
+	for (auto& table : script.jump_tables)
+	{
+		table.for_each_target([&](u32& target) { target = offsets[target]; });
+	}
+
+	script.cached_cfg.reset();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/unpack/chunk/code.hpp"
+#include <vector>
+
+//! Editable form of the bytecode of a script. Branches refer to their target
+//! by instruction index rather than by block offset, so that instructions can
+//! be removed or resized freely before encoding the result back. The same
+//! goes for the targets of jump tables.
+class InstructionList
+{
+	public:
+	struct Instruction
+	{
+		//! Main block followed by the operand blocks, if any.
+		std::vector<Block> blocks;
+
+		//! For branches, index of the target instruction.
+		std::size_t target = 0;
+
+		bool removed = false;
+
+		//! When inlined from another script, where it comes from.
+		const Script* callee        = nullptr;
+		std::size_t   callee_offset = 0;
+
+		[[nodiscard]] Instr opcode() const;
+		[[nodiscard]] DataType t1() const;
+		[[nodiscard]] DataType t2() const;
+	};
+
+	std::vector<Instruction> instructions;
+
+	//! Jump tables of the script, with targets as instruction indices.
+	std::vector<JumpTable> jump_tables;
+
+	explicit InstructionList(const Script& script);
+
+	//! Index of the first instruction that was not removed, starting from
+	//! 'index'. Returns instructions.size() when there is none.
+	[[nodiscard]] std::size_t live(std::size_t index) const;
+
+	//! Index of the first live instruction following 'index'.
+	[[nodiscard]] std::size_t next(std::size_t index) const;
+
+	//! Returns, for each instruction, whether a branch may jump to it.
+	[[nodiscard]] std::vector<bool> branch_targets() const;
+
+	//! Replaces the instruction at 'index' with the non-empty 'replacement',
+	//! which must not contain branches. Branches to the instruction land on
+	//! the first instruction of 'replacement'.
+	void splice(std::size_t index, std::vector<Instruction> replacement);
+
+	//! Writes the bytecode back to 'script', fixing up branch offsets.
+	//! Branches to a removed instruction jump to the next live one instead.
+	void encode(Script& script) const;
+};
+
+inline Instr InstructionList::Instruction::opcode() const
+{
+	return instr_opcode(blocks.front());
+}
+
+inline DataType InstructionList::Instruction::t1() const
+{
+	return instr_t1(blocks.front());
+}
+
+inline DataType InstructionList::Instruction::t2() const
+{
+	return instr_t2(blocks.front());
+}
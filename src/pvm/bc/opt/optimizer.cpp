@@ -0,0 +1,28 @@
+#include "pvm/bc/opt/optimizer.hpp"
+
+#include "pvm/bc/opt/peephole.hpp"
+#include "pvm/bc/opt/switchtable.hpp"
+#include "pvm/bc/opt/typeinference.hpp"
+#include "pvm/config.hpp"
+
+void optimize(Script& script)
+{
+	if constexpr (opt::peephole)
+	{
+		peephole_optimize(script);
+	}
+
+	if constexpr (opt::jump_tables)
+	{
+		build_jump_tables(script);
+	}
+
+	if constexpr (opt::infer_types)
+	{
+		// Retyping leaves identity conversions behind, clean them up
+		if (infer_types(script) != 0 && opt::peephole)
+		{
+			peephole_optimize(script);
+		}
+	}
+}
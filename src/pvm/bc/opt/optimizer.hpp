@@ -0,0 +1,8 @@
+#pragma once
+
+#include "pvm/unpack/chunk/code.hpp"
+
+//! Runs the bytecode optimization passes enabled in the 'opt' configuration
+//! namespace over 'script'. The result can be inspected using the
+//! Disassembler like any other script.
+void optimize(Script& script);
@@ -0,0 +1,479 @@
+#include "pvm/bc/opt/peephole.hpp"
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/bc/opt/constant.hpp"
+#include "pvm/bc/opt/instructionlist.hpp"
+#include "pvm/config.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <functional>
+#include <limits>
+
+namespace
+{
+using Instruction = InstructionList::Instruction;
+
+//! Applies 'op' the way the VM would, but without relying on signed overflow.
+template<class R, class A, class B, class Op>
+[[nodiscard]] R wrapping(A a, B b, Op op)
+{
+	if constexpr (std::is_integral_v<R>)
+	{
+		using U = std::make_unsigned_t<R>;
+		return R(op(U(R(a)), U(R(b))));
+	}
+	else
+	{
+		return op(R(a), R(b));
+	}
+}
+
+[[nodiscard]] std::optional<Constant>
+fold_binary(Instr opcode, const Constant& lhs, const Constant& rhs)
+{
+	return std::visit(
+		[opcode](auto a, auto b) -> std::optional<Constant> {
+			using A = decltype(a);
+			using B = decltype(b);
+			using R = decltype(a + b);
+
+			constexpr bool integral = std::is_integral_v<A>
+				&& std::is_integral_v<B>;
+
+			switch (opcode)
+			{
+			case Instr::opadd: return wrapping<R>(a, b, std::plus<>{});
+			case Instr::opsub: return wrapping<R>(a, b, std::minus<>{});
+			case Instr::opmul: return wrapping<R>(a, b, std::multiplies<>{});
+
+			case Instr::opdiv:
+				if constexpr (integral)
+				{
+					if (b == 0
+						|| (R(a) == std::numeric_limits<R>::min()
+							&& R(b) == -1))
+					{
+						return std::nullopt;
+					}
+				}
+
+				return R(a) / R(b);
+
+			case Instr::opand:
+			case Instr::opor:
+			case Instr::opxor:
+				if constexpr (integral)
+				{
+					switch (opcode)
+					{
+					case Instr::opand: return R(a) & R(b);
+					case Instr::opor: return R(a) | R(b);
+					default: return R(a) ^ R(b);
+					}
+				}
+
+				return std::nullopt;
+
+			case Instr::opshl:
+			case Instr::opshr:
+				if constexpr (integral)
+				{
+					using S = decltype(a << b);
+
+					if (b < 0 || b >= B(sizeof(S) * 8))
+					{
+						return std::nullopt;
+					}
+
+					if (opcode == Instr::opshl)
+					{
+						return S(std::make_unsigned_t<S>(a) << b);
+					}
+
+					return S(a >> b);
+				}
+
+				return std::nullopt;
+
+			// rem, mod and others are not implemented by the VM yet
+			default: return std::nullopt;
+			}
+		},
+		lhs,
+		rhs);
+}
+
+[[nodiscard]] std::optional<Constant>
+fold_conv(const Constant& constant, DataType target)
+{
+	return std::visit(
+		[target](auto v) -> std::optional<Constant> {
+			auto convert = [&](auto dst) -> std::optional<Constant> {
+				using D = decltype(dst);
+
+				if constexpr (
+					std::is_integral_v<D> && std::is_floating_point_v<decltype(v)>)
+				{
+					// Out of range float to integer conversions are UB
+					if (!(v >= f64(std::numeric_limits<D>::min())
+						  && v < -f64(std::numeric_limits<D>::min())))
+					{
+						return std::nullopt;
+					}
+				}
+
+				return D(v);
+			};
+
+			switch (target)
+			{
+			case DataType::i32: return convert(s32{});
+			case DataType::i64: return convert(s64{});
+			case DataType::f32: return convert(f32{});
+			case DataType::f64: return convert(f64{});
+			default: return std::nullopt;
+			}
+		},
+		constant);
+}
+
+//! Whether converting from 'from' to 'to' can be done without losing
+//! information, so that a following conversion sees the original value.
+[[nodiscard]] bool is_lossless_conv(DataType from, DataType to)
+{
+	if (!is_numeric(from))
+	{
+		return false;
+	}
+
+	return from == to || to == DataType::var
+		|| (from == DataType::i32
+			&& (to == DataType::i64 || to == DataType::f64))
+		|| (from == DataType::f32 && to == DataType::f64);
+}
+
+//! Type pushed by a push without side effects, if 'instruction' is one.
+[[nodiscard]] std::optional<DataType> pure_push_type(const Instruction& instruction)
+{
+	if (auto constant = constant_of(instruction))
+	{
+		return stack_type_of(*constant);
+	}
+
+	// Array elements pop their index first
+	if (is_array_access(instruction.blocks.data()))
+	{
+		return std::nullopt;
+	}
+
+	switch (instruction.opcode())
+	{
+	case Instr::oppushloc: return instruction.t1();
+
+	case Instr::oppushcst:
+		if (instruction.t1() == DataType::var
+			&& InstType(s16(instruction.blocks[0] & 0xFFFFu))
+				== InstType::local)
+		{
+			return DataType::var;
+		}
+
+		return std::nullopt;
+
+	default: return std::nullopt;
+	}
+}
+
+class Peephole
+{
+	InstructionList&  _list;
+	std::vector<bool> _targets;
+
+	std::size_t _folds = 0, _convs = 0, _dead_pushes = 0, _threads = 0;
+
+	[[nodiscard]] Instruction& at(std::size_t index);
+	[[nodiscard]] bool         is_plain(std::size_t index) const;
+
+	void remove(std::size_t index);
+
+	[[nodiscard]] bool fold_constants(std::size_t index);
+	[[nodiscard]] bool collapse_convs(std::size_t index);
+	[[nodiscard]] bool eliminate_dead_push(std::size_t index);
+	[[nodiscard]] bool thread_jump(std::size_t index);
+
+	public:
+	explicit Peephole(InstructionList& list);
+
+	std::size_t operator()();
+
+	void print_stats(const Script& script) const;
+};
+
+Peephole::Peephole(InstructionList& list) : _list{list} {}
+
+Instruction& Peephole::at(std::size_t index)
+{
+	return _list.instructions[index];
+}
+
+//! Whether the instruction at 'index' exists and is not a branch target, i.e.
+//! it may be merged with the preceding instruction.
+bool Peephole::is_plain(std::size_t index) const
+{
+	return index < _list.instructions.size() && !_targets[index];
+}
+
+void Peephole::remove(std::size_t index)
+{
+	at(index).removed = true;
+
+	// Branches to it now land on the following instruction
+	auto next = _list.next(index);
+	if (_targets[index] && next < _targets.size())
+	{
+		_targets[next] = true;
+	}
+}
+
+bool Peephole::fold_constants(std::size_t index)
+{
+	auto lhs = constant_of(at(index));
+	if (!lhs)
+	{
+		return false;
+	}
+
+	auto second = _list.next(index);
+	if (!is_plain(second))
+	{
+		return false;
+	}
+
+	// push; conv
+	if (at(second).opcode() == Instr::opconv
+		&& at(second).t1() == stack_type_of(*lhs))
+	{
+		if (auto result = fold_conv(*lhs, at(second).t2()))
+		{
+			at(index).blocks = encode_push(*result);
+			remove(second);
+			++_folds;
+			return true;
+		}
+
+		return false;
+	}
+
+	// push; push; op
+	auto rhs   = constant_of(at(second));
+	auto third = _list.next(second);
+
+	if (!rhs || !is_plain(third) || at(third).t1() != stack_type_of(*rhs)
+		|| at(third).t2() != stack_type_of(*lhs))
+	{
+		return false;
+	}
+
+	if (auto result = fold_binary(at(third).opcode(), *lhs, *rhs))
+	{
+		at(index).blocks = encode_push(*result);
+		remove(second);
+		remove(third);
+		++_folds;
+		return true;
+	}
+
+	return false;
+}
+
+bool Peephole::collapse_convs(std::size_t index)
+{
+	auto& first = at(index);
+	if (first.opcode() != Instr::opconv)
+	{
+		return false;
+	}
+
+	auto from = first.t1(), through = first.t2();
+
+	auto second = _list.next(index);
+	if (!is_plain(second) || at(second).t1() != through)
+	{
+		return false;
+	}
+
+	// conv.A.B; popz.B -> popz.A
+	if (at(second).opcode() == Instr::oppopz && is_numeric(from))
+	{
+		first.blocks[0] = with_types(
+			Block(Instr::oppopz) << 24u, from, DataType::f64);
+		remove(second);
+		++_convs;
+		return true;
+	}
+
+	if (at(second).opcode() != Instr::opconv
+		|| !is_lossless_conv(from, through))
+	{
+		return false;
+	}
+
+	auto to = at(second).t2();
+	if (!is_numeric(to) && to != DataType::var)
+	{
+		return false;
+	}
+
+	// The tag of a variable is observable (e.g. f64 and i32 operands divide
+	// differently), so conv.A.B; conv.B.var must keep boxing a B
+	if (to == DataType::var && from != through)
+	{
+		return false;
+	}
+
+	if (from == to)
+	{
+		remove(index);
+	}
+	else
+	{
+		first.blocks[0] = with_types(first.blocks[0], from, to);
+	}
+
+	remove(second);
+	++_convs;
+	return true;
+}
+
+bool Peephole::eliminate_dead_push(std::size_t index)
+{
+	auto second = _list.next(index);
+
+	auto type = pure_push_type(at(index));
+	if (!type || !is_plain(second) || at(second).opcode() != Instr::oppopz
+		|| at(second).t1() != *type)
+	{
+		return false;
+	}
+
+	remove(index);
+	remove(second);
+	++_dead_pushes;
+	return true;
+}
+
+bool Peephole::thread_jump(std::size_t index)
+{
+	auto& branch = at(index);
+	if (!is_branch(branch.opcode()))
+	{
+		return false;
+	}
+
+	auto size     = _list.instructions.size();
+	auto original = _list.live(branch.target);
+	auto target   = original;
+
+	// Follow chains of unconditional branches, stopping on cycles
+	std::vector<std::size_t> visited{target};
+
+	while (target < size && at(target).opcode() == Instr::opb)
+	{
+		auto next_target = _list.live(at(target).target);
+
+		if (std::find(visited.begin(), visited.end(), next_target)
+			!= visited.end())
+		{
+			break;
+		}
+
+		visited.push_back(next_target);
+		target = next_target;
+	}
+
+	branch.target = target;
+	bool changed  = target != original;
+
+	// Branching to the next instruction is a no-op
+	if (target == _list.next(index))
+	{
+		remove(index);
+		changed = true;
+	}
+
+	if (changed)
+	{
+		++_threads;
+	}
+
+	return changed;
+}
+
+std::size_t Peephole::operator()()
+{
+	bool changed;
+
+	do
+	{
+		changed  = false;
+		_targets = _list.branch_targets();
+
+		for (auto i = _list.live(0); i < _list.instructions.size();
+			 i       = _list.next(i))
+		{
+			if (fold_constants(i) || collapse_convs(i)
+				|| eliminate_dead_push(i) || thread_jump(i))
+			{
+				changed = true;
+			}
+		}
+	} while (changed);
+
+	return _folds + _convs + _dead_pushes + _threads;
+}
+
+void Peephole::print_stats(const Script& script) const
+{
+	fmt::print(
+		"Peephole: '{}': {} folds, {} conv collapses, {} dead pushes, {} "
+		"threaded jumps\n",
+		script.name,
+		_folds,
+		_convs,
+		_dead_pushes,
+		_threads);
+}
+} // namespace
+
+std::size_t peephole_optimize(Script& script)
+{
+	try
+	{
+		InstructionList list{script};
+		Peephole        peephole{list};
+
+		auto rewrites = peephole();
+
+		if (rewrites != 0)
+		{
+			list.encode(script);
+
+			if constexpr (check(debug::verbose_postprocess))
+			{
+				peephole.print_stats(script);
+			}
+		}
+
+		return rewrites;
+	}
+	catch (const DecoderError& e)
+	{
+		if constexpr (check(debug::verbose_postprocess))
+		{
+			fmt::print(
+				"Peephole: skipped '{}': {}\n", script.name, e.what());
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "pvm/unpack/chunk/code.hpp"
+
+//! Runs local rewrites over the bytecode of 'script' until none applies:
+//! - Constant folding of arithmetic and conversions over pushed constants;
+//! - Collapsing of lossless conv chains (e.g. conv.i32.var; conv.var.f64);
+//! - Elimination of side-effect free pushes that are directly discarded;
+//! - Jump threading of branches to unconditional branches.
+//! @returns the amount of rewrites done.
+std::size_t peephole_optimize(Script& script);
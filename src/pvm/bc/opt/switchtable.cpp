@@ -0,0 +1,238 @@
+#include "pvm/bc/opt/switchtable.hpp"
+
+#include "pvm/bc/opt/constant.hpp"
+#include "pvm/bc/opt/instructionlist.hpp"
+#include "pvm/config.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <limits>
+
+namespace
+{
+using Instruction = InstructionList::Instruction;
+
+//! Case of a compare chain, i.e. 'dup; push; cmp; bt'.
+struct Case
+{
+	s64 key;
+
+	//! Index of the bt instruction.
+	std::size_t branch;
+};
+
+[[nodiscard]] bool is_integral(DataType type)
+{
+	return type == DataType::i32 || type == DataType::i64;
+}
+
+class SwitchTableBuilder
+{
+	InstructionList&  _list;
+	std::vector<bool> _targets;
+
+	[[nodiscard]] Instruction& at(std::size_t index);
+
+	//! Matches the case starting with the dup instruction at 'index'.
+	[[nodiscard]] std::optional<Case>
+	match_case(std::size_t index, DataType type, bool first);
+
+	[[nodiscard]] bool build_from(std::size_t index);
+
+	public:
+	explicit SwitchTableBuilder(InstructionList& list);
+
+	std::size_t operator()();
+};
+
+SwitchTableBuilder::SwitchTableBuilder(InstructionList& list) :
+	_list{list},
+	_targets{list.branch_targets()}
+{}
+
+Instruction& SwitchTableBuilder::at(std::size_t index)
+{
+	return _list.instructions[index];
+}
+
+std::optional<Case>
+SwitchTableBuilder::match_case(std::size_t index, DataType type, bool first)
+{
+	auto push    = _list.next(index);
+	auto compare = _list.next(push);
+	auto branch  = _list.next(compare);
+
+	// Only the first dup may be jumped to, as the others get removed
+	if (branch >= _list.instructions.size() || (!first && _targets[index])
+		|| _targets[push] || _targets[compare] || _targets[branch])
+	{
+		return std::nullopt;
+	}
+
+	auto& dup = at(index);
+	if (dup.opcode() != Instr::opdup || dup.t1() != type
+		|| (dup.blocks[0] & 0xFFu) != 0)
+	{
+		return std::nullopt;
+	}
+
+	auto constant = constant_of(at(push));
+	if (!constant)
+	{
+		return std::nullopt;
+	}
+
+	auto  constant_type = stack_type_of(*constant);
+	auto& cmp           = at(compare);
+
+	if (cmp.opcode() != Instr::opcmp
+		|| CompFunc((cmp.blocks[0] >> 8u) & 0xFFu) != CompFunc::eq
+		|| cmp.t1() != constant_type || cmp.t2() != type
+		|| at(branch).opcode() != Instr::opbt)
+	{
+		return std::nullopt;
+	}
+
+	auto key = integral_value(*constant);
+	if (!key)
+	{
+		return std::nullopt;
+	}
+
+	// Comparisons involving floats may round the integral side, so only
+	// allow keys that any float type represents exactly
+	constexpr s64 max_exact_float = s64(1) << 24;
+	if ((!is_integral(type) || !is_integral(constant_type))
+		&& (*key <= -max_exact_float || *key >= max_exact_float))
+	{
+		return std::nullopt;
+	}
+
+	return Case{*key, branch};
+}
+
+bool SwitchTableBuilder::build_from(std::size_t index)
+{
+	auto type = at(index).t1();
+	if (type != DataType::var && !is_numeric(type))
+	{
+		return false;
+	}
+
+	std::vector<Case> cases;
+	for (auto i = index; i < _list.instructions.size();)
+	{
+		auto c = match_case(i, type, i == index);
+		if (!c)
+		{
+			break;
+		}
+
+		cases.push_back(*c);
+		i = _list.next(c->branch);
+	}
+
+	if (cases.size() < opt::jump_table_min_cases
+		|| _list.jump_tables.size() > std::numeric_limits<u16>::max())
+	{
+		return false;
+	}
+
+	JumpTable table;
+	table.default_target = u32(_list.next(cases.back().branch));
+
+	s64 min_key = cases.front().key, max_key = cases.front().key;
+	for (auto& c : cases)
+	{
+		min_key = std::min(min_key, c.key);
+		max_key = std::max(max_key, c.key);
+	}
+
+	// The first matching case wins, as it would in the compare chain
+	auto span = u64(max_key) - u64(min_key);
+	if (span < cases.size() * opt::jump_table_max_sparsity)
+	{
+		table.min_key = min_key;
+		table.dense_targets.resize(span + 1, JumpTable::no_case);
+
+		for (auto& c : cases)
+		{
+			auto& target = table.dense_targets[u64(c.key) - u64(min_key)];
+			if (target == JumpTable::no_case)
+			{
+				target = u32(at(c.branch).target);
+			}
+		}
+	}
+	else
+	{
+		for (auto& c : cases)
+		{
+			table.sparse_targets.emplace(c.key, u32(at(c.branch).target));
+		}
+	}
+
+	// The first dup becomes the switch, the rest of the chain goes away
+	at(index).blocks = {with_types(
+		(Block(Instr::opswitch) << 24u) | u32(_list.jump_tables.size()),
+		type,
+		DataType::f64)};
+
+	for (auto i = _list.next(index); i <= cases.back().branch;
+		 i      = _list.next(i))
+	{
+		at(i).removed = true;
+	}
+
+	_list.jump_tables.push_back(std::move(table));
+	return true;
+}
+
+std::size_t SwitchTableBuilder::operator()()
+{
+	std::size_t built = 0;
+
+	for (auto i = _list.live(0); i < _list.instructions.size();
+		 i       = _list.next(i))
+	{
+		if (at(i).opcode() == Instr::opdup && build_from(i))
+		{
+			++built;
+		}
+	}
+
+	return built;
+}
+} // namespace
+
+std::size_t build_jump_tables(Script& script)
+{
+	try
+	{
+		InstructionList list{script};
+
+		auto built = SwitchTableBuilder{list}();
+
+		if (built != 0)
+		{
+			list.encode(script);
+
+			if constexpr (check(debug::verbose_postprocess))
+			{
+				fmt::print(
+					"Jump tables: built {} in '{}'\n", built, script.name);
+			}
+		}
+
+		return built;
+	}
+	catch (const DecoderError& e)
+	{
+		if constexpr (check(debug::verbose_postprocess))
+		{
+			fmt::print(
+				"Jump tables: skipped '{}': {}\n", script.name, e.what());
+		}
+
+		return 0;
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "pvm/unpack/chunk/code.hpp"
+
+//! Replaces chains of 'dup.T 0; push <constant>; cmp.eq; bt <case>', as
+//! emitted by GM:S for switch statements, with a single switch instruction
+//! looking up the case target in a jump table. Only chains of at least
+//! opt::jump_table_min_cases integral keys are considered.
+//! @returns the amount of jump tables built.
+std::size_t build_jump_tables(Script& script);
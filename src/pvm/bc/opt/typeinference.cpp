@@ -0,0 +1,756 @@
+#include "pvm/bc/opt/typeinference.hpp"
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/config.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <map>
+#include <optional>
+#include <vector>
+
+namespace
+{
+//! Abstract value of a stack slot.
+struct AbstractSlot
+{
+	//! Type of the slot as laid out on the stack, i.e. DataType::var for a
+	//! tagged variable.
+	DataType stack_type;
+
+	//! For tagged variables, type of the tag when it is statically known.
+	std::optional<DataType> tag;
+
+	//! Offsets of the instructions that may have pushed this slot.
+	std::vector<std::size_t> producers;
+};
+
+//! Known tag of each local. A missing entry means that the local was not
+//! assigned yet; std::nullopt means that its type is unknown.
+using LocalTypes = std::map<u32, std::optional<DataType>>;
+
+struct AbstractState
+{
+	std::vector<AbstractSlot> stack;
+	LocalTypes                locals;
+};
+
+//! Operand of an instruction that consumed a stack slot.
+struct Use
+{
+	std::size_t consumer;
+
+	//! 1 or 2 when the operand type is decoded from respectively t1 or t2,
+	//! 0 when the operand cannot be retyped (e.g. a call argument).
+	int type_field;
+
+	//! Whether the slot may only come from one producer.
+	bool single_producer;
+
+	std::optional<DataType> tag;
+};
+
+[[nodiscard]] bool is_retypable(std::optional<DataType> type)
+{
+	return type == DataType::f64 || type == DataType::f32
+		|| type == DataType::i32 || type == DataType::i64;
+}
+
+[[nodiscard]] bool is_arithmetic_op(Instr opcode)
+{
+	switch (opcode)
+	{
+	case Instr::opmul:
+	case Instr::opdiv:
+	case Instr::oprem:
+	case Instr::opmod:
+	case Instr::opadd:
+	case Instr::opsub:
+	case Instr::opand:
+	case Instr::opor:
+	case Instr::opxor:
+	case Instr::opshl:
+	case Instr::opshr: return true;
+	default: return false;
+	}
+}
+
+//! Mirrors the C++ promotion rules the VM arithmetic handlers end up using.
+[[nodiscard]] std::optional<DataType> arithmetic_type(
+	Instr opcode, std::optional<DataType> a, std::optional<DataType> b)
+{
+	auto is_numeric = [](std::optional<DataType> type) {
+		return is_retypable(type) || type == DataType::i16;
+	};
+
+	if (!is_numeric(a) || !is_numeric(b))
+	{
+		return std::nullopt;
+	}
+
+	auto any = [&](DataType type) { return a == type || b == type; };
+
+	bool integral_op = opcode == Instr::opand || opcode == Instr::opor
+		|| opcode == Instr::opxor || opcode == Instr::opshl
+		|| opcode == Instr::opshr;
+
+	if (integral_op && (any(DataType::f64) || any(DataType::f32)))
+	{
+		return std::nullopt;
+	}
+
+	if (opcode == Instr::opshl || opcode == Instr::opshr)
+	{
+		return *a == DataType::i64 ? DataType::i64 : DataType::i32;
+	}
+
+	if (any(DataType::f64))
+	{
+		return DataType::f64;
+	}
+
+	if (any(DataType::f32))
+	{
+		return DataType::f32;
+	}
+
+	return any(DataType::i64) ? DataType::i64 : DataType::i32;
+}
+
+class TypeInference
+{
+	Script& _script;
+
+	//! Abstract state on entry of each instruction, indexed by block offset.
+	std::vector<std::optional<AbstractState>> _states;
+
+	//! Uses of the slot pushed by each instruction, indexed by block offset.
+	std::vector<std::vector<Use>> _uses;
+
+	bool _recording = false;
+
+	[[nodiscard]] bool merge_into(std::size_t offset, const AbstractState& in);
+
+	[[nodiscard]] bool transfer(
+		std::size_t               offset,
+		AbstractState&            state,
+		std::vector<std::size_t>& successors);
+
+	[[nodiscard]] bool analyze();
+
+	[[nodiscard]] std::size_t rewrite();
+
+	public:
+	TypeInference(Script& script);
+
+	std::size_t operator()();
+};
+
+TypeInference::TypeInference(Script& script) :
+	_script{script},
+	_states(script.data.size()),
+	_uses(script.data.size())
+{}
+
+bool TypeInference::merge_into(std::size_t offset, const AbstractState& in)
+{
+	auto& target = _states[offset];
+
+	if (!target)
+	{
+		target = in;
+		return true;
+	}
+
+	if (target->stack.size() != in.stack.size())
+	{
+		throw DecoderError{"Inconsistent stack height at branch target"};
+	}
+
+	bool changed = false;
+
+	for (std::size_t i = 0; i < in.stack.size(); ++i)
+	{
+		auto&       slot     = target->stack[i];
+		const auto& incoming = in.stack[i];
+
+		if (slot.stack_type != incoming.stack_type)
+		{
+			throw DecoderError{"Inconsistent stack types at branch target"};
+		}
+
+		if (slot.tag && slot.tag != incoming.tag)
+		{
+			slot.tag = std::nullopt;
+			changed  = true;
+		}
+
+		for (auto producer : incoming.producers)
+		{
+			auto it = std::lower_bound(
+				slot.producers.begin(), slot.producers.end(), producer);
+
+			if (it == slot.producers.end() || *it != producer)
+			{
+				slot.producers.insert(it, producer);
+				changed = true;
+			}
+		}
+	}
+
+	// Locals only assigned on some of the paths become unknown
+	for (auto& [id, type] : target->locals)
+	{
+		auto it = in.locals.find(id);
+		if (type && (it == in.locals.end() || it->second != type))
+		{
+			type    = std::nullopt;
+			changed = true;
+		}
+	}
+
+	for (auto& [id, type] : in.locals)
+	{
+		if (target->locals.find(id) == target->locals.end())
+		{
+			target->locals.emplace(id, std::nullopt);
+			changed = true;
+		}
+	}
+
+	return changed;
+}
+
+bool TypeInference::transfer(
+	std::size_t               offset,
+	AbstractState&            state,
+	std::vector<std::size_t>& successors)
+{
+	const Block* block  = &_script.data[offset];
+	const auto   opcode = instr_opcode(*block);
+	const auto   t1     = instr_t1(*block);
+	const auto   t2     = instr_t2(*block);
+
+	std::optional<AbstractSlot> popped;
+
+	auto pop = [&](int type_field, DataType expected) {
+		if (state.stack.empty() || state.stack.back().stack_type != expected)
+		{
+			return false;
+		}
+
+		popped = std::move(state.stack.back());
+		state.stack.pop_back();
+
+		if (_recording)
+		{
+			for (auto producer : popped->producers)
+			{
+				_uses[producer].push_back(
+					{offset,
+					 type_field,
+					 popped->producers.size() == 1,
+					 popped->tag});
+			}
+		}
+
+		return true;
+	};
+
+	auto push = [&](DataType stack_type, std::optional<DataType> tag = {}) {
+		state.stack.push_back({stack_type, tag, {offset}});
+	};
+
+	auto local_tag = [&](Block reference) -> std::optional<DataType> {
+		auto it = state.locals.find(reference & 0x00FFFFFFu);
+		return it != state.locals.end() ? it->second : std::nullopt;
+	};
+
+	auto reference_is_normal = [&] {
+		return VarType(block[1] >> 24u) == VarType::normal;
+	};
+
+	// Array accesses pop the index and the instance of the element first
+	auto pop_array_index = [&] {
+		return pop(0, DataType::i32) && pop(0, DataType::i32);
+	};
+
+	bool falls_through = true;
+
+	switch (opcode)
+	{
+	case Instr::opconv:
+	{
+		if (!pop(1, t1))
+		{
+			return false;
+		}
+
+		if (t2 == DataType::var)
+		{
+			push(t2, t1 == DataType::var ? popped->tag : t1);
+		}
+		else
+		{
+			push(t2);
+		}
+
+		break;
+	}
+
+	case Instr::opmul:
+	case Instr::opdiv:
+	case Instr::oprem:
+	case Instr::opmod:
+	case Instr::opadd:
+	case Instr::opsub:
+	case Instr::opand:
+	case Instr::opor:
+	case Instr::opxor:
+	case Instr::opshl:
+	case Instr::opshr:
+	{
+		// t1 is the type of the top of the stack, i.e. the right-hand side
+		if (!pop(1, t1))
+		{
+			return false;
+		}
+		auto b = t1 == DataType::var ? popped->tag : t1;
+
+		if (!pop(2, t2))
+		{
+			return false;
+		}
+		auto a = t2 == DataType::var ? popped->tag : t2;
+
+		auto result = arithmetic_type(opcode, a, b);
+
+		if (t1 == DataType::var || t2 == DataType::var)
+		{
+			push(DataType::var, result);
+		}
+		else if (result)
+		{
+			push(*result);
+		}
+		else
+		{
+			return false;
+		}
+
+		break;
+	}
+
+	case Instr::opneg:
+	case Instr::opnot:
+	{
+		if (!pop(1, t1))
+		{
+			return false;
+		}
+
+		push(t1, popped->tag);
+		break;
+	}
+
+	case Instr::opcmp:
+	{
+		if (!pop(1, t1) || !pop(2, t2))
+		{
+			return false;
+		}
+
+		break;
+	}
+
+	case Instr::oppop:
+	{
+		auto inst_type = InstType(s16(*block & 0xFFFFu));
+		bool array     = is_array_access(block);
+
+		if ((!reference_is_normal() && !array)
+			|| inst_type == InstType::stack_top_or_global
+			|| (array && !pop_array_index()) || !pop(2, t2))
+		{
+			return false;
+		}
+
+		if (inst_type == InstType::local)
+		{
+			auto& tag = state.locals[block[1] & 0x00FFFFFFu];
+
+			// Writing an element makes the local hold an array
+			if (array)
+			{
+				tag = std::nullopt;
+			}
+			else
+			{
+				tag = t2 == DataType::var ? popped->tag : t2;
+			}
+		}
+
+		break;
+	}
+
+	case Instr::oppushcst:
+	case Instr::oppushglb:
+	{
+		if (is_array_access(block))
+		{
+			if (!pop_array_index())
+			{
+				return false;
+			}
+
+			push(DataType::var);
+		}
+		else if (t1 == DataType::var)
+		{
+			if (!reference_is_normal())
+			{
+				return false;
+			}
+
+			auto inst_type = InstType(s16(*block & 0xFFFFu));
+			push(
+				DataType::var,
+				inst_type == InstType::local ? local_tag(block[1])
+											 : std::nullopt);
+		}
+		else
+		{
+			// i16 constants are widened to i32 when pushed
+			push(t1 == DataType::i16 ? DataType::i32 : t1);
+		}
+
+		break;
+	}
+
+	case Instr::oppushloc:
+	{
+		if (is_array_access(block))
+		{
+			if (!pop_array_index())
+			{
+				return false;
+			}
+
+			push(DataType::var);
+			break;
+		}
+
+		if (t1 != DataType::var || !reference_is_normal())
+		{
+			return false;
+		}
+
+		push(DataType::var, local_tag(block[1]));
+		break;
+	}
+
+	case Instr::oppushspc:
+	{
+		push(DataType::var);
+		break;
+	}
+
+	case Instr::oppushi16:
+	{
+		push(DataType::i32);
+		break;
+	}
+
+	case Instr::opdup:
+	{
+		// Duplicated slots are shared, so leave their producers untouched
+		if ((*block & 0xFFu) != 0 || !pop(0, t1))
+		{
+			return false;
+		}
+
+		state.stack.push_back(*popped);
+		push(t1, popped->tag);
+		break;
+	}
+
+	case Instr::opswitch:
+	{
+		auto index = *block & 0xFFFFu;
+		if (index >= _script.jump_tables.size() || !pop(0, t1))
+		{
+			return false;
+		}
+
+		// The switched value is only peeked at
+		state.stack.push_back(*popped);
+
+		bool in_range = true;
+		_script.jump_tables[index].for_each_target([&](u32 target) {
+			if (target < _script.data.size())
+			{
+				successors.push_back(target);
+			}
+			else
+			{
+				in_range = false;
+			}
+		});
+
+		if (!in_range)
+		{
+			return false;
+		}
+
+		falls_through = false;
+		break;
+	}
+
+	case Instr::oppopz:
+	{
+		if (!pop(1, t1))
+		{
+			return false;
+		}
+
+		break;
+	}
+
+	case Instr::opcall:
+	{
+		for (std::size_t i = 0; i < (*block & 0xFFFFu); ++i)
+		{
+			if (!pop(0, DataType::var))
+			{
+				return false;
+			}
+		}
+
+		push(DataType::var);
+		break;
+	}
+
+	case Instr::opret:
+	{
+		if (!pop(0, t1))
+		{
+			return false;
+		}
+
+		falls_through = false;
+		break;
+	}
+
+	case Instr::opexit:
+	{
+		falls_through = false;
+		break;
+	}
+
+	case Instr::opb:
+	case Instr::opbt:
+	case Instr::opbf:
+	{
+		auto target = s64(offset) + branch_offset(*block);
+
+		if (target < 0 || std::size_t(target) >= _script.data.size())
+		{
+			return false;
+		}
+
+		successors.push_back(std::size_t(target));
+		falls_through = opcode != Instr::opb;
+		break;
+	}
+
+	default: return false;
+	}
+
+	auto next = offset + instruction_size(block);
+	if (falls_through && next < _script.data.size())
+	{
+		successors.push_back(next);
+	}
+
+	return true;
+}
+
+bool TypeInference::analyze()
+{
+	std::vector<std::size_t> worklist{0}, successors;
+
+	if (_script.data.empty())
+	{
+		return false;
+	}
+
+	_states[0] = AbstractState{};
+
+	try
+	{
+		while (!worklist.empty())
+		{
+			auto offset = worklist.back();
+			worklist.pop_back();
+
+			AbstractState state = *_states[offset];
+
+			successors.clear();
+			if (!transfer(offset, state, successors))
+			{
+				return false;
+			}
+
+			for (auto successor : successors)
+			{
+				if (merge_into(successor, state))
+				{
+					worklist.push_back(successor);
+				}
+			}
+		}
+	}
+	catch (const DecoderError&)
+	{
+		return false;
+	}
+
+	// Now that states converged, record which instruction consumes what
+	_recording = true;
+
+	for (std::size_t offset = 0; offset < _states.size(); ++offset)
+	{
+		if (_states[offset])
+		{
+			AbstractState state = *_states[offset];
+			successors.clear();
+			(void)transfer(offset, state, successors);
+		}
+	}
+
+	return true;
+}
+
+std::size_t TypeInference::rewrite()
+{
+	std::size_t rewritten = 0;
+
+	// Consumers whose operand was retyped already, so that arithmetic
+	// results keep being a variable
+	std::vector<std::size_t> retyped_consumers;
+
+	for (std::size_t producer = 0; producer < _uses.size(); ++producer)
+	{
+		const auto& uses = _uses[producer];
+
+		if (uses.size() != 1 || !uses.front().single_producer
+			|| !is_retypable(uses.front().tag))
+		{
+			continue;
+		}
+
+		const Use& use  = uses.front();
+		const auto type = *use.tag;
+
+		Block&     producer_block = _script.data[producer];
+		const auto producer_op    = instr_opcode(producer_block);
+
+		bool producer_ok
+			= (producer_op == Instr::opconv
+			   && instr_t1(producer_block) == type)
+			|| producer_op == Instr::oppushloc
+			|| ((producer_op == Instr::oppushcst
+				 || producer_op == Instr::oppushglb)
+				&& InstType(s16(producer_block & 0xFFFFu)) == InstType::local);
+
+		if (!producer_ok || use.type_field == 0)
+		{
+			continue;
+		}
+
+		Block&     consumer_block = _script.data[use.consumer];
+		const auto consumer_op    = instr_opcode(consumer_block);
+
+		bool consumer_ok = consumer_op == Instr::opconv
+			|| consumer_op == Instr::oppopz || consumer_op == Instr::opcmp
+			|| consumer_op == Instr::oppop;
+
+		if (is_arithmetic_op(consumer_op))
+		{
+			// The result stays a variable only as long as the other operand is
+			auto other = use.type_field == 1 ? instr_t2(consumer_block)
+											 : instr_t1(consumer_block);
+
+			consumer_ok = other == DataType::var
+				&& std::find(
+					   retyped_consumers.begin(),
+					   retyped_consumers.end(),
+					   use.consumer)
+					== retyped_consumers.end();
+		}
+
+		if (!consumer_ok)
+		{
+			continue;
+		}
+
+		if (producer_op == Instr::opconv)
+		{
+			// conv.T.var becomes the identity conv.T.T
+			producer_block = with_types(producer_block, type, type);
+		}
+		else
+		{
+			// Local reads are turned into typed pushloc, which only push the
+			// value of the local
+			producer_block = with_types(
+				with_opcode(producer_block, Instr::oppushloc),
+				type,
+				instr_t2(producer_block));
+		}
+
+		consumer_block = use.type_field == 1
+			? with_types(consumer_block, type, instr_t2(consumer_block))
+			: with_types(consumer_block, instr_t1(consumer_block), type);
+
+		retyped_consumers.push_back(use.consumer);
+		++rewritten;
+	}
+
+	return rewritten;
+}
+
+std::size_t TypeInference::operator()()
+{
+	if (!analyze())
+	{
+		if constexpr (check(debug::verbose_postprocess))
+		{
+			fmt::print(
+				"Type inference: skipped '{}' (unsupported bytecode)\n",
+				_script.name);
+		}
+
+		return 0;
+	}
+
+	return rewrite();
+}
+} // namespace
+
+std::size_t infer_types(Script& script)
+{
+	auto rewritten = TypeInference{script}();
+
+	if constexpr (check(debug::verbose_postprocess))
+	{
+		if (rewritten != 0)
+		{
+			fmt::print(
+				"Type inference: retyped {} operands in '{}'\n",
+				rewritten,
+				script.name);
+		}
+	}
+
+	return rewritten;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "pvm/unpack/chunk/code.hpp"
+
+//! Infers the type of the stack slots and locals of 'script' through dataflow
+//! analysis, then rewrites 'var' operands to their concrete type when it is
+//! provably safe, so the VM does not have to dispatch over a runtime DataType
+//! tag for them.
+//! Scripts using instructions the analysis does not understand are left
+//! untouched.
+//! @returns the amount of rewritten operands.
+std::size_t infer_types(Script& script);
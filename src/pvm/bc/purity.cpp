@@ -0,0 +1,152 @@
+#include "pvm/bc/purity.hpp"
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/unpack/chunk/form.hpp"
+#include <vector>
+
+namespace
+{
+//! Whether the script at 'index' can be pure, leaving aside the scripts it
+//! calls, which get appended to 'callees'.
+[[nodiscard]] bool is_locally_pure(
+	const Form& form, std::size_t index, std::vector<std::size_t>& callees)
+{
+	const auto& data = form.code.elements[index].data;
+
+	for (std::size_t offset = 0; offset < data.size();)
+	{
+		auto size = instruction_size(&data[offset]);
+
+		if (offset + size > data.size())
+		{
+			return false;
+		}
+
+		auto inst_type = InstType(s16(data[offset] & 0xFFFFu));
+
+		// Arrays are allocated, and their results would be memoized
+		if (is_array_access(&data[offset]))
+		{
+			return false;
+		}
+
+		switch (instr_opcode(data[offset]))
+		{
+		case Instr::opconv:
+		case Instr::opmul:
+		case Instr::opdiv:
+		case Instr::opadd:
+		case Instr::opsub:
+		case Instr::opand:
+		case Instr::opor:
+		case Instr::opxor:
+		case Instr::opshl:
+		case Instr::opshr:
+		case Instr::opcmp:
+		case Instr::opdup:
+		case Instr::opswitch:
+		case Instr::opret:
+		case Instr::oppopz:
+		case Instr::opb:
+		case Instr::opbt:
+		case Instr::opbf:
+		case Instr::oppushloc:
+		case Instr::oppushi16: break;
+
+		// Variables other than locals may be changed by anyone
+		case Instr::oppushcst:
+			if (instr_t1(data[offset]) == DataType::var
+				&& inst_type != InstType::local)
+			{
+				return false;
+			}
+			break;
+
+		case Instr::oppop:
+			if (inst_type != InstType::local)
+			{
+				return false;
+			}
+			break;
+
+		case Instr::oppushspc:
+			if (SpecialVar(data[offset + 1] & 0x00FFFFFFu)
+				> SpecialVar::argument_count)
+			{
+				return false;
+			}
+			break;
+
+		case Instr::opcall:
+		{
+			auto  id    = data[offset + 1] & 0x00FFFFFFu;
+			auto& funcs = form.func.definitions;
+
+			if (id >= funcs.size() || funcs[id].is_builtin
+				|| funcs[id].associated_script == nullptr)
+			{
+				return false;
+			}
+
+			callees.push_back(std::size_t(
+				funcs[id].associated_script - form.code.elements.data()));
+			break;
+		}
+
+		default: return false;
+		}
+
+		offset += size;
+	}
+
+	return true;
+}
+} // namespace
+
+std::size_t find_pure_scripts(Form& form)
+{
+	auto& scripts = form.code.elements;
+
+	std::vector<std::vector<std::size_t>> callees(scripts.size());
+	std::vector<bool>                     pure(scripts.size());
+
+	for (std::size_t i = 0; i < scripts.size(); ++i)
+	{
+		pure[i] = is_locally_pure(form, i, callees[i]);
+	}
+
+	// Assume calls are pure until proven otherwise, so that (mutually)
+	// recursive scripts can qualify
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+
+		for (std::size_t i = 0; i < scripts.size(); ++i)
+		{
+			if (!pure[i])
+			{
+				continue;
+			}
+
+			for (auto callee : callees[i])
+			{
+				if (!pure[callee])
+				{
+					pure[i] = false;
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+
+	std::size_t count = 0;
+
+	for (std::size_t i = 0; i < scripts.size(); ++i)
+	{
+		scripts[i].is_pure = pure[i];
+		count += pure[i];
+	}
+
+	return count;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+
+struct Form;
+
+//! Finds the scripts whose result only depends on their arguments, and which
+//! have no side effect: they only access their arguments and locals, and only
+//! call other pure scripts. Sets Script::is_pure accordingly.
+//! Builtins are never considered pure.
+//! @returns the amount of pure scripts.
+std::size_t find_pure_scripts(Form& form);
@@ -20,9 +20,14 @@ constexpr bool
 	//! binding done
 	verbose_bindings = true,
 
-	//! Disassembles the bytecode program.
+	//! Disassembles the bytecode program to 'data.win.disasm', on as many
+	//! threads as there are cores (see write_disassembly()).
 	disassemble = true,
 
+	//! Writes the control flow graph of every script to '<script name>.dot'
+	//! in the working directory.
+	dump_cfg = false,
+
 	//! Prints a debug message on every single instruction in the VM.
 	vm_verbose_instructions = false,
 
@@ -32,22 +37,137 @@ constexpr bool
 	//! Prints a debug message when entering/leaving any function.
 	vm_verbose_calls = false,
 
-	//! Initializes stacks with a recognizable pattern to help detect
-	//! uninitialized stack usage.
+	//! Prints a debug message when a hot script gets promoted.
+	vm_verbose_tiering = false,
+
+	//! Records which basic blocks of the scripts of the form ran (see
+	//! Coverage), at the cost of a store per basic block. Scripts run from
+	//! their original bytecode, as optimized copies and native code have
+	//! their own offsets. The runners write the report next to the
+	//! data.win file, to 'data.win.coverage'.
+	vm_coverage = false,
+
+	//! Runs every call to native code through the interpreter as well, from
+	//! the same stack state, and throws when their results differ. Side
+	//! effects outside of the stack happen twice.
+	jit_verify = false,
+
+	//! Prints the statistics of every step of the garbage collector (see
+	//! Heap).
+	vm_verbose_gc = false,
+
+	//! Initializes stack memory with a recognizable pattern as it gets
+	//! committed, to help detect uninitialized stack usage.
 	vm_debug_stack = true,
 
 	//! Trades performance for safety. This includes:
 	//! - Turning maybe_unreachable() calls from __builtin_unreachable to an
 	//!   exception.
 	//! - Checking the boundaries for the block reader.
-	//! - Checking stack limits (main stack, call stack, ...).
+	//! - Checking stack limits (call stack, ...). The main stack relies on
+	//!   guard pages instead.
 	vm_safer = true;
 }
 
+namespace opt
+{
+constexpr bool
+	//! Statically infers the type of stack slots and locals, and rewrites
+	//! 'var' operands to their concrete type where it is provably safe.
+	infer_types = true,
+
+	//! Runs peephole optimizations (constant folding, conv chain collapsing,
+	//! dead push elimination and jump threading) over the bytecode.
+	peephole = true,
+
+	//! Replaces switch compare chains with O(1) jump tables.
+	jump_tables = true,
+
+	//! Only optimizes scripts once they get hot, in a background thread,
+	//! rather than optimizing every script when loading the form.
+	tiered = true,
+
+	//! Compiles scripts promoted by tiering to native code (x86-64 only).
+	jit = tiered,
+
+	//! Saves which scripts got promoted to 'data.win.profile' on exit, and
+	//! promotes them before running anything on the next startup.
+	persist_profile = tiered,
+
+	//! Caches the results of calls to pure scripts (see find_pure_scripts())
+	//! in a per-VM table, keyed on their arguments.
+	memoize_pure = true,
+
+	//! Replaces calls to small scripts with a copy of their bytecode when
+	//! loading the form.
+	inline_scripts = true,
+
+	//! Runs the region and disk operations of ds_grid with SIMD kernels, for
+	//! the widest instruction set the CPU supports (see grid_kernels()).
+	simd_grid_kernels = true;
+
+constexpr std::size_t
+	//! Least amount of cases for a compare chain to become a jump table.
+	jump_table_min_cases = 4,
+
+	//! A jump table is dense (direct indexing) when its key range does not
+	//! exceed this many slots per case, otherwise it is hashed.
+	jump_table_max_sparsity = 4,
+
+	//! Amount of calls to a script after which it gets optimized.
+	tier_up_invocations = 1000,
+
+	//! Amount of backward branches taken in a script (i.e. loop iterations)
+	//! after which it gets optimized.
+	tier_up_backedges = 10000,
+
+	//! Amount of entries of the memoization table of each VM. Colliding
+	//! entries replace each other.
+	memo_table_size = 4096,
+
+	//! Calls to pure scripts with more arguments than this are not memoized.
+	memo_max_arguments = 4,
+
+	//! Largest script, in blocks, that gets inlined into its callers.
+	inline_max_blocks = 16,
+
+	//! Bytes the scripts of a VM may allocate between two steps of the
+	//! garbage collector, which bounds the pause of each step.
+	gc_step_bytes = 1024 * 64, // 64KiB
+
+	//! Objects marked or swept by a step of the garbage collector for each
+	//! object allocated since the previous one. Above 1, collection outpaces
+	//! allocation so that cycles end.
+	gc_step_multiplier = 2,
+
+	//! Heap size below which no collection cycle starts. Past it, cycles
+	//! start once the heap doubled since the end of the previous one.
+	gc_min_heap_bytes = 1024 * 1024; // 1MiB
+}
+
 [[nodiscard]] constexpr bool check(const bool flag)
 {
 	return debug::debug_everything || flag;
 }
 
-constexpr std::size_t max_stack_depth = 1024 * 32, // 32KiB
-	max_context_depth = 16, max_call_depth = 256;
+constexpr std::size_t
+	//! Size the main stack of a VM may grow up to. Only the used part of it
+	//! gets committed.
+	max_stack_size = 1024 * 1024 * 64, // 64MiB
+
+	//! Stack space each call makes sure is committed, past its arguments and
+	//! locals, for its temporaries. Memory gets committed geometrically, so
+	//! going past it usually lands in committed memory rather than faulting:
+	//! only running past max_stack_size hits the guard page.
+	stack_frame_headroom = 1024 * 16, // 16KiB
+
+	//! Nested calls a VM may make. Like the main stack, only the frames in
+	//! use get committed.
+	max_call_depth = 1024 * 1024,
+
+	//! Native stack of the threads of a ParallelRunner. Calls to scripts
+	//! recurse in the interpreter, so this bounds the recursion depth of
+	//! scripts as well. Only the used part gets committed by the OS.
+	runner_thread_stack_size = 1024 * 1024 * 512, // 512MiB
+
+	max_context_depth = 16;
@@ -0,0 +1,744 @@
+#include "pvm/jit/compiler.hpp"
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/bc/opt/constant.hpp"
+#include "pvm/config.hpp"
+#include "pvm/vm/vm.hpp"
+#include <cstddef>
+#include <cstring>
+#include <fmt/core.h>
+#include <initializer_list>
+#include <optional>
+
+#if defined(__x86_64__)
+
+namespace
+{
+//! Raw x86-64 encoder, only covering what the templates need.
+class Assembler
+{
+	public:
+	std::vector<u8> code;
+
+	void emit(std::initializer_list<u8> bytes)
+	{
+		code.insert(code.end(), bytes);
+	}
+
+	template<class T>
+	void immediate(T value)
+	{
+		u8 bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		code.insert(code.end(), bytes, bytes + sizeof(T));
+	}
+
+	//! Emits a jump with a 32-bit displacement to be patched later.
+	//! @returns the offset of the displacement.
+	std::size_t jump(std::initializer_list<u8> opcode)
+	{
+		emit(opcode);
+		immediate(s32(0));
+		return code.size() - sizeof(s32);
+	}
+
+	void patch(std::size_t displacement_at, std::size_t target)
+	{
+		auto displacement = s32(
+			s64(target) - s64(displacement_at + sizeof(s32)));
+		std::memcpy(&code[displacement_at], &displacement, sizeof(s32));
+	}
+};
+
+//! rbx points to the JitContext, so its fields are addressed as [rbx+disp8].
+constexpr u8 context_field(std::size_t offset)
+{
+	return u8(offset);
+}
+
+constexpr u8 stack_raw_field = context_field(offsetof(JitContext, stack_raw)),
+			 stack_offset_field
+	= context_field(offsetof(JitContext, stack_offset)),
+			 locals_field  = context_field(offsetof(JitContext, locals)),
+			 targets_field = context_field(offsetof(JitContext, native_targets)),
+			 flag_field    = context_field(offsetof(JitContext, compare_flag));
+
+//! Displacement of the stack slot 'bytes' below the stack top.
+constexpr u8 below_top(std::size_t bytes)
+{
+	return u8(-s8(bytes));
+}
+
+[[nodiscard]] std::size_t stack_size_of(DataType type)
+{
+	return type == DataType::i64 || type == DataType::f64 ? 8 : 4;
+}
+
+class NativeCompiler
+{
+	const Script& _script;
+	const Form&   _form;
+	Assembler     _asm;
+
+	//! Native offset of each block offset, plus one for the exit code.
+	std::vector<std::size_t> _offsets;
+
+	struct Fixup
+	{
+		std::size_t displacement, target_block;
+	};
+	std::vector<Fixup> _fixups;
+
+	[[nodiscard]] std::size_t exit_block() const;
+
+	void load_stack_top();
+
+	//! mov rcx, [rbx+locals]
+	void load_locals();
+	void adjust_stack(s32 bytes);
+	void jump_to(std::initializer_list<u8> opcode, std::size_t target_block);
+
+	//! Calls 'helper' with the context and the block offset of the
+	//! instruction, leaving its result in eax.
+	template<class R>
+	void call_helper(R (*helper)(JitContext*, u32), std::size_t offset);
+
+	//! @returns the displacement of the local 'reference' refers to from the
+	//! first local, or nullopt when it refers to an element of an array.
+	[[nodiscard]] std::optional<s32> local_displacement(Block reference) const;
+
+	void emit_push(const Constant& constant);
+	void emit_push_local(s32 displacement, DataType type);
+	void emit_pop_local(s32 displacement, DataType type);
+	[[nodiscard]] bool emit_arithmetic(Instr opcode, DataType type);
+	[[nodiscard]] bool emit_compare(CompFunc func, DataType type);
+	void               emit_interpreted(std::size_t offset);
+
+	[[nodiscard]] bool compile_instruction(std::size_t offset);
+
+	public:
+	NativeCompiler(const Script& script, const Form& form);
+
+	std::shared_ptr<const NativeCode> operator()();
+};
+
+NativeCompiler::NativeCompiler(const Script& script, const Form& form) :
+	_script{script},
+	_form{form},
+	_offsets(script.data.size() + 1)
+{}
+
+std::size_t NativeCompiler::exit_block() const
+{
+	return _script.data.size();
+}
+
+void NativeCompiler::load_stack_top()
+{
+	// mov rsi, [rbx+stack_offset]; mov rax, [rsi]
+	_asm.emit({0x48, 0x8B, 0x73, stack_offset_field, 0x48, 0x8B, 0x06});
+
+	// mov rdi, [rbx+stack_raw]; add rdi, rax
+	_asm.emit({0x48, 0x8B, 0x7B, stack_raw_field, 0x48, 0x01, 0xC7});
+}
+
+void NativeCompiler::load_locals()
+{
+	_asm.emit({0x48, 0x8B, 0x4B, locals_field});
+}
+
+void NativeCompiler::adjust_stack(s32 bytes)
+{
+	// add/sub qword [rsi], imm8
+	if (bytes >= 0)
+	{
+		_asm.emit({0x48, 0x83, 0x06, u8(bytes)});
+	}
+	else
+	{
+		_asm.emit({0x48, 0x83, 0x2E, u8(-bytes)});
+	}
+}
+
+void NativeCompiler::jump_to(
+	std::initializer_list<u8> opcode, std::size_t target_block)
+{
+	_fixups.push_back({_asm.jump(opcode), target_block});
+}
+
+template<class R>
+void NativeCompiler::call_helper(R (*helper)(JitContext*, u32), std::size_t offset)
+{
+	// mov rdi, rbx; mov esi, offset
+	_asm.emit({0x48, 0x89, 0xDF, 0xBE});
+	_asm.immediate(u32(offset));
+
+	// mov rax, helper; call rax
+	_asm.emit({0x48, 0xB8});
+	_asm.immediate(reinterpret_cast<u64>(helper));
+	_asm.emit({0xFF, 0xD0});
+}
+
+void NativeCompiler::emit_push(const Constant& constant)
+{
+	load_stack_top();
+
+	std::visit(
+		[&](auto v) {
+			if constexpr (sizeof(v) == 8)
+			{
+				// mov rax, imm64; mov [rdi], rax
+				_asm.emit({0x48, 0xB8});
+				_asm.immediate(v);
+				_asm.emit({0x48, 0x89, 0x07});
+			}
+			else
+			{
+				// mov dword [rdi], imm32
+				_asm.emit({0xC7, 0x07});
+				_asm.immediate(v);
+			}
+
+			adjust_stack(sizeof(v));
+		},
+		constant);
+}
+
+std::optional<s32> NativeCompiler::local_displacement(Block reference) const
+{
+	// Same as VM::local_id_from_reference()
+	auto id = reference & 0x00FFFFFFu;
+	if (VarType(reference >> 24u) == VarType::array
+		|| id >= _form.vari.definitions.size())
+	{
+		return std::nullopt;
+	}
+
+	auto local_id = s64(_form.vari.definitions[id].unknown) - 1;
+	if (local_id < 0 || std::size_t(local_id) >= _script.local_count)
+	{
+		return std::nullopt;
+	}
+
+	return s32(local_id * s64(Variable::stack_variable_size));
+}
+
+void NativeCompiler::emit_push_local(s32 displacement, DataType type)
+{
+	load_stack_top();
+	load_locals();
+
+	if (type == DataType::var)
+	{
+		// The whole variable: mov rax, [rcx+disp]; mov [rdi], rax;
+		// mov al, [rcx+disp+8]; mov [rdi+8], al
+		_asm.emit({0x48, 0x8B, 0x81});
+		_asm.immediate(displacement);
+		_asm.emit({0x48, 0x89, 0x07, 0x8A, 0x81});
+		_asm.immediate(s32(displacement + sizeof(s64)));
+		_asm.emit({0x88, 0x47, u8(sizeof(s64))});
+		adjust_stack(s32(Variable::stack_variable_size));
+		return;
+	}
+
+	// Only the value, the tag being known: mov eax, [rcx+disp]; mov [rdi], eax
+	auto size = stack_size_of(type);
+	if (size == 8)
+	{
+		_asm.emit({0x48});
+	}
+	_asm.emit({0x8B, 0x81});
+	_asm.immediate(displacement);
+
+	if (size == 8)
+	{
+		_asm.emit({0x48});
+	}
+	_asm.emit({0x89, 0x07});
+	adjust_stack(s32(size));
+}
+
+void NativeCompiler::emit_pop_local(s32 displacement, DataType type)
+{
+	auto size = stack_size_of(type);
+
+	load_stack_top();
+	load_locals();
+
+	// mov eax, [top-size]; mov [rcx+disp], eax
+	if (size == 8)
+	{
+		_asm.emit({0x48});
+	}
+	_asm.emit({0x8B, 0x47, below_top(size)});
+
+	if (size == 8)
+	{
+		_asm.emit({0x48});
+	}
+	_asm.emit({0x89, 0x81});
+	_asm.immediate(displacement);
+
+	// Like VM::push_stack_variable(), the padding is left as is:
+	// mov byte [rcx+disp+8], tag
+	_asm.emit({0xC6, 0x81});
+	_asm.immediate(s32(displacement + sizeof(s64)));
+	_asm.emit({u8(type)});
+
+	adjust_stack(-s32(size));
+}
+
+bool NativeCompiler::emit_arithmetic(Instr opcode, DataType type)
+{
+	auto size = stack_size_of(type);
+	auto lhs = below_top(2 * size), rhs = below_top(size);
+
+	if (type == DataType::f64)
+	{
+		u8 sse_op;
+		switch (opcode)
+		{
+		case Instr::opadd: sse_op = 0x58; break;
+		case Instr::opsub: sse_op = 0x5C; break;
+		case Instr::opmul: sse_op = 0x59; break;
+		case Instr::opdiv: sse_op = 0x5E; break;
+		default: return false;
+		}
+
+		// movsd xmm0, [lhs]; <op>sd xmm0, [rhs]; movsd [lhs], xmm0
+		load_stack_top();
+		_asm.emit({0xF2, 0x0F, 0x10, 0x47, lhs});
+		_asm.emit({0xF2, 0x0F, sse_op, 0x47, rhs});
+		_asm.emit({0xF2, 0x0F, 0x11, 0x47, lhs});
+	}
+	else if (type == DataType::i32 || type == DataType::i64)
+	{
+		if (opcode != Instr::opadd && opcode != Instr::opsub
+			&& opcode != Instr::opmul)
+		{
+			return false;
+		}
+
+		load_stack_top();
+
+		auto rex = [&] {
+			if (type == DataType::i64)
+			{
+				_asm.emit({0x48});
+			}
+		};
+
+		// mov eax, [lhs]
+		rex();
+		_asm.emit({0x8B, 0x47, lhs});
+
+		// add/sub/imul eax, [rhs]
+		rex();
+		switch (opcode)
+		{
+		case Instr::opadd: _asm.emit({0x03, 0x47, rhs}); break;
+		case Instr::opsub: _asm.emit({0x2B, 0x47, rhs}); break;
+		default: _asm.emit({0x0F, 0xAF, 0x47, rhs}); break;
+		}
+
+		// mov [lhs], eax
+		rex();
+		_asm.emit({0x89, 0x47, lhs});
+	}
+	else
+	{
+		return false;
+	}
+
+	adjust_stack(-s32(size));
+	return true;
+}
+
+bool NativeCompiler::emit_compare(CompFunc func, DataType type)
+{
+	auto size = stack_size_of(type);
+	auto lhs = below_top(2 * size), rhs = below_top(size);
+
+	// setcc al
+	auto set = [&](u8 condition) { _asm.emit({0x0F, condition, 0xC0}); };
+
+	if (type == DataType::f64)
+	{
+		// Unordered comparisons (NaN) set ZF, PF and CF, so only 'above'
+		// conditions and explicit parity checks give C++ semantics
+		auto compare = [&](u8 first, u8 second) {
+			// movsd xmm0, [first]; ucomisd xmm0, [second]
+			_asm.emit({0xF2, 0x0F, 0x10, 0x47, first});
+			_asm.emit({0x66, 0x0F, 0x2E, 0x47, second});
+		};
+
+		load_stack_top();
+
+		switch (func)
+		{
+		case CompFunc::lt: compare(rhs, lhs); set(0x97); break;
+		case CompFunc::lte: compare(rhs, lhs); set(0x93); break;
+		case CompFunc::gt: compare(lhs, rhs); set(0x97); break;
+		case CompFunc::gte: compare(lhs, rhs); set(0x93); break;
+
+		// sete al; setnp cl; and al, cl
+		case CompFunc::eq:
+			compare(lhs, rhs);
+			set(0x94);
+			_asm.emit({0x0F, 0x9B, 0xC1, 0x20, 0xC8});
+			break;
+
+		// setne al; setp cl; or al, cl
+		case CompFunc::neq:
+			compare(lhs, rhs);
+			set(0x95);
+			_asm.emit({0x0F, 0x9A, 0xC1, 0x08, 0xC8});
+			break;
+
+		default: return false;
+		}
+	}
+	else if (type == DataType::i32 || type == DataType::i64)
+	{
+		u8 condition;
+		switch (func)
+		{
+		case CompFunc::lt: condition = 0x9C; break;
+		case CompFunc::lte: condition = 0x9E; break;
+		case CompFunc::eq: condition = 0x94; break;
+		case CompFunc::neq: condition = 0x95; break;
+		case CompFunc::gte: condition = 0x9D; break;
+		case CompFunc::gt: condition = 0x9F; break;
+		default: return false;
+		}
+
+		load_stack_top();
+
+		// mov eax, [lhs]; cmp eax, [rhs]
+		if (type == DataType::i64)
+		{
+			_asm.emit({0x48, 0x8B, 0x47, lhs, 0x48, 0x3B, 0x47, rhs});
+		}
+		else
+		{
+			_asm.emit({0x8B, 0x47, lhs, 0x3B, 0x47, rhs});
+		}
+
+		set(condition);
+	}
+	else
+	{
+		return false;
+	}
+
+	// mov [rbx+compare_flag], al
+	_asm.emit({0x88, 0x43, flag_field});
+	adjust_stack(-s32(2 * size));
+	return true;
+}
+
+void NativeCompiler::emit_interpreted(std::size_t offset)
+{
+	call_helper(&VM::jit_step, offset);
+
+	// The script returned, or the VM threw: test al, al; jnz exit
+	_asm.emit({0x84, 0xC0});
+	jump_to({0x0F, 0x85}, exit_block());
+}
+
+bool NativeCompiler::compile_instruction(std::size_t offset)
+{
+	const Block* block  = &_script.data[offset];
+	const auto   opcode = instr_opcode(*block);
+	const auto   t1     = instr_t1(*block);
+	const auto   t2     = instr_t2(*block);
+	const auto   size   = instruction_size(block);
+
+	auto is_native_type = [](DataType type) {
+		return type == DataType::i32 || type == DataType::i64
+			|| type == DataType::f32 || type == DataType::f64;
+	};
+
+	switch (opcode)
+	{
+	case Instr::oppushi16:
+	case Instr::oppushcst:
+	{
+		InstructionList::Instruction instruction{{block, block + size}};
+		if (auto constant = constant_of(instruction))
+		{
+			emit_push(*constant);
+			return true;
+		}
+
+		break;
+	}
+
+	case Instr::opadd:
+	case Instr::opsub:
+	case Instr::opmul:
+	case Instr::opdiv:
+		if (t1 == t2 && emit_arithmetic(opcode, t1))
+		{
+			return true;
+		}
+
+		break;
+
+	case Instr::opcmp:
+		if (t1 == t2 && emit_compare(CompFunc((*block >> 8u) & 0xFFu), t1))
+		{
+			return true;
+		}
+
+		break;
+
+	case Instr::opconv:
+		// Identity conversions are left behind by type inference
+		if (t1 == t2 && is_native_type(t1))
+		{
+			return true;
+		}
+
+		if (t1 == DataType::i32 && t2 == DataType::f64)
+		{
+			// cvtsi2sd xmm0, dword [top-4]; movsd [top-4], xmm0
+			load_stack_top();
+			_asm.emit({0xF2, 0x0F, 0x2A, 0x47, below_top(4)});
+			_asm.emit({0xF2, 0x0F, 0x11, 0x47, below_top(4)});
+			adjust_stack(4);
+			return true;
+		}
+
+		break;
+
+	case Instr::opdup:
+		if (is_native_type(t1) && (*block & 0xFFu) == 0)
+		{
+			auto bytes = stack_size_of(t1);
+
+			// mov eax, [top-size]; mov [top], eax
+			load_stack_top();
+			if (bytes == 8)
+			{
+				_asm.emit({0x48, 0x8B, 0x47, below_top(bytes), 0x48, 0x89, 0x07});
+			}
+			else
+			{
+				_asm.emit({0x8B, 0x47, below_top(bytes), 0x89, 0x07});
+			}
+			adjust_stack(s32(bytes));
+			return true;
+		}
+
+		break;
+
+	case Instr::oppopz:
+		if (is_native_type(t1))
+		{
+			// mov rsi, [rbx+stack_offset]
+			_asm.emit({0x48, 0x8B, 0x73, stack_offset_field});
+			adjust_stack(-s32(stack_size_of(t1)));
+			return true;
+		}
+
+		break;
+
+	case Instr::opb:
+	case Instr::opbt:
+	case Instr::opbf:
+	{
+		auto target = s64(offset) + branch_offset(*block);
+		if (target < 0 || std::size_t(target) > _script.data.size())
+		{
+			return false;
+		}
+
+		if (opcode == Instr::opb)
+		{
+			jump_to({0xE9}, std::size_t(target));
+			return true;
+		}
+
+		// cmp byte [rbx+compare_flag], 0; jne/je target
+		_asm.emit({0x80, 0x7B, flag_field, 0x00});
+		jump_to(
+			{0x0F, u8(opcode == Instr::opbt ? 0x85 : 0x84)},
+			std::size_t(target));
+		return true;
+	}
+
+	case Instr::oppushloc:
+		if (t1 == DataType::var || is_native_type(t1))
+		{
+			if (auto displacement = local_displacement(block[1]))
+			{
+				emit_push_local(*displacement, t1);
+				return true;
+			}
+		}
+
+		break;
+
+	case Instr::oppop:
+		// A number written to a local, which needs no heap bookkeeping
+		if (InstType(s16(*block & 0xFFFFu)) == InstType::local
+			&& t1 == DataType::var && is_native_type(t2))
+		{
+			if (auto displacement = local_displacement(block[1]))
+			{
+				emit_pop_local(*displacement, t2);
+				return true;
+			}
+		}
+
+		break;
+
+	case Instr::opswitch:
+	{
+		// The helper returns the target block offset, exit on errors
+		call_helper(&VM::jit_switch_target, offset);
+
+		// mov rcx, [rbx+native_targets]; jmp [rcx+rax*8]
+		_asm.emit({0x48, 0x8B, 0x4B, targets_field, 0xFF, 0x24, 0xC1});
+		return true;
+	}
+
+	// Not implemented by the interpreter either
+	case Instr::oprem:
+	case Instr::opmod:
+	case Instr::opneg:
+	case Instr::opnot:
+	case Instr::opexit:
+	case Instr::oppushenv:
+	case Instr::oppopenv:
+	case Instr::opbreak: return false;
+
+	default: break;
+	}
+
+	switch (opcode)
+	{
+	case Instr::opconv:
+	case Instr::opmul:
+	case Instr::opdiv:
+	case Instr::opadd:
+	case Instr::opsub:
+	case Instr::opand:
+	case Instr::opor:
+	case Instr::opxor:
+	case Instr::opshl:
+	case Instr::opshr:
+	case Instr::opcmp:
+	case Instr::oppop:
+	case Instr::opdup:
+	case Instr::opret:
+	case Instr::oppopz:
+	case Instr::oppushcst:
+	case Instr::oppushglb:
+	case Instr::oppushloc:
+	case Instr::oppushspc:
+	case Instr::oppushi16:
+	case Instr::opcall: emit_interpreted(offset); return true;
+
+	default: return false;
+	}
+}
+
+std::shared_ptr<const NativeCode> NativeCompiler::operator()()
+{
+	const auto& data = _script.data;
+
+	// push rbx; mov rbx, rdi
+	_asm.emit({0x53, 0x48, 0x89, 0xFB});
+
+	std::vector<bool> starts(data.size() + 1);
+
+	// Each step must land on the start of the next instruction. Instructions
+	// with operands other than constants (pushloc, pop, call...) go through
+	// jit_step(), which checks that the interpreter read as many blocks as
+	// instruction_size() skips here.
+	for (std::size_t offset = 0; offset < data.size();)
+	{
+		auto size = instruction_size(&data[offset]);
+		if (offset + size > data.size())
+		{
+			return nullptr;
+		}
+
+		starts[offset]   = true;
+		_offsets[offset] = _asm.code.size();
+
+		if (!compile_instruction(offset))
+		{
+			return nullptr;
+		}
+
+		offset += size;
+	}
+
+	// Falling through the end of the script returns like jumping there does
+	auto exit          = _asm.code.size();
+	_offsets.back()    = exit;
+	starts.back()      = true;
+
+	// pop rbx; ret
+	_asm.emit({0x5B, 0xC3});
+
+	for (std::size_t offset = 0; offset < data.size(); ++offset)
+	{
+		if (!starts[offset])
+		{
+			_offsets[offset] = exit;
+		}
+	}
+
+	for (auto& fixup : _fixups)
+	{
+		// Branching to the middle of an instruction
+		if (!starts[fixup.target_block])
+		{
+			return nullptr;
+		}
+
+		_asm.patch(fixup.displacement, _offsets[fixup.target_block]);
+	}
+
+	return std::make_shared<const NativeCode>(_asm.code, _offsets);
+}
+} // namespace
+
+std::shared_ptr<const NativeCode>
+compile_native(const Script& script, const Form& form)
+{
+	auto code = NativeCompiler{script, form}();
+
+	if constexpr (check(debug::verbose_postprocess))
+	{
+		if (code != nullptr)
+		{
+			fmt::print(
+				"JIT: compiled '{}' ({} blocks -> {} bytes)\n",
+				script.name,
+				script.data.size(),
+				code->size());
+		}
+		else
+		{
+			fmt::print(
+				"JIT: '{}' is not supported, keeping it interpreted\n",
+				script.name);
+		}
+	}
+
+	return code;
+}
+
+#else
+
+std::shared_ptr<const NativeCode> compile_native(const Script&, const Form&)
+{
+	return nullptr;
+}
+
+#endif
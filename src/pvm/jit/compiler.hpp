@@ -0,0 +1,24 @@
+#pragma once
+
+#include "pvm/jit/nativecode.hpp"
+#include "pvm/unpack/chunk/code.hpp"
+#include "pvm/unpack/chunk/form.hpp"
+#include <memory>
+
+//! Compiles 'script' of 'form' to x86-64 machine code by stitching together a
+//! template per instruction. Templates work on the MainStack directly, so that
+//! native code and the interpreter share the same stack and frame layout.
+//! Compiled inline are:
+//! - constants, dup and popz of numeric values;
+//! - add, sub, mul and cmp with both operands i32, i64 or f64, div of f64,
+//!   and conv.i32.f64;
+//! - reads of locals, typed or var, and writes of a numeric value to a local;
+//! - branches, with switches looked up through VM::jit_switch_target.
+//! Other instructions (var arithmetic, globals, instance variables, arrays,
+//! calls and returns) call back into the interpreter (see VM::jit_step), so
+//! only scripts retyped by infer_types() run mostly native.
+//! @returns nullptr when the script uses an instruction the interpreter does
+//! not support, or when the host is not x86-64. The script should then be
+//! interpreted.
+std::shared_ptr<const NativeCode>
+compile_native(const Script& script, const Form& form);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+
+class VM;
+struct Script;
+
+//! State shared between native code and the VM while running a script. Native
+//! code keeps a pointer to it in rbx.
+struct JitContext
+{
+	VM*           vm;
+	const Script* script;
+
+	//! MainStack::raw and MainStack::offset of the VM.
+	char*        stack_raw;
+	std::size_t* stack_offset;
+
+	//! Address of the first local of the running frame.
+	char* locals;
+
+	//! Native address of each block offset, used for switches.
+	const void* const* native_targets;
+
+	bool compare_flag;
+
+	//! Exception thrown by the VM while running native code, which cannot
+	//! unwind through it.
+	std::exception_ptr error;
+};
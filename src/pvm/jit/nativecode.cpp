@@ -0,0 +1,58 @@
+#include "pvm/jit/nativecode.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+
+NativeCode::NativeCode(
+	const std::vector<u8>& code, const std::vector<std::size_t>& offsets) :
+	_size{code.size()}
+{
+	_memory = mmap(
+		nullptr,
+		_size,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS,
+		-1,
+		0);
+
+	if (_memory == MAP_FAILED)
+	{
+		throw std::runtime_error{"Failed to allocate memory for native code"};
+	}
+
+	std::memcpy(_memory, code.data(), _size);
+
+	// Never leave the memory both writable and executable
+	if (mprotect(_memory, _size, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(_memory, _size);
+		throw std::runtime_error{"Failed to make native code executable"};
+	}
+
+	_targets.reserve(offsets.size());
+	for (auto offset : offsets)
+	{
+		_targets.push_back(static_cast<const u8*>(_memory) + offset);
+	}
+}
+
+NativeCode::~NativeCode()
+{
+	munmap(_memory, _size);
+}
+
+NativeCode::Entry NativeCode::entry() const
+{
+	return reinterpret_cast<Entry>(_memory);
+}
+
+const void* const* NativeCode::targets() const
+{
+	return _targets.data();
+}
+
+std::size_t NativeCode::size() const
+{
+	return _size;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include "pvm/jit/context.hpp"
+#include <vector>
+
+//! Executable machine code compiled from a script by compile_native().
+class NativeCode
+{
+	public:
+	using Entry = void (*)(JitContext*);
+
+	//! Copies 'code' to executable memory. 'offsets' holds, for each block
+	//! offset of the script plus one past the end, the offset of the
+	//! corresponding native code (or of the exit code for operand blocks).
+	NativeCode(
+		const std::vector<u8>& code, const std::vector<std::size_t>& offsets);
+	~NativeCode();
+
+	NativeCode(const NativeCode&) = delete;
+	NativeCode& operator=(const NativeCode&) = delete;
+
+	[[nodiscard]] Entry              entry() const;
+	[[nodiscard]] const void* const* targets() const;
+	[[nodiscard]] std::size_t        size() const;
+
+	private:
+	void*                    _memory;
+	std::size_t              _size;
+	std::vector<const void*> _targets;
+};
@@ -1,9 +1,17 @@
+#include "pvm/aot/library.hpp"
+#include "pvm/bc/cfg.hpp"
 #include "pvm/bc/disasm.hpp"
 #include "pvm/std/everything.hpp"
 #include "pvm/unpack/decode.hpp"
 #include "pvm/unpack/mmap.hpp"
-#include "pvm/vm/vm.hpp"
+#include "pvm/vm/coverage.hpp"
+#include "pvm/vm/profile.hpp"
+#include "pvm/vm/vmpool.hpp"
+#include <algorithm>
 #include <fmt/core.h>
+#include <fstream>
+#include <memory>
+#include <thread>
 
 int main()
 {
@@ -21,24 +29,99 @@ int main()
 
 	bind_everything(main_form.func);
 
+	// Scripts compiled ahead of time by phosphorvm-aot, if any
+	std::unique_ptr<AotLibrary> aot_library;
+	if (std::ifstream{"data.aot.so"})
+	{
+		try
+		{
+			aot_library = std::make_unique<AotLibrary>("./data.aot.so");
+			aot_library->bind(main_form);
+		}
+		catch (const std::runtime_error& e)
+		{
+			fmt::print("Not using 'data.aot.so': {}\n", e.what());
+		}
+	}
+
+	// Scripts that got hot during previous runs
+	Profile profile;
+	profile.checksum = main_form.bytecode_checksum;
+
+	if constexpr (opt::persist_profile)
+	{
+		try
+		{
+			profile = load_profile("data.win.profile", main_form);
+		}
+		catch (const std::runtime_error& e)
+		{
+			fmt::print("Not using 'data.win.profile': {}\n", e.what());
+		}
+	}
+
+	if constexpr (check(debug::disassemble))
+	{
+		write_disassembly(
+			main_form,
+			"data.win.disasm",
+			std::max(std::thread::hardware_concurrency(), 1u));
+
+		fmt::print("Wrote the disassembly to 'data.win.disasm'\n");
+	}
+
+	VMPool   pool{main_form};
+	Coverage coverage{main_form};
+
+	auto run = [&](const Script& script, auto... arguments) {
+		auto vm = pool.acquire();
+
+		if constexpr (opt::persist_profile)
+		{
+			vm->warm_up(profile);
+		}
+
+		vm->invoke(script, arguments...);
+
+		if constexpr (opt::persist_profile)
+		{
+			vm->record_profile(profile);
+		}
+
+		if constexpr (check(debug::vm_coverage))
+		{
+			vm->record_coverage(coverage);
+		}
+	};
+
 	for (auto& script : main_form.code.elements)
 	{
-		if constexpr (check(debug::disassemble))
+		if constexpr (check(debug::dump_cfg))
 		{
-			Disassembler{main_form}(script);
+			Disassembler disasm{main_form};
+			std::ofstream{script.name + ".dot"}
+				<< control_flow_graph(script).to_dot(script, &disasm);
 		}
 
 		if (script.name == "gml_Script_script_fibo")
 		{
-			VM vm{main_form};
-			vm.push_stack_variable(s32(37));
-			vm.run(script);
+			run(script, s32(37));
 		}
 
 		if (script.name == "gml_Object_object1_Create_0")
 		{
-			VM vm{main_form};
-			vm.run(script);
+			run(script);
 		}
 	}
+
+	if constexpr (opt::persist_profile)
+	{
+		save_profile(profile, "data.win.profile");
+	}
+
+	if constexpr (check(debug::vm_coverage))
+	{
+		coverage.write("data.win.coverage");
+		fmt::print("Wrote the coverage to 'data.win.coverage'\n");
+	}
 }
@@ -0,0 +1,370 @@
+#include "pvm/pack/writer.hpp"
+
+#include "pvm/bc/instruction.hpp"
+#include "pvm/unpack/decode.hpp"
+#include <cstring>
+#include <fmt/core.h>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+
+namespace
+{
+//! Reference chains store the distance to the next occurrence in 24 bits.
+constexpr u32 max_occurrence_distance = 0x00FFFFFFu;
+
+//! Which table the operand of an instruction refers to, if any.
+enum class Reference
+{
+	none,
+	variable,
+	function
+};
+
+[[nodiscard]] Reference reference_of(Block block)
+{
+	switch (instr_opcode(block))
+	{
+	case Instr::oppushcst:
+	case Instr::oppushglb:
+		return instr_t1(block) == DataType::var ? Reference::variable
+												: Reference::none;
+
+	// Typed pushloc (see infer_types) still refer to a local variable
+	case Instr::oppushloc:
+	case Instr::oppushspc:
+	case Instr::oppop: return Reference::variable;
+
+	case Instr::opcall: return Reference::function;
+
+	default: return Reference::none;
+	}
+}
+
+class Writer
+{
+	const Form& _form;
+
+	std::vector<char> _data;
+
+	//! String references to point to the name pool once it is written.
+	std::vector<std::pair<std::size_t, std::string>> _string_references;
+
+	//! File offsets of the instructions referring to each VARI and FUNC entry.
+	std::vector<std::vector<u32>> _variable_occurrences, _function_occurrences;
+
+	[[nodiscard]] u32 position() const { return u32(_data.size()); }
+
+	template<class T>
+	void write(T value)
+	{
+		_data.resize(_data.size() + sizeof(T));
+		std::memcpy(_data.data() + _data.size() - sizeof(T), &value, sizeof(T));
+	}
+
+	template<class T>
+	void patch(std::size_t position, T value)
+	{
+		std::memcpy(_data.data() + position, &value, sizeof(T));
+	}
+
+	template<class T>
+	[[nodiscard]] T read(std::size_t position) const
+	{
+		T value;
+		std::memcpy(&value, _data.data() + position, sizeof(T));
+		return value;
+	}
+
+	void write_string_reference(const std::string& value);
+
+	//! Writes a chunk header, returning the position its size is patched at.
+	[[nodiscard]] std::size_t begin_chunk(std::string_view name);
+	void                      end_chunk(std::size_t size_position);
+
+	//! Writes a List of 'count' elements through 'write_element'.
+	template<class F>
+	void write_list(std::size_t count, F write_element);
+
+	void write_scripts();
+	void write_code();
+	void write_chains(
+		std::vector<std::vector<u32>>& occurrences, std::string_view table);
+	void write_functions();
+	void write_variables();
+	void write_strings();
+
+	public:
+	explicit Writer(const Form& form);
+
+	[[nodiscard]] std::vector<char> operator()();
+};
+
+Writer::Writer(const Form& form) :
+	_form{form},
+	_variable_occurrences(form.vari.definitions.size()),
+	_function_occurrences(form.func.definitions.size())
+{}
+
+void Writer::write_string_reference(const std::string& value)
+{
+	_string_references.emplace_back(position(), value);
+	write(u32(0));
+}
+
+std::size_t Writer::begin_chunk(std::string_view name)
+{
+	_data.insert(_data.end(), name.begin(), name.end());
+
+	auto size_position = _data.size();
+	write(s32(0));
+	return size_position;
+}
+
+void Writer::end_chunk(std::size_t size_position)
+{
+	patch(size_position, s32(_data.size() - size_position - 4));
+}
+
+template<class F>
+void Writer::write_list(std::size_t count, F write_element)
+{
+	write(s32(count));
+
+	auto addresses = _data.size();
+	_data.resize(_data.size() + count * 4);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		patch(addresses + i * 4, s32(position()));
+		write_element(i);
+	}
+}
+
+void Writer::write_scripts()
+{
+	auto chunk = begin_chunk("SCPT");
+
+	auto& definitions = _form.scpt.elements;
+	write_list(definitions.size(), [&](std::size_t i) {
+		write_string_reference(definitions[i].name);
+		write(definitions[i].id);
+	});
+
+	end_chunk(chunk);
+}
+
+void Writer::write_code()
+{
+	auto  chunk   = begin_chunk("CODE");
+	auto& scripts = _form.code.elements;
+
+	// Bytecode follows the entries, which point to it relatively to their
+	// offset field (see user_reader(Script&))
+	std::vector<std::size_t> offset_positions;
+
+	write_list(scripts.size(), [&](std::size_t i) {
+		write_string_reference(scripts[i].name);
+		write(s32(scripts[i].data.size() * sizeof(Block)));
+		write(u32(0));
+		offset_positions.push_back(position());
+		write(s32(0));
+		write(u32(0));
+	});
+
+	for (std::size_t i = 0; i < scripts.size(); ++i)
+	{
+		auto& script = scripts[i];
+		auto  begin  = position();
+
+		patch(offset_positions[i], s32(begin - offset_positions[i]));
+
+		for (std::size_t offset = 0; offset < script.data.size();)
+		{
+			const Block* block = &script.data[offset];
+			auto         size  = instruction_size(block);
+
+			if (instr_opcode(*block) == Instr::opswitch)
+			{
+				throw std::runtime_error{fmt::format(
+					"Cannot write the switch at ${:08x} in '{}'",
+					offset,
+					script.name)};
+			}
+
+			if (offset + size > script.data.size())
+			{
+				throw std::runtime_error{fmt::format(
+					"Truncated instruction at ${:08x} in '{}'",
+					offset,
+					script.name)};
+			}
+
+			auto reference = reference_of(*block);
+			if (reference != Reference::none)
+			{
+				auto& occurrences = reference == Reference::variable
+					? _variable_occurrences
+					: _function_occurrences;
+
+				auto index = block[1] & 0x00FFFFFFu;
+				if (index >= occurrences.size())
+				{
+					throw std::runtime_error{fmt::format(
+						"Bad reference at ${:08x} in '{}'",
+						offset,
+						script.name)};
+				}
+
+				occurrences[index].push_back(
+					u32(begin + offset * sizeof(Block)));
+			}
+
+			offset += size;
+		}
+
+		auto bytes = reinterpret_cast<const char*>(script.data.data());
+		_data.insert(
+			_data.end(), bytes, bytes + script.data.size() * sizeof(Block));
+	}
+
+	end_chunk(chunk);
+}
+
+void Writer::write_chains(
+	std::vector<std::vector<u32>>& occurrences, std::string_view table)
+{
+	// Each occurrence points to the next one, the reference itself being
+	// restored by process_references()
+	for (std::size_t i = 0; i < occurrences.size(); ++i)
+	{
+		auto& addresses = occurrences[i];
+
+		for (std::size_t j = 0; j + 1 < addresses.size(); ++j)
+		{
+			auto distance = addresses[j + 1] - addresses[j];
+			if (distance > max_occurrence_distance)
+			{
+				throw std::runtime_error{fmt::format(
+					"{} entry #{} is referred to too far apart", table, i)};
+			}
+
+			auto operand = addresses[j] + sizeof(Block);
+			patch(
+				operand, (read<Block>(operand) & 0xFF000000u) | distance);
+		}
+	}
+}
+
+void Writer::write_functions()
+{
+	write_chains(_function_occurrences, "FUNC");
+
+	auto  chunk       = begin_chunk("FUNC");
+	auto& definitions = _form.func.definitions;
+
+	write(u32(definitions.size()));
+
+	for (std::size_t i = 0; i < definitions.size(); ++i)
+	{
+		auto& occurrences = _function_occurrences[i];
+
+		write_string_reference(definitions[i].name);
+		write(u32(occurrences.size()));
+		write(u32(occurrences.empty() ? 0 : occurrences.front()));
+	}
+
+	end_chunk(chunk);
+}
+
+void Writer::write_variables()
+{
+	write_chains(_variable_occurrences, "VARI");
+
+	auto  chunk       = begin_chunk("VARI");
+	auto& definitions = _form.vari.definitions;
+
+	// Unknown header, skipped by the loader (see Vari)
+	write(u32(definitions.size()));
+	write(u32(definitions.size()));
+	write(u32(1));
+
+	for (std::size_t i = 0; i < definitions.size(); ++i)
+	{
+		auto& occurrences = _variable_occurrences[i];
+
+		write_string_reference(definitions[i].name);
+		write(definitions[i].instance_type);
+		write(definitions[i].unknown);
+		write(u32(occurrences.size()));
+		write(u32(occurrences.empty() ? 0 : occurrences.front()));
+	}
+
+	end_chunk(chunk);
+}
+
+void Writer::write_strings()
+{
+	auto chunk = begin_chunk("STRG");
+
+	// Position of the characters of each string written so far
+	std::map<std::string, u32> pool;
+
+	auto write_string = [&](const std::string& value) {
+		write(u32(value.size()));
+		pool.emplace(value, position());
+		_data.insert(_data.end(), value.begin(), value.end());
+		_data.push_back('\0');
+	};
+
+	auto& strings = _form.strg.elements;
+	write_list(strings.size(), [&](std::size_t i) {
+		write_string(strings[i].value);
+	});
+
+	// Names are not part of the STRG list, but live alongside its strings
+	for (auto& [reference, value] : _string_references)
+	{
+		if (pool.find(value) == pool.end())
+		{
+			write_string(value);
+		}
+
+		patch(reference, u32(pool.at(value)));
+	}
+
+	end_chunk(chunk);
+}
+
+std::vector<char> Writer::operator()()
+{
+	auto form_chunk = begin_chunk("FORM");
+
+	write_scripts();
+	write_code();
+	write_functions();
+	write_variables();
+	write_strings();
+
+	end_chunk(form_chunk);
+
+	return std::move(_data);
+}
+} // namespace
+
+std::vector<char> pack_form(const Form& form)
+{
+	return Writer{form}();
+}
+
+void write_form(const Form& form, const std::string& path)
+{
+	auto data = pack_form(form);
+
+	std::ofstream file{path, std::ios::binary};
+	if (!file.write(data.data(), std::streamsize(data.size())))
+	{
+		throw std::runtime_error{fmt::format("Failed to write '{}'", path)};
+	}
+}
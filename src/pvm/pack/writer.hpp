@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct Form;
+
+//! Packs the SCPT, FUNC, VARI, CODE and STRG chunks of 'form' into a data.win
+//! image, which is the least the loader needs to run its scripts.
+//!
+//! 'form' may have been loaded, finalized, or built by assemble(): variable
+//! and function references are read as VARI and FUNC indices, and turned back
+//! into the occurrence chains process_references() walks. Bytecode rewritten
+//! in a way the loader cannot read back, such as switch instructions, is
+//! rejected.
+//! @throws std::runtime_error when 'form' cannot be represented.
+[[nodiscard]] std::vector<char> pack_form(const Form& form);
+
+//! Writes pack_form(form) to the file at 'path'.
+//! @throws std::runtime_error when 'form' cannot be represented, or when the
+//! file cannot be written.
+void write_form(const Form& form, const std::string& path);
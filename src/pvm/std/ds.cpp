@@ -0,0 +1,840 @@
+#include "pvm/std/ds.hpp"
+#include "pvm/vm/gridkernels.hpp"
+#include "pvm/vm/vm.hpp"
+
+#include <algorithm>
+#include <array>
+#include <fmt/core.h>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+//! Pops the 'N' arguments of the builtin 'name', in order.
+//! @throws std::runtime_error when it was passed another amount.
+template<std::size_t N>
+std::array<Variable, N> pop_arguments(VM& vm, const char* name)
+{
+	if (vm.argument_count() != N)
+	{
+		throw std::runtime_error{fmt::format(
+			"{} takes {} arguments, not {}", name, N, vm.argument_count())};
+	}
+
+	std::array<Variable, N> arguments;
+	for (auto i = N; i-- != 0;)
+	{
+		arguments[i] = vm.pop_variable();
+	}
+
+	return arguments;
+}
+
+//! Pops the values passed to the builtin 'name' after the index of a
+//! container, e.g. ds_list_add(list, values...), and returns them in order.
+//! The index is left on the stack.
+//! @throws std::runtime_error when no value was passed.
+std::vector<Variable> pop_values(VM& vm, const char* name)
+{
+	if (vm.argument_count() < 2)
+	{
+		throw std::runtime_error{fmt::format(
+			"{} takes at least 2 arguments, not {}",
+			name,
+			vm.argument_count())};
+	}
+
+	std::vector<Variable> values(vm.argument_count() - 1);
+	for (auto i = values.size(); i-- != 0;)
+	{
+		values[i] = vm.pop_variable();
+	}
+
+	return values;
+}
+
+//! Returns the number 'argument' holds, which is one of 'what'.
+//! @throws std::runtime_error when it is not a number.
+f64 number_of(const Variable& argument, const char* what)
+{
+	auto number = as_number(argument);
+	if (!number)
+	{
+		throw std::runtime_error{fmt::format("{} must be numbers", what)};
+	}
+
+	return *number;
+}
+
+//! Returns the index of a container or the position in a list 'argument'
+//! holds.
+//! @throws std::runtime_error when it is not a number.
+s32 index_of(const Variable& argument)
+{
+	return s32(number_of(argument, "Indices"));
+}
+
+//! Same as index_of(), for the position in a list of 'size' elements.
+//! @throws std::runtime_error when it is out of bounds.
+std::size_t position_of(const Variable& argument, std::size_t size)
+{
+	auto position = index_of(argument);
+	if (position < 0 || std::size_t(position) >= size)
+	{
+		throw std::runtime_error{
+			fmt::format("List position {} is out of bounds", position)};
+	}
+
+	return std::size_t(position);
+}
+
+//! Whether 'a' and 'b' are equal, as compared by GML.
+bool equal(const Variable& a, const Variable& b)
+{
+	auto number_a = as_number(a), number_b = as_number(b);
+	if (number_a && number_b)
+	{
+		return *number_a == *number_b;
+	}
+
+	auto* string_a = std::get_if<StringReference>(&a.data);
+	auto* string_b = std::get_if<StringReference>(&b.data);
+	if (string_a != nullptr && string_b != nullptr)
+	{
+		return string_a->string->view() == string_b->string->view();
+	}
+
+	auto* array_a = std::get_if<ArrayReference>(&a.data);
+	auto* array_b = std::get_if<ArrayReference>(&b.data);
+	return array_a != nullptr && array_b != nullptr
+		&& array_a->array == array_b->array;
+}
+
+//! Pushes 'value' as the result of a lookup, or 0 if nothing was found.
+void push_found(VM& vm, const Variable* value)
+{
+	if (value != nullptr)
+	{
+		vm.push_variable(*value);
+	}
+	else
+	{
+		vm.push_stack_variable(s32(0));
+	}
+}
+
+//! Returns a copy of 'value' to store into a container.
+Variable stored(const Variable& value)
+{
+	DataStructures::share(value);
+	return value;
+}
+
+//! Returns the width or the height of a grid 'argument' holds.
+//! @throws std::runtime_error when it is not a number, or is negative.
+std::size_t grid_size_of(const Variable& argument)
+{
+	auto size = number_of(argument, "Grid sizes");
+	if (!(size >= 0.0))
+	{
+		throw std::runtime_error{"Grid sizes must not be negative"};
+	}
+
+	return std::size_t(size);
+}
+
+DsGrid& grid_of(VM& vm, const Variable& index)
+{
+	return vm.data_structures().grids[index_of(index)];
+}
+
+f64 coordinate_of(const Variable& argument)
+{
+	return number_of(argument, "Grid coordinates");
+}
+
+//! Kernel writing spans of cells, e.g. GridKernels::add.
+using GridWrite = void (*)(f64* data, std::size_t count, f64 value);
+
+enum class GridReduction
+{
+	sum,
+	max,
+	min,
+	mean
+};
+
+//! Reduces the spans of cells 'for_each_span' calls its argument on.
+//! @returns the result, or 0 when there are no cells.
+template<class F>
+f64 reduce(GridReduction reduction, F for_each_span)
+{
+	auto&       kernels = grid_kernels();
+	f64         result  = 0.0;
+	std::size_t cells   = 0;
+
+	for_each_span([&](const f64* data, std::size_t count) {
+		switch (reduction)
+		{
+		case GridReduction::sum:
+		case GridReduction::mean: result += kernels.sum(data, count); break;
+
+		case GridReduction::max:
+		{
+			auto max = kernels.max(data, count);
+			result   = cells == 0 || max > result ? max : result;
+			break;
+		}
+
+		case GridReduction::min:
+		{
+			auto min = kernels.min(data, count);
+			result   = cells == 0 || min < result ? min : result;
+			break;
+		}
+		}
+
+		cells += count;
+	});
+
+	if (reduction == GridReduction::mean && cells != 0)
+	{
+		result /= f64(cells);
+	}
+
+	return result;
+}
+
+//! Implements ds_grid_*_region(grid, x1, y1, x2, y2, value) with 'kernel'.
+void write_region(VM& vm, const char* name, GridWrite kernel)
+{
+	auto [grid, x1, y1, x2, y2, value] = pop_arguments<6>(vm, name);
+	auto number = number_of(value, "Grid cells");
+
+	grid_of(vm, grid).for_each_region_span(
+		coordinate_of(x1),
+		coordinate_of(y1),
+		coordinate_of(x2),
+		coordinate_of(y2),
+		[&](f64* data, std::size_t count) { kernel(data, count, number); });
+	vm.push_stack_variable(s32(0));
+}
+
+//! Implements ds_grid_get_*(grid, x1, y1, x2, y2) with 'reduction'.
+void read_region(VM& vm, const char* name, GridReduction reduction)
+{
+	auto [grid_index, x1, y1, x2, y2] = pop_arguments<5>(vm, name);
+	auto& grid = grid_of(vm, grid_index);
+
+	f64 left = coordinate_of(x1), top = coordinate_of(y1);
+	f64 right = coordinate_of(x2), bottom = coordinate_of(y2);
+
+	vm.push_stack_variable(reduce(reduction, [&](auto f) {
+		grid.for_each_region_span(left, top, right, bottom, f);
+	}));
+}
+
+//! Implements ds_grid_*_disk(grid, x, y, radius, value) with 'kernel'.
+void write_disk(VM& vm, const char* name, GridWrite kernel)
+{
+	auto [grid, x, y, radius, value] = pop_arguments<5>(vm, name);
+	auto number = number_of(value, "Grid cells");
+
+	grid_of(vm, grid).for_each_disk_span(
+		coordinate_of(x),
+		coordinate_of(y),
+		number_of(radius, "Radiuses"),
+		[&](f64* data, std::size_t count) { kernel(data, count, number); });
+	vm.push_stack_variable(s32(0));
+}
+
+//! Implements ds_grid_get_disk_*(grid, x, y, radius) with 'reduction'.
+void read_disk(VM& vm, const char* name, GridReduction reduction)
+{
+	auto [grid_index, x, y, radius] = pop_arguments<4>(vm, name);
+	auto& grid = grid_of(vm, grid_index);
+
+	f64 center_x = coordinate_of(x), center_y = coordinate_of(y);
+	f64 distance = number_of(radius, "Radiuses");
+
+	vm.push_stack_variable(reduce(reduction, [&](auto f) {
+		grid.for_each_disk_span(center_x, center_y, distance, f);
+	}));
+}
+
+//! Implements ds_grid_*(grid, x, y, value) writing a cell with 'write'.
+//! Cells out of the grid are ignored.
+template<class F>
+void write_cell(VM& vm, const char* name, F write)
+{
+	auto [grid, x, y, value] = pop_arguments<4>(vm, name);
+	auto number = number_of(value, "Grid cells");
+
+	if (auto* cell = grid_of(vm, grid).cell(coordinate_of(x), coordinate_of(y)))
+	{
+		write(*cell, number);
+	}
+
+	vm.push_stack_variable(s32(0));
+}
+} // namespace
+
+void ds_map_create(VM& vm)
+{
+	pop_arguments<0>(vm, __func__);
+	vm.push_stack_variable(vm.data_structures().maps.create());
+}
+
+void ds_map_destroy(VM& vm)
+{
+	auto [map] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().maps.destroy(index_of(map));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_map_add(VM& vm)
+{
+	auto [map, key, value] = pop_arguments<3>(vm, __func__);
+	auto& structures       = vm.data_structures();
+
+	bool added = structures.maps[index_of(map)].add(
+		structures.key(key), stored(value));
+	vm.push_stack_variable(s32(added));
+}
+
+void ds_map_set(VM& vm)
+{
+	auto [map, key, value] = pop_arguments<3>(vm, __func__);
+	auto& structures       = vm.data_structures();
+
+	structures.maps[index_of(map)].set(structures.key(key), stored(value));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_map_replace(VM& vm)
+{
+	ds_map_set(vm);
+}
+
+void ds_map_find_value(VM& vm)
+{
+	auto [map, key]  = pop_arguments<2>(vm, __func__);
+	auto& structures = vm.data_structures();
+	push_found(vm, structures.maps[index_of(map)].find(structures.key(key)));
+}
+
+void ds_map_exists(VM& vm)
+{
+	auto [map, key]  = pop_arguments<2>(vm, __func__);
+	auto& structures = vm.data_structures();
+
+	bool exists
+		= structures.maps[index_of(map)].find(structures.key(key)) != nullptr;
+	vm.push_stack_variable(s32(exists));
+}
+
+void ds_map_delete(VM& vm)
+{
+	auto [map, key]  = pop_arguments<2>(vm, __func__);
+	auto& structures = vm.data_structures();
+	structures.maps[index_of(map)].erase(structures.key(key));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_map_size(VM& vm)
+{
+	auto [map] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().maps[index_of(map)].size()));
+}
+
+void ds_map_clear(VM& vm)
+{
+	auto [map] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().maps[index_of(map)].clear();
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_list_create(VM& vm)
+{
+	pop_arguments<0>(vm, __func__);
+	vm.push_stack_variable(vm.data_structures().lists.create());
+}
+
+void ds_list_destroy(VM& vm)
+{
+	auto [list] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().lists.destroy(index_of(list));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_list_add(VM& vm)
+{
+	auto  values = pop_values(vm, __func__);
+	auto& list   = vm.data_structures().lists[index_of(vm.pop_variable())];
+
+	for (auto& value : values)
+	{
+		list.push_back(stored(value));
+	}
+
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_list_set(VM& vm)
+{
+	auto [list_index, position, value] = pop_arguments<3>(vm, __func__);
+	auto& list = vm.data_structures().lists[index_of(list_index)];
+
+	// Setting past the end grows the list, filling it with 0
+	auto at = index_of(position);
+	if (at < 0)
+	{
+		throw std::runtime_error{
+			fmt::format("List position {} is out of bounds", at)};
+	}
+
+	if (std::size_t(at) >= list.size())
+	{
+		list.resize(std::size_t(at) + 1, Variable{s32(0)});
+	}
+
+	list[std::size_t(at)] = stored(value);
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_list_insert(VM& vm)
+{
+	auto [list_index, position, value] = pop_arguments<3>(vm, __func__);
+	auto& list = vm.data_structures().lists[index_of(list_index)];
+
+	auto at = position_of(position, list.size() + 1);
+	list.insert(list.begin() + std::ptrdiff_t(at), stored(value));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_list_find_value(VM& vm)
+{
+	auto [list_index, position] = pop_arguments<2>(vm, __func__);
+	auto& list = vm.data_structures().lists[index_of(list_index)];
+
+	auto at = index_of(position);
+	push_found(
+		vm,
+		at >= 0 && std::size_t(at) < list.size() ? &list[std::size_t(at)]
+												 : nullptr);
+}
+
+void ds_list_find_index(VM& vm)
+{
+	auto arguments = pop_arguments<2>(vm, __func__);
+	auto& list     = vm.data_structures().lists[index_of(arguments[0])];
+
+	auto it = std::find_if(list.begin(), list.end(), [&](const Variable& v) {
+		return equal(v, arguments[1]);
+	});
+	vm.push_stack_variable(
+		it != list.end() ? s32(std::distance(list.begin(), it)) : s32(-1));
+}
+
+void ds_list_delete(VM& vm)
+{
+	auto [list_index, position] = pop_arguments<2>(vm, __func__);
+	auto& list = vm.data_structures().lists[index_of(list_index)];
+
+	auto at = position_of(position, list.size());
+	list.erase(list.begin() + std::ptrdiff_t(at));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_list_size(VM& vm)
+{
+	auto [list] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().lists[index_of(list)].size()));
+}
+
+void ds_list_clear(VM& vm)
+{
+	auto [list] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().lists[index_of(list)].clear();
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_stack_create(VM& vm)
+{
+	pop_arguments<0>(vm, __func__);
+	vm.push_stack_variable(vm.data_structures().stacks.create());
+}
+
+void ds_stack_destroy(VM& vm)
+{
+	auto [stack] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().stacks.destroy(index_of(stack));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_stack_push(VM& vm)
+{
+	auto  values = pop_values(vm, __func__);
+	auto& stack  = vm.data_structures().stacks[index_of(vm.pop_variable())];
+
+	for (auto& value : values)
+	{
+		stack.push_back(stored(value));
+	}
+
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_stack_pop(VM& vm)
+{
+	auto [stack_index] = pop_arguments<1>(vm, __func__);
+	auto& stack = vm.data_structures().stacks[index_of(stack_index)];
+
+	if (stack.empty())
+	{
+		push_found(vm, nullptr);
+		return;
+	}
+
+	auto value = stack.back();
+	stack.pop_back();
+	vm.push_variable(value);
+}
+
+void ds_stack_top(VM& vm)
+{
+	auto [stack_index] = pop_arguments<1>(vm, __func__);
+	auto& stack = vm.data_structures().stacks[index_of(stack_index)];
+	push_found(vm, stack.empty() ? nullptr : &stack.back());
+}
+
+void ds_stack_size(VM& vm)
+{
+	auto [stack] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().stacks[index_of(stack)].size()));
+}
+
+void ds_stack_empty(VM& vm)
+{
+	auto [stack] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().stacks[index_of(stack)].empty()));
+}
+
+void ds_stack_clear(VM& vm)
+{
+	auto [stack] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().stacks[index_of(stack)].clear();
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_queue_create(VM& vm)
+{
+	pop_arguments<0>(vm, __func__);
+	vm.push_stack_variable(vm.data_structures().queues.create());
+}
+
+void ds_queue_destroy(VM& vm)
+{
+	auto [queue] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().queues.destroy(index_of(queue));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_queue_enqueue(VM& vm)
+{
+	auto  values = pop_values(vm, __func__);
+	auto& queue  = vm.data_structures().queues[index_of(vm.pop_variable())];
+
+	for (auto& value : values)
+	{
+		queue.push_back(stored(value));
+	}
+
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_queue_dequeue(VM& vm)
+{
+	auto [queue_index] = pop_arguments<1>(vm, __func__);
+	auto& queue = vm.data_structures().queues[index_of(queue_index)];
+
+	if (queue.empty())
+	{
+		push_found(vm, nullptr);
+		return;
+	}
+
+	auto value = queue.front();
+	queue.pop_front();
+	vm.push_variable(value);
+}
+
+void ds_queue_head(VM& vm)
+{
+	auto [queue_index] = pop_arguments<1>(vm, __func__);
+	auto& queue = vm.data_structures().queues[index_of(queue_index)];
+	push_found(vm, queue.empty() ? nullptr : &queue.front());
+}
+
+void ds_queue_tail(VM& vm)
+{
+	auto [queue_index] = pop_arguments<1>(vm, __func__);
+	auto& queue = vm.data_structures().queues[index_of(queue_index)];
+	push_found(vm, queue.empty() ? nullptr : &queue.back());
+}
+
+void ds_queue_size(VM& vm)
+{
+	auto [queue] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().queues[index_of(queue)].size()));
+}
+
+void ds_queue_empty(VM& vm)
+{
+	auto [queue] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().queues[index_of(queue)].empty()));
+}
+
+void ds_queue_clear(VM& vm)
+{
+	auto [queue] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().queues[index_of(queue)].clear();
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_priority_create(VM& vm)
+{
+	pop_arguments<0>(vm, __func__);
+	vm.push_stack_variable(vm.data_structures().priorities.create());
+}
+
+void ds_priority_destroy(VM& vm)
+{
+	auto [priority] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().priorities.destroy(index_of(priority));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_priority_add(VM& vm)
+{
+	auto [priority_index, value, priority]
+		= pop_arguments<3>(vm, __func__);
+
+	vm.data_structures().priorities[index_of(priority_index)].add(
+		stored(value), number_of(priority, "Priorities"));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_priority_delete_max(VM& vm)
+{
+	auto [priority_index] = pop_arguments<1>(vm, __func__);
+	auto& priority = vm.data_structures().priorities[index_of(priority_index)];
+
+	if (priority.size() == 0)
+	{
+		push_found(vm, nullptr);
+		return;
+	}
+
+	vm.push_variable(priority.delete_max());
+}
+
+void ds_priority_delete_min(VM& vm)
+{
+	auto [priority_index] = pop_arguments<1>(vm, __func__);
+	auto& priority = vm.data_structures().priorities[index_of(priority_index)];
+
+	if (priority.size() == 0)
+	{
+		push_found(vm, nullptr);
+		return;
+	}
+
+	vm.push_variable(priority.delete_min());
+}
+
+void ds_priority_find_max(VM& vm)
+{
+	auto [priority] = pop_arguments<1>(vm, __func__);
+	push_found(
+		vm, vm.data_structures().priorities[index_of(priority)].find_max());
+}
+
+void ds_priority_find_min(VM& vm)
+{
+	auto [priority] = pop_arguments<1>(vm, __func__);
+	push_found(
+		vm, vm.data_structures().priorities[index_of(priority)].find_min());
+}
+
+void ds_priority_size(VM& vm)
+{
+	auto [priority] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().priorities[index_of(priority)].size()));
+}
+
+void ds_priority_empty(VM& vm)
+{
+	auto [priority] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(
+		s32(vm.data_structures().priorities[index_of(priority)].size() == 0));
+}
+
+void ds_priority_clear(VM& vm)
+{
+	auto [priority] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().priorities[index_of(priority)].clear();
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_grid_create(VM& vm)
+{
+	auto [width, height] = pop_arguments<2>(vm, __func__);
+	auto& grids          = vm.data_structures().grids;
+
+	auto index = grids.create();
+	grids[index].resize(grid_size_of(width), grid_size_of(height));
+	vm.push_stack_variable(index);
+}
+
+void ds_grid_destroy(VM& vm)
+{
+	auto [grid] = pop_arguments<1>(vm, __func__);
+	vm.data_structures().grids.destroy(index_of(grid));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_grid_width(VM& vm)
+{
+	auto [grid] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(s32(grid_of(vm, grid).width()));
+}
+
+void ds_grid_height(VM& vm)
+{
+	auto [grid] = pop_arguments<1>(vm, __func__);
+	vm.push_stack_variable(s32(grid_of(vm, grid).height()));
+}
+
+void ds_grid_resize(VM& vm)
+{
+	auto [grid, width, height] = pop_arguments<3>(vm, __func__);
+	grid_of(vm, grid).resize(grid_size_of(width), grid_size_of(height));
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_grid_clear(VM& vm)
+{
+	auto [grid_index, value] = pop_arguments<2>(vm, __func__);
+	auto& grid               = grid_of(vm, grid_index);
+
+	grid.for_each_region_span(
+		0.0,
+		0.0,
+		f64(grid.width()),
+		f64(grid.height()),
+		[number = number_of(value, "Grid cells")](
+			f64* data, std::size_t count) {
+			grid_kernels().fill(data, count, number);
+		});
+	vm.push_stack_variable(s32(0));
+}
+
+void ds_grid_get(VM& vm)
+{
+	auto [grid, x, y] = pop_arguments<3>(vm, __func__);
+	auto* cell = grid_of(vm, grid).cell(coordinate_of(x), coordinate_of(y));
+	vm.push_stack_variable(cell != nullptr ? *cell : 0.0);
+}
+
+void ds_grid_set(VM& vm)
+{
+	write_cell(vm, __func__, [](f64& cell, f64 value) { cell = value; });
+}
+
+void ds_grid_add(VM& vm)
+{
+	write_cell(vm, __func__, [](f64& cell, f64 value) { cell += value; });
+}
+
+void ds_grid_multiply(VM& vm)
+{
+	write_cell(vm, __func__, [](f64& cell, f64 value) { cell *= value; });
+}
+
+void ds_grid_set_region(VM& vm)
+{
+	write_region(vm, __func__, grid_kernels().fill);
+}
+
+void ds_grid_add_region(VM& vm)
+{
+	write_region(vm, __func__, grid_kernels().add);
+}
+
+void ds_grid_multiply_region(VM& vm)
+{
+	write_region(vm, __func__, grid_kernels().multiply);
+}
+
+void ds_grid_get_sum(VM& vm)
+{
+	read_region(vm, __func__, GridReduction::sum);
+}
+
+void ds_grid_get_max(VM& vm)
+{
+	read_region(vm, __func__, GridReduction::max);
+}
+
+void ds_grid_get_min(VM& vm)
+{
+	read_region(vm, __func__, GridReduction::min);
+}
+
+void ds_grid_get_mean(VM& vm)
+{
+	read_region(vm, __func__, GridReduction::mean);
+}
+
+void ds_grid_set_disk(VM& vm)
+{
+	write_disk(vm, __func__, grid_kernels().fill);
+}
+
+void ds_grid_add_disk(VM& vm)
+{
+	write_disk(vm, __func__, grid_kernels().add);
+}
+
+void ds_grid_multiply_disk(VM& vm)
+{
+	write_disk(vm, __func__, grid_kernels().multiply);
+}
+
+void ds_grid_get_disk_sum(VM& vm)
+{
+	read_disk(vm, __func__, GridReduction::sum);
+}
+
+void ds_grid_get_disk_max(VM& vm)
+{
+	read_disk(vm, __func__, GridReduction::max);
+}
+
+void ds_grid_get_disk_min(VM& vm)
+{
+	read_disk(vm, __func__, GridReduction::min);
+}
+
+void ds_grid_get_disk_mean(VM& vm)
+{
+	read_disk(vm, __func__, GridReduction::mean);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "pvm/vm/builtins/bind.hpp"
+
+// Containers referred to by index, like the ds_* functions of GameMaker (see
+// DataStructures). Lookups of missing values return 0, as there is no
+// undefined, and booleans are returned as 0 or 1 like comparisons in GML.
+// Grids only hold numbers, and ignore accesses out of their bounds.
+
+void ds_map_create(VM& vm);
+void ds_map_destroy(VM& vm);
+void ds_map_add(VM& vm);
+void ds_map_set(VM& vm);
+void ds_map_replace(VM& vm);
+void ds_map_find_value(VM& vm);
+void ds_map_exists(VM& vm);
+void ds_map_delete(VM& vm);
+void ds_map_size(VM& vm);
+void ds_map_clear(VM& vm);
+
+void ds_list_create(VM& vm);
+void ds_list_destroy(VM& vm);
+void ds_list_add(VM& vm);
+void ds_list_set(VM& vm);
+void ds_list_insert(VM& vm);
+void ds_list_find_value(VM& vm);
+void ds_list_find_index(VM& vm);
+void ds_list_delete(VM& vm);
+void ds_list_size(VM& vm);
+void ds_list_clear(VM& vm);
+
+void ds_stack_create(VM& vm);
+void ds_stack_destroy(VM& vm);
+void ds_stack_push(VM& vm);
+void ds_stack_pop(VM& vm);
+void ds_stack_top(VM& vm);
+void ds_stack_size(VM& vm);
+void ds_stack_empty(VM& vm);
+void ds_stack_clear(VM& vm);
+
+void ds_queue_create(VM& vm);
+void ds_queue_destroy(VM& vm);
+void ds_queue_enqueue(VM& vm);
+void ds_queue_dequeue(VM& vm);
+void ds_queue_head(VM& vm);
+void ds_queue_tail(VM& vm);
+void ds_queue_size(VM& vm);
+void ds_queue_empty(VM& vm);
+void ds_queue_clear(VM& vm);
+
+void ds_priority_create(VM& vm);
+void ds_priority_destroy(VM& vm);
+void ds_priority_add(VM& vm);
+void ds_priority_delete_max(VM& vm);
+void ds_priority_delete_min(VM& vm);
+void ds_priority_find_max(VM& vm);
+void ds_priority_find_min(VM& vm);
+void ds_priority_size(VM& vm);
+void ds_priority_empty(VM& vm);
+void ds_priority_clear(VM& vm);
+
+void ds_grid_create(VM& vm);
+void ds_grid_destroy(VM& vm);
+void ds_grid_width(VM& vm);
+void ds_grid_height(VM& vm);
+void ds_grid_resize(VM& vm);
+void ds_grid_clear(VM& vm);
+void ds_grid_get(VM& vm);
+void ds_grid_set(VM& vm);
+void ds_grid_add(VM& vm);
+void ds_grid_multiply(VM& vm);
+void ds_grid_set_region(VM& vm);
+void ds_grid_add_region(VM& vm);
+void ds_grid_multiply_region(VM& vm);
+void ds_grid_get_sum(VM& vm);
+void ds_grid_get_max(VM& vm);
+void ds_grid_get_min(VM& vm);
+void ds_grid_get_mean(VM& vm);
+void ds_grid_set_disk(VM& vm);
+void ds_grid_add_disk(VM& vm);
+void ds_grid_multiply_disk(VM& vm);
+void ds_grid_get_disk_sum(VM& vm);
+void ds_grid_get_disk_max(VM& vm);
+void ds_grid_get_disk_min(VM& vm);
+void ds_grid_get_disk_mean(VM& vm);
+
+inline void bind_ds(Func& func)
+{
+	bind<ds_map_create>(func, "ds_map_create");
+	bind<ds_map_destroy>(func, "ds_map_destroy");
+	bind<ds_map_add>(func, "ds_map_add");
+	bind<ds_map_set>(func, "ds_map_set");
+	bind<ds_map_replace>(func, "ds_map_replace");
+	bind<ds_map_find_value>(func, "ds_map_find_value");
+	bind<ds_map_exists>(func, "ds_map_exists");
+	bind<ds_map_delete>(func, "ds_map_delete");
+	bind<ds_map_size>(func, "ds_map_size");
+	bind<ds_map_clear>(func, "ds_map_clear");
+
+	bind<ds_list_create>(func, "ds_list_create");
+	bind<ds_list_destroy>(func, "ds_list_destroy");
+	bind<ds_list_add>(func, "ds_list_add");
+	bind<ds_list_set>(func, "ds_list_set");
+	bind<ds_list_insert>(func, "ds_list_insert");
+	bind<ds_list_find_value>(func, "ds_list_find_value");
+	bind<ds_list_find_index>(func, "ds_list_find_index");
+	bind<ds_list_delete>(func, "ds_list_delete");
+	bind<ds_list_size>(func, "ds_list_size");
+	bind<ds_list_clear>(func, "ds_list_clear");
+
+	bind<ds_stack_create>(func, "ds_stack_create");
+	bind<ds_stack_destroy>(func, "ds_stack_destroy");
+	bind<ds_stack_push>(func, "ds_stack_push");
+	bind<ds_stack_pop>(func, "ds_stack_pop");
+	bind<ds_stack_top>(func, "ds_stack_top");
+	bind<ds_stack_size>(func, "ds_stack_size");
+	bind<ds_stack_empty>(func, "ds_stack_empty");
+	bind<ds_stack_clear>(func, "ds_stack_clear");
+
+	bind<ds_queue_create>(func, "ds_queue_create");
+	bind<ds_queue_destroy>(func, "ds_queue_destroy");
+	bind<ds_queue_enqueue>(func, "ds_queue_enqueue");
+	bind<ds_queue_dequeue>(func, "ds_queue_dequeue");
+	bind<ds_queue_head>(func, "ds_queue_head");
+	bind<ds_queue_tail>(func, "ds_queue_tail");
+	bind<ds_queue_size>(func, "ds_queue_size");
+	bind<ds_queue_empty>(func, "ds_queue_empty");
+	bind<ds_queue_clear>(func, "ds_queue_clear");
+
+	bind<ds_priority_create>(func, "ds_priority_create");
+	bind<ds_priority_destroy>(func, "ds_priority_destroy");
+	bind<ds_priority_add>(func, "ds_priority_add");
+	bind<ds_priority_delete_max>(func, "ds_priority_delete_max");
+	bind<ds_priority_delete_min>(func, "ds_priority_delete_min");
+	bind<ds_priority_find_max>(func, "ds_priority_find_max");
+	bind<ds_priority_find_min>(func, "ds_priority_find_min");
+	bind<ds_priority_size>(func, "ds_priority_size");
+	bind<ds_priority_empty>(func, "ds_priority_empty");
+	bind<ds_priority_clear>(func, "ds_priority_clear");
+
+	bind<ds_grid_create>(func, "ds_grid_create");
+	bind<ds_grid_destroy>(func, "ds_grid_destroy");
+	bind<ds_grid_width>(func, "ds_grid_width");
+	bind<ds_grid_height>(func, "ds_grid_height");
+	bind<ds_grid_resize>(func, "ds_grid_resize");
+	bind<ds_grid_clear>(func, "ds_grid_clear");
+	bind<ds_grid_get>(func, "ds_grid_get");
+	bind<ds_grid_set>(func, "ds_grid_set");
+	bind<ds_grid_add>(func, "ds_grid_add");
+	bind<ds_grid_multiply>(func, "ds_grid_multiply");
+	bind<ds_grid_set_region>(func, "ds_grid_set_region");
+	bind<ds_grid_add_region>(func, "ds_grid_add_region");
+	bind<ds_grid_multiply_region>(func, "ds_grid_multiply_region");
+	bind<ds_grid_get_sum>(func, "ds_grid_get_sum");
+	bind<ds_grid_get_max>(func, "ds_grid_get_max");
+	bind<ds_grid_get_min>(func, "ds_grid_get_min");
+	bind<ds_grid_get_mean>(func, "ds_grid_get_mean");
+	bind<ds_grid_set_disk>(func, "ds_grid_set_disk");
+	bind<ds_grid_add_disk>(func, "ds_grid_add_disk");
+	bind<ds_grid_multiply_disk>(func, "ds_grid_multiply_disk");
+	bind<ds_grid_get_disk_sum>(func, "ds_grid_get_disk_sum");
+	bind<ds_grid_get_disk_max>(func, "ds_grid_get_disk_max");
+	bind<ds_grid_get_disk_min>(func, "ds_grid_get_disk_min");
+	bind<ds_grid_get_disk_mean>(func, "ds_grid_get_disk_mean");
+}
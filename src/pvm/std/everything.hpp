@@ -2,8 +2,14 @@
 
 #include "pvm/vm/builtins/bind.hpp"
 #include "pvm/std/debug.hpp"
+#include "pvm/std/ds.hpp"
+#include "pvm/std/math.hpp"
+#include "pvm/std/string.hpp"
 
 inline void bind_everything(Func& func_chunk)
 {
 	bind_debug(func_chunk);
+	bind_ds(func_chunk);
+	bind_math(func_chunk);
+	bind_string(func_chunk);
 }
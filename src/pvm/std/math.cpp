@@ -0,0 +1,179 @@
+#include "pvm/std/math.hpp"
+
+#include <cmath>
+
+namespace
+{
+constexpr f64 degrees_per_radian = 180.0 / 3.14159265358979323846;
+} // namespace
+
+namespace math
+{
+f64 abs(f64 x)
+{
+	return std::fabs(x);
+}
+
+f64 sign(f64 x)
+{
+	return x > 0.0 ? 1.0 : (x < 0.0 ? -1.0 : 0.0);
+}
+
+f64 round(f64 x)
+{
+	// Halves go to the even neighbour, as in GameMaker
+	return std::nearbyint(x);
+}
+
+f64 floor(f64 x)
+{
+	return std::floor(x);
+}
+
+f64 ceil(f64 x)
+{
+	return std::ceil(x);
+}
+
+f64 frac(f64 x)
+{
+	return x - std::trunc(x);
+}
+
+f64 sqrt(f64 x)
+{
+	return std::sqrt(x);
+}
+
+f64 sqr(f64 x)
+{
+	return x * x;
+}
+
+f64 power(f64 x, f64 n)
+{
+	return std::pow(x, n);
+}
+
+f64 exp(f64 x)
+{
+	return std::exp(x);
+}
+
+f64 ln(f64 x)
+{
+	return std::log(x);
+}
+
+f64 log2(f64 x)
+{
+	return std::log2(x);
+}
+
+f64 log10(f64 x)
+{
+	return std::log10(x);
+}
+
+f64 min(f64 a, f64 b)
+{
+	return std::fmin(a, b);
+}
+
+f64 max(f64 a, f64 b)
+{
+	return std::fmax(a, b);
+}
+
+f64 clamp(f64 x, f64 min, f64 max)
+{
+	return std::fmin(std::fmax(x, min), max);
+}
+
+f64 lerp(f64 a, f64 b, f64 amount)
+{
+	return a + (b - a) * amount;
+}
+
+f64 sin(f64 x)
+{
+	return std::sin(x);
+}
+
+f64 cos(f64 x)
+{
+	return std::cos(x);
+}
+
+f64 tan(f64 x)
+{
+	return std::tan(x);
+}
+
+f64 arcsin(f64 x)
+{
+	return std::asin(x);
+}
+
+f64 arccos(f64 x)
+{
+	return std::acos(x);
+}
+
+f64 arctan(f64 x)
+{
+	return std::atan(x);
+}
+
+f64 arctan2(f64 y, f64 x)
+{
+	return std::atan2(y, x);
+}
+
+f64 dsin(f64 degrees)
+{
+	return std::sin(degtorad(degrees));
+}
+
+f64 dcos(f64 degrees)
+{
+	return std::cos(degtorad(degrees));
+}
+
+f64 dtan(f64 degrees)
+{
+	return std::tan(degtorad(degrees));
+}
+
+f64 degtorad(f64 degrees)
+{
+	return degrees / degrees_per_radian;
+}
+
+f64 radtodeg(f64 radians)
+{
+	return radians * degrees_per_radian;
+}
+
+f64 point_distance(f64 x1, f64 y1, f64 x2, f64 y2)
+{
+	return std::hypot(x2 - x1, y2 - y1);
+}
+
+f64 point_direction(f64 x1, f64 y1, f64 x2, f64 y2)
+{
+	// y points down, so that going up is 90 degrees
+	auto direction = radtodeg(std::atan2(y1 - y2, x2 - x1));
+	return direction < 0.0 ? direction + 360.0 : direction;
+}
+
+f64 lengthdir_x(f64 length, f64 direction)
+{
+	return length * dcos(direction);
+}
+
+f64 lengthdir_y(f64 length, f64 direction)
+{
+	return -length * dsin(direction);
+}
+} // namespace math
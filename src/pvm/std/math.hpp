@@ -0,0 +1,88 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include "pvm/vm/builtins/bind.hpp"
+
+// Math functions of GameMaker, bound as typed builtins (see TypedBuiltin).
+// Angles are in radians, except for the d* functions and point_direction(),
+// which are in degrees going counterclockwise with y pointing down.
+// They get their own namespace, as most of their names are taken by the C
+// library.
+
+namespace math
+{
+f64 abs(f64 x);
+f64 sign(f64 x);
+f64 round(f64 x);
+f64 floor(f64 x);
+f64 ceil(f64 x);
+f64 frac(f64 x);
+f64 sqrt(f64 x);
+f64 sqr(f64 x);
+f64 power(f64 x, f64 n);
+f64 exp(f64 x);
+f64 ln(f64 x);
+f64 log2(f64 x);
+f64 log10(f64 x);
+f64 min(f64 a, f64 b);
+f64 max(f64 a, f64 b);
+f64 clamp(f64 x, f64 min, f64 max);
+f64 lerp(f64 a, f64 b, f64 amount);
+
+f64 sin(f64 x);
+f64 cos(f64 x);
+f64 tan(f64 x);
+f64 arcsin(f64 x);
+f64 arccos(f64 x);
+f64 arctan(f64 x);
+f64 arctan2(f64 y, f64 x);
+f64 dsin(f64 degrees);
+f64 dcos(f64 degrees);
+f64 dtan(f64 degrees);
+f64 degtorad(f64 degrees);
+f64 radtodeg(f64 radians);
+
+f64 point_distance(f64 x1, f64 y1, f64 x2, f64 y2);
+f64 point_direction(f64 x1, f64 y1, f64 x2, f64 y2);
+f64 lengthdir_x(f64 length, f64 direction);
+f64 lengthdir_y(f64 length, f64 direction);
+} // namespace math
+
+inline void bind_math(Func& func)
+{
+	bind<math::abs>(func, "abs");
+	bind<math::sign>(func, "sign");
+	bind<math::round>(func, "round");
+	bind<math::floor>(func, "floor");
+	bind<math::ceil>(func, "ceil");
+	bind<math::frac>(func, "frac");
+	bind<math::sqrt>(func, "sqrt");
+	bind<math::sqr>(func, "sqr");
+	bind<math::power>(func, "power");
+	bind<math::exp>(func, "exp");
+	bind<math::ln>(func, "ln");
+	bind<math::log2>(func, "log2");
+	bind<math::log10>(func, "log10");
+	bind<math::min>(func, "min");
+	bind<math::max>(func, "max");
+	bind<math::clamp>(func, "clamp");
+	bind<math::lerp>(func, "lerp");
+
+	bind<math::sin>(func, "sin");
+	bind<math::cos>(func, "cos");
+	bind<math::tan>(func, "tan");
+	bind<math::arcsin>(func, "arcsin");
+	bind<math::arccos>(func, "arccos");
+	bind<math::arctan>(func, "arctan");
+	bind<math::arctan2>(func, "arctan2");
+	bind<math::dsin>(func, "dsin");
+	bind<math::dcos>(func, "dcos");
+	bind<math::dtan>(func, "dtan");
+	bind<math::degtorad>(func, "degtorad");
+	bind<math::radtodeg>(func, "radtodeg");
+
+	bind<math::point_distance>(func, "point_distance");
+	bind<math::point_direction>(func, "point_direction");
+	bind<math::lengthdir_x>(func, "lengthdir_x");
+	bind<math::lengthdir_y>(func, "lengthdir_y");
+}
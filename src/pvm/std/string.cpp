@@ -0,0 +1,121 @@
+#include "pvm/std/string.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+//! Returns 'value' truncated and clamped to [0, 'bound'], with NaN as 0.
+std::size_t clamp_count(f64 value, std::size_t bound)
+{
+	if (!(value > 0.0))
+	{
+		return 0;
+	}
+
+	return value < f64(bound) ? std::size_t(value) : bound;
+}
+
+//! Returns 'text' with the ASCII letters mapped by 'letter'.
+template<class F>
+std::string map_letters(std::string_view text, char first, F letter)
+{
+	std::string result{text};
+	for (auto& c : result)
+	{
+		if (c >= first && c <= first + ('z' - 'a'))
+		{
+			c = letter(c);
+		}
+	}
+
+	return result;
+}
+} // namespace
+
+s32 string_length(std::string_view text)
+{
+	return s32(text.size());
+}
+
+std::string_view string_char_at(std::string_view text, f64 index)
+{
+	auto position = clamp_count(index, text.size() + 1);
+	if (position == 0 || position > text.size())
+	{
+		return {};
+	}
+
+	return text.substr(position - 1, 1);
+}
+
+std::string_view string_copy(std::string_view text, f64 index, f64 count)
+{
+	auto start
+		= std::max<std::size_t>(clamp_count(index, text.size() + 1), 1) - 1;
+	return text.substr(start, clamp_count(count, text.size() - start));
+}
+
+s32 string_pos(std::string_view substring, std::string_view text)
+{
+	if (substring.empty())
+	{
+		return 0;
+	}
+
+	auto position = text.find(substring);
+	return position == std::string_view::npos ? 0 : s32(position + 1);
+}
+
+s32 string_count(std::string_view substring, std::string_view text)
+{
+	if (substring.empty())
+	{
+		return 0;
+	}
+
+	s32 count = 0;
+	for (auto position = text.find(substring);
+		 position != std::string_view::npos;
+		 position = text.find(substring, position + substring.size()))
+	{
+		++count;
+	}
+
+	return count;
+}
+
+std::string string_upper(std::string_view text)
+{
+	return map_letters(text, 'a', [](char c) { return char(c - 'a' + 'A'); });
+}
+
+std::string string_lower(std::string_view text)
+{
+	return map_letters(text, 'A', [](char c) { return char(c - 'A' + 'a'); });
+}
+
+std::string string_repeat(std::string_view text, f64 count)
+{
+	auto repeats = clamp_count(count, std::numeric_limits<s32>::max());
+
+	std::string result;
+	result.reserve(text.size() * repeats);
+
+	for (std::size_t i = 0; i < repeats; ++i)
+	{
+		result += text;
+	}
+
+	return result;
+}
+
+s32 ord(std::string_view text)
+{
+	return text.empty() ? 0 : s32(u8(text.front()));
+}
+
+std::string chr(f64 code)
+{
+	return std::string(1, char(u8(clamp_count(code, 255))));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include "pvm/vm/builtins/bind.hpp"
+#include <string>
+#include <string_view>
+
+// String functions of GameMaker, bound as typed builtins (see TypedBuiltin).
+// Strings are handled as bytes, which matches GameMaker for ASCII text, and
+// positions start at 1. Positions and counts out of the string are clamped to
+// it.
+
+s32 string_length(std::string_view text);
+std::string_view string_char_at(std::string_view text, f64 index);
+std::string_view string_copy(std::string_view text, f64 index, f64 count);
+s32 string_pos(std::string_view substring, std::string_view text);
+s32 string_count(std::string_view substring, std::string_view text);
+std::string string_upper(std::string_view text);
+std::string string_lower(std::string_view text);
+std::string string_repeat(std::string_view text, f64 count);
+s32 ord(std::string_view text);
+std::string chr(f64 code);
+
+inline void bind_string(Func& func)
+{
+	bind<string_length>(func, "string_length");
+	bind<string_char_at>(func, "string_char_at");
+	bind<string_copy>(func, "string_copy");
+	bind<string_pos>(func, "string_pos");
+	bind<string_count>(func, "string_count");
+	bind<string_upper>(func, "string_upper");
+	bind<string_lower>(func, "string_lower");
+	bind<string_repeat>(func, "string_repeat");
+	bind<ord>(func, "ord");
+	bind<chr>(func, "chr");
+}
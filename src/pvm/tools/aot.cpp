@@ -0,0 +1,49 @@
+#include "pvm/aot/transpiler.hpp"
+#include "pvm/unpack/decode.hpp"
+#include "pvm/unpack/mmap.hpp"
+#include <filesystem>
+#include <fmt/core.h>
+#include <stdexcept>
+
+// Transpiles the scripts of a data.win to C++, see write_aot_module().
+// Usage: phosphorvm-aot [data.win path] [output directory]
+int main(int argc, char** argv)
+{
+	std::string data_path  = argc > 1 ? argv[1] : "data.win";
+	std::string output_dir = argc > 2 ? argv[2] : "aot";
+
+	ReadMappedFile file{data_path};
+
+	if (!file)
+	{
+		fmt::print("Could not open '{}'! Failing.\n", data_path);
+		return 1;
+	}
+
+	Form   form;
+	Reader reader{file.data(), file.data() + file.size()};
+	reader >> form;
+
+	try
+	{
+		std::filesystem::create_directories(output_dir);
+
+		auto count = write_aot_module(form, output_dir, PVM_INCLUDE_DIRECTORY);
+
+		fmt::print(
+			"Transpiled {} of {} scripts to '{}'. Build it with:\n"
+			"\tcmake -S {} -B {}/build && cmake --build {}/build\n"
+			"then copy 'data.aot.so' next to 'data.win'.\n",
+			count,
+			form.code.elements.size(),
+			output_dir,
+			output_dir,
+			output_dir,
+			output_dir);
+	}
+	catch (const std::exception& e)
+	{
+		fmt::print("Failed: {}\n", e.what());
+		return 1;
+	}
+}
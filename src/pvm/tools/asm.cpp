@@ -0,0 +1,165 @@
+#include "pvm/bc/assembler.hpp"
+#include "pvm/bc/disasm.hpp"
+#include "pvm/pack/writer.hpp"
+#include "pvm/unpack/decode.hpp"
+#include "pvm/unpack/mmap.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+constexpr auto usage
+	= "Usage: phosphorvm-asm [-o <data.win>] <source>...\n"
+	  "       phosphorvm-asm --roundtrip <data.win>\n"
+	  "\n"
+	  "Assembles sources written in the disassembler syntax into a data.win\n"
+	  "holding their scripts (default: data.win). With --roundtrip, checks\n"
+	  "that disassembling then reassembling each script of a data.win gives\n"
+	  "back the same bytecode.\n";
+
+[[nodiscard]] std::string read_text(const std::string& path)
+{
+	std::ifstream file{path};
+	if (!file)
+	{
+		throw std::runtime_error{fmt::format("Could not open '{}'", path)};
+	}
+
+	std::stringstream text;
+	text << file.rdbuf();
+	return text.str();
+}
+
+int assemble_files(
+	const std::vector<std::string>& sources, const std::string& output_path)
+{
+	Form form;
+
+	for (auto& path : sources)
+	{
+		try
+		{
+			assemble(form, read_text(path));
+		}
+		catch (const std::runtime_error& e)
+		{
+			fmt::print("{}: {}\n", path, e.what());
+			return 1;
+		}
+	}
+
+	try
+	{
+		write_form(form, output_path);
+	}
+	catch (const std::runtime_error& e)
+	{
+		fmt::print("Failed: {}\n", e.what());
+		return 1;
+	}
+
+	fmt::print(
+		"Wrote {} scripts to '{}'.\n", form.code.elements.size(), output_path);
+	return 0;
+}
+
+int roundtrip(const std::string& data_path)
+{
+	ReadMappedFile file{data_path};
+
+	if (!file)
+	{
+		fmt::print("Could not open '{}'! Failing.\n", data_path);
+		return 1;
+	}
+
+	Form   form;
+	Reader reader{file.data(), file.data() + file.size()};
+	reader >> form;
+
+	Disassembler disasm{form};
+	std::size_t  failures = 0;
+
+	for (auto& script : form.code.elements)
+	{
+		auto original = script.data;
+
+		try
+		{
+			assemble(form, disasm.listing(script));
+		}
+		catch (const std::runtime_error& e)
+		{
+			fmt::print("{}: {}\n", script.name, e.what());
+			++failures;
+			continue;
+		}
+
+		if (script.data != original)
+		{
+			auto mismatch = std::mismatch(
+				original.begin(),
+				original.end(),
+				script.data.begin(),
+				script.data.end());
+
+			fmt::print(
+				"{}: differs from ${:08x}\n",
+				script.name,
+				std::distance(original.begin(), mismatch.first));
+			++failures;
+		}
+	}
+
+	fmt::print(
+		"{} of {} scripts assembled back to the same bytecode.\n",
+		form.code.elements.size() - failures,
+		form.code.elements.size());
+
+	return failures == 0 ? 0 : 1;
+}
+} // namespace
+
+// Assembles scripts into a data.win, see assemble().
+int main(int argc, char** argv)
+{
+	std::vector<std::string> arguments(argv + 1, argv + argc);
+
+	if (arguments.size() == 2 && arguments[0] == "--roundtrip")
+	{
+		return roundtrip(arguments[1]);
+	}
+
+	std::string              output_path = "data.win";
+	std::vector<std::string> sources;
+
+	for (std::size_t i = 0; i < arguments.size(); ++i)
+	{
+		if (arguments[i] == "-o" && i + 1 < arguments.size())
+		{
+			output_path = arguments[++i];
+		}
+		else if (arguments[i].front() == '-')
+		{
+			sources.clear();
+			break;
+		}
+		else
+		{
+			sources.push_back(arguments[i]);
+		}
+	}
+
+	if (sources.empty())
+	{
+		fmt::print("{}", usage);
+		return 1;
+	}
+
+	return assemble_files(sources, output_path);
+}
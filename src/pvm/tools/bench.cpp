@@ -0,0 +1,1455 @@
+#include "pvm/bc/instruction.hpp"
+#include "pvm/bc/opt/constant.hpp"
+#include "pvm/bc/opt/optimizer.hpp"
+#include "pvm/jit/compiler.hpp"
+#include "pvm/std/ds.hpp"
+#include "pvm/vm/builtins/bindwrapper.hpp"
+#include "pvm/vm/datastructures.hpp"
+#include "pvm/vm/gridkernels.hpp"
+#include "pvm/vm/heap.hpp"
+#include "pvm/vm/instancemanager.hpp"
+#include "pvm/vm/mainstack.hpp"
+#include "pvm/vm/vm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <fmt/core.h>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <optional>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Micro-benchmarks of the interpreter primitives. Scripts are built in memory
+// and kept out of the form's code chunk, so that tiering never promotes them
+// and only the interpreter gets measured. The tier.* benchmarks promote their
+// script by hand instead, to compare both tiers.
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+constexpr auto usage
+	= "Usage: phosphorvm-bench [-f <filter>] [-c <baseline.tsv>] [-t]\n"
+	  "\n"
+	  "Prints the time per operation of each benchmark as tab-separated\n"
+	  "values. Save the output to compare later runs against it with -c.\n"
+	  "\n"
+	  "Options:\n"
+	  "\t-f <filter>  Only run benchmarks whose name contains <filter>\n"
+	  "\t-c <file>    Compare against the results of a previous run\n"
+	  "\t-t           Checks the grid kernels and the ds_grid builtins\n"
+	  "\t             against reference computations instead\n";
+
+//! Each measure runs for at least this long.
+constexpr auto min_sample_time = std::chrono::milliseconds{20};
+
+//! Measures taken per benchmark, the median one being reported.
+constexpr std::size_t sample_count = 5;
+
+//! Keeps the compiler from optimizing 'value' away.
+template<class T>
+void keep(const T& value)
+{
+	asm volatile("" : : "m"(value) : "memory");
+}
+
+//! Runs 'iterations' operations.
+using Benchmark = std::function<void(std::size_t iterations)>;
+
+//! Returns the median time per operation of 'benchmark', in nanoseconds.
+[[nodiscard]] double measure(const Benchmark& benchmark)
+{
+	auto time = [&](std::size_t iterations) {
+		auto begin = Clock::now();
+		benchmark(iterations);
+		return Clock::now() - begin;
+	};
+
+	// Calibrate so that a measure is long enough for the clock
+	std::size_t iterations = 1;
+	while (time(iterations) < min_sample_time)
+	{
+		iterations *= 2;
+	}
+
+	std::vector<double> samples;
+	for (std::size_t i = 0; i < sample_count; ++i)
+	{
+		samples.push_back(
+			std::chrono::duration<double, std::nano>(time(iterations)).count()
+			/ double(iterations));
+	}
+
+	std::nth_element(
+		samples.begin(), samples.begin() + sample_count / 2, samples.end());
+	return samples[sample_count / 2];
+}
+
+// VARI entries of the benchmark form
+constexpr Block argument0_reference = 0, counter_reference = 1,
+				lhs_reference = 2, rhs_reference = 3;
+
+constexpr Block local_inst_type  = u16(InstType::local),
+				global_inst_type = u16(InstType::global);
+
+//! Operand block referring to the variable 'reference'.
+[[nodiscard]] constexpr Block variable(Block reference)
+{
+	return (Block(VarType::normal) << 24u) | reference;
+}
+
+[[nodiscard]] constexpr Block
+instruction(Instr opcode, DataType t1, DataType t2, Block low = 0)
+{
+	return with_types((Block(opcode) << 24u) | low, t1, t2);
+}
+
+//! Bytecode of a script running its body 'argument0' times, the counter
+//! being a local. 'prologue' runs once beforehand.
+class LoopBuilder
+{
+	std::vector<Block> _data;
+	std::size_t        _head, _exit_branch;
+
+	public:
+	explicit LoopBuilder(std::vector<Block> prologue = {});
+
+	LoopBuilder& emit(std::vector<Block> blocks);
+
+	[[nodiscard]] std::size_t offset() const;
+
+	//! Emits a branch to 'target', which may be patched later.
+	std::size_t branch(Instr opcode, std::size_t target = 0);
+	void        patch(std::size_t branch, std::size_t target);
+
+	[[nodiscard]] std::vector<Block> finish();
+};
+
+LoopBuilder::LoopBuilder(std::vector<Block> prologue) :
+	_data{std::move(prologue)}
+{
+	// i = 0
+	emit(encode_push(s32(0)));
+	emit({instruction(Instr::opconv, DataType::i32, DataType::var),
+		  instruction(
+			  Instr::oppop, DataType::var, DataType::var, local_inst_type),
+		  variable(counter_reference)});
+
+	// while (i < argument0)
+	_head = offset();
+	emit({instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+		  variable(counter_reference),
+		  instruction(Instr::oppushspc, DataType::var, DataType::f64, 0xFFFFu),
+		  variable(argument0_reference),
+		  instruction(
+			  Instr::opcmp,
+			  DataType::var,
+			  DataType::var,
+			  Block(CompFunc::lt) << 8u)});
+	_exit_branch = branch(Instr::opbf);
+}
+
+LoopBuilder& LoopBuilder::emit(std::vector<Block> blocks)
+{
+	_data.insert(_data.end(), blocks.begin(), blocks.end());
+	return *this;
+}
+
+std::size_t LoopBuilder::offset() const
+{
+	return _data.size();
+}
+
+std::size_t LoopBuilder::branch(Instr opcode, std::size_t target)
+{
+	_data.push_back(Block(opcode) << 24u);
+	patch(offset() - 1, target);
+	return offset() - 1;
+}
+
+void LoopBuilder::patch(std::size_t branch, std::size_t target)
+{
+	auto relative = s64(target) - s64(branch);
+	_data[branch] = (_data[branch] & 0xFF800000u) | (u32(relative) & 0x7FFFFFu);
+}
+
+std::vector<Block> LoopBuilder::finish()
+{
+	// ++i
+	emit({instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+		  variable(counter_reference)});
+	emit(encode_push(s32(1)));
+	emit({instruction(Instr::opadd, DataType::i32, DataType::var),
+		  instruction(
+			  Instr::oppop, DataType::var, DataType::var, local_inst_type),
+		  variable(counter_reference)});
+	branch(Instr::opb, _head);
+
+	// Falls through the end of the script, returning nothing
+	patch(_exit_branch, offset());
+	return std::move(_data);
+}
+
+[[nodiscard]] std::string type_name(DataType type)
+{
+	switch (type)
+	{
+	case DataType::i32: return "i32";
+	case DataType::i64: return "i64";
+	case DataType::f32: return "f32";
+	case DataType::f64: return "f64";
+	default: return "var";
+	}
+}
+
+//! Operand of an arithmetic benchmark, of the given type. 'var' operands
+//! are locals holding an i32 for integral operations, an f64 otherwise.
+[[nodiscard]] std::vector<Block>
+push_operand(DataType type, bool integral, Block var_reference)
+{
+	switch (type)
+	{
+	case DataType::i32: return encode_push(s32(integral ? 3 : 7));
+	case DataType::i64: return encode_push(s64(3));
+	case DataType::f32: return encode_push(f32(3.25f));
+	case DataType::f64: return encode_push(f64(3.25));
+	default:
+		return {instruction(
+					Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+				variable(var_reference)};
+	}
+}
+
+//! Type an arithmetic operation over 'a' and 'b' pushes, following the C++
+//! promotion rules the handlers use.
+[[nodiscard]] DataType result_type(Instr opcode, DataType a, DataType b)
+{
+	auto any = [&](DataType type) { return a == type || b == type; };
+
+	if (any(DataType::var))
+	{
+		return DataType::var;
+	}
+
+	if (opcode == Instr::opshl || opcode == Instr::opshr)
+	{
+		return a == DataType::i64 ? DataType::i64 : DataType::i32;
+	}
+
+	if (any(DataType::f64))
+	{
+		return DataType::f64;
+	}
+
+	if (any(DataType::f32))
+	{
+		return DataType::f32;
+	}
+
+	return any(DataType::i64) ? DataType::i64 : DataType::i32;
+}
+
+//! Builtin adding its two arguments, popped through pop_dispatch().
+void add_generic(VM& vm)
+{
+	auto rhs = vm.pop_variable();
+	auto lhs = vm.pop_variable();
+	vm.push_stack_variable(as_number(lhs).value() + as_number(rhs).value());
+}
+
+//! add_generic() as a typed builtin.
+f64 add_typed(f64 lhs, f64 rhs)
+{
+	return lhs + rhs;
+}
+
+class Suite
+{
+	Form _form;
+
+	//! Benchmark scripts, outside of the form so that they never get tiered.
+	std::deque<Script> _scripts;
+
+	std::unique_ptr<VM> _vm;
+
+	std::vector<std::pair<std::string, Benchmark>> _benchmarks;
+
+	void add(std::string name, Benchmark benchmark);
+
+	//! Adds a benchmark running 'body' in a loop, per iteration.
+	void add_loop(std::string name, std::vector<Block> body);
+	void add_loop(std::string name, LoopBuilder& builder);
+
+	//! Adds a script callable through call instructions, returning its id.
+	Block add_function(std::string name, std::vector<Block> data);
+
+	//! Adds a builtin callable through call instructions, returning its id.
+	//! 'arity' is that of typed builtins (see TypedBuiltin).
+	Block add_builtin(
+		std::string        name,
+		GenericBuiltin*    builtin,
+		std::optional<u16> arity = {});
+
+	void add_stack_benchmarks();
+	void add_instance_benchmarks();
+	void add_variable_benchmarks();
+	void add_call_benchmarks();
+	void add_arithmetic_benchmarks();
+	void add_branch_benchmarks();
+	void add_tier_benchmarks();
+	void add_ds_benchmarks();
+
+	public:
+	Suite();
+
+	[[nodiscard]] const auto& benchmarks() const { return _benchmarks; }
+};
+
+Suite::Suite()
+{
+	auto add_variable = [&](std::string name, s32 instance_type, u32 local_id) {
+		VariableDefinition def;
+		def.name          = std::move(name);
+		def.instance_type = instance_type;
+		def.unknown       = local_id + 1;
+		_form.vari.definitions.push_back(std::move(def));
+	};
+
+	add_variable("argument0", s32(InstType::self), 0);
+	_form.vari.definitions.back().special_var = SpecialVar::argument0;
+	add_variable("i", s32(InstType::local), 0);
+	add_variable("lhs", s32(InstType::local), 1);
+	add_variable("rhs", s32(InstType::local), 2);
+
+	add_stack_benchmarks();
+	add_instance_benchmarks();
+	add_variable_benchmarks();
+	add_call_benchmarks();
+	add_arithmetic_benchmarks();
+	add_branch_benchmarks();
+	add_tier_benchmarks();
+	add_ds_benchmarks();
+
+	// Built last, as it keeps a reference to the form
+	_vm = std::make_unique<VM>(_form);
+}
+
+void Suite::add(std::string name, Benchmark benchmark)
+{
+	_benchmarks.emplace_back(std::move(name), std::move(benchmark));
+}
+
+void Suite::add_loop(std::string name, std::vector<Block> body)
+{
+	LoopBuilder builder;
+	builder.emit(std::move(body));
+	add_loop(std::move(name), builder);
+}
+
+void Suite::add_loop(std::string name, LoopBuilder& builder)
+{
+	auto& script       = _scripts.emplace_back();
+	script.name        = name;
+	script.data        = builder.finish();
+	script.local_count = 3;
+
+	add(std::move(name), [this, &script](std::size_t iterations) {
+		_vm->invoke(script, s32(iterations));
+		_vm->reset();
+	});
+}
+
+Block Suite::add_function(std::string name, std::vector<Block> data)
+{
+	auto& script = _scripts.emplace_back();
+	script.name  = name;
+	script.data  = std::move(data);
+
+	FunctionDefinition def;
+	def.name              = std::move(name);
+	def.is_builtin        = false;
+	def.associated_script = &script;
+	_form.func.definitions.push_back(std::move(def));
+
+	return Block(_form.func.definitions.size() - 1);
+}
+
+Block Suite::add_builtin(
+	std::string name, GenericBuiltin* builtin, std::optional<u16> arity)
+{
+	FunctionDefinition def;
+	def.name               = std::move(name);
+	def.is_builtin         = true;
+	def.associated_builtin = builtin;
+	def.builtin_arity      = arity;
+	_form.func.definitions.push_back(std::move(def));
+
+	return Block(_form.func.definitions.size() - 1);
+}
+
+void Suite::add_stack_benchmarks()
+{
+	auto push_pop = [&](std::string name, auto value) {
+		add("stack.push_pop." + name, [value](std::size_t iterations) {
+			MainStack stack;
+			stack.raw.ensure(sizeof(value));
+
+			for (std::size_t i = 0; i < iterations; ++i)
+			{
+				stack.push(value);
+				keep(stack.pop<decltype(value)>());
+			}
+		});
+	};
+
+	push_pop("i32", s32(1));
+	push_pop("i64", s64(1));
+	push_pop("f64", f64(1));
+
+	auto push_variable = [&](std::string name, auto value) {
+		add("stack.push_variable." + name, [this, value](std::size_t iterations) {
+			MainStack stack;
+			stack.raw.ensure(Variable::stack_variable_size);
+
+			for (std::size_t i = 0; i < iterations; ++i)
+			{
+				_vm->push_stack_variable(value, stack);
+				keep(stack.raw[0]);
+				stack.skip(Variable::stack_variable_size);
+			}
+		});
+	};
+
+	push_variable("i32", s32(1));
+	push_variable("f64", f64(1));
+}
+
+void Suite::add_instance_benchmarks()
+{
+	// Spread over a few variables, as a script would
+	constexpr VarId variables = 16;
+
+	add("instances.global.read", [](std::size_t iterations) {
+		InstanceManager instances;
+		for (VarId id = 0; id < variables; ++id)
+		{
+			instances.global().variable(id).data = f64(id);
+		}
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			keep(instances.global().variable(VarId(i % variables)).data);
+		}
+	});
+
+	add("instances.global.write", [](std::size_t iterations) {
+		InstanceManager instances;
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			instances.global().variable(VarId(i % variables)).data = f64(i);
+		}
+
+		keep(instances.global().variable(0).data);
+	});
+}
+
+void Suite::add_variable_benchmarks()
+{
+	add_loop("loop.empty", {});
+
+	add_loop(
+		"local.read",
+		{instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+		 variable(counter_reference),
+		 instruction(Instr::oppopz, DataType::var, DataType::f64)});
+
+	auto write_local = encode_push(s32(1));
+	write_local.insert(
+		write_local.end(),
+		{instruction(Instr::oppop, DataType::var, DataType::i32, local_inst_type),
+		 variable(lhs_reference)});
+	add_loop("local.write", write_local);
+
+	add_loop(
+		"global.read",
+		{instruction(Instr::oppushcst, DataType::var, DataType::f64, global_inst_type),
+		 variable(0),
+		 instruction(Instr::oppopz, DataType::var, DataType::f64)});
+
+	auto write_global = encode_push(s32(1));
+	write_global.insert(
+		write_global.end(),
+		{instruction(Instr::oppop, DataType::var, DataType::i32, global_inst_type),
+		 variable(0)});
+	add_loop("global.write", write_global);
+}
+
+void Suite::add_call_benchmarks()
+{
+	auto nothing = encode_push(s32(0));
+	nothing.insert(
+		nothing.end(),
+		{instruction(Instr::opconv, DataType::i32, DataType::var),
+		 instruction(Instr::opret, DataType::var, DataType::f64)});
+
+	auto nothing_id = add_function("nothing", nothing);
+
+	add_loop(
+		"call.0_arguments",
+		{instruction(Instr::opcall, DataType::i32, DataType::f64, 0),
+		 nothing_id,
+		 instruction(Instr::oppopz, DataType::var, DataType::f64)});
+
+	auto identity_id = add_function(
+		"identity",
+		{instruction(Instr::oppushspc, DataType::var, DataType::f64, 0xFFFFu),
+		 variable(argument0_reference),
+		 instruction(Instr::opret, DataType::var, DataType::f64)});
+
+	add_loop(
+		"call.1_argument",
+		{instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+		 variable(counter_reference),
+		 instruction(Instr::opcall, DataType::i32, DataType::f64, 1),
+		 identity_id,
+		 instruction(Instr::oppopz, DataType::var, DataType::f64)});
+
+	// The same builtin, popping its arguments through pop_dispatch() or
+	// reading them where they lie as a typed builtin
+	auto call_builtin = [&](std::string name, Block builtin_id) {
+		add_loop(
+			"call.builtin." + name,
+			{instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+			 variable(counter_reference),
+			 instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+			 variable(counter_reference),
+			 instruction(Instr::opcall, DataType::i32, DataType::f64, 2),
+			 builtin_id,
+			 instruction(Instr::oppopz, DataType::var, DataType::f64)});
+	};
+
+	using Typed = TypedBuiltin<add_typed>;
+
+	call_builtin("generic", add_builtin("add_generic", add_generic));
+	call_builtin("typed", add_builtin("add_typed", Typed::run, Typed::arity));
+}
+
+void Suite::add_arithmetic_benchmarks()
+{
+	const std::vector<std::pair<std::string, Instr>> operations{
+		{"add", Instr::opadd},
+		{"sub", Instr::opsub},
+		{"mul", Instr::opmul},
+		{"div", Instr::opdiv},
+		{"and", Instr::opand},
+		{"or", Instr::opor},
+		{"xor", Instr::opxor},
+		{"shl", Instr::opshl},
+		{"shr", Instr::opshr}};
+
+	const DataType types[]{
+		DataType::i32, DataType::i64, DataType::f32, DataType::f64, DataType::var};
+
+	for (auto& [name, opcode] : operations)
+	{
+		bool integral = opcode != Instr::opadd && opcode != Instr::opsub
+			&& opcode != Instr::opmul && opcode != Instr::opdiv;
+
+		for (auto a : types)
+		{
+			for (auto b : types)
+			{
+				auto is_float = [](DataType type) {
+					return type == DataType::f32 || type == DataType::f64;
+				};
+
+				if (integral && (is_float(a) || is_float(b)))
+				{
+					continue;
+				}
+
+				// The var operands get initialized before the loop
+				std::vector<Block> prologue;
+
+				for (auto reference : {lhs_reference, rhs_reference})
+				{
+					auto push = integral ? encode_push(s32(3))
+										 : encode_push(f64(7.5));
+					prologue.insert(prologue.end(), push.begin(), push.end());
+					prologue.insert(
+						prologue.end(),
+						{instruction(
+							 Instr::oppop,
+							 DataType::var,
+							 integral ? DataType::i32 : DataType::f64,
+							 local_inst_type),
+						 variable(reference)});
+				}
+
+				// The operand pushed last is on top, and its type goes first
+				LoopBuilder builder{std::move(prologue)};
+				builder.emit(push_operand(a, integral, lhs_reference))
+					.emit(push_operand(b, integral, rhs_reference))
+					.emit({instruction(opcode, b, a),
+						   instruction(
+							   Instr::oppopz,
+							   result_type(opcode, a, b),
+							   DataType::f64)});
+
+				add_loop(
+					fmt::format(
+						"arith.{}.{}.{}", name, type_name(a), type_name(b)),
+					builder);
+			}
+		}
+	}
+}
+
+void Suite::add_branch_benchmarks()
+{
+	// if ((i & 1) == 0) { <push; popz> }, taken every other iteration
+	LoopBuilder alternating;
+	alternating
+		.emit({instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+			   variable(counter_reference)})
+		.emit(encode_push(s32(1)))
+		.emit({instruction(Instr::opand, DataType::i32, DataType::var)})
+		.emit(encode_push(s32(0)))
+		.emit({instruction(
+			Instr::opcmp, DataType::i32, DataType::var, Block(CompFunc::eq) << 8u)});
+
+	auto skip = alternating.branch(Instr::opbf);
+	alternating.emit(encode_push(s32(1)))
+		.emit({instruction(Instr::oppopz, DataType::i32, DataType::f64)});
+	alternating.patch(skip, alternating.offset());
+
+	add_loop("branch.alternating", alternating);
+
+	// Chain of compares against i & 3, as emitted for a switch
+	LoopBuilder chain;
+	std::vector<std::size_t> exits;
+
+	for (s32 value = 0; value < 4; ++value)
+	{
+		chain
+			.emit({instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+				   variable(counter_reference)})
+			.emit(encode_push(s32(3)))
+			.emit({instruction(Instr::opand, DataType::i32, DataType::var)})
+			.emit(encode_push(value))
+			.emit({instruction(
+				Instr::opcmp, DataType::i32, DataType::var, Block(CompFunc::eq) << 8u)});
+		exits.push_back(chain.branch(Instr::opbt));
+	}
+
+	for (auto exit : exits)
+	{
+		chain.patch(exit, chain.offset());
+	}
+
+	add_loop("branch.compare_chain", chain);
+}
+
+void Suite::add_tier_benchmarks()
+{
+	// lhs = 0; while (...) { lhs = lhs + i * 0.5 } return lhs, interpreted as
+	// loaded, then optimized and compiled as Tiering would once it gets hot
+	auto prologue = encode_push(f64(0.0));
+	prologue.insert(
+		prologue.end(),
+		{instruction(Instr::oppop, DataType::var, DataType::f64, local_inst_type),
+		 variable(lhs_reference)});
+
+	LoopBuilder builder{std::move(prologue)};
+	builder
+		.emit({instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+			   variable(lhs_reference),
+			   instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+			   variable(counter_reference)})
+		.emit(encode_push(f64(0.5)))
+		.emit({instruction(Instr::opconv, DataType::f64, DataType::var),
+			   instruction(Instr::opmul, DataType::var, DataType::var),
+			   instruction(Instr::opadd, DataType::var, DataType::var),
+			   instruction(
+				   Instr::oppop, DataType::var, DataType::var, local_inst_type),
+			   variable(lhs_reference)});
+
+	// Returning rather than falling through the end, which type inference
+	// does not follow
+	auto data = builder.finish();
+	data.insert(
+		data.end(),
+		{instruction(Instr::oppushloc, DataType::var, DataType::f64, local_inst_type),
+		 variable(lhs_reference),
+		 instruction(Instr::opret, DataType::var, DataType::f64)});
+
+	auto& interpreted       = _scripts.emplace_back();
+	interpreted.name        = "tier.sum.interpreted";
+	interpreted.data        = std::move(data);
+	interpreted.local_count = 3;
+
+	auto& promoted = _scripts.emplace_back(interpreted);
+	promoted.name  = "tier.sum.promoted";
+	optimize(promoted);
+
+	if constexpr (opt::jit)
+	{
+		promoted.native_code = compile_native(promoted, _form);
+	}
+
+	for (auto* script : {&interpreted, &promoted})
+	{
+		add(script->name, [this, script](std::size_t iterations) {
+			keep(_vm->invoke(*script, s32(iterations)));
+			_vm->reset();
+		});
+	}
+}
+
+void Suite::add_ds_benchmarks()
+{
+	// Containers of the ds_* builtins against their standard counterparts,
+	// over a working set of this many keys or elements
+	constexpr std::size_t elements = 4096;
+
+	// Number keys go through DataStructures::key() as the builtins do, which
+	// gives the bits of their f64
+	add("ds.map.set.number", [](std::size_t iterations) {
+		DataStructures structures;
+		DsMap          map;
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			map.set(
+				structures.key(Variable{s32(i % elements)}), Variable{s32(1)});
+		}
+
+		keep(map.size());
+	});
+
+	add("std.unordered_map.set.number", [](std::size_t iterations) {
+		std::unordered_map<f64, Variable> map;
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			map[f64(i % elements)] = Variable{s32(1)};
+		}
+
+		keep(map.size());
+	});
+
+	add("ds.map.find.number", [](std::size_t iterations) {
+		DataStructures structures;
+		DsMap          map;
+
+		for (std::size_t i = 0; i < elements; ++i)
+		{
+			map.set(structures.key(Variable{s32(i)}), Variable{s32(i)});
+		}
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			keep(map.find(structures.key(Variable{s32(i % elements)})));
+		}
+	});
+
+	add("std.unordered_map.find.number", [](std::size_t iterations) {
+		std::unordered_map<f64, Variable> map;
+		for (std::size_t i = 0; i < elements; ++i)
+		{
+			map[f64(i)] = Variable{s32(i)};
+		}
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			keep(map.find(f64(i % elements)));
+		}
+	});
+
+	// Keys are distinct strings equal to the ones inserted, as scripts
+	// building their keys would look them up
+	auto string_keys = [](Heap& heap) {
+		std::vector<Variable> keys;
+		for (std::size_t i = 0; i < elements; ++i)
+		{
+			auto name = fmt::format("key{}", i);
+			keys.push_back({StringReference{heap.make_string(name)}});
+		}
+
+		return keys;
+	};
+
+	add("ds.map.find.string", [string_keys](std::size_t iterations) {
+		Heap           heap;
+		DataStructures structures;
+		DsMap          map;
+
+		for (auto& key : string_keys(heap))
+		{
+			map.set(structures.key(key), key);
+		}
+
+		auto keys = string_keys(heap);
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			keep(map.find(structures.key(keys[i % elements])));
+		}
+	});
+
+	add("std.unordered_map.find.string", [string_keys](std::size_t iterations) {
+		Heap                                          heap;
+		std::unordered_map<std::string_view, Variable> map;
+
+		for (auto& key : string_keys(heap))
+		{
+			map[std::get<StringReference>(key.data).string->view()] = key;
+		}
+
+		auto keys = string_keys(heap);
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			auto& key = std::get<StringReference>(keys[i % elements].data);
+			keep(map.find(key.string->view()));
+		}
+	});
+
+	auto fill_list = [](auto& list, std::size_t iterations) {
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			if (list.size() == elements)
+			{
+				list.clear();
+			}
+
+			list.push_back(Variable{s32(i)});
+		}
+
+		keep(list.size());
+	};
+
+	add("ds.list.add", [fill_list](std::size_t iterations) {
+		DataStructures structures;
+		fill_list(structures.lists[structures.lists.create()], iterations);
+	});
+
+	add("std.vector.push_back", [fill_list](std::size_t iterations) {
+		std::vector<Variable> list;
+		fill_list(list, iterations);
+	});
+
+	add("ds.priority.add_delete_max", [](std::size_t iterations) {
+		DsPriority priority;
+		for (std::size_t i = 0; i < elements; ++i)
+		{
+			priority.add(Variable{s32(i)}, f64((i * 7919) % elements));
+		}
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			priority.add(priority.delete_max(), f64((i * 7919) % elements));
+		}
+
+		keep(priority.size());
+	});
+
+	add("ds.priority.add_delete_min", [](std::size_t iterations) {
+		DsPriority priority;
+		for (std::size_t i = 0; i < elements; ++i)
+		{
+			priority.add(Variable{s32(i)}, f64((i * 7919) % elements));
+		}
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			priority.add(priority.delete_min(), f64((i * 7919) % elements));
+		}
+
+		keep(priority.size());
+	});
+
+	add("std.priority_queue.push_pop", [](std::size_t iterations) {
+		std::priority_queue<std::pair<f64, s32>> priority;
+		for (std::size_t i = 0; i < elements; ++i)
+		{
+			priority.push({f64((i * 7919) % elements), s32(i)});
+		}
+
+		for (std::size_t i = 0; i < iterations; ++i)
+		{
+			auto value = priority.top().second;
+			priority.pop();
+			priority.push({f64((i * 7919) % elements), value});
+		}
+
+		keep(priority.size());
+	});
+
+	// Region and disk operations of a 256x256 grid, with each set of kernels
+	std::vector<const GridKernels*> grid_kernel_sets{&scalar_grid_kernels};
+#if defined(__x86_64__)
+	grid_kernel_sets.push_back(&sse2_grid_kernels);
+	if (__builtin_cpu_supports("avx2"))
+	{
+		grid_kernel_sets.push_back(&avx2_grid_kernels);
+	}
+#endif
+
+	for (auto* kernels : grid_kernel_sets)
+	{
+		auto suffix = std::string{"."} + kernels->name;
+
+		add("ds.grid.add_region" + suffix, [kernels](std::size_t iterations) {
+			DsGrid grid;
+			grid.resize(256, 256);
+
+			for (std::size_t i = 0; i < iterations; ++i)
+			{
+				grid.for_each_region_span(
+					16, 16, 239, 239, [&](f64* data, std::size_t count) {
+						kernels->add(data, count, 1.0);
+					});
+			}
+
+			keep(*grid.cell(16, 16));
+		});
+
+		add("ds.grid.get_sum" + suffix, [kernels](std::size_t iterations) {
+			DsGrid grid;
+			grid.resize(256, 256);
+
+			for (std::size_t i = 0; i < iterations; ++i)
+			{
+				f64 sum = 0.0;
+				grid.for_each_region_span(
+					16, 16, 239, 239, [&](f64* data, std::size_t count) {
+						sum += kernels->sum(data, count);
+					});
+				keep(sum);
+			}
+		});
+
+		add("ds.grid.multiply_disk" + suffix, [kernels](std::size_t iterations) {
+			DsGrid grid;
+			grid.resize(256, 256);
+
+			for (std::size_t i = 0; i < iterations; ++i)
+			{
+				grid.for_each_disk_span(
+					128, 128, 100, [&](f64* data, std::size_t count) {
+						kernels->multiply(data, count, 1.0);
+					});
+			}
+
+			keep(*grid.cell(128, 128));
+		});
+	}
+}
+
+//! Kernel sets the CPU supports, the scalar one included.
+[[nodiscard]] std::vector<const GridKernels*> supported_grid_kernels()
+{
+	std::vector<const GridKernels*> sets{&scalar_grid_kernels};
+
+#if defined(__x86_64__)
+	sets.push_back(&sse2_grid_kernels);
+	if (__builtin_cpu_supports("avx2"))
+	{
+		sets.push_back(&avx2_grid_kernels);
+	}
+#endif
+
+	return sets;
+}
+
+//! Whether 'actual' is 'expected' up to the rounding of sums over numbers of
+//! 'magnitude' in total.
+[[nodiscard]] bool close_to(f64 actual, f64 expected, f64 magnitude)
+{
+	return std::fabs(actual - expected) <= magnitude * 1e-12;
+}
+
+//! Checks every kernel set against plain loops, on random spans starting at
+//! every offset within a vector, so that both aligned and unaligned accesses
+//! and all the remainder lengths get covered.
+//! @throws std::runtime_error on the first mismatch.
+void check_grid_kernels()
+{
+	std::mt19937_64                     random{1};
+	std::uniform_real_distribution<f64> numbers{-1000.0, 1000.0};
+
+	std::vector<f64> input(64 + 4), expected, actual;
+
+	for (auto* kernels : supported_grid_kernels())
+	{
+		for (std::size_t offset = 0; offset < 4; ++offset)
+		{
+			for (std::size_t count = 0; offset + count <= input.size(); ++count)
+			{
+				auto fail = [&](const char* kernel) {
+					throw std::runtime_error{fmt::format(
+						"{} {} is wrong on {} numbers at offset {}",
+						kernels->name,
+						kernel,
+						count,
+						offset)};
+				};
+
+				for (auto& number : input)
+				{
+					number = numbers(random);
+				}
+
+				auto value = numbers(random);
+				auto first = input.begin() + s64(offset);
+				auto last  = first + s64(count);
+
+				// Whole vectors get compared, to catch writes past the span
+				auto check_write = [&](const char* kernel, auto write, auto op) {
+					expected = input;
+					std::transform(
+						first, last, expected.begin() + s64(offset), op);
+
+					actual = input;
+					write(actual.data() + offset, count, value);
+
+					if (actual != expected)
+					{
+						fail(kernel);
+					}
+				};
+
+				check_write("fill", kernels->fill, [&](f64) { return value; });
+				check_write(
+					"add", kernels->add, [&](f64 cell) { return cell + value; });
+				check_write("multiply", kernels->multiply, [&](f64 cell) {
+					return cell * value;
+				});
+
+				const f64* data = input.data() + offset;
+
+				f64 sum = 0.0, magnitude = 0.0;
+				for (auto it = first; it != last; ++it)
+				{
+					sum += *it;
+					magnitude += std::fabs(*it);
+				}
+
+				if (!close_to(kernels->sum(data, count), sum, magnitude))
+				{
+					fail("sum");
+				}
+
+				if (count != 0)
+				{
+					if (kernels->max(data, count) != *std::max_element(first, last))
+					{
+						fail("max");
+					}
+
+					if (kernels->min(data, count) != *std::min_element(first, last))
+					{
+						fail("min");
+					}
+				}
+			}
+		}
+	}
+}
+
+//! Calls 'builtin' with 'arguments', as a call instruction would.
+//! @returns the number it returned.
+f64 call_builtin(
+	VM& vm, GenericBuiltin* builtin, const std::vector<f64>& arguments)
+{
+	FunctionDefinition def;
+	def.name               = "builtin";
+	def.is_builtin         = true;
+	def.associated_builtin = builtin;
+
+	for (auto argument : arguments)
+	{
+		vm.push_stack_variable(argument);
+	}
+
+	vm.call(def, arguments.size());
+	return as_number(vm.pop_variable()).value();
+}
+
+//! Checks the ds_grid_* region and disk builtins against a grid updated and
+//! read cell by cell, over random operations reaching out of the grid.
+//! Coordinates and radiuses are multiples of 0.5, so that the distances
+//! compared to decide which cells are in a disk are exact.
+//! @throws std::runtime_error on the first mismatch.
+void check_grid_builtins()
+{
+	constexpr s64 width = 23, height = 17;
+
+	Form form;
+	VM   vm{form};
+
+	// Multiples of 0.5 from 'low' to 'high'
+	std::mt19937_64 random{2};
+	auto            between = [&](s64 low, s64 high) {
+		std::uniform_int_distribution<s64> halves{2 * low, 2 * high};
+		return f64(halves(random)) / 2.0;
+	};
+
+	auto grid = call_builtin(vm, ds_grid_create, {f64(width), f64(height)});
+
+	std::vector<f64> cells(std::size_t(width * height));
+	auto             cell = [&](s64 x, s64 y) -> f64& {
+		return cells[std::size_t(x * height + y)];
+	};
+
+	for (s64 x = 0; x < width; ++x)
+	{
+		for (s64 y = 0; y < height; ++y)
+		{
+			cell(x, y) = between(-8, 8);
+			call_builtin(vm, ds_grid_set, {grid, f64(x), f64(y), cell(x, y)});
+		}
+	}
+
+	enum class Shape
+	{
+		region,
+		disk
+	};
+
+	enum class Reduction
+	{
+		sum,
+		max,
+		min,
+		mean
+	};
+
+	enum class Op
+	{
+		set,
+		add,
+		multiply
+	};
+
+	struct Write
+	{
+		const char*     name;
+		GenericBuiltin* builtin;
+		Shape           shape;
+		Op              op;
+	};
+
+	struct Read
+	{
+		const char*     name;
+		GenericBuiltin* builtin;
+		Shape           shape;
+		Reduction       reduction;
+	};
+
+	const Write writes[]{
+		{"ds_grid_set_region", ds_grid_set_region, Shape::region, Op::set},
+		{"ds_grid_add_region", ds_grid_add_region, Shape::region, Op::add},
+		{"ds_grid_multiply_region",
+		 ds_grid_multiply_region,
+		 Shape::region,
+		 Op::multiply},
+		{"ds_grid_set_disk", ds_grid_set_disk, Shape::disk, Op::set},
+		{"ds_grid_add_disk", ds_grid_add_disk, Shape::disk, Op::add},
+		{"ds_grid_multiply_disk",
+		 ds_grid_multiply_disk,
+		 Shape::disk,
+		 Op::multiply}};
+
+	const Read reads[]{
+		{"ds_grid_get_sum", ds_grid_get_sum, Shape::region, Reduction::sum},
+		{"ds_grid_get_max", ds_grid_get_max, Shape::region, Reduction::max},
+		{"ds_grid_get_min", ds_grid_get_min, Shape::region, Reduction::min},
+		{"ds_grid_get_mean", ds_grid_get_mean, Shape::region, Reduction::mean},
+		{"ds_grid_get_disk_sum",
+		 ds_grid_get_disk_sum,
+		 Shape::disk,
+		 Reduction::sum},
+		{"ds_grid_get_disk_max",
+		 ds_grid_get_disk_max,
+		 Shape::disk,
+		 Reduction::max},
+		{"ds_grid_get_disk_min",
+		 ds_grid_get_disk_min,
+		 Shape::disk,
+		 Reduction::min},
+		{"ds_grid_get_disk_mean",
+		 ds_grid_get_disk_mean,
+		 Shape::disk,
+		 Reduction::mean}};
+
+	for (int step = 0; step < 2000; ++step)
+	{
+		// Corners of a region, or the center and the radius of a disk
+		f64 a = between(-4, width + 3), b = between(-4, height + 3);
+		f64 c = between(-4, width + 3), d = between(-4, height + 3);
+		f64 radius = between(-1, 9);
+
+		auto covers = [&](Shape shape, s64 x, s64 y) {
+			if (shape == Shape::disk)
+			{
+				auto dx = f64(x) - a, dy = f64(y) - b;
+				return radius >= 0.0 && dx * dx + dy * dy <= radius * radius;
+			}
+
+			// Coordinates are truncated towards 0, as by DsGrid::coordinate()
+			return s64(std::fmin(a, c)) <= x && x <= s64(std::fmax(a, c))
+				&& s64(std::fmin(b, d)) <= y && y <= s64(std::fmax(b, d));
+		};
+
+		auto arguments = [&](Shape shape) {
+			return shape == Shape::disk ? std::vector<f64>{grid, a, b, radius}
+										: std::vector<f64>{grid, a, b, c, d};
+		};
+
+		if (step % 2 == 0)
+		{
+			const auto& write = writes[std::size_t(step / 2) % std::size(writes)];
+			auto        value = between(-2, 2);
+
+			auto values = arguments(write.shape);
+			values.push_back(value);
+			call_builtin(vm, write.builtin, values);
+
+			for (s64 x = 0; x < width; ++x)
+			{
+				for (s64 y = 0; y < height; ++y)
+				{
+					if (covers(write.shape, x, y))
+					{
+						auto& expected = cell(x, y);
+						switch (write.op)
+						{
+						case Op::set: expected = value; break;
+						case Op::add: expected += value; break;
+						case Op::multiply: expected *= value; break;
+						}
+					}
+
+					auto actual = call_builtin(
+						vm, ds_grid_get, {grid, f64(x), f64(y)});
+
+					if (actual != cell(x, y))
+					{
+						throw std::runtime_error{fmt::format(
+							"{} left {} at {},{} rather than {}",
+							write.name,
+							actual,
+							x,
+							y,
+							cell(x, y))};
+					}
+				}
+			}
+		}
+		else
+		{
+			const auto& read = reads[std::size_t(step / 2) % std::size(reads)];
+
+			f64         expected = 0.0, magnitude = 0.0;
+			std::size_t count = 0;
+
+			for (s64 x = 0; x < width; ++x)
+			{
+				for (s64 y = 0; y < height; ++y)
+				{
+					if (!covers(read.shape, x, y))
+					{
+						continue;
+					}
+
+					auto value = cell(x, y);
+					switch (read.reduction)
+					{
+					case Reduction::sum:
+					case Reduction::mean: expected += value; break;
+
+					case Reduction::max:
+						expected = count == 0 || value > expected ? value : expected;
+						break;
+
+					case Reduction::min:
+						expected = count == 0 || value < expected ? value : expected;
+						break;
+					}
+
+					magnitude += std::fabs(value);
+					++count;
+				}
+			}
+
+			if (read.reduction == Reduction::mean && count != 0)
+			{
+				expected /= f64(count);
+				magnitude /= f64(count);
+			}
+
+			auto actual = call_builtin(vm, read.builtin, arguments(read.shape));
+
+			if (!close_to(actual, expected, magnitude))
+			{
+				throw std::runtime_error{fmt::format(
+					"{} returned {} rather than {} over {} cells",
+					read.name,
+					actual,
+					expected,
+					count)};
+			}
+		}
+	}
+}
+
+//! Reads the results of a previous run, as printed by main().
+[[nodiscard]] std::map<std::string, double> load_baseline(const std::string& path)
+{
+	std::ifstream file{path};
+	if (!file)
+	{
+		throw std::runtime_error{fmt::format("Could not open '{}'", path)};
+	}
+
+	std::map<std::string, double> baseline;
+
+	std::string name;
+	double      time;
+	for (std::string line; std::getline(file, line);)
+	{
+		if (line.empty() || line.front() == '#')
+		{
+			continue;
+		}
+
+		auto tab = line.find('\t');
+		if (tab == std::string::npos)
+		{
+			throw std::runtime_error{
+				fmt::format("Malformed line in '{}': {}", path, line)};
+		}
+
+		name = line.substr(0, tab);
+
+		try
+		{
+			time = std::stod(line.substr(tab + 1));
+		}
+		catch (const std::logic_error&)
+		{
+			throw std::runtime_error{
+				fmt::format("Malformed line in '{}': {}", path, line)};
+		}
+
+		baseline[name] = time;
+	}
+
+	return baseline;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	std::string filter, baseline_path;
+	bool        run_checks = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument = argv[i];
+
+		if ((argument == "-f" || argument == "-c") && i + 1 < argc)
+		{
+			(argument == "-f" ? filter : baseline_path) = argv[++i];
+		}
+		else if (argument == "-t")
+		{
+			run_checks = true;
+		}
+		else
+		{
+			fmt::print("{}", usage);
+			return 1;
+		}
+	}
+
+	std::map<std::string, double> baseline;
+
+	try
+	{
+		if (run_checks)
+		{
+			check_grid_kernels();
+			check_grid_builtins();
+
+			std::string names;
+			for (auto* kernels : supported_grid_kernels())
+			{
+				names += fmt::format(" {}", kernels->name);
+			}
+
+			fmt::print(
+				"Grid kernels (checked:{}) and ds_grid builtins (using {}) match "
+				"the reference\n",
+				names,
+				grid_kernels().name);
+			return 0;
+		}
+
+		if (!baseline_path.empty())
+		{
+			baseline = load_baseline(baseline_path);
+		}
+
+		Suite suite;
+
+		// Results depend on these, so record them along
+		fmt::print(
+			"# vm_safer={} vm_debug_stack={}\n",
+			check(debug::vm_safer),
+			check(debug::vm_debug_stack));
+
+		fmt::print(
+			baseline.empty() ? "# name\tns/op\n"
+							 : "# name\tns/op\tbaseline ns/op\tchange\n");
+
+		for (auto& [name, benchmark] : suite.benchmarks())
+		{
+			if (name.find(filter) == std::string::npos)
+			{
+				continue;
+			}
+
+			auto time = measure(benchmark);
+
+			if (auto it = baseline.find(name); it != baseline.end())
+			{
+				fmt::print(
+					"{}\t{:.3f}\t{:.3f}\t{:+.1f}%\n",
+					name,
+					time,
+					it->second,
+					(time / it->second - 1.0) * 100.0);
+			}
+			else
+			{
+				fmt::print("{}\t{:.3f}\n", name, time);
+			}
+
+			std::fflush(stdout);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		fmt::print("Failed: {}\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,602 @@
+#include "pvm/aot/library.hpp"
+#include "pvm/std/everything.hpp"
+#include "pvm/unpack/decode.hpp"
+#include "pvm/unpack/mmap.hpp"
+#include "pvm/vm/coverage.hpp"
+#include "pvm/vm/debugger.hpp"
+#include "pvm/vm/heap.hpp"
+#include "pvm/vm/parallelrunner.hpp"
+#include "pvm/vm/vm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fmt/format.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+constexpr auto usage
+	= "Usage: phosphorvm-run [options] <data.win> <entry>...\n"
+	  "\n"
+	  "Runs each entry point repeatedly and reports its throughput and latency.\n"
+	  "An entry is a script name followed by its typed arguments, e.g.\n"
+	  "'gml_Script_script_fibo,i32:37'. The 'gml_Script_' prefix may be left\n"
+	  "out. Argument types are i16, i32, i64, f32 and f64.\n"
+	  "\n"
+	  "Options:\n"
+	  "\t-n <count>  Timed runs of each entry point (default: 100)\n"
+	  "\t-w <count>  Untimed runs on each thread beforehand (default: 10)\n"
+	  "\t-j <count>  Threads, each with its own VM (default: 1)\n"
+	  "\t-b <count>  Yields runs every <count> calls and backward branches,\n"
+	  "\t            resuming them right away (default: 0, never yields)\n"
+	  "\t-m          Keeps the results of calls to pure scripts memoized from\n"
+	  "\t            one run to the next, rather than clearing them\n"
+	  "\t-g          Runs each entry point once under the debugger instead,\n"
+	  "\t            reading commands from stdin ('help' lists them)\n"
+	  "\n"
+	  "Fails when an entry point does not return the same result on every run,\n"
+	  "e.g. once its script got promoted to an optimized tier.\n";
+
+struct Options
+{
+	std::string              data_path;
+	std::vector<std::string> entries;
+
+	std::size_t iterations = 100, warmup_iterations = 10, threads = 1;
+	std::size_t budget = 0;
+
+	bool debug = false;
+
+	//! Whether runs may reuse the results memoized by earlier ones, which
+	//! makes them time cache lookups rather than the calls.
+	bool keep_memoized = false;
+};
+
+struct EntryPoint
+{
+	const Script*         script;
+	std::vector<Variable> arguments;
+};
+
+[[nodiscard]] std::size_t parse_count(const std::string& text)
+{
+	std::size_t parsed = 0;
+	auto        count  = std::stoull(text, &parsed);
+
+	if (parsed != text.size())
+	{
+		throw std::invalid_argument{text};
+	}
+
+	return std::size_t(count);
+}
+
+[[nodiscard]] Options parse_options(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument = argv[i];
+
+		if (argument == "-g")
+		{
+			options.debug = true;
+		}
+		else if (argument == "-m")
+		{
+			options.keep_memoized = true;
+		}
+		else if (
+			argument == "-n" || argument == "-w" || argument == "-j"
+			|| argument == "-b")
+		{
+			if (++i == argc)
+			{
+				throw std::runtime_error{
+					fmt::format("Missing value for '{}'", argument)};
+			}
+
+			std::size_t count;
+			try
+			{
+				count = parse_count(argv[i]);
+			}
+			catch (const std::logic_error&)
+			{
+				throw std::runtime_error{fmt::format(
+					"Bad value '{}' for '{}'", argv[i], argument)};
+			}
+
+			switch (argument[1])
+			{
+			case 'n': options.iterations = count; break;
+			case 'w': options.warmup_iterations = count; break;
+			case 'b': options.budget = count; break;
+			default: options.threads = std::max<std::size_t>(count, 1); break;
+			}
+		}
+		else if (options.data_path.empty())
+		{
+			options.data_path = argument;
+		}
+		else
+		{
+			options.entries.push_back(argument);
+		}
+	}
+
+	if (options.entries.empty())
+	{
+		throw std::runtime_error{"No entry point given"};
+	}
+
+	return options;
+}
+
+[[nodiscard]] Variable parse_argument(const std::string& text)
+{
+	auto separator = text.find(':');
+	if (separator == std::string::npos)
+	{
+		throw std::runtime_error{
+			fmt::format("Argument '{}' is not of the form type:value", text)};
+	}
+
+	auto type  = text.substr(0, separator);
+	auto value = text.substr(separator + 1);
+
+	try
+	{
+		std::size_t parsed = 0;
+		Variable    variable;
+
+		if (type == "i16")
+		{
+			variable.data = s16(std::stoi(value, &parsed));
+		}
+		else if (type == "i32")
+		{
+			variable.data = s32(std::stol(value, &parsed));
+		}
+		else if (type == "i64")
+		{
+			variable.data = s64(std::stoll(value, &parsed));
+		}
+		else if (type == "f32")
+		{
+			variable.data = std::stof(value, &parsed);
+		}
+		else if (type == "f64")
+		{
+			variable.data = std::stod(value, &parsed);
+		}
+		else
+		{
+			throw std::runtime_error{
+				fmt::format("Unknown type '{}' in argument '{}'", type, text)};
+		}
+
+		if (parsed == value.size())
+		{
+			return variable;
+		}
+	}
+	catch (const std::logic_error&)
+	{}
+
+	throw std::runtime_error{fmt::format("Bad value in argument '{}'", text)};
+}
+
+[[nodiscard]] EntryPoint parse_entry(const Form& form, const std::string& text)
+{
+	std::vector<std::string> fields;
+
+	for (std::size_t begin = 0;;)
+	{
+		auto end = text.find(',', begin);
+		fields.push_back(text.substr(begin, end - begin));
+
+		if (end == std::string::npos)
+		{
+			break;
+		}
+
+		begin = end + 1;
+	}
+
+	auto& name    = fields.front();
+	auto& scripts = form.code.elements;
+
+	auto it = std::find_if(scripts.begin(), scripts.end(), [&](auto& script) {
+		return script.name == name || script.name == "gml_Script_" + name;
+	});
+
+	if (it == scripts.end())
+	{
+		throw std::runtime_error{fmt::format("No script named '{}'", name)};
+	}
+
+	EntryPoint entry{&*it, {}};
+	for (auto field = fields.begin() + 1; field != fields.end(); ++field)
+	{
+		entry.arguments.push_back(parse_argument(*field));
+	}
+
+	return entry;
+}
+
+[[nodiscard]] std::string to_string(const Variable& variable)
+{
+	return std::visit(
+		[](auto v) -> std::string {
+			if constexpr (std::is_same_v<decltype(v), StringReference>)
+			{
+				return fmt::format("\"{}\"", v.string->view());
+			}
+			else if constexpr (std::is_same_v<decltype(v), ArrayReference>)
+			{
+				// Rows of 2D arrays are listed as arrays of their own
+				auto& array = *v.array;
+				auto  rows  = array.numeric ? array.numbers.size()
+											: array.values.size();
+
+				std::vector<std::string> listed;
+				for (std::size_t row = 0; row < rows; ++row)
+				{
+					auto columns = array.numeric ? array.numbers[row].size()
+												 : array.values[row].size();
+
+					std::vector<std::string> elements;
+					for (std::size_t column = 0; column < columns; ++column)
+					{
+						elements.push_back(to_string(
+							array.at(row * array_row_size + column)));
+					}
+
+					listed.push_back(
+						fmt::format("[{}]", fmt::join(elements, ", ")));
+				}
+
+				return rows == 1 ? listed.front()
+								 : fmt::format("[{}]", fmt::join(listed, ", "));
+			}
+			else
+			{
+				return fmt::format("{}", v);
+			}
+		},
+		variable.data);
+}
+
+[[nodiscard]] std::string to_string(const std::optional<Variable>& result)
+{
+	return result ? to_string(*result) : "none";
+}
+
+//! Formats a duration in nanoseconds with a sensible unit.
+[[nodiscard]] std::string to_string(f64 nanoseconds)
+{
+	if (nanoseconds >= 1e9)
+	{
+		return fmt::format("{:.2f}s", nanoseconds / 1e9);
+	}
+
+	if (nanoseconds >= 1e6)
+	{
+		return fmt::format("{:.2f}ms", nanoseconds / 1e6);
+	}
+
+	if (nanoseconds >= 1e3)
+	{
+		return fmt::format("{:.2f}us", nanoseconds / 1e3);
+	}
+
+	return fmt::format("{:.0f}ns", nanoseconds);
+}
+
+void run_debugged(const Form& form, const std::vector<EntryPoint>& entries)
+{
+	VM       vm{form};
+	Debugger debugger{form, std::cin, std::cout};
+
+	for (auto& entry : entries)
+	{
+		auto result = debugger.run(vm, *entry.script, entry.arguments);
+		fmt::print("{} returned {}\n", entry.script->name, to_string(result));
+
+		vm.reset();
+	}
+}
+
+//! Resets 'vm' for the next run of an entry point.
+void reset_for_next_run(VM& vm, const Options& options)
+{
+	vm.reset();
+
+	if (!options.keep_memoized)
+	{
+		vm.clear_memoized();
+	}
+}
+
+//! Runs 'entry' to completion, in slices of 'budget' if not 0.
+std::optional<Variable>
+run_entry(VM& vm, const EntryPoint& entry, std::size_t budget)
+{
+	if (budget == 0)
+	{
+		return vm.invoke(*entry.script, entry.arguments);
+	}
+
+	auto result = vm.start(*entry.script, entry.arguments, budget);
+	while (result.yielded)
+	{
+		result = vm.resume(budget);
+	}
+
+	return result.value;
+}
+
+//! Returns false when the runs of 'entry' did not all return the same result.
+bool benchmark(
+	ParallelRunner&   runner,
+	const EntryPoint& entry,
+	const Options&    options,
+	Coverage&         coverage)
+{
+	auto threads = runner.thread_count();
+
+	std::vector<f64>        latencies;
+	std::optional<Variable> result;
+	std::mutex              mutex;
+
+	// Results of the first and last run of each thread. The first one always
+	// gets interpreted, while later ones may run promoted code.
+	std::vector<std::pair<std::string, std::string>> results;
+
+	latencies.reserve(options.iterations);
+
+	auto begin = Clock::now();
+
+	for (std::size_t thread = 0; thread < threads; ++thread)
+	{
+		// Split the runs evenly, the first threads taking the remainder
+		auto runs = options.iterations / threads
+			+ (thread < options.iterations % threads ? 1 : 0);
+
+		runner.submit([&, runs](VM& vm) {
+			std::vector<f64>           local_latencies;
+			std::optional<Variable>    local_result;
+			std::optional<std::string> first_result;
+
+			local_latencies.reserve(runs);
+
+			for (std::size_t i = 0; i < options.warmup_iterations; ++i)
+			{
+				auto warmup_result = run_entry(vm, entry, options.budget);
+
+				// Formatted right away, as reset() may free its strings
+				if (!first_result)
+				{
+					first_result = to_string(warmup_result);
+				}
+
+				reset_for_next_run(vm, options);
+			}
+
+			for (std::size_t i = 0; i < runs; ++i)
+			{
+				auto run_begin = Clock::now();
+				local_result   = run_entry(vm, entry, options.budget);
+				auto run_end   = Clock::now();
+
+				local_latencies.push_back(
+					std::chrono::duration<f64, std::nano>(run_end - run_begin)
+						.count());
+
+				if (!first_result)
+				{
+					first_result = to_string(local_result);
+				}
+
+				if (i + 1 < runs)
+				{
+					reset_for_next_run(vm, options);
+				}
+			}
+
+			std::lock_guard lock{mutex};
+
+			if (first_result)
+			{
+				results.emplace_back(*first_result, to_string(local_result));
+			}
+
+			reset_for_next_run(vm, options);
+
+			latencies.insert(
+				latencies.end(), local_latencies.begin(), local_latencies.end());
+
+			if (local_result)
+			{
+				result = local_result;
+			}
+
+			if constexpr (check(debug::vm_coverage))
+			{
+				vm.record_coverage(coverage);
+			}
+		});
+	}
+
+	runner.wait();
+
+	// Includes the warm-up runs, which are usually negligible
+	auto elapsed = std::chrono::duration<f64>(Clock::now() - begin).count();
+
+	std::sort(latencies.begin(), latencies.end());
+
+	auto percentile = [&](f64 p) {
+		if (latencies.empty())
+		{
+			return 0.0;
+		}
+
+		auto index = std::size_t(p * f64(latencies.size() - 1) + 0.5);
+		return latencies[index];
+	};
+
+	fmt::print(
+		"{:<40} {:>8} {:>12.1f} {:>10} {:>10} {:>10} {:>10}  {}\n",
+		entry.script->name,
+		latencies.size(),
+		f64(latencies.size()) / elapsed,
+		to_string(percentile(0.50)),
+		to_string(percentile(0.90)),
+		to_string(percentile(0.99)),
+		to_string(percentile(1.00)),
+		to_string(result));
+
+	for (auto& [first, last] : results)
+	{
+		for (auto* other : {&first, &last})
+		{
+			if (*other != results.front().first)
+			{
+				fmt::print(
+					"{} returned {}, then {}\n",
+					entry.script->name,
+					results.front().first,
+					*other);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+} // namespace
+
+// Benchmarks entry points of a data.win without an interactive runner.
+int main(int argc, char** argv)
+{
+	Options options;
+
+	try
+	{
+		options = parse_options(argc, argv);
+	}
+	catch (const std::runtime_error& e)
+	{
+		fmt::print("{}\n\n{}", e.what(), usage);
+		return 1;
+	}
+
+	std::optional<ReadMappedFile> file;
+
+	try
+	{
+		file.emplace(options.data_path);
+	}
+	catch (const std::runtime_error& e)
+	{
+		fmt::print("Failed: {}\n", e.what());
+		return 1;
+	}
+
+	Form   form;
+	Reader reader{file->data(), file->data() + file->size()};
+	reader >> form;
+
+	bind_everything(form.func);
+
+	// Same as the main runner, use the scripts compiled ahead of time if any
+	auto aot_path = std::filesystem::path{options.data_path}.replace_filename(
+		"data.aot.so");
+
+	std::unique_ptr<AotLibrary> aot_library;
+	if (std::filesystem::exists(aot_path))
+	{
+		try
+		{
+			aot_library = std::make_unique<AotLibrary>(
+				std::filesystem::absolute(aot_path).string());
+			aot_library->bind(form);
+		}
+		catch (const std::runtime_error& e)
+		{
+			fmt::print("Not using '{}': {}\n", aot_path.string(), e.what());
+		}
+	}
+
+	try
+	{
+		std::vector<EntryPoint> entries;
+		for (auto& entry : options.entries)
+		{
+			entries.push_back(parse_entry(form, entry));
+		}
+
+		if (options.debug)
+		{
+			run_debugged(form, entries);
+			return 0;
+		}
+
+		ParallelRunner runner{form, options.threads};
+		Coverage       coverage{form};
+
+		if constexpr (opt::memoize_pure)
+		{
+			fmt::print(
+				"Memoized results of pure scripts are {} between runs\n",
+				options.keep_memoized ? "kept" : "cleared");
+		}
+
+		fmt::print(
+			"{:<40} {:>8} {:>12} {:>10} {:>10} {:>10} {:>10}  {}\n",
+			"script",
+			"runs",
+			"runs/s",
+			"p50",
+			"p90",
+			"p99",
+			"max",
+			"result");
+
+		bool consistent = true;
+		for (auto& entry : entries)
+		{
+			consistent &= benchmark(runner, entry, options, coverage);
+		}
+
+		if constexpr (check(debug::vm_coverage))
+		{
+			auto path = options.data_path + ".coverage";
+			coverage.write(path);
+			fmt::print("Wrote the coverage to '{}'\n", path);
+		}
+
+		if (!consistent)
+		{
+			return 1;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		fmt::print("Failed: {}\n", e.what());
+		return 1;
+	}
+}
@@ -1,6 +1,24 @@
 #pragma once
 
+#include "pvm/bc/jumptable.hpp"
 #include "pvm/unpack/chunk/common.hpp"
+#include <memory>
+
+class ControlFlowGraph;
+class NativeCode;
+
+struct Script;
+
+//! Instruction copied into a script by inlining (see inline_calls()).
+struct InlinedInstruction
+{
+	//! Block offset of the instruction in the script it was inlined into.
+	std::size_t offset;
+
+	//! Script the instruction comes from, and its block offset there.
+	const Script* callee;
+	std::size_t   callee_offset;
+};
 
 //! Script code entry, which contains bytecode data and related metadata.
 struct Script
@@ -11,6 +29,25 @@ struct Script
 
 	std::size_t local_count = 0;
 
+	//! Whether the result of the script only depends on its arguments, and it
+	//! has no side effect (see find_pure_scripts()).
+	bool is_pure = false;
+
+	//! Tables referred to by the opswitch instructions of 'data'.
+	std::vector<JumpTable> jump_tables;
+
+	//! Origin of the instructions inlined from other scripts, sorted by
+	//! offset.
+	std::vector<InlinedInstruction> inlined;
+
+	//! Lazily built by control_flow_graph(). Anything rewriting 'data' in a
+	//! way that alters the control flow must reset it.
+	mutable std::shared_ptr<const ControlFlowGraph> cached_cfg;
+
+	//! Machine code the VM runs instead of interpreting 'data', if any. Only
+	//! set on optimized copies promoted by Tiering.
+	std::shared_ptr<const NativeCode> native_code;
+
 	void debug_print() const
 	{
 		fmt::print("\tCode entry for '{}'\n", name);
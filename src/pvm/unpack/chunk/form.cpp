@@ -1,6 +1,10 @@
 #include "pvm/unpack/chunk/form.hpp"
 
 #include "pvm/bc/names.hpp"
+#include "pvm/bc/opt/inliner.hpp"
+#include "pvm/bc/opt/optimizer.hpp"
+#include "pvm/bc/purity.hpp"
+#include <algorithm>
 #include <fmt/color.h>
 
 void Form::finalize_bytecode()
@@ -9,6 +13,12 @@ void Form::finalize_bytecode()
 	process_variables();
 	process_references();
 	process_functions();
+	process_purity();
+	process_inlining();
+	process_optimizations();
+
+	// Last, as AOT modules embed the inlined bytecode
+	process_checksum();
 }
 
 void Form::process_variables()
@@ -71,8 +81,7 @@ void Form::process_references()
 				    def.occurrences);
 			}
 
-			Script*     last_script       = nullptr;
-			std::size_t same_script_count = 0;
+			Script* last_script = nullptr;
 
 			for (unsigned j = 0; j < def.occurrences; ++j)
 			{
@@ -87,25 +96,15 @@ void Form::process_references()
 					break;
 				}
 
-				if (last_script != nullptr
-				    && (script != last_script || j == def.occurrences - 1))
+				// Once per script, including the ones referring to it once
+				if (script != last_script)
 				{
 					if constexpr (check(debug::verbose_postprocess))
 					{
-						fmt::print("\tOverriden in '{}'\n", script->name, i);
-
-						if (same_script_count != 0)
-						{
-							fmt::print(
-							    "\t... {} times\n", same_script_count + 1);
-						}
+						fmt::print("\tReferred to in '{}'\n", script->name);
 					}
 
-					on_reference_found(def, *last_script);
-				}
-				else
-				{
-					++same_script_count;
+					on_reference_found(def, *script);
 				}
 
 				// Find the relevant block from the offset
@@ -124,9 +123,11 @@ void Form::process_references()
 	};
 
 	process_references_for(vari, [](VariableDefinition& def, Script& script) {
+		// Locals live in the slot 'unknown - 1' of the frame (see VM)
 		if (def.instance_type == -7 && s32(def.unknown) > 0)
 		{
-			++script.local_count;
+			script.local_count
+			    = std::max(script.local_count, std::size_t(def.unknown));
 		}
 	});
 
@@ -155,6 +156,84 @@ void Form::process_functions()
 	}
 }
 
+void Form::process_purity()
+{
+	auto count = find_pure_scripts(*this);
+
+	if constexpr (check(debug::verbose_postprocess))
+	{
+		fmt::print(
+			"Purity: {} out of {} scripts are pure\n",
+			count,
+			code.elements.size());
+
+		for (auto& script : code.elements)
+		{
+			if (script.is_pure)
+			{
+				fmt::print("\t{}\n", script.name);
+			}
+		}
+	}
+}
+
+void Form::process_checksum()
+{
+	// FNV-1a
+	u64 hash = 0xCBF29CE484222325u;
+
+	auto feed = [&](const void* data, std::size_t size) {
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ static_cast<const u8*>(data)[i]) * 0x100000001B3u;
+		}
+	};
+
+	for (auto& script : code.elements)
+	{
+		u64 local_count = script.local_count;
+
+		feed(script.name.data(), script.name.size() + 1);
+		feed(&local_count, sizeof(local_count));
+		feed(script.data.data(), script.data.size() * sizeof(Block));
+	}
+
+	// Inlining adds variables for the locals of inlined scripts
+	for (auto& var : vari.definitions)
+	{
+		feed(var.name.data(), var.name.size() + 1);
+	}
+
+	bytecode_checksum = hash;
+}
+
+void Form::process_inlining()
+{
+	if constexpr (opt::inline_scripts)
+	{
+		auto count = inline_calls(*this);
+
+		if constexpr (check(debug::verbose_postprocess))
+		{
+			fmt::print("Inliner: inlined {} calls\n", count);
+		}
+	}
+}
+
+void Form::process_optimizations()
+{
+	// Hot scripts get optimized on demand instead, see Tiering
+	if constexpr (opt::tiered)
+	{
+		return;
+	}
+
+	for (auto& script : code.elements)
+	{
+		optimize(script);
+	}
+}
+
 void user_reader(Form& form, Reader& reader)
 {
 	const ChunkHeader form_header = reader();
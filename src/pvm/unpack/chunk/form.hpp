@@ -3,6 +3,9 @@
 #include "pvm/unpack/chunk/common.hpp"
 #include "pvm/unpack/decode.hpp"
 
+//! Unpacked data.win. Once finalize_bytecode() ran and builtins (and AOT
+//! modules) are bound, the form is only read from, and may be shared by VMs
+//! running on different threads.
 struct Form
 {
 	Gen8 gen8;
@@ -28,11 +31,20 @@ struct Form
 	Txtr txtr;
 	Audo audo;
 
+	//! Hash of the finalized bytecode of every script and of the variables
+	//! it refers to, which identifies the data.win and the settings AOT
+	//! modules were built with.
+	u64 bytecode_checksum = 0;
+
 	void finalize_bytecode();
 
 	void process_variables();
 	void process_references();
 	void process_functions();
+	void process_purity();
+	void process_checksum();
+	void process_inlining();
+	void process_optimizations();
 };
 
 void user_reader(Form& form, Reader& reader);
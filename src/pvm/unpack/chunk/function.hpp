@@ -3,6 +3,9 @@
 #include "pvm/vm/builtin.hpp"
 #include "pvm/unpack/chunk/code.hpp"
 #include "pvm/unpack/chunk/common.hpp"
+#include <optional>
+
+struct NativeFunction;
 
 // See VariableDefinition for an explanation on some of the fields below
 struct FunctionDefinition
@@ -12,9 +15,17 @@ struct FunctionDefinition
 	u32 first_address;
 
 	bool is_builtin;
-	Script* associated_script;
+	const Script* associated_script;
 	GenericBuiltin* associated_builtin;
 
+	//! Amount of arguments 'associated_builtin' requires, if it is a typed
+	//! builtin (see TypedBuiltin), checked by the VM before calling it.
+	std::optional<u16> builtin_arity;
+
+	//! Ahead-of-time compiled version of 'associated_script', which takes
+	//! precedence over it when set (see AotLibrary).
+	const NativeFunction* associated_native = nullptr;
+
 	void debug_print() const
 	{
 		fmt::print("\tFunction {}\n", name);
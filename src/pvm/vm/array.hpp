@@ -0,0 +1,9 @@
+#pragma once
+
+struct HeapArray;
+
+//! Array value, referencing a copy-on-write array of the Heap of the VM.
+struct ArrayReference
+{
+	HeapArray* array = nullptr;
+};
@@ -38,7 +38,9 @@ inline const Block& BlockReader::current_block() const
 inline const Block& BlockReader::next_block()
 {
 	// TODO: fix this check
-	if (out_of_bounds())
+	// Jumping to the first block leaves the reader one block before it,
+	// which wraps around.
+	if (_offset + 1 > _end)
 	{
 		maybe_unreachable("VM unexpectedly reached end of program");
 	}
@@ -16,6 +16,12 @@ void bind(Func& func_chunk, std::string_view name)
 		func_chunk.definitions.end(),
 		[name](FunctionDefinition& def) { return def.name == name; });
 
+	// Forms only define the functions their code calls
+	if (func_it == func_chunk.definitions.end())
+	{
+		return;
+	}
+
 	if constexpr (check(debug::verbose_postprocess))
 	{
 		fmt::print(
@@ -30,6 +36,7 @@ void bind(Func& func_chunk, std::string_view name)
 	}
 	else
 	{
-		func_it->associated_builtin = std_wrapper<BindFunc>;
+		func_it->associated_builtin = TypedBuiltin<BindFunc>::run;
+		func_it->builtin_arity      = TypedBuiltin<BindFunc>::arity;
 	}
 }
@@ -1,34 +1,123 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
+#include <string_view>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 #include "pvm/bc/types.hpp"
+#include "pvm/vm/traits/datatype.hpp"
 #include "pvm/vm/traits/funcinfo.hpp"
 #include "pvm/vm/vm.hpp"
 
+//! Builtin calling 'Func', a plain C++ function, with the arguments of the
+//! call converted to its parameter types (see VM::argument()).
+//!
+//! Arguments are read where they lie on the stack, each with the conversion
+//! its parameter type needs, rather than popped through pop_dispatch(). The
+//! amount of arguments is known from the signature, and checked by the VM
+//! before calling it (see FunctionDefinition::builtin_arity).
+//!
+//! 'Func' may take the VM as its first parameter. It may return nothing,
+//! which is returned as 0, a number, which includes booleans as 0 or 1, a
+//! Variable, a StringReference, an ArrayReference or a std::string, which is
+//! allocated on the heap.
 template<auto Func>
-inline auto std_wrapper = [](VM& vm, const Frame& frame) {
-	using FuncSignature = std::remove_pointer_t<decltype(Func)>;
-	using FuncInfo = func_info<FuncSignature>;
+struct TypedBuiltin
+{
+	using Info       = func_info<std::remove_pointer_t<decltype(Func)>>;
+	using Parameters = typename Info::args_type;
+	using Result     = typename Info::return_type;
 
-	if (frame.argument_count != std::tuple_size_v<typename FuncInfo::args_type>)
-	{
-		exit(0);
-	}
+	static constexpr bool takes_vm = [] {
+		if constexpr (std::tuple_size_v<Parameters> != 0)
+		{
+			return std::is_same_v<std::tuple_element_t<0, Parameters>, VM&>;
+		}
+		else
+		{
+			return false;
+		}
+	}();
 
-	auto fill_params = [&](auto... params)
+	//! Amount of arguments scripts pass.
+	static constexpr std::size_t arity
+		= std::tuple_size_v<Parameters> - (takes_vm ? 1 : 0);
+
+	static void run(VM& vm)
 	{
-		return std::tuple{vm.read_variable_parameter<decltype(params)>()...};
-	};
+		auto arguments = std::make_index_sequence<arity>{};
 
-	auto ret = std::apply(Func, std::apply(fill_params, typename FuncInfo::args_type{}));
+		if constexpr (std::is_void_v<Result>)
+		{
+			call(vm, arguments);
+			vm.drop_arguments();
+			vm.push_stack_variable(s32(0));
+		}
+		else
+		{
+			// Read before dropping, as strings may be views of the arguments
+			Result result = call(vm, arguments);
+			vm.drop_arguments();
+			push(vm, std::move(result));
+		}
+	}
 
-	if constexpr (std::is_same_v<typename FuncInfo::return_type, void>)
+	private:
+	template<std::size_t I>
+	using Argument = std::decay_t<
+		std::tuple_element_t<I + (takes_vm ? 1 : 0), Parameters>>;
+
+	template<std::size_t... Is>
+	static Result call(VM& vm, std::index_sequence<Is...>)
 	{
-		vm.push_stack_variable(s32(0));
+		if constexpr (takes_vm)
+		{
+			return Func(vm, vm.argument<Argument<Is>>(Is)...);
+		}
+		else
+		{
+			(void)vm;
+			return Func(vm.argument<Argument<Is>>(Is)...);
+		}
 	}
-	else
+
+	static void push(VM& vm, Result result)
 	{
-		vm.push_stack_variable(ret);
+		if constexpr (std::is_same_v<Result, bool>)
+		{
+			vm.push_stack_variable(s32(result));
+		}
+		else if constexpr (std::is_same_v<Result, Variable>)
+		{
+			vm.push_variable(result);
+		}
+		else if constexpr (
+			std::is_same_v<Result, std::string>
+			|| std::is_same_v<Result, std::string_view>)
+		{
+			vm.push_stack_variable(vm.make_string(result));
+		}
+		else if constexpr (
+			std::is_same_v<Result, StringReference>
+			|| std::is_same_v<Result, ArrayReference>)
+		{
+			vm.push_stack_variable(result);
+		}
+		else
+		{
+			static_assert(
+				std::is_arithmetic_v<Result>, "Unsupported type of result");
+
+			if constexpr (data_type_for<Result>::value != DataType::var)
+			{
+				vm.push_stack_variable(result);
+			}
+			else
+			{
+				vm.push_stack_variable(f64(result));
+			}
+		}
 	}
 };
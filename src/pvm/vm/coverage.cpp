@@ -0,0 +1,140 @@
+#include "pvm/vm/coverage.hpp"
+
+#include "pvm/bc/cfg.hpp"
+#include "pvm/bc/disasm.hpp"
+#include "pvm/bc/instruction.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <fstream>
+#include <stdexcept>
+
+Coverage::Coverage(const Form& form) : _form{form}
+{
+	if constexpr (check(debug::vm_coverage))
+	{
+		_hits.resize(form.code.elements.size());
+	}
+}
+
+void Coverage::merge(const Coverage& other)
+{
+	_hits.resize(std::max(_hits.size(), other._hits.size()));
+
+	for (std::size_t i = 0; i < other._hits.size(); ++i)
+	{
+		auto& hits = _hits[i];
+		auto& from = other._hits[i];
+
+		if (hits.size() < from.size())
+		{
+			hits.resize(from.size());
+		}
+
+		for (std::size_t offset = 0; offset < from.size(); ++offset)
+		{
+			hits[offset] |= from[offset];
+		}
+	}
+}
+
+std::vector<bool> Coverage::covered_blocks(std::size_t index) const
+{
+	const auto& script = _form.code.elements[index];
+	const auto& cfg    = control_flow_graph(script);
+
+	std::vector<bool> covered(cfg.blocks.size());
+	if (index >= _hits.size() || _hits[index].empty())
+	{
+		return covered;
+	}
+
+	const auto& hits = _hits[index];
+
+	// Blocks come in bytecode order, so a block is known to have run by the
+	// time the one it falls through into is looked at
+	bool falls_through = false;
+
+	for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+	{
+		auto& block = cfg.blocks[i];
+		covered[i]  = hits[block.begin] != 0 || falls_through;
+
+		std::size_t last = block.begin;
+		for (std::size_t offset = block.begin; offset < block.end;
+			 offset += instruction_size(&script.data[offset]))
+		{
+			last = offset;
+		}
+
+		// Conditional branches record the block they fall through into, and
+		// the other terminators do not fall through
+		auto opcode   = instr_opcode(script.data[last]);
+		falls_through = covered[i] && !is_branch(opcode)
+			&& opcode != Instr::opret && opcode != Instr::opexit
+			&& opcode != Instr::opswitch;
+	}
+
+	return covered;
+}
+
+void Coverage::write(const std::string& path) const
+{
+	Disassembler            disassembler{_form};
+	DisassembledInstruction disasm;
+
+	std::string text;
+	std::size_t total_blocks = 0, total_covered = 0;
+
+	auto& scripts = _form.code.elements;
+	for (std::size_t i = 0; i < scripts.size(); ++i)
+	{
+		auto& script  = scripts[i];
+		auto  covered = covered_blocks(i);
+		auto& blocks  = control_flow_graph(script).blocks;
+
+		auto count
+			= std::size_t(std::count(covered.begin(), covered.end(), true));
+		total_blocks += blocks.size();
+		total_covered += count;
+
+		fmt::format_to(
+			std::back_inserter(text),
+			".script {} ; {} of {} basic blocks covered\n",
+			script.name,
+			count,
+			blocks.size());
+
+		std::size_t block_index = 0;
+		for (const Block* block = script.data.data();
+			 block != script.data.data() + script.data.size();)
+		{
+			auto offset = std::size_t(block - script.data.data());
+
+			if (block_index < blocks.size()
+				&& blocks[block_index].begin == offset)
+			{
+				text += covered[block_index] ? "; covered\n" : "; not covered\n";
+				++block_index;
+			}
+
+			disassembler.disassemble_block(block, &script, disasm);
+			disasm.append_plain_string(text);
+			text += '\n';
+			block = disasm.end_block;
+		}
+
+		text += '\n';
+	}
+
+	fmt::format_to(
+		std::back_inserter(text),
+		"; {} of {} basic blocks covered\n",
+		total_covered,
+		total_blocks);
+
+	std::ofstream file{path, std::ios::binary};
+	if (!file.write(text.data(), std::streamsize(text.size())))
+	{
+		throw std::runtime_error{fmt::format("Failed to write '{}'", path)};
+	}
+}
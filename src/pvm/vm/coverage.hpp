@@ -0,0 +1,63 @@
+#pragma once
+
+#include "pvm/unpack/chunk/form.hpp"
+#include <string>
+#include <vector>
+
+//! Records which basic blocks of the scripts of a form ran (see
+//! debug::vm_coverage).
+//!
+//! Each script gets a map with a byte per block of bytecode, which the VM sets
+//! when entering a basic block: on script entry, on taken branches and
+//! switches, and past conditional branches that were not taken. Basic blocks
+//! that are entered by falling through the previous one are deduced from it
+//! when writing the report, so that the cost is one store per basic block
+//! rather than per instruction.
+class Coverage
+{
+	public:
+	explicit Coverage(const Form& form);
+
+	//! Returns the map of 'script', or nullptr when it is not a non-empty
+	//! script of the form (e.g. an optimized copy).
+	[[nodiscard]] u8* hits_of(const Script& script);
+
+	//! Adds the basic blocks 'other' saw running.
+	void merge(const Coverage& other);
+
+	//! Returns whether each basic block of the control flow graph of the
+	//! script at 'index' in the form ran.
+	[[nodiscard]] std::vector<bool> covered_blocks(std::size_t index) const;
+
+	//! Writes the listing of every script of the form (see
+	//! Disassembler::listing()) to the file at 'path', with a comment before
+	//! each basic block telling whether it ran.
+	//! @throws std::runtime_error when the file cannot be written.
+	void write(const std::string& path) const;
+
+	private:
+	const Form& _form;
+
+	//! Map of each script of the form, allocated on its first run. Maps have
+	//! an extra byte for branches to the end of the script.
+	std::vector<std::vector<u8>> _hits;
+};
+
+inline u8* Coverage::hits_of(const Script& script)
+{
+	const auto& scripts = _form.code.elements;
+
+	if (scripts.empty() || &script < &scripts.front()
+		|| &script > &scripts.back() || script.data.empty())
+	{
+		return nullptr;
+	}
+
+	auto& hits = _hits[std::size_t(&script - scripts.data())];
+	if (hits.empty())
+	{
+		hits.resize(script.data.size() + 1);
+	}
+
+	return hits.data();
+}
@@ -0,0 +1,413 @@
+#include "pvm/vm/datastructures.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+//! Mixes all the bits of 'bits' into the low ones, as the low bits of keys
+//! are often all zero: those of integral f64 and of aligned addresses.
+u64 mix(u64 bits)
+{
+	bits ^= bits >> 30;
+	bits *= 0xBF58476D1CE4E5B9;
+	bits ^= bits >> 27;
+	bits *= 0x94D049BB133111EB;
+	bits ^= bits >> 31;
+	return bits;
+}
+} // namespace
+
+const Variable* DsMap::find(DsKey key) const
+{
+	if (_size == 0)
+	{
+		return nullptr;
+	}
+
+	auto& slot = _slots[slot_of(key)];
+	return slot.kind != 0 ? &slot.value : nullptr;
+}
+
+void DsMap::set(DsKey key, const Variable& value)
+{
+	if ((_size + 1) * 4 > _slots.size() * 3)
+	{
+		grow();
+	}
+
+	auto& slot = _slots[slot_of(key)];
+	if (slot.kind == 0)
+	{
+		slot.bits = key.bits;
+		slot.kind = u8(key.kind);
+		++_size;
+	}
+
+	slot.value = value;
+}
+
+bool DsMap::add(DsKey key, const Variable& value)
+{
+	if ((_size + 1) * 4 > _slots.size() * 3)
+	{
+		grow();
+	}
+
+	auto& slot = _slots[slot_of(key)];
+	if (slot.kind != 0)
+	{
+		return false;
+	}
+
+	slot = {value, key.bits, u8(key.kind)};
+	++_size;
+	return true;
+}
+
+bool DsMap::erase(DsKey key)
+{
+	if (_size == 0)
+	{
+		return false;
+	}
+
+	auto mask = _slots.size() - 1;
+	auto hole = slot_of(key);
+
+	if (_slots[hole].kind == 0)
+	{
+		return false;
+	}
+
+	for (auto i = (hole + 1) & mask; _slots[i].kind != 0; i = (i + 1) & mask)
+	{
+		// Moves back the entries whose probe sequence goes over the hole
+		auto home = home_of({_slots[i].bits, DsKey::Kind(_slots[i].kind)});
+		if (((i - home) & mask) >= ((i - hole) & mask))
+		{
+			_slots[hole] = std::move(_slots[i]);
+			hole         = i;
+		}
+	}
+
+	_slots[hole] = {};
+	--_size;
+	return true;
+}
+
+void DsMap::clear()
+{
+	std::fill(_slots.begin(), _slots.end(), Slot{});
+	_size = 0;
+}
+
+std::size_t DsMap::slot_of(DsKey key) const
+{
+	auto mask = _slots.size() - 1;
+
+	for (auto i = home_of(key);; i = (i + 1) & mask)
+	{
+		auto& slot = _slots[i];
+		if (slot.kind == 0
+			|| (slot.bits == key.bits && slot.kind == u8(key.kind)))
+		{
+			return i;
+		}
+	}
+}
+
+std::size_t DsMap::home_of(DsKey key) const
+{
+	return std::size_t(mix(key.bits ^ u64(key.kind))) & (_slots.size() - 1);
+}
+
+void DsMap::grow()
+{
+	auto slots = std::exchange(
+		_slots, std::vector<Slot>(std::max<std::size_t>(_slots.size() * 2, 8)));
+
+	for (auto& slot : slots)
+	{
+		if (slot.kind != 0)
+		{
+			_slots[slot_of({slot.bits, DsKey::Kind(slot.kind)})]
+				= std::move(slot);
+		}
+	}
+}
+
+void DsPriority::add(const Variable& value, f64 priority)
+{
+	auto index = _elements.size();
+	_elements.push_back(
+		{priority, _sequence++, value, _max_heap.size(), _min_heap.size()});
+
+	_max_heap.push_back(index);
+	_min_heap.push_back(index);
+	sift_up<true>(_max_heap.size() - 1);
+	sift_up<false>(_min_heap.size() - 1);
+}
+
+const Variable* DsPriority::find_max() const
+{
+	return _elements.empty() ? nullptr : &_elements[_max_heap.front()].value;
+}
+
+const Variable* DsPriority::find_min() const
+{
+	return _elements.empty() ? nullptr : &_elements[_min_heap.front()].value;
+}
+
+Variable DsPriority::delete_max()
+{
+	return remove(_max_heap.front());
+}
+
+Variable DsPriority::delete_min()
+{
+	return remove(_min_heap.front());
+}
+
+void DsPriority::clear()
+{
+	_elements.clear();
+	_max_heap.clear();
+	_min_heap.clear();
+}
+
+template<bool Max>
+bool DsPriority::before(const Element& a, const Element& b)
+{
+	if (a.priority != b.priority)
+	{
+		return Max ? a.priority > b.priority : a.priority < b.priority;
+	}
+
+	return a.sequence < b.sequence;
+}
+
+template<bool Max>
+std::vector<std::size_t>& DsPriority::heap()
+{
+	if constexpr (Max)
+	{
+		return _max_heap;
+	}
+	else
+	{
+		return _min_heap;
+	}
+}
+
+template<bool Max>
+std::size_t& DsPriority::position(Element& element)
+{
+	return Max ? element.max_position : element.min_position;
+}
+
+Variable DsPriority::remove(std::size_t index)
+{
+	erase<true>(_elements[index].max_position);
+	erase<false>(_elements[index].min_position);
+
+	auto value = std::move(_elements[index].value);
+
+	// Fill the hole with the last element, whose heap entries follow it
+	if (index != _elements.size() - 1)
+	{
+		auto& moved = _elements[index] = std::move(_elements.back());
+		_max_heap[moved.max_position]  = index;
+		_min_heap[moved.min_position]  = index;
+	}
+
+	_elements.pop_back();
+	return value;
+}
+
+template<bool Max>
+void DsPriority::erase(std::size_t at)
+{
+	auto& entries = heap<Max>();
+
+	auto last = entries.back();
+	entries.pop_back();
+
+	if (at < entries.size())
+	{
+		entries[at]                    = last;
+		position<Max>(_elements[last]) = at;
+		sift_down<Max>(at);
+		sift_up<Max>(position<Max>(_elements[last]));
+	}
+}
+
+template<bool Max>
+void DsPriority::sift_up(std::size_t at)
+{
+	// Moves parents down into the hole rather than swapping
+	auto& entries = heap<Max>();
+	auto  index   = entries[at];
+
+	while (at != 0)
+	{
+		auto parent = (at - 1) / 2;
+		if (!before<Max>(_elements[index], _elements[entries[parent]]))
+		{
+			break;
+		}
+
+		entries[at]                           = entries[parent];
+		position<Max>(_elements[entries[at]]) = at;
+		at                                    = parent;
+	}
+
+	entries[at]                     = index;
+	position<Max>(_elements[index]) = at;
+}
+
+template<bool Max>
+void DsPriority::sift_down(std::size_t at)
+{
+	auto& entries = heap<Max>();
+	auto  index   = entries[at];
+
+	for (;;)
+	{
+		auto child = at * 2 + 1;
+		if (child >= entries.size())
+		{
+			break;
+		}
+
+		if (child + 1 < entries.size()
+			&& before<Max>(
+				_elements[entries[child + 1]], _elements[entries[child]]))
+		{
+			++child;
+		}
+
+		if (!before<Max>(_elements[entries[child]], _elements[index]))
+		{
+			break;
+		}
+
+		entries[at]                           = entries[child];
+		position<Max>(_elements[entries[at]]) = at;
+		at                                    = child;
+	}
+
+	entries[at]                     = index;
+	position<Max>(_elements[index]) = at;
+}
+
+void DsGrid::resize(std::size_t width, std::size_t height)
+{
+	std::vector<f64> cells(width * height);
+
+	auto kept_height = std::min(height, _height);
+	for (std::size_t x = 0; x < std::min(width, _width); ++x)
+	{
+		std::copy_n(&_cells[x * _height], kept_height, &cells[x * height]);
+	}
+
+	_cells  = std::move(cells);
+	_width  = width;
+	_height = height;
+}
+
+f64* DsGrid::cell(f64 x, f64 y)
+{
+	if (!(x >= 0.0 && y >= 0.0 && x < f64(_width) && y < f64(_height)))
+	{
+		return nullptr;
+	}
+
+	return &_cells[std::size_t(x) * _height + std::size_t(y)];
+}
+
+DsKey DataStructures::key(const Variable& value)
+{
+	if (auto* string = std::get_if<StringReference>(&value.data))
+	{
+		auto* text = string->string;
+
+		if (text->interned == nullptr)
+		{
+			// The first string used as a key becomes the interned one
+			text->interned = _interned.try_emplace(text->view(), text)
+								 .first->second;
+		}
+
+		return {
+			u64(reinterpret_cast<std::uintptr_t>(text->interned)),
+			DsKey::Kind::string};
+	}
+
+	auto number = as_number(value);
+	if (!number)
+	{
+		throw std::runtime_error{"Map keys must be numbers or strings"};
+	}
+
+	// Adding 0 turns -0 into 0, which is the same key
+	auto normalized = *number + 0.0;
+
+	u64 bits;
+	std::memcpy(&bits, &normalized, sizeof(bits));
+	return {bits, DsKey::Kind::number};
+}
+
+void DataStructures::share(const Variable& value)
+{
+	if (auto* array = std::get_if<ArrayReference>(&value.data))
+	{
+		++array->array->shares;
+	}
+}
+
+void DataStructures::mark(Heap& heap) const
+{
+	auto mark_values = [&](const auto& values) {
+		for (auto& value : values)
+		{
+			heap.mark(value);
+		}
+	};
+
+	maps.for_each([&](const DsMap& map) {
+		map.for_each([&](DsKey, const Variable& value) { heap.mark(value); });
+	});
+
+	lists.for_each(mark_values);
+	stacks.for_each(mark_values);
+	queues.for_each(mark_values);
+
+	priorities.for_each([&](const DsPriority& priority) {
+		priority.for_each([&](const Variable& value) { heap.mark(value); });
+	});
+
+	// Map keys only hold the address of these
+	for (auto& [text, string] : _interned)
+	{
+		heap.mark(string);
+	}
+}
+
+void DataStructures::reset(Heap& heap)
+{
+	maps.clear();
+	lists.clear();
+	stacks.clear();
+	queues.clear();
+	priorities.clear();
+	grids.clear();
+
+	if (!_interned.empty())
+	{
+		heap.forget_interned();
+		_interned.clear();
+	}
+}
@@ -0,0 +1,433 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include "pvm/vm/heap.hpp"
+#include "pvm/vm/variable.hpp"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <fmt/core.h>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+//! Key of a DsMap, i.e. a number or an interned string.
+struct DsKey
+{
+	enum class Kind : u8
+	{
+		number = 1,
+		string
+	};
+
+	//! Bits of the f64 of numbers, address of the interned string otherwise.
+	u64  bits;
+	Kind kind;
+
+	[[nodiscard]] bool operator==(const DsKey& other) const;
+};
+
+//! Hash map of ds_map_*, with open addressing and linear probing. Erased
+//! entries are replaced by moving back the following entries of their probe
+//! sequence, so that no tombstone is left behind.
+class DsMap
+{
+	public:
+	[[nodiscard]] const Variable* find(DsKey key) const;
+
+	//! Inserts 'value' at 'key', or replaces the value there.
+	void set(DsKey key, const Variable& value);
+
+	//! Inserts 'value' at 'key', unless it is there already.
+	//! @returns whether it was inserted.
+	bool add(DsKey key, const Variable& value);
+
+	//! @returns whether 'key' was there.
+	bool erase(DsKey key);
+
+	void clear();
+
+	[[nodiscard]] std::size_t size() const;
+
+	//! Calls 'f' on the key and the value of each entry.
+	template<class F>
+	void for_each(F f) const;
+
+	private:
+	struct Slot
+	{
+		Variable value;
+		u64      bits;
+
+		//! Kind of the key, 0 for empty slots.
+		u8 kind = 0;
+	};
+
+	//! Power of two slots, filled to at most 3/4.
+	std::vector<Slot> _slots;
+	std::size_t       _size = 0;
+
+	//! Returns the slot holding 'key', or the empty one ending its probe
+	//! sequence. There must be slots.
+	[[nodiscard]] std::size_t slot_of(DsKey key) const;
+
+	//! Slot where the probe sequence of 'key' begins.
+	[[nodiscard]] std::size_t home_of(DsKey key) const;
+
+	void grow();
+};
+
+//! Values by priority, of ds_priority_*, kept in a max-heap and a min-heap.
+//! Values of equal priority come out in insertion order.
+class DsPriority
+{
+	public:
+	void add(const Variable& value, f64 priority);
+
+	//! Returns the element of highest or lowest priority, if any.
+	[[nodiscard]] const Variable* find_max() const;
+	[[nodiscard]] const Variable* find_min() const;
+
+	//! Removes the element of highest or lowest priority, and returns it.
+	//! There must be elements.
+	Variable delete_max();
+	Variable delete_min();
+
+	void clear();
+
+	[[nodiscard]] std::size_t size() const;
+
+	template<class F>
+	void for_each(F f) const;
+
+	private:
+	struct Element
+	{
+		f64      priority;
+		u64      sequence;
+		Variable value;
+
+		//! Positions of the element in the max and min heaps.
+		std::size_t max_position, min_position;
+	};
+
+	//! Elements in no particular order, and two heaps of indices into them:
+	//! one with the highest priority on top, one with the lowest, so that
+	//! both ends are found in O(1) and removed in O(log n). Ties come out in
+	//! insertion order from both ends.
+	std::vector<Element>     _elements;
+	std::vector<std::size_t> _max_heap, _min_heap;
+	u64                      _sequence = 0;
+
+	//! Whether 'a' comes out before 'b' from the top of the max or min heap.
+	template<bool Max>
+	[[nodiscard]] static bool before(const Element& a, const Element& b);
+
+	template<bool Max>
+	[[nodiscard]] std::vector<std::size_t>& heap();
+
+	template<bool Max>
+	[[nodiscard]] static std::size_t& position(Element& element);
+
+	//! Removes the element at 'index' of '_elements', and returns it.
+	Variable remove(std::size_t index);
+
+	//! Removes the entry at 'position' of a heap.
+	template<bool Max>
+	void erase(std::size_t position);
+
+	template<bool Max>
+	void sift_up(std::size_t position);
+
+	template<bool Max>
+	void sift_down(std::size_t position);
+};
+
+//! Grid of numbers of ds_grid_*. Cells are stored column by column, so that
+//! the cells of a region or a disk are a contiguous span per column, which
+//! operations process with the kernels of grid_kernels().
+class DsGrid
+{
+	public:
+	[[nodiscard]] std::size_t width() const;
+	[[nodiscard]] std::size_t height() const;
+
+	//! Keeps the cells within both sizes. New cells are 0.
+	void resize(std::size_t width, std::size_t height);
+
+	//! Returns the cell at 'x' and 'y', or nullptr when it is out of the grid.
+	[[nodiscard]] f64* cell(f64 x, f64 y);
+
+	//! Calls 'f(data, count)' on the span of each column of the region with
+	//! corners 'x1','y1' and 'x2','y2' (inclusive, in any order), clipped to
+	//! the grid. A region spanning whole columns is a single span.
+	template<class F>
+	void for_each_region_span(f64 x1, f64 y1, f64 x2, f64 y2, F f);
+
+	//! Same as above, for the cells within 'radius' of 'x','y'.
+	template<class F>
+	void for_each_disk_span(f64 x, f64 y, f64 radius, F f);
+
+	private:
+	std::size_t      _width = 0, _height = 0;
+	std::vector<f64> _cells;
+
+	//! Converts 'value' to a coordinate of a cell, saturating far out of
+	//! any grid rather than overflowing.
+	[[nodiscard]] static s64 coordinate(f64 value);
+
+	//! Calls 'f' on the span of column 'x' from row 'y1' to 'y2', clipped
+	//! to the grid.
+	template<class F>
+	void column_span(s64 x, s64 y1, s64 y2, F& f);
+};
+
+//! Containers of a kind, referred to by index from the scripts, like in
+//! GameMaker. Indices of destroyed containers get reused.
+template<class T>
+class DsPool
+{
+	public:
+	explicit DsPool(const char* name);
+
+	//! @returns the index of the new container.
+	s32 create();
+
+	//! @throws std::runtime_error when there is no container at 'index'.
+	void destroy(s32 index);
+
+	//! @throws std::runtime_error when there is no container at 'index'.
+	[[nodiscard]] T& operator[](s32 index);
+
+	//! Calls 'f' on each container.
+	template<class F>
+	void for_each(F f) const;
+
+	//! Destroys every container.
+	void clear();
+
+	private:
+	//! Name of the kind of container, for errors.
+	const char* _name;
+
+	std::vector<T>    _containers;
+	std::vector<bool> _exists;
+	std::vector<s32>  _free;
+};
+
+//! Containers of the ds_* builtins of a VM, whose values the garbage
+//! collector needs to see (see mark()).
+//!
+//! Map keys are either numbers or interned strings, so that keys compare and
+//! hash by address. Strings used as keys are interned for as long as the VM
+//! is not reset, and remember the interned string they are equal to (see
+//! HeapString::interned), so that looking up with a constant key is as
+//! cheap as with a number.
+class DataStructures
+{
+	public:
+	DsPool<DsMap>                 maps{"ds_map"};
+	DsPool<std::vector<Variable>> lists{"ds_list"};
+	DsPool<std::vector<Variable>> stacks{"ds_stack"};
+	DsPool<std::deque<Variable>>  queues{"ds_queue"};
+	DsPool<DsPriority>            priorities{"ds_priority"};
+	DsPool<DsGrid>                grids{"ds_grid"};
+
+	//! Returns the map key for 'value'.
+	//! @throws std::runtime_error when it is neither a number nor a string.
+	[[nodiscard]] DsKey key(const Variable& value);
+
+	//! Counts 'value' as shared when it is an array, as containers holding
+	//! it never release it (see HeapArray::shares).
+	static void share(const Variable& value);
+
+	//! Marks the values held by the containers, and the interned strings.
+	void mark(Heap& heap) const;
+
+	//! Destroys every container and forgets the interned strings.
+	void reset(Heap& heap);
+
+	private:
+	std::unordered_map<std::string_view, const HeapString*> _interned;
+};
+
+inline bool DsKey::operator==(const DsKey& other) const
+{
+	return bits == other.bits && kind == other.kind;
+}
+
+inline std::size_t DsMap::size() const
+{
+	return _size;
+}
+
+template<class F>
+void DsMap::for_each(F f) const
+{
+	for (auto& slot : _slots)
+	{
+		if (slot.kind != 0)
+		{
+			f(DsKey{slot.bits, DsKey::Kind(slot.kind)}, slot.value);
+		}
+	}
+}
+
+inline std::size_t DsPriority::size() const
+{
+	return _elements.size();
+}
+
+template<class F>
+void DsPriority::for_each(F f) const
+{
+	for (auto& element : _elements)
+	{
+		f(element.value);
+	}
+}
+
+inline std::size_t DsGrid::width() const
+{
+	return _width;
+}
+
+inline std::size_t DsGrid::height() const
+{
+	return _height;
+}
+
+template<class F>
+void DsGrid::for_each_region_span(f64 x1, f64 y1, f64 x2, f64 y2, F f)
+{
+	auto left   = coordinate(std::fmin(x1, x2));
+	auto right  = coordinate(std::fmax(x1, x2));
+	auto top    = coordinate(std::fmin(y1, y2));
+	auto bottom = coordinate(std::fmax(y1, y2));
+
+	if (left <= 0 && right >= s64(_width) - 1 && top <= 0
+		&& bottom >= s64(_height) - 1)
+	{
+		if (!_cells.empty())
+		{
+			f(_cells.data(), _cells.size());
+		}
+
+		return;
+	}
+
+	for (auto x = std::max<s64>(left, 0); x <= right && x < s64(_width); ++x)
+	{
+		column_span(x, top, bottom, f);
+	}
+}
+
+template<class F>
+void DsGrid::for_each_disk_span(f64 x, f64 y, f64 radius, F f)
+{
+	if (!(radius >= 0.0))
+	{
+		return;
+	}
+
+	auto left  = std::max<s64>(coordinate(std::ceil(x - radius)), 0);
+	auto right = coordinate(std::floor(x + radius));
+
+	for (auto column = left; column <= right && column < s64(_width);
+		 ++column)
+	{
+		// Rounding may take the columns at the edges slightly out of the disk
+		auto distance = f64(column) - x;
+		auto half
+			= std::sqrt(std::fmax(radius * radius - distance * distance, 0.0));
+
+		column_span(
+			column,
+			coordinate(std::ceil(y - half)),
+			coordinate(std::floor(y + half)),
+			f);
+	}
+}
+
+inline s64 DsGrid::coordinate(f64 value)
+{
+	// std::fmax() also maps NaN to the lower bound
+	constexpr f64 bound = 1e15;
+	return s64(std::fmin(std::fmax(value, -bound), bound));
+}
+
+template<class F>
+void DsGrid::column_span(s64 x, s64 y1, s64 y2, F& f)
+{
+	y1 = std::max<s64>(y1, 0);
+	y2 = std::min<s64>(y2, s64(_height) - 1);
+
+	if (y1 <= y2)
+	{
+		f(&_cells[std::size_t(x) * _height + std::size_t(y1)],
+		  std::size_t(y2 - y1 + 1));
+	}
+}
+
+template<class T>
+DsPool<T>::DsPool(const char* name) : _name{name}
+{}
+
+template<class T>
+s32 DsPool<T>::create()
+{
+	if (!_free.empty())
+	{
+		auto index = _free.back();
+		_free.pop_back();
+		_exists[std::size_t(index)] = true;
+		return index;
+	}
+
+	_containers.emplace_back();
+	_exists.push_back(true);
+	return s32(_containers.size() - 1);
+}
+
+template<class T>
+void DsPool<T>::destroy(s32 index)
+{
+	(*this)[index] = T{};
+	_exists[std::size_t(index)] = false;
+	_free.push_back(index);
+}
+
+template<class T>
+T& DsPool<T>::operator[](s32 index)
+{
+	if (index < 0 || std::size_t(index) >= _containers.size()
+		|| !_exists[std::size_t(index)])
+	{
+		throw std::runtime_error{
+			fmt::format("{} {} does not exist", _name, index)};
+	}
+
+	return _containers[std::size_t(index)];
+}
+
+template<class T>
+template<class F>
+void DsPool<T>::for_each(F f) const
+{
+	for (std::size_t i = 0; i < _containers.size(); ++i)
+	{
+		if (_exists[i])
+		{
+			f(_containers[i]);
+		}
+	}
+}
+
+template<class T>
+void DsPool<T>::clear()
+{
+	_containers.clear();
+	_exists.clear();
+	_free.clear();
+}
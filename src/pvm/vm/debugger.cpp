@@ -0,0 +1,745 @@
+#include "pvm/vm/debugger.hpp"
+
+#include "pvm/bc/disasm.hpp"
+#include "pvm/bc/instruction.hpp"
+#include "pvm/vm/vm.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+//! Main block patched over instructions to stop at.
+constexpr Block breakpoint_block = Block(Instr::opbreak) << 24u;
+
+//! Depth of the frames stepping stops in when stepping into calls.
+constexpr std::size_t any_depth = std::numeric_limits<std::size_t>::max();
+
+//! Formats the stack variable at 'offset' of 'stack'.
+[[nodiscard]] std::string stack_variable(StackMemory& stack, std::size_t offset)
+{
+	DataType type;
+	std::memcpy(&type, &stack[offset + sizeof(s64)], sizeof(type));
+
+	auto read = [&](auto value) {
+		std::memcpy(&value, &stack[offset], sizeof(value));
+		return fmt::format("{}", value);
+	};
+
+	switch (type)
+	{
+	case DataType::f64: return read(f64{});
+	case DataType::f32: return read(f32{});
+	case DataType::i64: return read(s64{});
+	case DataType::i32: return read(s32{});
+	case DataType::i16: return read(s16{});
+	case DataType::str:
+	{
+		StringReference string;
+		std::memcpy(&string, &stack[offset], sizeof(string));
+		return fmt::format("\"{}\"", string.string->view());
+	}
+	case DataType::array: return "<array>";
+	default: return "<unset>";
+	}
+}
+
+//! @returns whether 'offset' is where an instruction of 'script' begins.
+[[nodiscard]] bool is_instruction(const Script& script, std::size_t offset)
+{
+	std::size_t current = 0;
+	while (current < offset)
+	{
+		current += instruction_size(&script.data[current]);
+	}
+
+	return current == offset && offset < script.data.size();
+}
+
+//! Parses a block offset, written either as a '$xxxxxxxx' location or as a
+//! number.
+[[nodiscard]] std::optional<std::size_t> parse_offset(std::string text)
+{
+	int base = 0;
+	if (!text.empty() && text.front() == '$')
+	{
+		text.erase(0, 1);
+		base = 16;
+	}
+
+	try
+	{
+		std::size_t parsed = 0;
+		auto        offset = std::stoull(text, &parsed, base);
+
+		if (parsed == text.size())
+		{
+			return std::size_t(offset);
+		}
+	}
+	catch (const std::logic_error&)
+	{}
+
+	return std::nullopt;
+}
+} // namespace
+
+const char* const Debugger::help_text
+	= "break <script> <offset>   Sets a breakpoint, e.g. 'b fibo $0000000a'\n"
+	  "delete <script> <offset>  Deletes a breakpoint\n"
+	  "breakpoints               Lists the breakpoints\n"
+	  "continue                  Runs until the next breakpoint\n"
+	  "step                      Runs one instruction, entering calls\n"
+	  "next                      Runs one instruction, stepping over calls\n"
+	  "finish                    Runs until the current script returns\n"
+	  "backtrace                 Lists the frames, innermost first\n"
+	  "args [frame]              Prints the arguments of a frame\n"
+	  "locals [frame]            Prints the locals of a frame\n"
+	  "globals                   Prints the global variables\n"
+	  "list                      Disassembles the next instructions\n"
+	  "detach                    Removes the breakpoints, running at full speed\n"
+	  "kill                      Stops the script with an error\n";
+
+Debugger::Debugger(
+	const Form& form, std::istream& input, std::ostream& output) :
+	_form{form},
+	_input{input},
+	_output{output}
+{}
+
+std::optional<Variable> Debugger::run(
+	VM& vm, const Script& script, const std::vector<Variable>& arguments)
+{
+	_entry = &copy_of(script);
+	_return_sites.clear();
+
+	vm.debugger = this;
+	prompt(vm, std::nullopt);
+
+	std::optional<Variable> result;
+
+	try
+	{
+		result = vm.invoke(script, arguments);
+	}
+	catch (...)
+	{
+		vm.debugger = nullptr;
+		_disarmed.reset();
+		forget_steps();
+		throw;
+	}
+
+	vm.debugger = nullptr;
+	_disarmed.reset();
+	forget_steps();
+
+	return result;
+}
+
+const Script& Debugger::script_for(const Script& script)
+{
+	return copy_of(script);
+}
+
+void Debugger::on_call(
+	const Script& caller, std::size_t return_offset, std::size_t depth)
+{
+	// Calls of the frames that returned since
+	while (!_return_sites.empty() && _return_sites.back().depth >= depth)
+	{
+		_return_sites.pop_back();
+	}
+
+	auto original = _original_of.find(&caller);
+	_return_sites.push_back(
+		{original != _original_of.end() ? &copy_of(*original->second)
+										: nullptr,
+		 return_offset,
+		 depth});
+}
+
+bool Debugger::on_break(VM& vm, const Script& script, std::size_t offset)
+{
+	auto original = _original_of.find(&script);
+	if (original == _original_of.end())
+	{
+		return false;
+	}
+
+	Location location{&copy_of(*original->second), offset};
+
+	auto it = _traps.find(location);
+	if (it == _traps.end() || !it->second.patched)
+	{
+		return false;
+	}
+
+	Trap hit   = it->second;
+	auto depth = vm.frames.offset;
+
+	while (!_return_sites.empty() && _return_sites.back().depth >= depth)
+	{
+		_return_sites.pop_back();
+	}
+
+	// The VM moved past the previous breakpoint hit, which gets patched
+	// again while this one gets put back
+	_disarmed = location;
+	for_each_trap([](Trap& trap) { trap.rearm = false; });
+
+	if (hit.user || (hit.step_depth && depth <= *hit.step_depth))
+	{
+		forget_steps();
+		prompt(vm, location);
+	}
+
+	it = _traps.find(location);
+	if (it == _traps.end() || !it->second.needed())
+	{
+		_disarmed.reset();
+		return true;
+	}
+
+	// Breakpoints need to be patched again once the VM is past them
+	std::vector<Location> successors;
+	add_successors(successors, location, depth, true);
+
+	for (auto& successor : successors)
+	{
+		if (successor != location)
+		{
+			_traps[successor].rearm = true;
+			update(successor);
+		}
+	}
+
+	return true;
+}
+
+Script& Debugger::copy_of(const Script& script)
+{
+	if (auto it = _copy_of.find(&script); it != _copy_of.end())
+	{
+		return *it->second;
+	}
+
+	// Copies run interpreted, native code not knowing about breakpoints
+	Script& copy     = _copies.emplace_back(script);
+	copy.native_code = nullptr;
+
+	_copy_of.emplace(&script, &copy);
+	_original_of.emplace(&copy, &script);
+	return copy;
+}
+
+void Debugger::update(const Location& location)
+{
+	auto it = _traps.find(location);
+	if (it == _traps.end())
+	{
+		return;
+	}
+
+	auto& [script, offset] = location;
+	Trap& trap             = it->second;
+
+	bool patch = trap.needed() && location != _disarmed;
+
+	if (patch && !trap.patched)
+	{
+		trap.original        = script->data[offset];
+		script->data[offset] = breakpoint_block;
+		trap.patched         = true;
+	}
+	else if (!patch && trap.patched)
+	{
+		script->data[offset] = trap.original;
+		trap.patched         = false;
+	}
+
+	if (!trap.needed() && !trap.patched)
+	{
+		_traps.erase(it);
+	}
+}
+
+template<class F>
+void Debugger::for_each_trap(F f)
+{
+	std::vector<Location> locations;
+	locations.reserve(_traps.size());
+
+	for (auto& [location, trap] : _traps)
+	{
+		f(trap);
+		locations.push_back(location);
+	}
+
+	for (auto& location : locations)
+	{
+		update(location);
+	}
+}
+
+void Debugger::forget_steps()
+{
+	for_each_trap([](Trap& trap) {
+		trap.rearm = false;
+		trap.step_depth.reset();
+	});
+}
+
+void Debugger::add_successors(
+	std::vector<Location>& successors,
+	const Location&        location,
+	std::size_t            depth,
+	bool                   into)
+{
+	auto& [script, offset] = location;
+	const Block* block     = &script->data[offset];
+
+	// Falling through the end of the script returns from it
+	auto add = [&](std::size_t target) {
+		if (target < script->data.size())
+		{
+			successors.emplace_back(script, target);
+		}
+		else
+		{
+			add_return_site(successors, depth);
+		}
+	};
+
+	auto next   = offset + instruction_size(block);
+	auto target = std::size_t(s64(offset) + branch_offset(*block));
+
+	switch (instr_opcode(*block))
+	{
+	case Instr::opb: add(target); break;
+
+	case Instr::opbt:
+	case Instr::opbf:
+		add(next);
+		add(target);
+		break;
+
+	case Instr::opswitch:
+		script->jump_tables[*block & 0xFFFFu].for_each_target(add);
+		break;
+
+	case Instr::opret:
+	case Instr::opexit: add_return_site(successors, depth); break;
+
+	case Instr::opcall:
+	{
+		auto& func = _form.func.definitions[block[1]];
+		if (into && !func.is_builtin && !func.associated_script->data.empty())
+		{
+			successors.emplace_back(&copy_of(*func.associated_script), 0);
+		}
+
+		add(next);
+		break;
+	}
+
+	default: add(next); break;
+	}
+}
+
+void Debugger::add_return_site(
+	std::vector<Location>& successors, std::size_t depth)
+{
+	for (auto it = _return_sites.rbegin(); it != _return_sites.rend(); ++it)
+	{
+		if (it->depth >= depth)
+		{
+			continue;
+		}
+
+		if (it->caller == nullptr)
+		{
+			return;
+		}
+
+		if (it->offset < it->caller->data.size())
+		{
+			successors.emplace_back(it->caller, it->offset);
+		}
+		else
+		{
+			add_return_site(successors, it->depth);
+		}
+
+		return;
+	}
+}
+
+Script* Debugger::find_script(const std::string& name)
+{
+	auto& scripts = _form.code.elements;
+
+	auto it = std::find_if(scripts.begin(), scripts.end(), [&](auto& script) {
+		return script.name == name || script.name == "gml_Script_" + name;
+	});
+
+	return it != scripts.end() ? &copy_of(*it) : nullptr;
+}
+
+std::string Debugger::describe(const Script& script, std::size_t offset)
+{
+	// Disassembles the original script, which has no block patched
+	auto& original = *_original_of.at(&script);
+
+	Disassembler disasm{_form};
+	auto instruction
+		= disasm.disassemble_block(&original.data[offset], &original);
+
+	auto text = fmt::format(
+		"{} ${:08x}: {} {}",
+		script.name,
+		offset,
+		instruction.mnemonic,
+		instruction.params);
+
+	text.erase(text.find_last_not_of(' ') + 1);
+	return text;
+}
+
+void Debugger::print_variables(
+	VM& vm, const Script& script, std::size_t depth, bool arguments)
+{
+	const Frame& frame = vm.frames.frames[depth];
+
+	if (arguments)
+	{
+		for (std::size_t i = 0; i < frame.argument_count; ++i)
+		{
+			_output << fmt::format(
+				"argument{} = {}\n",
+				i,
+				stack_variable(vm.stack.raw, frame.argument_offset(ArgId(i))));
+		}
+
+		return;
+	}
+
+	// Locals are only known by the instructions referring to them
+	std::vector<std::string> names(script.local_count);
+
+	auto& original = *_original_of.at(&script);
+	for (std::size_t offset = 0; offset < original.data.size();
+		 offset += instruction_size(&original.data[offset]))
+	{
+		const Block* block  = &original.data[offset];
+		auto         opcode = instr_opcode(*block);
+
+		bool refers_to_variable = opcode == Instr::oppushloc
+			|| opcode == Instr::oppop
+			|| (opcode == Instr::oppushcst
+				&& instr_t1(*block) == DataType::var);
+
+		if (!refers_to_variable)
+		{
+			continue;
+		}
+
+		auto& definition = _form.vari.definitions[block[1] & 0x00FFFFFFu];
+		if (definition.instance_type == s32(InstType::local)
+			&& definition.unknown >= 1
+			&& std::size_t(definition.unknown) <= names.size())
+		{
+			names[definition.unknown - 1] = definition.name;
+		}
+	}
+
+	for (std::size_t i = 0; i < names.size(); ++i)
+	{
+		_output << fmt::format(
+			"local.{} = {}\n",
+			names[i].empty() ? fmt::format("#{}", i) : names[i],
+			stack_variable(vm.stack.raw, frame.local_offset(VarId(i))));
+	}
+}
+
+void Debugger::print_globals(VM& vm)
+{
+	std::vector<std::pair<s32, const Variable*>> globals;
+	for (auto& [id, variable] : vm.instances.global().variables())
+	{
+		globals.emplace_back(id, &variable);
+	}
+
+	std::sort(globals.begin(), globals.end());
+
+	for (auto& [id, variable] : globals)
+	{
+		auto name = std::size_t(id) < _form.vari.definitions.size()
+			? _form.vari.definitions[id].name
+			: fmt::format("#{}", id);
+
+		auto value = std::visit(
+			[](auto v) -> std::string {
+				if constexpr (std::is_same_v<decltype(v), StringReference>)
+				{
+					return fmt::format("\"{}\"", v.string->view());
+				}
+				else if constexpr (std::is_same_v<decltype(v), ArrayReference>)
+				{
+					return "<array>";
+				}
+				else
+				{
+					return fmt::format("{}", v);
+				}
+			},
+			variable->data);
+
+		_output << fmt::format("global.{} = {}\n", name, value);
+	}
+}
+
+void Debugger::prompt(VM& vm, std::optional<Location> location)
+{
+	auto depth = vm.frames.offset;
+
+	if (location)
+	{
+		_output << fmt::format(
+			"Stopped at {}\n", describe(*location->first, location->second));
+	}
+	else
+	{
+		_output << fmt::format("Ready to run {}\n", _entry->name);
+	}
+
+	// Frame 'n' frames below the innermost one, and where it is at
+	auto frame = [&](std::size_t n) -> std::optional<Location> {
+		if (!location || n >= depth)
+		{
+			return std::nullopt;
+		}
+
+		if (n == 0)
+		{
+			return location;
+		}
+
+		for (auto& site : _return_sites)
+		{
+			if (site.depth == depth - n && site.caller != nullptr)
+			{
+				// Return sites follow the call instruction
+				return Location{site.caller, site.offset - 2};
+			}
+		}
+
+		return std::nullopt;
+	};
+
+	// Steps through the instructions run after the one at 'location'
+	auto step = [&](bool into, std::size_t step_depth) {
+		std::vector<Location> successors;
+
+		if (location)
+		{
+			add_successors(successors, *location, depth, into);
+		}
+		else if (!_entry->data.empty())
+		{
+			successors.emplace_back(_entry, 0);
+		}
+
+		for (auto& successor : successors)
+		{
+			auto& trap      = _traps[successor];
+			trap.step_depth = std::max(trap.step_depth.value_or(0), step_depth);
+			update(successor);
+		}
+	};
+
+	for (;;)
+	{
+		_output.flush();
+
+		std::string line;
+		if (!std::getline(_input, line))
+		{
+			// Nothing left to read, let the script run freely
+			line = "detach";
+		}
+
+		std::istringstream words{line};
+		std::string        command, first, second;
+		words >> command >> first >> second;
+
+		if (command.empty())
+		{
+			continue;
+		}
+
+		if (command == "help" || command == "h")
+		{
+			_output << help_text;
+		}
+		else if (
+			command == "break" || command == "b" || command == "delete"
+			|| command == "d")
+		{
+			Script* script = find_script(first);
+			auto    offset = parse_offset(second);
+
+			if (script == nullptr)
+			{
+				_output << fmt::format("No script named '{}'\n", first);
+				continue;
+			}
+
+			if (!offset || !is_instruction(*_original_of.at(script), *offset))
+			{
+				_output << fmt::format("No instruction at '{}'\n", second);
+				continue;
+			}
+
+			Location breakpoint{script, *offset};
+
+			if (command[0] == 'b')
+			{
+				_traps[breakpoint].user = true;
+				update(breakpoint);
+				_output << fmt::format(
+					"Breakpoint at {}\n", describe(*script, *offset));
+			}
+			else if (auto it = _traps.find(breakpoint);
+					 it != _traps.end() && it->second.user)
+			{
+				it->second.user = false;
+				update(breakpoint);
+				_output << fmt::format(
+					"Deleted breakpoint at {}\n", describe(*script, *offset));
+			}
+			else
+			{
+				_output << fmt::format(
+					"No breakpoint at {}\n", describe(*script, *offset));
+			}
+		}
+		else if (command == "breakpoints")
+		{
+			for (auto& [breakpoint, trap] : _traps)
+			{
+				if (trap.user)
+				{
+					_output << fmt::format(
+						"{}\n", describe(*breakpoint.first, breakpoint.second));
+				}
+			}
+		}
+		else if (command == "continue" || command == "c")
+		{
+			return;
+		}
+		else if (command == "step" || command == "s")
+		{
+			step(true, any_depth);
+			return;
+		}
+		else if (command == "next" || command == "n")
+		{
+			step(false, location ? depth : any_depth);
+			return;
+		}
+		else if (command == "finish" || command == "f")
+		{
+			if (!location || depth <= 1)
+			{
+				_output << "No script to return to\n";
+				continue;
+			}
+
+			std::vector<Location> successors;
+			add_return_site(successors, depth);
+
+			for (auto& successor : successors)
+			{
+				auto& trap = _traps[successor];
+				trap.step_depth
+					= std::max(trap.step_depth.value_or(0), depth - 1);
+				update(successor);
+			}
+
+			return;
+		}
+		else if (command == "backtrace" || command == "bt")
+		{
+			for (std::size_t n = 0; frame(n); ++n)
+			{
+				auto [script, offset] = *frame(n);
+				_output << fmt::format("#{} {}\n", n, describe(*script, offset));
+			}
+		}
+		else if (command == "args" || command == "locals")
+		{
+			auto n = first.empty() ? std::optional<std::size_t>{0}
+								   : parse_offset(first);
+
+			auto where = n ? frame(*n) : std::nullopt;
+			if (!where)
+			{
+				_output << "No such frame\n";
+				continue;
+			}
+
+			print_variables(vm, *where->first, depth - *n, command == "args");
+		}
+		else if (command == "globals")
+		{
+			print_globals(vm);
+		}
+		else if (command == "list" || command == "l")
+		{
+			if (!location)
+			{
+				_output << "Not running\n";
+				continue;
+			}
+
+			auto& [script, offset] = *location;
+			auto& original         = *_original_of.at(script);
+
+			for (std::size_t i = 0, current = offset;
+				 i < 8 && current < original.data.size();
+				 ++i, current += instruction_size(&original.data[current]))
+			{
+				_output << fmt::format("{}\n", describe(*script, current));
+			}
+		}
+		else if (command == "detach")
+		{
+			_disarmed.reset();
+			for_each_trap([](Trap& trap) {
+				trap.user = trap.rearm = false;
+				trap.step_depth.reset();
+			});
+
+			vm.debugger = nullptr;
+			_output << "Detached\n";
+			_output.flush();
+			return;
+		}
+		else if (command == "kill")
+		{
+			throw std::runtime_error{"Killed from the debugger"};
+		}
+		else
+		{
+			_output << fmt::format(
+				"Unknown command '{}', see 'help'\n", command);
+		}
+	}
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "pvm/unpack/chunk/form.hpp"
+#include "pvm/vm/variable.hpp"
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class VM;
+
+//! Breakpoint debugger driven by a line-based protocol (see help_text), e.g.
+//! over stdin and stdout.
+//!
+//! Scripts run by a VM the debugger is attached to are private copies, in
+//! which breakpoints are set by overwriting the main block of an instruction
+//! with opbreak. The VM hands the opbreak over to on_break(), which puts the
+//! original block back so that the instruction runs normally. Nothing is
+//! checked on the other instructions, and a VM without a debugger attached
+//! only checks for one on calls.
+//!
+//! To keep breakpoints across hits and to step, blocks get patched on the
+//! instructions that may run next, which are found from the bytecode: branch
+//! targets, callee entries and return sites. The latter are recorded by the
+//! VM on calls (see on_call()), as frames do not keep track of them.
+//!
+//! A debugger may only be attached to one VM at a time.
+class Debugger
+{
+	public:
+	//! Lists the commands of the protocol.
+	static const char* const help_text;
+
+	Debugger(const Form& form, std::istream& input, std::ostream& output);
+
+	//! Runs 'script' on 'vm' under the debugger, passing it 'arguments'.
+	//! Commands are read before it starts, so that breakpoints can be set.
+	//! @returns the value the script returned, if any.
+	//! @throws std::runtime_error when the script throws, or when it gets
+	//! killed from the debugger.
+	std::optional<Variable> run(
+		VM& vm, const Script& script, const std::vector<Variable>& arguments);
+
+	//! Returns the copy of 'script' the VM runs instead of it.
+	[[nodiscard]] const Script& script_for(const Script& script);
+
+	//! Called by the VM before 'caller', running in frame 'depth', makes a
+	//! call that returns to block 'return_offset'.
+	void on_call(
+		const Script& caller, std::size_t return_offset, std::size_t depth);
+
+	//! Called by the VM on an opbreak at block 'offset' of 'script'. Reads
+	//! commands if this is a place to stop at.
+	//! @returns whether the opbreak was a patched block, in which case the
+	//! original instruction was put back for the VM to execute it.
+	[[nodiscard]] bool
+	on_break(VM& vm, const Script& script, std::size_t offset);
+
+	private:
+	//! A block of a script copy.
+	using Location = std::pair<Script*, std::size_t>;
+
+	//! Reasons for a block to be patched.
+	struct Trap
+	{
+		//! Main block of the instruction while patched.
+		Block original = 0;
+		bool  patched  = false;
+
+		//! Breakpoint set by the user, kept until deleted.
+		bool user = false;
+
+		//! Set on the next instructions to run after a breakpoint is hit, to
+		//! patch the breakpoint again once the VM moved past it.
+		bool rearm = false;
+
+		//! Set by stepping, to stop when reached in a frame at most this deep.
+		std::optional<std::size_t> step_depth;
+
+		[[nodiscard]] bool needed() const
+		{
+			return user || rearm || step_depth;
+		}
+	};
+
+	//! Call made while debugging, see on_call().
+	struct ReturnSite
+	{
+		Script*     caller;
+		std::size_t offset, depth;
+	};
+
+	const Form&   _form;
+	std::istream& _input;
+	std::ostream& _output;
+
+	std::deque<Script>                               _copies;
+	std::unordered_map<const Script*, Script*>       _copy_of;
+	std::unordered_map<const Script*, const Script*> _original_of;
+
+	std::map<Location, Trap> _traps;
+
+	//! Breakpoint the VM is moving past, which is not patched until it did.
+	std::optional<Location> _disarmed;
+
+	std::vector<ReturnSite> _return_sites;
+
+	//! Copy of the script run(), once it got called.
+	Script* _entry = nullptr;
+
+	//! Returns the copy of 'script' to patch, making it on first use.
+	[[nodiscard]] Script& copy_of(const Script& script);
+
+	//! Brings the block at 'location' in line with its trap.
+	void update(const Location& location);
+
+	//! Calls 'f' on each trap, then updates them.
+	template<class F>
+	void for_each_trap(F f);
+
+	//! Drops the traps set to step or to patch breakpoints again.
+	void forget_steps();
+
+	//! Adds the locations the instruction at 'location', which is not
+	//! patched, may continue to. Callee entries are only added when 'into'.
+	void add_successors(
+		std::vector<Location>& successors,
+		const Location&        location,
+		std::size_t            depth,
+		bool                   into);
+
+	//! Adds the location where frame 'depth' returns to, if known.
+	void add_return_site(std::vector<Location>& successors, std::size_t depth);
+
+	//! Returns the copy of the script named 'name', with or without its
+	//! 'gml_Script_' prefix, if any.
+	[[nodiscard]] Script* find_script(const std::string& name);
+
+	//! Describes the instruction at 'offset' of the copy 'script'.
+	[[nodiscard]] std::string
+	describe(const Script& script, std::size_t offset);
+
+	//! Prints the arguments or the locals of frame 'depth', running 'script'.
+	void print_variables(
+		VM& vm, const Script& script, std::size_t depth, bool arguments);
+
+	void print_globals(VM& vm);
+
+	//! Reads commands until one resumes execution. 'location' is where
+	//! execution stopped, if it started.
+	void prompt(VM& vm, std::optional<Location> location);
+};
@@ -3,6 +3,8 @@
 #include <unordered_map>
 #include "pvm/vm/variable.hpp"
 
+struct Script;
+
 struct Frame
 {
 	//std::unordered_map<std::int32_t, Variable> locals;
@@ -14,6 +16,13 @@ struct Frame
 	//! Quantity of parameters passed to the function, as read from opcall.
 	u16 argument_count = 0;
 
+	//! Where the script of the frame continues from, only set while the VM
+	//! is suspended (see VM::resume()). Frames below the innermost one are
+	//! at the instruction following their call.
+	const Script* script        = nullptr;
+	std::size_t   resume_offset = 0;
+	bool          compare_flag  = false;
+
 	[[nodiscard]] std::size_t argument_offset(ArgId arg_id = 0) const;
 	[[nodiscard]] std::size_t local_offset(VarId var_id = 0) const;
 };
@@ -2,14 +2,22 @@
 
 #include "pvm/config.hpp"
 #include "pvm/vm/frame.hpp"
-#include <array>
+#include "pvm/vm/stackmemory.hpp"
+#include <new>
 #include <stdexcept>
 
+//! Stack of the frames of the calls in progress, in a StackMemory so that deep
+//! recursion only commits the frames it uses.
 struct FrameStack
 {
+	FrameStack();
+
 	std::size_t offset = 0;
 
-	std::array<Frame, max_call_depth> frames;
+	StackMemory memory{max_call_depth * sizeof(Frame), sizeof(Frame)};
+
+	//! Points into 'memory', whose base address never changes.
+	Frame* frames;
 
 	[[nodiscard]] Frame& push();
 	void pop();
@@ -17,16 +25,24 @@ struct FrameStack
 	[[nodiscard]] const Frame& top() const;
 };
 
+inline FrameStack::FrameStack() :
+	frames{reinterpret_cast<Frame*>(memory.data())}
+{
+	new(&frames[0]) Frame{};
+}
+
 inline Frame& FrameStack::push()
 {
 	if constexpr (check(debug::vm_safer))
 	{
-		if (offset >= frames.size())
+		if (offset + 1 >= max_call_depth)
 		{
 			throw std::runtime_error{"Frame stack limit reached"};
 		}
 	}
 
+	memory.ensure((offset + 2) * sizeof(Frame));
+
 	new(&frames[++offset]) Frame{};
 	return top();
 }
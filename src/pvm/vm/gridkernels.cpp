@@ -0,0 +1,87 @@
+#include "pvm/vm/gridkernels.hpp"
+
+#include "pvm/config.hpp"
+
+#if defined(__x86_64__)
+#	include <emmintrin.h>
+#endif
+
+namespace
+{
+//! Vectors of a single number, see make_grid_kernels().
+struct Scalar
+{
+	static constexpr std::size_t width = 1;
+
+	static f64  broadcast(f64 value) { return value; }
+	static f64  load(const f64* data) { return *data; }
+	static void store(f64* data, f64 value) { *data = value; }
+	static f64  add(f64 a, f64 b) { return a + b; }
+	static f64  mul(f64 a, f64 b) { return a * b; }
+	static f64  max(f64 a, f64 b) { return b > a ? b : a; }
+	static f64  min(f64 a, f64 b) { return b < a ? b : a; }
+	static f64  sum_lanes(f64 value) { return value; }
+	static f64  max_lanes(f64 value) { return value; }
+	static f64  min_lanes(f64 value) { return value; }
+};
+
+#if defined(__x86_64__)
+//! SSE2 is part of x86-64, so these need no check.
+struct Sse2
+{
+	static constexpr std::size_t width = 2;
+
+	static __m128d broadcast(f64 value) { return _mm_set1_pd(value); }
+	static __m128d load(const f64* data) { return _mm_loadu_pd(data); }
+	static void    store(f64* data, __m128d v) { _mm_storeu_pd(data, v); }
+	static __m128d add(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+	static __m128d mul(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+	static __m128d max(__m128d a, __m128d b) { return _mm_max_pd(a, b); }
+	static __m128d min(__m128d a, __m128d b) { return _mm_min_pd(a, b); }
+
+	static f64 sum_lanes(__m128d v)
+	{
+		return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+	}
+
+	static f64 max_lanes(__m128d v)
+	{
+		return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v)));
+	}
+
+	static f64 min_lanes(__m128d v)
+	{
+		return _mm_cvtsd_f64(_mm_min_sd(v, _mm_unpackhi_pd(v, v)));
+	}
+};
+#endif
+} // namespace
+
+constexpr GridKernels scalar_grid_kernels = make_grid_kernels<Scalar>("scalar");
+
+#if defined(__x86_64__)
+constexpr GridKernels sse2_grid_kernels = make_grid_kernels<Sse2>("sse2");
+#endif
+
+const GridKernels& grid_kernels()
+{
+	static const GridKernels& kernels = []() -> const GridKernels& {
+		if constexpr (!opt::simd_grid_kernels)
+		{
+			return scalar_grid_kernels;
+		}
+
+#if defined(__x86_64__)
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return avx2_grid_kernels;
+		}
+
+		return sse2_grid_kernels;
+#else
+		return scalar_grid_kernels;
+#endif
+	}();
+
+	return kernels;
+}
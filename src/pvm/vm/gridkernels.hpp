@@ -0,0 +1,165 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include <cstddef>
+
+//! Operations on spans of numbers, which the region and disk operations of
+//! DsGrid break down into (one span per column).
+//!
+//! Each instruction set gets its own set of kernels, from the same template
+//! (see make_grid_kernels()). AVX2 kernels are built in their own translation
+//! unit with AVX2 enabled, and only picked once the CPU is known to support
+//! it, so that the rest of the VM keeps running on any x86-64 CPU.
+struct GridKernels
+{
+	//! Name of the instruction set, e.g. for benchmarks.
+	const char* name;
+
+	void (*fill)(f64* data, std::size_t count, f64 value);
+	void (*add)(f64* data, std::size_t count, f64 value);
+	void (*multiply)(f64* data, std::size_t count, f64 value);
+
+	//! Sums are accumulated in several lanes, so that the result may differ
+	//! from a sequential sum by rounding.
+	f64 (*sum)(const f64* data, std::size_t count);
+
+	//! There must be numbers.
+	f64 (*max)(const f64* data, std::size_t count);
+	f64 (*min)(const f64* data, std::size_t count);
+};
+
+//! Kernels without SIMD, for reference and for other architectures.
+extern const GridKernels scalar_grid_kernels;
+
+#if defined(__x86_64__)
+extern const GridKernels sse2_grid_kernels;
+extern const GridKernels avx2_grid_kernels;
+#endif
+
+//! Returns the kernels for the widest instruction set the CPU supports, or
+//! the scalar ones without opt::simd_grid_kernels.
+[[nodiscard]] const GridKernels& grid_kernels();
+
+//! Returns the kernels implemented with 'V', which provides the operations on
+//! vectors of 'V::width' numbers: broadcast(), load(), store(), add(), mul(),
+//! max(), min(), and the horizontal reductions sum_lanes(), max_lanes() and
+//! min_lanes(). Numbers past the last full vector are handled one by one.
+template<class V>
+[[nodiscard]] constexpr GridKernels make_grid_kernels(const char* name)
+{
+	constexpr std::size_t w = V::width;
+
+	GridKernels kernels{};
+	kernels.name = name;
+
+	kernels.fill = [](f64* data, std::size_t count, f64 value) {
+		auto        vector = V::broadcast(value);
+		std::size_t i      = 0;
+
+		for (; i + w <= count; i += w)
+		{
+			V::store(data + i, vector);
+		}
+
+		for (; i < count; ++i)
+		{
+			data[i] = value;
+		}
+	};
+
+	kernels.add = [](f64* data, std::size_t count, f64 value) {
+		auto        vector = V::broadcast(value);
+		std::size_t i      = 0;
+
+		for (; i + w <= count; i += w)
+		{
+			V::store(data + i, V::add(V::load(data + i), vector));
+		}
+
+		for (; i < count; ++i)
+		{
+			data[i] += value;
+		}
+	};
+
+	kernels.multiply = [](f64* data, std::size_t count, f64 value) {
+		auto        vector = V::broadcast(value);
+		std::size_t i      = 0;
+
+		for (; i + w <= count; i += w)
+		{
+			V::store(data + i, V::mul(V::load(data + i), vector));
+		}
+
+		for (; i < count; ++i)
+		{
+			data[i] *= value;
+		}
+	};
+
+	kernels.sum = [](const f64* data, std::size_t count) {
+		// Several accumulators, so that additions do not all wait on the
+		// previous one
+		auto a = V::broadcast(0.0), b = a, c = a, d = a;
+
+		std::size_t i = 0;
+		for (; i + 4 * w <= count; i += 4 * w)
+		{
+			a = V::add(a, V::load(data + i));
+			b = V::add(b, V::load(data + i + w));
+			c = V::add(c, V::load(data + i + 2 * w));
+			d = V::add(d, V::load(data + i + 3 * w));
+		}
+
+		for (; i + w <= count; i += w)
+		{
+			a = V::add(a, V::load(data + i));
+		}
+
+		f64 sum = V::sum_lanes(V::add(V::add(a, b), V::add(c, d)));
+		for (; i < count; ++i)
+		{
+			sum += data[i];
+		}
+
+		return sum;
+	};
+
+	kernels.max = [](const f64* data, std::size_t count) {
+		auto        vector = V::broadcast(data[0]);
+		std::size_t i      = 0;
+
+		for (; i + w <= count; i += w)
+		{
+			vector = V::max(vector, V::load(data + i));
+		}
+
+		f64 max = V::max_lanes(vector);
+		for (; i < count; ++i)
+		{
+			max = data[i] > max ? data[i] : max;
+		}
+
+		return max;
+	};
+
+	kernels.min = [](const f64* data, std::size_t count) {
+		auto        vector = V::broadcast(data[0]);
+		std::size_t i      = 0;
+
+		for (; i + w <= count; i += w)
+		{
+			vector = V::min(vector, V::load(data + i));
+		}
+
+		f64 min = V::min_lanes(vector);
+		for (; i < count; ++i)
+		{
+			min = data[i] < min ? data[i] : min;
+		}
+
+		return min;
+	};
+
+	return kernels;
+}
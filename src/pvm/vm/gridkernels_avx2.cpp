@@ -0,0 +1,49 @@
+// Built with AVX2 enabled (see CMakeLists.txt), so nothing else than the
+// kernels should be defined here: any inline function emitted from this file
+// could end up used on CPUs without AVX2.
+
+#include "pvm/vm/gridkernels.hpp"
+
+#if defined(__x86_64__)
+#	include <immintrin.h>
+
+namespace
+{
+struct Avx2
+{
+	static constexpr std::size_t width = 4;
+
+	static __m256d broadcast(f64 value) { return _mm256_set1_pd(value); }
+	static __m256d load(const f64* data) { return _mm256_loadu_pd(data); }
+	static void    store(f64* data, __m256d v) { _mm256_storeu_pd(data, v); }
+	static __m256d add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+	static __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+	static __m256d max(__m256d a, __m256d b) { return _mm256_max_pd(a, b); }
+	static __m256d min(__m256d a, __m256d b) { return _mm256_min_pd(a, b); }
+
+	//! Reduces the high half onto the low one, then the two lanes left.
+	static f64 sum_lanes(__m256d v)
+	{
+		auto half = _mm_add_pd(
+			_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+	}
+
+	static f64 max_lanes(__m256d v)
+	{
+		auto half = _mm_max_pd(
+			_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_max_sd(half, _mm_unpackhi_pd(half, half)));
+	}
+
+	static f64 min_lanes(__m256d v)
+	{
+		auto half = _mm_min_pd(
+			_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_min_sd(half, _mm_unpackhi_pd(half, half)));
+	}
+};
+} // namespace
+
+constexpr GridKernels avx2_grid_kernels = make_grid_kernels<Avx2>("avx2");
+#endif
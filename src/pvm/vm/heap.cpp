@@ -0,0 +1,463 @@
+#include "pvm/vm/heap.hpp"
+
+#include <algorithm>
+#include <fmt/color.h>
+#include <fmt/core.h>
+#include <new>
+#include <stdexcept>
+
+namespace
+{
+void destroy(HeapObject* object)
+{
+	if (object != nullptr && object->kind == HeapKind::array)
+	{
+		static_cast<HeapArray*>(object)->~HeapArray();
+	}
+
+	::operator delete(object);
+}
+
+//! Bytes taken by 'array', including its rows.
+std::size_t footprint(const HeapArray& array)
+{
+	auto bytes = sizeof(HeapArray)
+		+ array.numbers.capacity() * sizeof(array.numbers[0])
+		+ array.values.capacity() * sizeof(array.values[0]);
+
+	for (auto& row : array.numbers)
+	{
+		bytes += row.capacity() * sizeof(f64);
+	}
+
+	for (auto& row : array.values)
+	{
+		bytes += row.capacity() * sizeof(Variable);
+	}
+
+	return bytes;
+}
+
+//! Returns the element at 'row' and 'column' of 'rows', growing them as
+//! needed. 'bytes' is updated with the memory this takes.
+template<class T>
+T& element_at(
+	std::vector<std::vector<T>>& rows,
+	std::size_t                  row,
+	std::size_t                  column,
+	std::size_t&                 bytes)
+{
+	if (row >= rows.size())
+	{
+		bytes -= rows.capacity() * sizeof(rows[0]);
+		rows.resize(row + 1);
+		bytes += rows.capacity() * sizeof(rows[0]);
+	}
+
+	auto& elements = rows[row];
+	if (column >= elements.size())
+	{
+		bytes -= elements.capacity() * sizeof(T);
+		elements.resize(column + 1);
+		bytes += elements.capacity() * sizeof(T);
+	}
+
+	return elements[column];
+}
+} // namespace
+
+Variable HeapArray::at(std::size_t index) const
+{
+	auto row    = index / array_row_size;
+	auto column = index % array_row_size;
+
+	if (numeric && row < numbers.size() && column < numbers[row].size())
+	{
+		return {numbers[row][column]};
+	}
+
+	if (!numeric && row < values.size() && column < values[row].size())
+	{
+		return values[row][column];
+	}
+
+	throw std::runtime_error{
+		fmt::format("Array index {} is out of bounds", index)};
+}
+
+Heap::~Heap()
+{
+	for (auto* object : _objects)
+	{
+		destroy(object);
+	}
+
+	for (auto* constant : _constants)
+	{
+		::operator delete(constant);
+	}
+}
+
+const HeapString* Heap::make_string(std::string_view text)
+{
+	auto* string = allocate_string(text.size());
+	std::memcpy(const_cast<char*>(string->data()), text.data(), text.size());
+	return string;
+}
+
+const HeapString* Heap::make_string(std::string_view a, std::string_view b)
+{
+	auto* string = allocate_string(a.size() + b.size());
+	auto* data   = const_cast<char*>(string->data());
+	std::memcpy(data, a.data(), a.size());
+	std::memcpy(data + a.size(), b.data(), b.size());
+	return string;
+}
+
+HeapArray* Heap::make_array()
+{
+	auto* array = new (::operator new(sizeof(HeapArray))) HeapArray{
+		{sizeof(HeapArray), HeapKind::array, _marked}, 0, true, {}, {}};
+
+	track(array);
+	return array;
+}
+
+HeapArray* Heap::copy_array(const HeapArray& array)
+{
+	auto* copy = new (::operator new(sizeof(HeapArray))) HeapArray{
+		{0, HeapKind::array, _marked}, 0, array.numeric, array.numbers,
+		array.values};
+	copy->bytes = footprint(*copy);
+
+	for (auto& row : copy->values)
+	{
+		for (auto& element : row)
+		{
+			if (auto* nested = std::get_if<ArrayReference>(&element.data))
+			{
+				++nested->array->shares;
+			}
+		}
+	}
+
+	track(copy);
+
+	// Marked already, but the references it holds may not be yet
+	if (_phase == Phase::mark && !copy->numeric)
+	{
+		_gray.push_back(copy);
+	}
+
+	return copy;
+}
+
+void Heap::store(HeapArray& array, std::size_t index, const Variable& value)
+{
+	auto row    = index / array_row_size;
+	auto column = index % array_row_size;
+
+	auto number = as_number(value);
+
+	if (array.numeric && !number)
+	{
+		box(array);
+	}
+
+	auto bytes = array.bytes;
+
+	if (array.numeric)
+	{
+		element_at(array.numbers, row, column, bytes) = *number;
+	}
+	else
+	{
+		auto& element = element_at(array.values, row, column, bytes);
+
+		// Shared first, in case the element already references it
+		if (auto* stored = std::get_if<ArrayReference>(&value.data))
+		{
+			++stored->array->shares;
+		}
+
+		if (auto* replaced = std::get_if<ArrayReference>(&element.data))
+		{
+			--replaced->array->shares;
+		}
+
+		element = value;
+
+		if (_phase == Phase::mark && array.mark == _marked)
+		{
+			mark(value);
+		}
+	}
+
+	if (bytes != array.bytes)
+	{
+		resize(&array, bytes);
+	}
+}
+
+const HeapString* Heap::constant(std::size_t id, std::string_view text)
+{
+	if (id >= _constants.size())
+	{
+		_constants.resize(id + 1);
+	}
+
+	auto*& string = _constants[id];
+	if (string == nullptr)
+	{
+		auto bytes = sizeof(HeapString) + text.size();
+		string     = new (::operator new(bytes))
+			HeapString{{bytes, HeapKind::string, _marked}, text.size()};
+		std::memcpy(
+			const_cast<char*>(string->data()), text.data(), text.size());
+	}
+
+	return string;
+}
+
+void Heap::forget_interned()
+{
+	for (auto* object : _objects)
+	{
+		if (object != nullptr && object->kind == HeapKind::string)
+		{
+			static_cast<HeapString*>(object)->interned = nullptr;
+		}
+	}
+
+	for (auto* constant : _constants)
+	{
+		if (constant != nullptr)
+		{
+			constant->interned = nullptr;
+		}
+	}
+}
+
+void Heap::scan(const char* data, std::size_t size)
+{
+	if (_addresses.empty())
+	{
+		return;
+	}
+
+	for (std::size_t offset = 0; offset + sizeof(HeapObject*) <= size;
+		 ++offset)
+	{
+		const HeapObject* object;
+		std::memcpy(&object, data + offset, sizeof(object));
+
+		// Filters out most values without a lookup, e.g. numbers
+		if (object >= _lowest && object <= _highest
+			&& _addresses.count(object) != 0)
+		{
+			mark(object);
+		}
+	}
+}
+
+HeapString* Heap::allocate_string(std::size_t length)
+{
+	auto  bytes  = sizeof(HeapString) + length;
+	auto* string = new (::operator new(bytes))
+		HeapString{{bytes, HeapKind::string, _marked}, length};
+
+	track(string);
+	return string;
+}
+
+void Heap::track(HeapObject* object)
+{
+	_objects.push_back(object);
+	_addresses.insert(object);
+
+	if (_objects.size() == 1)
+	{
+		_lowest = _highest = object;
+	}
+
+	_lowest  = std::min<const HeapObject*>(_lowest, object);
+	_highest = std::max<const HeapObject*>(_highest, object);
+
+	// Survives the current cycle, see mark()
+	if (_phase == Phase::mark)
+	{
+		_live_bytes += object->bytes;
+	}
+
+	++_stats.objects;
+	_stats.bytes += object->bytes;
+	++_step.allocated_objects;
+	_step.allocated_bytes += object->bytes;
+}
+
+void Heap::resize(HeapObject* object, std::size_t bytes)
+{
+	if (bytes > object->bytes)
+	{
+		_step.allocated_bytes += bytes - object->bytes;
+	}
+
+	if (_phase == Phase::mark && object->mark == _marked)
+	{
+		_live_bytes = _live_bytes - object->bytes + bytes;
+	}
+
+	_stats.bytes  = _stats.bytes - object->bytes + bytes;
+	object->bytes = bytes;
+}
+
+void Heap::box(HeapArray& array)
+{
+	array.values.resize(array.numbers.size());
+
+	for (std::size_t row = 0; row < array.numbers.size(); ++row)
+	{
+		auto& values = array.values[row];
+		values.reserve(array.numbers[row].size());
+
+		for (auto number : array.numbers[row])
+		{
+			values.push_back({number});
+		}
+	}
+
+	array.numbers = {};
+	array.numeric = false;
+	resize(&array, footprint(array));
+}
+
+void Heap::free(HeapObject* object)
+{
+	++_step.freed_objects;
+	_step.freed_bytes += object->bytes;
+
+	--_stats.objects;
+	_stats.bytes -= object->bytes;
+
+	_addresses.erase(object);
+	destroy(object);
+}
+
+void Heap::trace(HeapObject* object)
+{
+	switch (object->kind)
+	{
+	case HeapKind::string: break;
+
+	case HeapKind::array:
+		for (auto& row : static_cast<HeapArray*>(object)->values)
+		{
+			for (auto& element : row)
+			{
+				mark(element);
+			}
+		}
+		break;
+	}
+}
+
+void Heap::start_cycle()
+{
+	_phase      = Phase::mark;
+	_marked     = !_marked;
+	_live_bytes = 0;
+}
+
+bool Heap::propagate(std::size_t budget)
+{
+	for (; budget != 0 && !_gray.empty(); --budget)
+	{
+		auto* object = _gray.back();
+		_gray.pop_back();
+		trace(object);
+	}
+
+	return _gray.empty();
+}
+
+void Heap::start_sweep()
+{
+	_phase      = Phase::sweep;
+	_sweep_kept = 0;
+	_sweep_next = 0;
+	_sweep_end  = _objects.size();
+}
+
+bool Heap::sweep(std::size_t budget)
+{
+	for (; budget != 0 && _sweep_next < _sweep_end; --budget, ++_sweep_next)
+	{
+		auto* object          = _objects[_sweep_next];
+		_objects[_sweep_next] = nullptr;
+		++_step.swept_objects;
+
+		if (object->mark == _marked)
+		{
+			_objects[_sweep_kept++] = object;
+		}
+		else
+		{
+			free(object);
+		}
+	}
+
+	if (_sweep_next < _sweep_end)
+	{
+		return false;
+	}
+
+	_objects.erase(
+		_objects.begin() + std::ptrdiff_t(_sweep_kept),
+		_objects.begin() + std::ptrdiff_t(_sweep_end));
+
+	// Objects allocated while sweeping are not counted, as they are likely
+	// to be garbage by the next cycle already
+	++_stats.cycles;
+	_threshold = std::max(opt::gc_min_heap_bytes, _live_bytes * 2);
+	return true;
+}
+
+std::size_t Heap::step_budget() const
+{
+	// Steps without allocations (e.g. collect()) still move forward
+	return std::max<std::size_t>(
+		_step.allocated_objects * opt::gc_step_multiplier, 256);
+}
+
+void Heap::finish_step(Clock::time_point begin)
+{
+	_step.pause_ns
+		= std::chrono::duration<f64, std::nano>(Clock::now() - begin).count();
+
+	++_stats.steps;
+	_stats.max_pause_ns = std::max(_stats.max_pause_ns, _step.pause_ns);
+	_stats.total_pause_ns += _step.pause_ns;
+	_stats.last_step = _step;
+
+	if constexpr (check(debug::vm_verbose_gc))
+	{
+		fmt::print(
+			fmt::color::light_sea_green,
+			"GC step {} (cycle {}): {} objects / {} bytes allocated, {} "
+			"marked, {} swept, {} objects / {} bytes freed in {:.0f}ns, heap "
+			"at {} objects / {} bytes\n",
+			_stats.steps,
+			_stats.cycles,
+			_step.allocated_objects,
+			_step.allocated_bytes,
+			_step.marked_objects,
+			_step.swept_objects,
+			_step.freed_objects,
+			_step.freed_bytes,
+			_step.pause_ns,
+			_stats.objects,
+			_stats.bytes);
+	}
+
+	_step = {};
+}
@@ -0,0 +1,357 @@
+#pragma once
+
+#include "pvm/bc/types.hpp"
+#include "pvm/config.hpp"
+#include "pvm/vm/variable.hpp"
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+//! Kinds of objects managed by a Heap.
+enum class HeapKind : u8
+{
+	string,
+	array
+};
+
+//! Header of the objects of a Heap, which values reference by address.
+struct HeapObject
+{
+	std::size_t bytes;
+	HeapKind    kind;
+
+	//! Whether the object was marked, in the parity of the current cycle.
+	bool mark;
+};
+
+//! Immutable string, its characters following the header.
+struct HeapString : HeapObject
+{
+	std::size_t length;
+
+	//! Equal string interned by the DataStructures of the VM, once looked up
+	//! there.
+	mutable const HeapString* interned = nullptr;
+
+	[[nodiscard]] const char*      data() const;
+	[[nodiscard]] std::string_view view() const;
+};
+
+//! Amount of columns of the rows of 2D arrays, whose elements are indexed by
+//! 'row * array_row_size + column' in the bytecode, like in GameMaker 1.
+constexpr std::size_t array_row_size = 32000;
+
+//! Array of one or two dimensions, made of dense rows. 1D arrays only have
+//! row 0.
+//!
+//! Arrays are copied on write: variables assigned an array share it, and an
+//! element written through a variable while the array is shared gets written
+//! to a copy, which the variable then holds (see VM::array_to_write()).
+struct HeapArray : HeapObject
+{
+	//! Amount of variables and elements referencing the array. Locals are
+	//! not released when their script returns, so this may overcount, which
+	//! only costs a copy.
+	std::size_t shares;
+
+	//! Whether every element is a number, stored unboxed in 'numbers' rather
+	//! than in 'values'.
+	bool numeric;
+
+	std::vector<std::vector<f64>>      numbers;
+	std::vector<std::vector<Variable>> values;
+
+	//! Returns the number at 'index', or nullptr when the array is not
+	//! numeric or 'index' is out of bounds.
+	[[nodiscard]] f64* number_at(std::size_t index);
+
+	//! @throws std::runtime_error when 'index' is out of bounds.
+	[[nodiscard]] Variable at(std::size_t index) const;
+};
+
+struct HeapStats
+{
+	//! Work done by a step of the collector.
+	struct Step
+	{
+		//! Allocated since the previous step.
+		std::size_t allocated_objects = 0, allocated_bytes = 0;
+
+		std::size_t marked_objects = 0, swept_objects = 0;
+		std::size_t freed_objects = 0, freed_bytes = 0;
+
+		f64 pause_ns = 0.0;
+	};
+
+	//! Objects currently allocated, including the garbage not swept yet.
+	std::size_t objects = 0, bytes = 0;
+
+	std::size_t steps = 0, cycles = 0;
+	f64         max_pause_ns = 0.0, total_pause_ns = 0.0;
+
+	Step last_step;
+};
+
+//! Garbage collected memory for the objects of a VM, i.e. strings and arrays.
+//!
+//! Collection is an incremental mark and sweep, which does a few steps of
+//! work at a time so that pauses stay short. Steps are taken by the VM at
+//! safepoints, before the instructions that allocate, once opt::gc_step_bytes
+//! were allocated since the previous step. The amount of work of each step is
+//! proportional to what was allocated (see opt::gc_step_multiplier).
+//!
+//! The roots are provided by the VM on each step that needs them. Values on
+//! the MainStack are not all tagged, so the stack gets scanned
+//! conservatively (see scan()): any 8 bytes that happen to be the address of
+//! an object keep it alive. Roots are not tracked while marking, so they get
+//! scanned once more before sweeping.
+//!
+//! Objects allocated during a cycle survive it. References handed out to
+//! the host are only valid until the next step.
+//!
+//! Arrays are the only mutable objects: a reference stored into an array
+//! that was already marked gets marked as well (see store()), so that the
+//! cycle does not miss it.
+class Heap
+{
+	public:
+	Heap() = default;
+	~Heap();
+
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+
+	//! Allocates a string holding 'text'.
+	[[nodiscard]] const HeapString* make_string(std::string_view text);
+
+	//! Same as above, holding the concatenation of 'a' and 'b'.
+	[[nodiscard]] const HeapString*
+	make_string(std::string_view a, std::string_view b);
+
+	//! Returns the string of the string constant 'id' holding 'text', which is
+	//! allocated on first use and never collected.
+	[[nodiscard]] const HeapString*
+	constant(std::size_t id, std::string_view text);
+
+	//! Allocates an empty array, numeric until anything else is stored.
+	[[nodiscard]] HeapArray* make_array();
+
+	//! Allocates a copy of 'array', which is not shared yet.
+	[[nodiscard]] HeapArray* copy_array(const HeapArray& array);
+
+	//! Stores 'value' at 'index' of 'array', growing it as needed. Elements
+	//! it grows over are set to 0.
+	void store(HeapArray& array, std::size_t index, const Variable& value);
+
+	//! Clears HeapString::interned of every string.
+	void forget_interned();
+
+	//! Whether enough was allocated since the previous step to take another.
+	[[nodiscard]] bool wants_step() const;
+
+	//! Does a step of collection work. 'mark_roots' is called when the roots
+	//! are needed, and marks them through mark() and scan().
+	template<class F>
+	void step(F mark_roots);
+
+	//! Finishes the current cycle if any, then runs a whole cycle.
+	template<class F>
+	void collect(F mark_roots);
+
+	//! Marks the object 'value' references, if any.
+	void mark(const Variable& value);
+	void mark(const HeapObject* object);
+
+	//! Marks the objects whose address is stored at any offset of the 'size'
+	//! bytes at 'data'.
+	void scan(const char* data, std::size_t size);
+
+	[[nodiscard]] const HeapStats& stats() const;
+
+	private:
+	using Clock = std::chrono::steady_clock;
+
+	enum class Phase
+	{
+		idle,
+		mark,
+		sweep
+	};
+
+	Phase _phase = Phase::idle;
+
+	//! Value of HeapObject::mark for objects marked in the current cycle.
+	//! Flipped when a cycle starts, which makes every object unmarked.
+	bool _marked = true;
+
+	//! Objects that may be collected, in allocation order. Null past the
+	//! objects kept by the sweep, until it ends.
+	std::vector<HeapObject*> _objects;
+
+	//! Addresses of the objects, to check values scanned conservatively.
+	std::unordered_set<const HeapObject*> _addresses;
+
+	//! Range of the addresses of the objects since the heap was last empty.
+	const HeapObject *_lowest = nullptr, *_highest = nullptr;
+
+	//! Objects marked whose references were not marked yet.
+	std::vector<HeapObject*> _gray;
+
+	//! Objects of the string constants, by id.
+	std::vector<HeapString*> _constants;
+
+	//! The sweep moves the objects it keeps to _sweep_kept, up to
+	//! _sweep_next. Objects from _sweep_end on were allocated while sweeping.
+	std::size_t _sweep_kept = 0, _sweep_next = 0, _sweep_end = 0;
+
+	//! Bytes of the objects that survive the current cycle so far.
+	std::size_t _live_bytes = 0;
+
+	//! Size of the heap past which a cycle starts.
+	std::size_t _threshold = opt::gc_min_heap_bytes;
+
+	HeapStats       _stats;
+	HeapStats::Step _step;
+
+	[[nodiscard]] HeapString* allocate_string(std::size_t length);
+
+	//! Starts managing 'object', which was just allocated.
+	void track(HeapObject* object);
+
+	//! Accounts for 'object' now taking 'bytes'.
+	void resize(HeapObject* object, std::size_t bytes);
+
+	//! Stores elements as variables rather than numbers, so that 'array' can
+	//! hold anything.
+	void box(HeapArray& array);
+
+	void free(HeapObject* object);
+
+	//! Marks the references of 'object'.
+	void trace(HeapObject* object);
+
+	void start_cycle();
+
+	//! Traces gray objects until 'budget' of them were.
+	//! @returns whether none is left.
+	bool propagate(std::size_t budget);
+
+	void start_sweep();
+
+	//! Sweeps until 'budget' objects were.
+	//! @returns whether the whole heap was.
+	bool sweep(std::size_t budget);
+
+	[[nodiscard]] std::size_t step_budget() const;
+
+	void finish_step(Clock::time_point begin);
+};
+
+inline const char* HeapString::data() const
+{
+	return reinterpret_cast<const char*>(this + 1);
+}
+
+inline std::string_view HeapString::view() const
+{
+	return {data(), length};
+}
+
+inline f64* HeapArray::number_at(std::size_t index)
+{
+	auto row    = index / array_row_size;
+	auto column = index % array_row_size;
+
+	if (!numeric || row >= numbers.size() || column >= numbers[row].size())
+	{
+		return nullptr;
+	}
+
+	return &numbers[row][column];
+}
+
+inline bool Heap::wants_step() const
+{
+	return _step.allocated_bytes >= opt::gc_step_bytes
+		&& (_phase != Phase::idle || _stats.bytes >= _threshold);
+}
+
+template<class F>
+void Heap::step(F mark_roots)
+{
+	auto begin = Clock::now();
+
+	if (_phase == Phase::idle)
+	{
+		start_cycle();
+		mark_roots();
+	}
+
+	if (_phase == Phase::mark)
+	{
+		if (propagate(step_budget()))
+		{
+			// Roots changed since they were marked, which was not tracked
+			mark_roots();
+			propagate(_gray.size() + _objects.size());
+			start_sweep();
+		}
+	}
+	else if (sweep(step_budget()))
+	{
+		_phase = Phase::idle;
+	}
+
+	finish_step(begin);
+}
+
+template<class F>
+void Heap::collect(F mark_roots)
+{
+	while (_phase != Phase::idle)
+	{
+		step(mark_roots);
+	}
+
+	do
+	{
+		step(mark_roots);
+	} while (_phase != Phase::idle);
+}
+
+inline void Heap::mark(const HeapObject* object)
+{
+	if (object == nullptr || object->mark == _marked)
+	{
+		return;
+	}
+
+	auto* marked = const_cast<HeapObject*>(object);
+	marked->mark = _marked;
+	++_step.marked_objects;
+	_live_bytes += marked->bytes;
+
+	if (marked->kind != HeapKind::string)
+	{
+		_gray.push_back(marked);
+	}
+}
+
+inline void Heap::mark(const Variable& value)
+{
+	if (auto* string = std::get_if<StringReference>(&value.data))
+	{
+		mark(string->string);
+	}
+	else if (auto* array = std::get_if<ArrayReference>(&value.data))
+	{
+		mark(array->array);
+	}
+}
+
+inline const HeapStats& Heap::stats() const
+{
+	return _stats;
+}
@@ -10,9 +10,24 @@ class Instance
 
 	public:
 	Variable& variable(VarId id);
+
+	//! Variables set so far, by VarId.
+	[[nodiscard]] const std::unordered_map<s32, Variable>& variables() const;
+
+	void clear();
 };
 
 inline Variable& Instance::variable(VarId id)
 {
 	return _variables[id];
 }
+
+inline const std::unordered_map<s32, Variable>& Instance::variables() const
+{
+	return _variables;
+}
+
+inline void Instance::clear()
+{
+	_variables.clear();
+}
@@ -1,6 +1,7 @@
 #include "pvm/vm/instancemanager.hpp"
 
 #include "pvm/bc/enums.hpp"
+#include <iterator>
 
 InstanceManager::InstanceManager() :
 	_global{_instances.emplace(s32(InstType::global), Instance{}).first->second}
@@ -10,3 +11,13 @@ Instance& InstanceManager::global()
 {
 	return _global;
 }
+
+void InstanceManager::reset()
+{
+	for (auto it = _instances.begin(); it != _instances.end();)
+	{
+		it = &it->second == &_global ? std::next(it) : _instances.erase(it);
+	}
+
+	_global.clear();
+}
@@ -13,4 +13,20 @@ class InstanceManager
 	InstanceManager();
 
 	Instance& global();
+
+	//! Calls 'f' on every instance, including the global one.
+	template<class F>
+	void for_each(F f);
+
+	//! Destroys every instance and clears the global variables.
+	void reset();
 };
+
+template<class F>
+void InstanceManager::for_each(F f)
+{
+	for (auto& [id, instance] : _instances)
+	{
+		f(instance);
+	}
+}
@@ -1,20 +1,22 @@
 #pragma once
 
-#include <array>
 #include <cstring>
 #include <fmt/core.h>
 #include <fmt/color.h>
 #include <stdexcept>
 #include <type_traits>
 #include "pvm/config.hpp"
+#include "pvm/vm/array.hpp"
+#include "pvm/vm/string.hpp"
 #include "pvm/vm/traits/datatype.hpp"
 #include "pvm/util/errormanagement.hpp"
 #include "pvm/util/nametype.hpp"
+#include "pvm/vm/stackmemory.hpp"
 
 struct MainStackReader
 {
 	std::size_t offset;
-	std::array<char, max_stack_depth>& raw_ref;
+	StackMemory& raw_ref;
 
 	template<class T>
 	T pop();
@@ -34,7 +36,7 @@ class MainStack : public MainStackReader
 public:
 	MainStack();
 
-	std::array<char, max_stack_depth> raw;
+	StackMemory raw;
 
 	void seek(MainStackReader reader);
 
@@ -93,6 +95,15 @@ T MainStackReader::pop()
 
 		return ret;
 	}
+	else if constexpr (
+		std::is_same_v<T, StringReference> || std::is_same_v<T, ArrayReference>)
+	{
+		offset -= sizeof(T);
+
+		T ret;
+		std::memcpy(&ret, &raw_ref[offset], sizeof(T));
+		return ret;
+	}
 
 	maybe_unreachable("Unimplemented MainStack::push for current type");
 }
@@ -115,6 +126,11 @@ void MainStackReader::push(const T& value)
 
 		push_raw(&value, sizeof(T));
 	}
+	else if constexpr (
+		std::is_same_v<T, StringReference> || std::is_same_v<T, ArrayReference>)
+	{
+		push_raw(&value, sizeof(T));
+	}
 	else
 	{
 		maybe_unreachable("Unimplemented MainStack::push for current type");
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "pvm/config.hpp"
+#include "pvm/unpack/chunk/code.hpp"
+#include "pvm/vm/variable.hpp"
+#include <array>
+#include <cstring>
+#include <vector>
+
+//! Bounded cache of the results of calls to pure scripts (see
+//! Script::is_pure), keyed on the called script and its argument values.
+class MemoTable
+{
+	public:
+	//! Stack variable, as laid out on the MainStack.
+	using Slot = std::array<char, Variable::stack_variable_size>;
+
+	struct Key
+	{
+		const Script* script         = nullptr;
+		std::size_t   argument_count = 0;
+
+		//! Only the used bytes of the values are kept, the padding of stack
+		//! variables being left uninitialized.
+		std::array<Slot, opt::memo_max_arguments> arguments{};
+	};
+
+	//! Builds the key of a call to 'script' with the 'count' stack variables
+	//! starting at 'arguments'.
+	//! @returns false when the call cannot be memoized, i.e. when it has too
+	//! many or non-numeric arguments.
+	[[nodiscard]] static bool make_key(
+		Key& key, const Script& script, const char* arguments, std::size_t count);
+
+	//! @returns the cached result of the call 'key', or nullptr.
+	[[nodiscard]] const Slot* find(const Key& key) const;
+
+	//! Caches 'result', the stack variable returned by the call 'key', unless
+	//! it is not numeric.
+	void insert(const Key& key, const char* result);
+
+	//! Forgets every cached result, keeping the memory of the table.
+	void clear();
+
+	private:
+	struct Entry
+	{
+		Key  key;
+		Slot result;
+	};
+
+	//! Copies the stack variable at 'source' to 'slot' without its padding.
+	//! @returns false when it is not numeric.
+	[[nodiscard]] static bool normalize(Slot& slot, const char* source);
+
+	[[nodiscard]] std::size_t index_of(const Key& key) const;
+
+	//! Allocated on the first insertion, as most VMs never call pure scripts.
+	std::vector<Entry> _entries;
+};
+
+inline bool MemoTable::normalize(Slot& slot, const char* source)
+{
+	auto type = DataType(source[sizeof(s64)]);
+
+	std::size_t size;
+	switch (type)
+	{
+	case DataType::f64:
+	case DataType::i64: size = 8; break;
+	case DataType::f32:
+	case DataType::i32:
+	case DataType::b32: size = 4; break;
+	default: return false;
+	}
+
+	slot.fill(0);
+	std::memcpy(slot.data(), source, size);
+	slot.back() = char(type);
+	return true;
+}
+
+inline bool MemoTable::make_key(
+	Key& key, const Script& script, const char* arguments, std::size_t count)
+{
+	if (count > opt::memo_max_arguments)
+	{
+		return false;
+	}
+
+	key.script         = &script;
+	key.argument_count = count;
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		if (!normalize(
+				key.arguments[i],
+				arguments + i * Variable::stack_variable_size))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+inline std::size_t MemoTable::index_of(const Key& key) const
+{
+	// FNV-1a
+	std::size_t hash = 0xCBF29CE484222325u;
+
+	auto feed = [&](const void* data, std::size_t size) {
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ static_cast<const u8*>(data)[i]) * 0x100000001B3u;
+		}
+	};
+
+	feed(&key.script, sizeof(key.script));
+	feed(key.arguments.data(), key.argument_count * sizeof(Slot));
+
+	return hash % opt::memo_table_size;
+}
+
+inline const MemoTable::Slot* MemoTable::find(const Key& key) const
+{
+	if (_entries.empty())
+	{
+		return nullptr;
+	}
+
+	const auto& entry = _entries[index_of(key)];
+
+	if (entry.key.script != key.script
+		|| entry.key.argument_count != key.argument_count
+		|| entry.key.arguments != key.arguments)
+	{
+		return nullptr;
+	}
+
+	return &entry.result;
+}
+
+inline void MemoTable::insert(const Key& key, const char* result)
+{
+	Slot slot;
+	if (!normalize(slot, result))
+	{
+		return;
+	}
+
+	if (_entries.empty())
+	{
+		_entries.resize(opt::memo_table_size);
+	}
+
+	auto& entry  = _entries[index_of(key)];
+	entry.key    = key;
+	entry.result = slot;
+}
+
+inline void MemoTable::clear()
+{
+	for (auto& entry : _entries)
+	{
+		entry.key.script = nullptr;
+	}
+}
@@ -0,0 +1,167 @@
+#include "pvm/vm/parallelrunner.hpp"
+
+#include "pvm/config.hpp"
+#include "pvm/vm/vm.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+ParallelRunner::ParallelRunner(const Form& form, std::size_t thread_count) :
+	_form{form}
+{
+	// hardware_concurrency() may not know
+	thread_count = std::max<std::size_t>(thread_count, 1);
+
+	pthread_attr_t attributes;
+	if (int status = pthread_attr_init(&attributes); status != 0)
+	{
+		throw std::runtime_error{fmt::format(
+			"Failed to set runner threads up: {}", std::strerror(status))};
+	}
+
+	if (int status
+		= pthread_attr_setstacksize(&attributes, runner_thread_stack_size);
+		status != 0)
+	{
+		pthread_attr_destroy(&attributes);
+		throw std::runtime_error{fmt::format(
+			"Failed to set the stack size of runner threads: {}",
+			std::strerror(status))};
+	}
+
+	auto entry = [](void* runner) -> void* {
+		static_cast<ParallelRunner*>(runner)->work();
+		return nullptr;
+	};
+
+	_threads.reserve(thread_count);
+	for (std::size_t i = 0; i < thread_count; ++i)
+	{
+		pthread_t thread;
+		if (int status = pthread_create(&thread, &attributes, entry, this);
+			status != 0)
+		{
+			pthread_attr_destroy(&attributes);
+			stop();
+			throw std::runtime_error{fmt::format(
+				"Failed to start a runner thread: {}", std::strerror(status))};
+		}
+
+		_threads.push_back(thread);
+	}
+
+	pthread_attr_destroy(&attributes);
+}
+
+ParallelRunner::~ParallelRunner()
+{
+	stop();
+}
+
+void ParallelRunner::stop()
+{
+	{
+		std::lock_guard lock{_mutex};
+		_stopping = true;
+	}
+
+	_wakeup.notify_all();
+
+	for (auto thread : _threads)
+	{
+		pthread_join(thread, nullptr);
+	}
+
+	_threads.clear();
+}
+
+void ParallelRunner::submit(Job job)
+{
+	{
+		std::lock_guard lock{_mutex};
+		_jobs.push_back(std::move(job));
+	}
+
+	_wakeup.notify_one();
+}
+
+void ParallelRunner::wait()
+{
+	std::unique_lock lock{_mutex};
+	_idle.wait(lock, [&] { return _jobs.empty() && _running == 0; });
+
+	if (auto error = std::exchange(_error, nullptr))
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+std::size_t ParallelRunner::thread_count() const
+{
+	return _threads.size();
+}
+
+void ParallelRunner::work()
+{
+	// Built on the thread using it, so that its memory is local to it. When
+	// that fails, the jobs the thread picks fail with the same error, so that
+	// wait() reports it.
+	std::unique_ptr<VM> vm;
+	std::exception_ptr  vm_error;
+
+	try
+	{
+		vm = std::make_unique<VM>(_form);
+	}
+	catch (...)
+	{
+		vm_error = std::current_exception();
+	}
+
+	std::unique_lock lock{_mutex};
+
+	for (;;)
+	{
+		_wakeup.wait(lock, [&] { return _stopping || !_jobs.empty(); });
+
+		// Only stop once the queued jobs are done
+		if (_jobs.empty())
+		{
+			return;
+		}
+
+		auto job = std::move(_jobs.front());
+		_jobs.pop_front();
+		++_running;
+
+		lock.unlock();
+
+		std::exception_ptr error = vm_error;
+		if (vm != nullptr)
+		{
+			try
+			{
+				job(*vm);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+
+			vm->reset();
+		}
+
+		lock.lock();
+
+		if (error != nullptr && _error == nullptr)
+		{
+			_error = error;
+		}
+
+		--_running;
+		_idle.notify_all();
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "pvm/unpack/chunk/form.hpp"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+class VM;
+
+//! Runs independent jobs against a shared form on a set of threads, each of
+//! which owns a VM. The VM is reset between jobs, so jobs do not see each
+//! other's globals or instances.
+class ParallelRunner
+{
+	public:
+	using Job = std::function<void(VM& vm)>;
+
+	//! Starts 'thread_count' threads, by default one per core, with a stack
+	//! of runner_thread_stack_size bytes.
+	//! @throws std::runtime_error when a thread cannot be started.
+	explicit ParallelRunner(
+		const Form& form,
+		std::size_t thread_count = std::thread::hardware_concurrency());
+
+	//! Runs the jobs still queued, then stops the threads.
+	~ParallelRunner();
+
+	ParallelRunner(const ParallelRunner&) = delete;
+	ParallelRunner& operator=(const ParallelRunner&) = delete;
+
+	//! Queues 'job' to run on whichever thread is available first.
+	void submit(Job job);
+
+	//! Blocks until every submitted job ran.
+	//! @throws the first exception a job threw since the last call, if any,
+	//! or the error a thread got building its VM.
+	void wait();
+
+	[[nodiscard]] std::size_t thread_count() const;
+
+	private:
+	void work();
+
+	//! Runs the jobs still queued, then joins the threads.
+	void stop();
+
+	const Form& _form;
+
+	std::mutex              _mutex;
+	std::condition_variable _wakeup, _idle;
+	std::deque<Job>         _jobs;
+	std::size_t             _running = 0;
+	bool                    _stopping = false;
+	std::exception_ptr      _error;
+
+	//! Not std::thread, which cannot be given a larger stack.
+	std::vector<pthread_t> _threads;
+};
@@ -0,0 +1,91 @@
+#include "pvm/vm/profile.hpp"
+
+#include <algorithm>
+#include <fmt/core.h>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+constexpr auto profile_magic   = "phosphorvm-profile";
+constexpr int  profile_version = 1;
+} // namespace
+
+void Profile::record(const Entry& entry)
+{
+	auto it = std::find_if(
+		hot_scripts.begin(), hot_scripts.end(), [&](const Entry& other) {
+			return other.name == entry.name;
+		});
+
+	if (it == hot_scripts.end())
+	{
+		hot_scripts.push_back(entry);
+		return;
+	}
+
+	it->invocations = std::max(it->invocations, entry.invocations);
+	it->backedges   = std::max(it->backedges, entry.backedges);
+}
+
+Profile load_profile(const std::string& path, const Form& form)
+{
+	Profile       profile;
+	std::ifstream file{path};
+
+	if (!file)
+	{
+		profile.checksum = form.bytecode_checksum;
+		return profile;
+	}
+
+	std::string magic;
+	int         version = 0;
+	file >> magic >> version >> std::hex >> profile.checksum >> std::dec;
+
+	if (!file || magic != profile_magic || version != profile_version)
+	{
+		throw std::runtime_error{
+			fmt::format("'{}' is not a profile for this version of the VM", path)};
+	}
+
+	if (profile.checksum != form.bytecode_checksum)
+	{
+		throw std::runtime_error{fmt::format(
+			"Profile checksum {:016x} does not match the data.win ({:016x})",
+			profile.checksum,
+			form.bytecode_checksum)};
+	}
+
+	Profile::Entry entry;
+	while (file >> entry.invocations >> entry.backedges >> entry.name)
+	{
+		profile.record(entry);
+	}
+
+	if (!file.eof())
+	{
+		throw std::runtime_error{fmt::format("Malformed profile '{}'", path)};
+	}
+
+	return profile;
+}
+
+void save_profile(const Profile& profile, const std::string& path)
+{
+	std::ofstream file{path};
+
+	file << fmt::format(
+		"{} {} {:016x}\n", profile_magic, profile_version, profile.checksum);
+
+	for (auto& entry : profile.hot_scripts)
+	{
+		file << fmt::format(
+			"{} {} {}\n", entry.invocations, entry.backedges, entry.name);
+	}
+
+	if (!file)
+	{
+		throw std::runtime_error{fmt::format("Failed to write '{}'", path)};
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "pvm/unpack/chunk/form.hpp"
+#include <string>
+#include <vector>
+
+//! Scripts that got hot during previous runs of a data.win, so that they can
+//! be optimized at startup rather than after warming up again.
+struct Profile
+{
+	struct Entry
+	{
+		std::string name;
+		std::size_t invocations, backedges;
+	};
+
+	//! Form::bytecode_checksum of the data.win the profile was recorded for.
+	u64 checksum = 0;
+
+	std::vector<Entry> hot_scripts;
+
+	//! Adds 'entry', or updates the counters of the entry of the same script.
+	void record(const Entry& entry);
+};
+
+//! Loads the profile at 'path', if it exists and was recorded for 'form'.
+//! @throws std::runtime_error when the file is malformed or stale.
+[[nodiscard]] Profile load_profile(const std::string& path, const Form& form);
+
+void save_profile(const Profile& profile, const std::string& path);
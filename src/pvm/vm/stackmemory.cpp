@@ -0,0 +1,77 @@
+#include "pvm/vm/stackmemory.hpp"
+
+#include "pvm/config.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+[[nodiscard]] std::size_t page_size()
+{
+	static const auto size = std::size_t(sysconf(_SC_PAGESIZE));
+	return size;
+}
+
+[[nodiscard]] std::size_t round_to_pages(std::size_t size)
+{
+	return (size + page_size() - 1) / page_size() * page_size();
+}
+} // namespace
+
+StackMemory::StackMemory(std::size_t max_size, std::size_t initial_size) :
+	_max_size{max_size}
+{
+	// The guard page is never committed
+	auto reserved = round_to_pages(_max_size) + page_size();
+
+	void* memory = mmap(
+		nullptr,
+		reserved,
+		PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+		-1,
+		0);
+
+	if (memory == MAP_FAILED)
+	{
+		throw std::runtime_error{"Failed to reserve memory for the stack"};
+	}
+
+	_base = static_cast<char*>(memory);
+	grow(initial_size);
+}
+
+StackMemory::~StackMemory()
+{
+	munmap(_base, round_to_pages(_max_size) + page_size());
+}
+
+void StackMemory::grow(std::size_t size)
+{
+	if (size > _max_size)
+	{
+		throw std::runtime_error{fmt::format(
+			"Stack overflow: {} bytes needed, limit is {}", size, _max_size)};
+	}
+
+	// Grow geometrically to keep the amount of mprotect calls low
+	auto committed = std::min(
+		round_to_pages(std::max(size, _committed * 2)),
+		round_to_pages(_max_size));
+
+	if (mprotect(_base, committed, PROT_READ | PROT_WRITE) != 0)
+	{
+		throw std::runtime_error{"Failed to commit memory for the stack"};
+	}
+
+	if constexpr (check(debug::vm_debug_stack))
+	{
+		std::memset(_base + _committed, 0xAB, committed - _committed);
+	}
+
+	_committed = committed;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "pvm/config.hpp"
+#include <cstddef>
+
+//! Memory backing the MainStack and the FrameStack. Address space for
+//! 'max_size' bytes plus a guard page is reserved upfront, but only the part
+//! in use gets committed, growing on demand. Accessing past the committed
+//! part faults instead of corrupting memory. The base address never changes,
+//! so native code may keep pointers into the stack.
+class StackMemory
+{
+	public:
+	//! Commits 'initial_size' bytes right away.
+	explicit StackMemory(
+		std::size_t max_size     = max_stack_size,
+		std::size_t initial_size = stack_frame_headroom);
+	~StackMemory();
+
+	StackMemory(const StackMemory&) = delete;
+	StackMemory& operator=(const StackMemory&) = delete;
+
+	[[nodiscard]] char& operator[](std::size_t offset);
+
+	[[nodiscard]] char* data();
+	[[nodiscard]] char* begin();
+
+	//! End of the committed memory.
+	[[nodiscard]] char* end();
+
+	//! Amount of committed bytes.
+	[[nodiscard]] std::size_t size() const;
+
+	//! Largest size passed to ensure() since the last call to forget_used(),
+	//! i.e. how far the stack may have been written to.
+	[[nodiscard]] std::size_t used() const;
+
+	void forget_used();
+
+	//! Makes sure that the first 'size' bytes are usable, committing more
+	//! memory when needed.
+	//! @throws std::runtime_error when 'size' exceeds the maximum size.
+	void ensure(std::size_t size);
+
+	private:
+	void grow(std::size_t size);
+
+	char*       _base;
+	std::size_t _max_size, _committed = 0, _used = 0;
+};
+
+inline char& StackMemory::operator[](std::size_t offset)
+{
+	return _base[offset];
+}
+
+inline char* StackMemory::data()
+{
+	return _base;
+}
+
+inline char* StackMemory::begin()
+{
+	return _base;
+}
+
+inline char* StackMemory::end()
+{
+	return _base + _committed;
+}
+
+inline std::size_t StackMemory::size() const
+{
+	return _committed;
+}
+
+inline std::size_t StackMemory::used() const
+{
+	return _used;
+}
+
+inline void StackMemory::forget_used()
+{
+	_used = 0;
+}
+
+inline void StackMemory::ensure(std::size_t size)
+{
+	// Only past the high water mark may more memory be needed
+	if (size > _used)
+	{
+		if (size > _committed)
+		{
+			grow(size);
+		}
+
+		_used = size;
+	}
+}
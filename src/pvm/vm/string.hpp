@@ -1,3 +1,9 @@
 #pragma once
 
-struct StringReference {};
+struct HeapString;
+
+//! String value, referencing an immutable string of the Heap of the VM.
+struct StringReference
+{
+	const HeapString* string = nullptr;
+};
@@ -0,0 +1,198 @@
+#include "pvm/vm/tiering.hpp"
+
+#include "pvm/bc/opt/optimizer.hpp"
+#include "pvm/config.hpp"
+#include "pvm/jit/compiler.hpp"
+#include <algorithm>
+#include <fmt/color.h>
+#include <fmt/core.h>
+#include <unordered_map>
+
+std::shared_ptr<TierCache> TierCache::of(const Form& form)
+{
+	static std::mutex mutex;
+	static std::unordered_map<const Form*, std::weak_ptr<TierCache>> caches;
+
+	std::lock_guard lock{mutex};
+
+	// Expired along with the last VM of the form, so that another form
+	// loaded at the same address gets a cache of its own
+	auto& cache  = caches[&form];
+	auto  shared = cache.lock();
+
+	if (shared == nullptr)
+	{
+		shared = std::make_shared<TierCache>(form);
+		cache  = shared;
+	}
+
+	return shared;
+}
+
+TierCache::TierCache(const Form& form) :
+	_form{form},
+	_promoted{std::make_unique<std::atomic<const Script*>[]>(
+		form.code.elements.size())},
+	_requested(form.code.elements.size())
+{}
+
+TierCache::~TierCache()
+{
+	{
+		std::lock_guard lock{_mutex};
+		_stopping = true;
+	}
+
+	_wakeup.notify_all();
+
+	if (_worker.joinable())
+	{
+		_worker.join();
+	}
+}
+
+bool TierCache::request(std::size_t index)
+{
+	{
+		std::lock_guard lock{_mutex};
+
+		if (_requested[index])
+		{
+			return false;
+		}
+
+		_requested[index] = true;
+
+		// Copying here rather than on the worker avoids racing with lazily
+		// computed data of the original script, e.g. its control flow graph
+		_jobs.push_back(
+			{index, std::make_unique<Script>(_form.code.elements[index])});
+
+		if (!_worker.joinable())
+		{
+			_worker = std::thread{[this] { work(); }};
+		}
+	}
+
+	_wakeup.notify_one();
+	return true;
+}
+
+void TierCache::wait_idle()
+{
+	std::unique_lock lock{_mutex};
+	_idle.wait(lock, [&] { return _jobs.empty() && !_busy; });
+}
+
+void TierCache::work()
+{
+	std::unique_lock lock{_mutex};
+
+	for (;;)
+	{
+		_wakeup.wait(lock, [&] { return _stopping || !_jobs.empty(); });
+
+		if (_stopping)
+		{
+			return;
+		}
+
+		auto job = std::move(_jobs.front());
+		_jobs.pop_front();
+		_busy = true;
+
+		lock.unlock();
+		optimize(*job.script);
+
+		if constexpr (opt::jit)
+		{
+			job.script->native_code = compile_native(*job.script, _form);
+		}
+		lock.lock();
+
+		_promoted[job.index].store(job.script.get(), std::memory_order_release);
+		_optimized.push_back(std::move(job.script));
+		_busy = false;
+
+		_idle.notify_all();
+	}
+}
+
+Tiering::Tiering(const Form& form) :
+	_form{form},
+	_counters(form.code.elements.size()),
+	_cache{TierCache::of(form)}
+{}
+
+void Tiering::wait_idle()
+{
+	_cache->wait_idle();
+}
+
+void Tiering::warm_up(const Profile& profile)
+{
+	const auto& scripts = _form.code.elements;
+
+	for (auto& entry : profile.hot_scripts)
+	{
+		auto it = std::find_if(
+			scripts.begin(), scripts.end(), [&](const Script& script) {
+				return script.name == entry.name;
+			});
+
+		if (it == scripts.end())
+		{
+			continue;
+		}
+
+		auto  index    = std::size_t(it - scripts.begin());
+		auto& counters = _counters[index];
+
+		counters.invocations = entry.invocations;
+		counters.backedges   = entry.backedges;
+
+		if (!counters.requested)
+		{
+			request(index);
+		}
+	}
+
+	wait_idle();
+}
+
+void Tiering::record(Profile& profile) const
+{
+	for (std::size_t i = 0; i < _counters.size(); ++i)
+	{
+		auto& counters = _counters[i];
+
+		if (counters.requested)
+		{
+			profile.record({_form.code.elements[i].name,
+							counters.invocations,
+							counters.backedges});
+		}
+	}
+}
+
+void Tiering::request(std::size_t index)
+{
+	auto& counters     = _counters[index];
+	counters.requested = true;
+
+	// Another VM of the form may have found it hot first
+	if (!_cache->request(index))
+	{
+		return;
+	}
+
+	if constexpr (check(debug::vm_verbose_tiering))
+	{
+		fmt::print(
+			fmt::color::medium_purple,
+			"Promoting '{}' ({} calls, {} backedges)\n",
+			_form.code.elements[index].name,
+			counters.invocations,
+			counters.backedges);
+	}
+}
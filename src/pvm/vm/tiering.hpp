@@ -0,0 +1,160 @@
+#pragma once
+
+#include "pvm/unpack/chunk/form.hpp"
+#include "pvm/vm/profile.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! Optimized copies of the scripts of a form, shared by every VM running it
+//! (see Tiering). A single background thread builds them, whichever VM found
+//! the script hot, so that each script gets optimized once.
+class TierCache
+{
+	public:
+	//! Returns the cache of 'form', creating it for the first VM using it.
+	//! It lives as long as a VM refers to it.
+	[[nodiscard]] static std::shared_ptr<TierCache> of(const Form& form);
+
+	explicit TierCache(const Form& form);
+	~TierCache();
+
+	TierCache(const TierCache&) = delete;
+	TierCache& operator=(const TierCache&) = delete;
+
+	//! Returns the optimized copy of the script at 'index' in the form, or
+	//! nullptr when it was not published yet.
+	[[nodiscard]] const Script* promoted(std::size_t index) const;
+
+	//! Queues the script at 'index' for optimization, unless it was already.
+	//! @returns whether it was queued by this call.
+	bool request(std::size_t index);
+
+	//! Blocks until every requested promotion has been published.
+	void wait_idle();
+
+	private:
+	struct Job
+	{
+		std::size_t             index;
+		std::unique_ptr<Script> script;
+	};
+
+	void work();
+
+	const Form& _form;
+
+	//! Optimized version of each script, published by the worker.
+	std::unique_ptr<std::atomic<const Script*>[]> _promoted;
+
+	std::mutex                           _mutex;
+	std::condition_variable              _wakeup, _idle;
+	std::deque<Job>                      _jobs;
+	std::vector<bool>                    _requested;
+	std::vector<std::unique_ptr<Script>> _optimized;
+	bool                                 _busy = false, _stopping = false;
+
+	//! Only started on the first promotion to keep startup cheap.
+	std::thread _worker;
+};
+
+//! Tracks how hot the scripts of a form are for a VM, and promotes scripts
+//! past the opt::tier_up_* thresholds to an optimized tier (see optimize()).
+//! The optimized copy is built by the TierCache of the form, and replaces the
+//! original script starting from its next call, in every VM of the form.
+class Tiering
+{
+	public:
+	struct Counters
+	{
+		std::size_t invocations = 0, backedges = 0;
+
+		//! Whether a promotion was requested already.
+		bool requested = false;
+	};
+
+	explicit Tiering(const Form& form);
+
+	//! Counts a call to 'script', and returns the script to execute for it.
+	[[nodiscard]] const Script& on_call(const Script& script);
+
+	//! Counts a backward branch taken within the script of 'counters'.
+	void on_backedge(Counters& counters);
+
+	//! Returns the counters of 'script', or nullptr when it is not a script
+	//! of the form (e.g. an optimized copy).
+	[[nodiscard]] Counters* counters_of(const Script& script);
+
+	//! Blocks until every requested promotion has been published.
+	void wait_idle();
+
+	//! Promotes the scripts 'profile' found hot right away, then waits for
+	//! them to be optimized.
+	void warm_up(const Profile& profile);
+
+	//! Records the scripts that were promoted so far into 'profile'.
+	void record(Profile& profile) const;
+
+	private:
+	void request(std::size_t index);
+
+	const Form& _form;
+
+	//! Counted per VM, so that calls do not contend on shared counters.
+	std::vector<Counters> _counters;
+
+	std::shared_ptr<TierCache> _cache;
+};
+
+inline const Script* TierCache::promoted(std::size_t index) const
+{
+	return _promoted[index].load(std::memory_order_acquire);
+}
+
+inline const Script& Tiering::on_call(const Script& script)
+{
+	auto* counters = counters_of(script);
+	if (counters == nullptr)
+	{
+		return script;
+	}
+
+	auto index = std::size_t(counters - _counters.data());
+	if (auto* promoted = _cache->promoted(index))
+	{
+		return *promoted;
+	}
+
+	if (++counters->invocations >= opt::tier_up_invocations
+		&& !counters->requested)
+	{
+		request(index);
+	}
+
+	return script;
+}
+
+inline void Tiering::on_backedge(Counters& counters)
+{
+	if (++counters.backedges >= opt::tier_up_backedges && !counters.requested)
+	{
+		request(std::size_t(&counters - _counters.data()));
+	}
+}
+
+inline Tiering::Counters* Tiering::counters_of(const Script& script)
+{
+	const auto& scripts = _form.code.elements;
+
+	if (scripts.empty() || &script < &scripts.front()
+		|| &script > &scripts.back())
+	{
+		return nullptr;
+	}
+
+	return &_counters[std::size_t(&script - scripts.data())];
+}
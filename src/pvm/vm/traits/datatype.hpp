@@ -2,6 +2,7 @@
 
 #include "pvm/bc/enums.hpp"
 #include "pvm/bc/types.hpp"
+#include "pvm/vm/array.hpp"
 #include "pvm/vm/string.hpp"
 #include "pvm/vm/traits/common.hpp"
 
@@ -16,6 +17,7 @@ class data_type_for
 		if constexpr (std::is_same_v<T, f32>) { return DataType::f32; }
 		if constexpr (std::is_same_v<T, f64>) { return DataType::f64; }
 		if constexpr (std::is_same_v<T, StringReference>) { return DataType::str; }
+		if constexpr (std::is_same_v<T, ArrayReference>) { return DataType::array; }
 		return DataType::var;
 	}
 
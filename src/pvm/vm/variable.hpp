@@ -2,8 +2,11 @@
 
 #include "pvm/bc/enums.hpp"
 #include "pvm/bc/types.hpp"
+#include "pvm/vm/array.hpp"
 #include "pvm/vm/string.hpp"
 #include "pvm/vm/traits/datatype.hpp"
+#include <optional>
+#include <type_traits>
 #include <variant>
 
 //! Type used as a placeholder in dispatcher so instructions can detect
@@ -16,8 +19,26 @@ struct VariablePlaceholder
 
 struct Variable
 {
-	std::variant<f64, f32, s64, s32, s16, bool, StringReference> data;
+	std::variant<f64, f32, s64, s32, s16, bool, StringReference, ArrayReference>
+	    data;
 
 	constexpr static std::size_t stack_variable_size
 	    = sizeof(VarType) + sizeof(s64);
 };
+
+//! Returns the value of 'variable' as a f64, if it holds a number.
+[[nodiscard]] inline std::optional<f64> as_number(const Variable& variable)
+{
+	return std::visit(
+	    [](auto v) -> std::optional<f64> {
+		    if constexpr (std::is_arithmetic_v<decltype(v)>)
+		    {
+			    return f64(v);
+		    }
+		    else
+		    {
+			    return std::nullopt;
+		    }
+	    },
+	    variable.data);
+}
@@ -1,17 +1,23 @@
 #include "pvm/vm/vm.hpp"
 
+#include "pvm/aot/library.hpp"
 #include "pvm/bc/disasm.hpp"
+#include "pvm/bc/instruction.hpp"
+#include "pvm/jit/nativecode.hpp"
 #include "pvm/util/cast.hpp"
 #include "pvm/util/compilersupport.hpp"
 #include "pvm/util/nametype.hpp"
 #include "pvm/vm/blockreader.hpp"
 #include "pvm/vm/traits.hpp"
 #include "pvm/vm/variableoperand.hpp"
+#include <algorithm>
+#include <cstring>
 #include <fmt/color.h>
 #include <fmt/core.h>
 #include <stdexcept>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 VarId VM::local_id_from_reference(u32 reference) const
 {
@@ -30,8 +36,166 @@ void VM::print_stack_frame()
 	    fmt::join(frame, ""));
 }
 
+void VM::reset()
+{
+	// Calls ensure() their headroom, so nothing past used() got written
+	if constexpr (check(debug::vm_debug_stack))
+	{
+		std::memset(stack.raw.data(), 0xAB, stack.raw.used());
+	}
+
+	stack.raw.forget_used();
+
+	stack.offset = 0;
+
+	frames.offset = 0;
+	frames.top()  = Frame{};
+
+	yielded      = false;
+	native_depth = 0;
+
+	instances.reset();
+	structures.reset(heap);
+}
+
+void VM::clear_memoized()
+{
+	memo.clear();
+}
+
+RunResult VM::resume(u64 budget)
+{
+	if (!yielded)
+	{
+		throw std::runtime_error{"Cannot resume a VM that did not yield"};
+	}
+
+	fuel    = std::max<u64>(budget, 1);
+	yielded = false;
+
+	// The entry frame sits right above the base frame (see invoke_pushed())
+	resume_frame(1);
+
+	if (yielded)
+	{
+		return {true, std::nullopt};
+	}
+
+	return {false, finish_entry()};
+}
+
+void VM::resume_frame(std::size_t depth)
+{
+	if (depth < frames.offset)
+	{
+		resume_frame(depth + 1);
+
+		if (yielded)
+		{
+			return;
+		}
+
+		// Returning from the call, as call() would have
+		frames.pop();
+	}
+
+	// Copied, as the frame gets suspended again if the script yields
+	const Frame&  frame        = frames.frames[depth];
+	const Script& script       = *frame.script;
+	auto          offset       = frame.resume_offset;
+	bool          compare_flag = frame.compare_flag;
+
+	if (offset < script.data.size())
+	{
+		interpret(script, offset, compare_flag);
+	}
+}
+
+void VM::mark_roots()
+{
+	heap.scan(stack.raw.data(), stack.offset);
+
+	instances.for_each([&](const Instance& instance) {
+		for (auto& [id, variable] : instance.variables())
+		{
+			heap.mark(variable);
+		}
+	});
+
+	structures.mark(heap);
+}
+
+HeapArray& VM::array_to_write(InstType inst_type, u32 reference)
+{
+	auto* array = array_of(inst_type, reference);
+	if (array != nullptr && array->shares <= 1)
+	{
+		return *array;
+	}
+
+	auto* written
+	    = array != nullptr ? heap.copy_array(*array) : heap.make_array();
+
+	write_variable(
+	    inst_type,
+	    reference & 0xFFFFFFu,
+	    VarType::normal,
+	    ArrayReference{written});
+
+	return *written;
+}
+
+void VM::push_element(InstType inst_type, u32 reference, std::size_t index)
+{
+	auto* array = array_of(inst_type, reference);
+	if (array == nullptr)
+	{
+		throw std::runtime_error{"Indexing a variable that holds no array"};
+	}
+
+	if (auto* number = array->number_at(index))
+	{
+		push_stack_variable(*number);
+		return;
+	}
+
+	std::visit(
+	    [&](auto element) { push_stack_variable(element); },
+	    array->at(index).data);
+}
+
 void VM::call(const FunctionDefinition& func, std::size_t argument_count)
 {
+	stack.raw.ensure(stack.offset + stack_frame_headroom);
+
+	auto arguments
+	    = stack.offset - argument_count * Variable::stack_variable_size;
+
+	MemoTable::Key memo_key;
+	bool           memoized = false;
+
+	if constexpr (opt::memoize_pure)
+	{
+		// Memoized results would skip over breakpoints
+		if (!func.is_builtin && func.associated_script->is_pure
+		    && debugger == nullptr
+		    && MemoTable::make_key(
+		        memo_key,
+		        *func.associated_script,
+		        &stack.raw[arguments],
+		        argument_count))
+		{
+			if (auto* result = memo.find(memo_key))
+			{
+				stack.offset = arguments;
+				stack.push_raw(result->data(), result->size());
+				return;
+			}
+
+			memoized = true;
+		}
+	}
+
 	Frame& frame         = frames.push();
 	frame.argument_count = argument_count;
 	frame.stack_offset
@@ -39,430 +203,711 @@ void VM::call(const FunctionDefinition& func, std::size_t argument_count)
 
 	if (func.is_builtin)
 	{
+		if (func.builtin_arity && *func.builtin_arity != argument_count)
+		{
+			throw std::runtime_error{fmt::format(
+			    "{} takes {} arguments, not {}",
+			    func.name,
+			    *func.builtin_arity,
+			    argument_count)};
+		}
+
+		// Builtins may allocate their result, while their arguments are
+		// still on the stack
+		gc_safepoint();
+
 		func.associated_builtin(*this);
 	}
+	else if (
+	    func.associated_native != nullptr && debugger == nullptr
+	    && !check(debug::vm_coverage))
+	{
+		const NativeFunction& native = *func.associated_native;
+		push_locals(native.script);
+		run_native(native.script, native.entry, nullptr);
+	}
 	else
 	{
-		Script& called_script = *func.associated_script;
-		stack.skip(-called_script.local_count * Variable::stack_variable_size);
+		const Script& called_script = script_to_run(*func.associated_script);
+		push_locals(called_script);
 		run(called_script);
 	}
 
+	// The frame stays until the run gets resumed (see resume_frame())
+	if (yielded)
+	{
+		return;
+	}
+
 	frames.pop();
+
+	// Scripts falling through their end without returning are not cached
+	if (memoized
+	    && stack.offset == arguments + Variable::stack_variable_size)
+	{
+		memo.insert(memo_key, &stack.raw[arguments]);
+	}
 }
 
-void VM::run(const Script& script)
+bool VM::execute(
+    const Script&      script,
+    BlockReader&       reader,
+    bool&              compare_flag,
+    Tiering::Counters* counters,
+    u8*                hits)
 {
-	if constexpr (check(debug::vm_verbose_calls))
+	VMState state{reader};
+
+	if constexpr (check(debug::vm_verbose_instructions))
 	{
+		Disassembler disasm{form};
+
+		print_stack_frame();
+
 		fmt::print(
-		    fmt::color::red,
-		    "Executing function '{}' ({}th nested call, {} bytes allocated on "
-		    "stack)\n",
-		    script.name,
-		    frames.offset + 1,
-		    stack.offset - frames.top().stack_offset);
+		    fmt::color::orange,
+		    "{:80}\n",
+		    disasm.disassemble_block(&script.data[reader.offset()], &script)
+		        .as_plain_string(),
+		    reader.offset(),
+		    enum_value(state.opcode));
 	}
 
-	BlockReader reader{script};
-
-	bool compare_flag = false;
+	//! Marks the basic block of the next instruction as covered, when
+	//! entering it otherwise than by falling through.
+	auto cover_next = [&]() FORCE_INLINE {
+		if constexpr (check(debug::vm_coverage))
+		{
+			if (hits != nullptr)
+			{
+				hits[reader.offset() + 1] = 1;
+			}
+		}
+	};
 
-	for (;;)
-	{
-		VMState state{reader};
+	//! Jumps to another instruction with an offset defined by the current
+	//! block.
+	//! @returns whether the run yields, i.e. execute() should return.
+	auto branch = [&]() FORCE_INLINE {
+		s16 offset = state.block & 0xFFFFu;
 
 		if constexpr (check(debug::vm_verbose_instructions))
 		{
-			Disassembler disasm{form};
-
-			print_stack_frame();
-
 			fmt::print(
-			    fmt::color::orange,
-			    "{:80}\n",
-			    disasm.disassemble_block(&script.data[reader.offset()], &script)
-			        .as_plain_string(),
-			    reader.offset(),
-			    enum_value(state.opcode));
+			    fmt::color::yellow_green,
+			    "    Branching with offset {} blocks\n",
+			    offset);
 		}
 
-		//! Jumps to another instruction with an offset defined by the current
-		//! block.
-		auto branch = [&]() FORCE_INLINE {
-			s16 offset = state.block & 0xFFFFu;
-
-			if constexpr (check(debug::vm_verbose_instructions))
+		if constexpr (opt::tiered)
+		{
+			if (offset < 0 && counters != nullptr)
 			{
-				fmt::print(
-				    fmt::color::yellow_green,
-				    "    Branching with offset {} blocks\n",
-				    offset);
+				tiering.on_backedge(*counters);
 			}
+		}
 
-			// TODO: make this nicer somehow? skipping block++ on the end
-			reader.relative_jump(offset - 1);
-		};
+		// TODO: make this nicer somehow? skipping block++ on the end
+		reader.relative_jump(offset - 1);
+		cover_next();
 
-		switch (state.opcode)
-		{
-		case Instr::opconv:
-		{
-			pop_dispatch(
-			    [&](auto src) FORCE_INLINE {
-				    dispatcher(
-				        [&](auto dst) FORCE_INLINE {
-					        if constexpr (std::is_same_v<
-					                          decltype(dst),
-					                          VariablePlaceholder>)
-					        {
-						        push_stack_variable(src);
-					        }
-					        else if constexpr (are<std::is_arithmetic,
-					                               decltype(dst),
-					                               decltype(value(src))>())
-					        {
-						        stack.push<decltype(dst)>(value(src));
-					        }
-					        else
-					        {
-						        maybe_unreachable(
-						            "Unimplemented conversion types");
-					        }
-				        },
-				        std::array{state.t2});
-			    },
-			    state.t1);
+		return offset < 0 && --fuel == 0 && out_of_fuel();
+	};
 
-			break;
-		}
+	switch (state.opcode)
+	{
+	case Instr::opconv:
+	{
+		pop_dispatch(
+		    [&](auto src) FORCE_INLINE {
+			    dispatcher(
+			        [&](auto dst) FORCE_INLINE {
+				        if constexpr (std::is_same_v<
+				                          decltype(dst),
+				                          VariablePlaceholder>)
+				        {
+					        push_stack_variable(src);
+				        }
+				        else if constexpr (
+				            are<std::is_arithmetic,
+				                decltype(dst),
+				                decltype(value(src))>()
+				            || std::is_same_v<
+				                decltype(dst),
+				                decltype(value(src))>)
+				        {
+					        stack.push<decltype(dst)>(value(src));
+				        }
+				        else
+				        {
+					        maybe_unreachable(
+					            "Unimplemented conversion types");
+				        }
+			        },
+			        std::array{state.t2});
+		    },
+		    state.t1);
+
+		break;
+	}
 
-		case Instr::opmul:
-		{
-			op_arithmetic2(state, [&](auto a, auto b) {
-				if constexpr (
-				    std::is_integral_v<decltype(
-				        a)> && std::is_same_v<decltype(b), StringReference>)
-				{
-					// TODO
-				}
+	case Instr::opmul:
+	{
+		op_arithmetic2(state, [&](auto a, auto b) {
+			if constexpr (
+			    std::is_integral_v<decltype(
+			        a)> && std::is_same_v<decltype(b), StringReference>)
+			{
+				// TODO
+			}
 
-				if constexpr (are<std::is_arithmetic>(a, b))
-				{
-					return a * b;
-				}
+			if constexpr (are<std::is_arithmetic>(a, b))
+			{
+				return a * b;
+			}
 
-				maybe_unreachable("Multiply op should be impossible");
-			});
+			maybe_unreachable("Multiply op should be impossible");
+		});
 
-			break;
-		}
+		break;
+	}
 
-		case Instr::opdiv:
-		{
-			op_arithmetic_numeric2(state, [&](auto a, auto b) {
-				// TODO: what to do on /0?
-				return a / b;
-			});
+	case Instr::opdiv:
+	{
+		op_arithmetic_numeric2(state, [&](auto a, auto b) {
+			// TODO: what to do on /0?
+			return a / b;
+		});
 
-			break;
-		}
+		break;
+	}
 
-			// case Instr::oprem: // TODO
-			// case Instr::opmod: // TODO
+		// case Instr::oprem: // TODO
+		// case Instr::opmod: // TODO
 
-		case Instr::opadd:
-		{
-			op_arithmetic2(state, [&](auto a, auto b) {
-				if constexpr (
-				    std::is_same_v<
-				        decltype(a),
-				        StringReference> && std::is_same_v<decltype(b), StringReference>)
-				{
-					// TODO
-				}
+	case Instr::opadd:
+	{
+		// Concatenation allocates, while the operands are still on the stack
+		gc_safepoint();
+
+		op_arithmetic2(state, [&](auto a, auto b) {
+			if constexpr (
+			    std::is_same_v<
+			        decltype(a),
+			        StringReference> && std::is_same_v<decltype(b), StringReference>)
+			{
+				return StringReference{
+				    heap.make_string(a.string->view(), b.string->view())};
+			}
 
-				if constexpr (are<std::is_arithmetic>(a, b))
-				{
-					return a + b;
-				}
-			});
+			if constexpr (are<std::is_arithmetic>(a, b))
+			{
+				return a + b;
+			}
+		});
 
-			break;
-		}
+		break;
+	}
 
-		case Instr::opsub:
-		{
-			op_arithmetic_numeric2(
-			    state, [&](auto a, auto b) { return a - b; });
+	case Instr::opsub:
+	{
+		op_arithmetic_numeric2(
+		    state, [&](auto a, auto b) { return a - b; });
 
-			break;
-		}
+		break;
+	}
 
-		case Instr::opand:
-		{
-			op_arithmetic_integral2(
-			    state, [&](auto a, auto b) { return a & b; });
+	case Instr::opand:
+	{
+		op_arithmetic_integral2(
+		    state, [&](auto a, auto b) { return a & b; });
 
-			break;
-		}
+		break;
+	}
 
-		case Instr::opor:
-		{
-			op_arithmetic_integral2(
-			    state, [&](auto a, auto b) { return a | b; });
+	case Instr::opor:
+	{
+		op_arithmetic_integral2(
+		    state, [&](auto a, auto b) { return a | b; });
 
-			break;
-		}
+		break;
+	}
 
-		case Instr::opxor:
-		{
-			op_arithmetic_integral2(
-			    state, [&](auto a, auto b) { return a ^ b; });
+	case Instr::opxor:
+	{
+		op_arithmetic_integral2(
+		    state, [&](auto a, auto b) { return a ^ b; });
 
-			break;
-		}
+		break;
+	}
 
-			// case Instr::opneg: // TODO
-			// case Instr::opnot: // TODO
+		// case Instr::opneg: // TODO
+		// case Instr::opnot: // TODO
 
-		case Instr::opshl:
-		{
-			op_arithmetic2(state, [&](auto a, auto b) {
-				if constexpr (are<std::is_integral>(a, b))
-				{
-					return a << b;
-				}
-			});
+	case Instr::opshl:
+	{
+		op_arithmetic2(state, [&](auto a, auto b) {
+			if constexpr (are<std::is_integral>(a, b))
+			{
+				return a << b;
+			}
+		});
 
-			break;
-		}
+		break;
+	}
 
-		case Instr::opshr:
-		{
-			op_arithmetic2(state, [&](auto a, auto b) {
-				if constexpr (are<std::is_integral>(a, b))
-				{
-					return a >> b;
-				}
-			});
+	case Instr::opshr:
+	{
+		op_arithmetic2(state, [&](auto a, auto b) {
+			if constexpr (are<std::is_integral>(a, b))
+			{
+				return a >> b;
+			}
+		});
 
-			break;
-		}
+		break;
+	}
 
-		case Instr::opcmp:
-		{
-			auto func = CompFunc((state.block >> 8u) & 0xFFu);
-			op_pop2(state, [&](auto a, auto b) {
-				auto va = value(a);
-				auto vb = value(b);
+	case Instr::opcmp:
+	{
+		auto func = CompFunc((state.block >> 8u) & 0xFFu);
+		op_pop2(state, [&](auto a, auto b) {
+			auto va = value(a);
+			auto vb = value(b);
 
-				if constexpr (are<std::is_arithmetic>(va, vb))
-				{
-					switch (func)
-					{
-					case CompFunc::lt: compare_flag = va < vb; break;
-					case CompFunc::lte: compare_flag = va <= vb; break;
-					case CompFunc::eq: compare_flag = va == vb; break;
-					case CompFunc::neq: compare_flag = va != vb; break;
-					case CompFunc::gte: compare_flag = va >= vb; break;
-					case CompFunc::gt: compare_flag = va > vb; break;
-					default: maybe_unreachable();
-					}
-				}
-				else
+			if constexpr (are<std::is_arithmetic>(va, vb))
+			{
+				switch (func)
 				{
-					maybe_unreachable("Comparison should be impossible");
+				case CompFunc::lt: compare_flag = va < vb; break;
+				case CompFunc::lte: compare_flag = va <= vb; break;
+				case CompFunc::eq: compare_flag = va == vb; break;
+				case CompFunc::neq: compare_flag = va != vb; break;
+				case CompFunc::gte: compare_flag = va >= vb; break;
+				case CompFunc::gt: compare_flag = va > vb; break;
+				default: maybe_unreachable();
 				}
-			});
+			}
+			else
+			{
+				maybe_unreachable("Comparison should be impossible");
+			}
+		});
 
-			break;
-		}
+		break;
+	}
+
+	case Instr::oppop:
+	{
+		auto inst_type = InstType(s16(state.block & 0xFFFFu));
+		auto reference = reader.next_block();
 
-		case Instr::oppop:
+		if (VarType(reference >> 24u) == VarType::array)
 		{
+			// Writing may allocate, while the value is still on the stack
+			gc_safepoint();
+
+			auto index = pop_array_index();
 			pop_dispatch(
 			    [&](auto v) {
-				    auto inst_type = InstType(s16(state.block & 0xFFFFu));
-				    auto reference = reader.next_block();
-
-				    write_variable(
-				        inst_type,
-				        reference & 0xFFFFFFu,
-				        VarType(reference >> 24u),
-				        value(v));
+				    write_element(inst_type, reference, index, value(v));
 			    },
 			    state.t2);
 
 			break;
 		}
 
-			// case Instr::oppushi16: // TODO
-			// case Instr::opdup: // TODO
+		pop_dispatch(
+		    [&](auto v) {
+			    write_variable(
+			        inst_type,
+			        reference & 0xFFFFFFu,
+			        VarType(reference >> 24u),
+			        value(v));
+		    },
+		    state.t2);
+
+		break;
+	}
+
+		// case Instr::oppushi16: // TODO
 
-		case Instr::opret:
+	case Instr::opdup:
+	{
+		std::size_t item_size = Variable::stack_variable_size;
+
+		if (state.t1 != DataType::var)
 		{
-			std::move(
-			    stack.raw.begin() + stack.offset
-			        - Variable::stack_variable_size,
-			    stack.raw.begin() + stack.offset,
-			    stack.raw.begin() + frames.top().stack_offset);
+			item_size = dispatcher(
+			    [&](auto v) -> std::size_t {
+				    if constexpr (
+				        std::is_arithmetic_v<decltype(
+				            v)> || std::is_same_v<decltype(v), StringReference>)
+				    {
+					    return sizeof(v);
+				    }
+				    else
+				    {
+					    maybe_unreachable("Type not implemented for dup");
+					    return 0;
+				    }
+			    },
+			    std::array{state.t1});
+		}
 
-			stack.skip(
-			    stack.offset - frames.top().stack_offset
-			    - Variable::stack_variable_size);
+		auto bytes = ((state.block & 0xFFu) + 1) * item_size;
+		stack.push_raw(&stack.raw[stack.offset - bytes], bytes);
+		break;
+	}
 
-			if constexpr (check(debug::vm_verbose_calls))
-			{
-				fmt::print(
-				    fmt::color::blue_violet,
-				    "\nReturning from {}\n\n",
-				    script.name);
-			}
+	case Instr::opswitch:
+	{
+		const auto& table = script.jump_tables[state.block & 0xFFFFu];
+
+		// The switched value is only peeked at, the case bodies are
+		// responsible for discarding it like in the original chain
+		auto offset  = stack.offset;
+		bool matched = false;
+		u32  target  = table.default_target;
+
+		pop_dispatch(
+		    [&](auto operand) {
+			    auto v = value(operand);
+			    using T = decltype(v);
+
+			    if constexpr (std::is_integral_v<T>)
+			    {
+				    target = table.find(s64(v), matched);
+			    }
+			    else if constexpr (std::is_floating_point_v<T>)
+			    {
+				    // Non-integral values cannot match any case
+				    if (v >= -0x1p63 && v < 0x1p63 && T(s64(v)) == v)
+				    {
+					    target = table.find(s64(v), matched);
+				    }
+			    }
+		    },
+		    state.t1);
 
-			return;
-		}
+		stack.offset = offset;
+		compare_flag = matched;
 
-			// case Instr::opexit: // TODO
+		reader.relative_jump(
+		    s32(target) - s32(reader.offset()) - 1);
+		cover_next();
+		break;
+	}
 
-		case Instr::oppopz:
-		{
-			pop_dispatch([]([[maybe_unused]] auto v) {}, state.t1);
-			break;
-		}
+	case Instr::opret:
+	{
+		std::move(
+		    stack.raw.begin() + stack.offset
+		        - Variable::stack_variable_size,
+		    stack.raw.begin() + stack.offset,
+		    stack.raw.begin() + frames.top().stack_offset);
+
+		stack.skip(
+		    stack.offset - frames.top().stack_offset
+		    - Variable::stack_variable_size);
 
-		case Instr::opb:
+		if constexpr (check(debug::vm_verbose_calls))
 		{
-			branch();
-			break;
+			fmt::print(
+			    fmt::color::blue_violet,
+			    "\nReturning from {}\n\n",
+			    script.name);
 		}
 
-		case Instr::opbt:
-		{
-			if (compare_flag)
-			{
-				branch();
-			}
+		return true;
+	}
 
-			break;
-		}
+		// case Instr::opexit: // TODO
+
+	case Instr::oppopz:
+	{
+		pop_dispatch([]([[maybe_unused]] auto v) {}, state.t1);
+		break;
+	}
+
+	case Instr::opb:
+	{
+		return branch();
+	}
 
-		case Instr::opbf:
+	case Instr::opbt:
+	{
+		if (compare_flag)
 		{
-			if (!compare_flag)
-			{
-				branch();
-			}
-			break;
+			return branch();
 		}
 
-			// case Instr::oppushenv: // TODO
-			// case Instr::oppopenv: // TODO
+		cover_next();
+		break;
+	}
 
-		case Instr::oppushcst:
-		case Instr::oppushglb: // TODO: separate
+	case Instr::opbf:
+	{
+		if (!compare_flag)
 		{
-			dispatcher(
-			    [&](auto v) {
-				    if constexpr (std::is_arithmetic_v<decltype(v)>)
+			return branch();
+		}
+
+		cover_next();
+		break;
+	}
+
+		// case Instr::oppushenv: // TODO
+		// case Instr::oppopenv: // TODO
+
+	case Instr::oppushcst:
+	case Instr::oppushglb: // TODO: separate
+	{
+		dispatcher(
+		    [&](auto v) {
+			    if constexpr (std::is_arithmetic_v<decltype(v)>)
+			    {
+				    if (state.t1 == DataType::i16)
 				    {
-					    if (state.t1 == DataType::i16)
-					    {
-						    stack.push(s32(state.block & 0xFFFFu));
-					    }
-					    else
-					    {
-						    stack.push_raw(&reader.next_block(), sizeof(v));
-
-						    // Move to the last block of the instruction
-						    // TODO: reader.skip() or something
-						    for (unsigned i = 0; i < (sizeof(v) / 4) - 1; ++i)
-						    {
-							    reader.next_block();
-						    }
-					    }
+					    stack.push(s32(state.block & 0xFFFFu));
 				    }
-				    else if constexpr (std::is_same_v<
-				                           decltype(v),
-				                           VariablePlaceholder>)
+				    else
 				    {
-					    auto inst_type = InstType(s16(state.block & 0xFFFFu));
-					    auto reference = reader.next_block();
+					    stack.push_raw(&reader.next_block(), sizeof(v));
 
-					    switch (inst_type)
+					    // Move to the last block of the instruction
+					    // TODO: reader.skip() or something
+					    for (unsigned i = 0; i < (sizeof(v) / 4) - 1; ++i)
 					    {
-					    case InstType::local:
-						    stack.push_raw(
-						        &stack.raw[frames.top().local_offset(
-						            local_id_from_reference(reference))],
-						        Variable::stack_variable_size);
-						    break;
-
-						case InstType::global:
-						{
-							Variable& global_variable
-								= instances.global().variable(
-									reference & 0x00FFFFFF);
-
-							std::visit(
-								[&](auto value) { push_stack_variable(value); },
-								global_variable.data);
-							break;
-						}
-
-					    default:
-						    maybe_unreachable(
-						        "InstType not implemented for pushcst");
+						    reader.next_block();
 					    }
 				    }
-				    else
+			    }
+			    else if constexpr (std::is_same_v<
+			                           decltype(v),
+			                           StringReference>)
+			    {
+				    auto id = reader.next_block();
+				    stack.push(StringReference{
+				        heap.constant(id, form.strg.elements[id].value)});
+			    }
+			    else if constexpr (std::is_same_v<
+			                           decltype(v),
+			                           VariablePlaceholder>)
+			    {
+				    auto inst_type = InstType(s16(state.block & 0xFFFFu));
+				    auto reference = reader.next_block();
+
+				    if (VarType(reference >> 24u) == VarType::array)
 				    {
-					    maybe_unreachable("Type not implemented for pushcst");
+					    auto index = pop_array_index();
+					    push_element(inst_type, reference, index);
+					    return;
 				    }
-			    },
-			    std::array{state.t1});
+
+				    switch (inst_type)
+				    {
+				    case InstType::local:
+					    stack.push_raw(
+					        &stack.raw[frames.top().local_offset(
+					            local_id_from_reference(reference))],
+					        Variable::stack_variable_size);
+					    break;
+
+					case InstType::global:
+					{
+						Variable& global_variable
+							= instances.global().variable(
+								reference & 0x00FFFFFF);
+
+						std::visit(
+							[&](auto value) { push_stack_variable(value); },
+							global_variable.data);
+						break;
+					}
+
+				    default:
+					    maybe_unreachable(
+					        "InstType not implemented for pushcst");
+				    }
+			    }
+			    else
+			    {
+				    maybe_unreachable("Type not implemented for pushcst");
+			    }
+		    },
+		    std::array{state.t1});
+		break;
+	}
+
+	case Instr::oppushloc:
+	{
+		auto reference    = reader.next_block();
+		auto local_offset = frames.top().local_offset(
+		    local_id_from_reference(reference));
+
+		if (state.t1 == DataType::var
+		    && VarType(reference >> 24u) == VarType::array)
+		{
+			auto index = pop_array_index();
+			push_element(InstType::local, reference, index);
 			break;
 		}
 
-		case Instr::oppushloc:
+		if (state.t1 == DataType::var)
 		{
-			auto reference = reader.next_block();
 			stack.push_raw(
-			    &stack.raw[frames.top().local_offset(
-			        local_id_from_reference(reference))],
-			    Variable::stack_variable_size);
+			    &stack.raw[local_offset], Variable::stack_variable_size);
 			break;
 		}
 
-		case Instr::oppushspc:
+		// Typed local read, as rewritten by infer_types: the tag is known
+		// statically so only the value gets pushed.
+		dispatcher(
+		    [&](auto v) {
+			    if constexpr (std::is_arithmetic_v<decltype(v)>)
+			    {
+				    stack.push_raw(&stack.raw[local_offset], sizeof(v));
+			    }
+			    else
+			    {
+				    maybe_unreachable("Type not implemented for pushloc");
+			    }
+		    },
+		    std::array{state.t1});
+		break;
+	}
+
+	case Instr::oppushspc:
+	{
+		read_special(SpecialVar(reader.next_block() & 0x00FFFFFFu));
+		break;
+	}
+
+	case Instr::oppushi16:
+	{
+		stack.push<s32>(s16(state.block & 0xFFFFu));
+		break;
+	}
+
+	case Instr::opcall:
+	{
+		std::size_t argument_count = state.block & 0xFFFFu;
+		auto&       func = form.func.definitions[reader.next_block()];
+
+		if (debugger != nullptr)
 		{
-			read_special(SpecialVar(reader.next_block() & 0x00FFFFFFu));
-			break;
+			debugger->on_call(script, reader.offset() + 1, frames.offset);
+		}
+
+		call(func, argument_count);
+
+		// The callee yielded, this frame gets suspended as well
+		if (yielded)
+		{
+			return true;
 		}
 
-		case Instr::oppushi16:
+		break;
+	}
+
+	case Instr::opbreak:
+	{
+		// Breakpoint patched in by the debugger, which put the original
+		// instruction back: run it instead.
+		if (debugger != nullptr
+		    && debugger->on_break(*this, script, reader.offset()))
 		{
-			stack.push<s32>(s16(state.block & 0xFFFFu));
+			reader.relative_jump(-1);
 			break;
 		}
 
-		case Instr::opcall:
+		[[fallthrough]];
+	}
+
+	default:
+	{
+		fmt::print(
+		    fmt::color::red, "Unhandled op ${:02x}\n", u8(state.opcode));
+		maybe_unreachable("Reached unhandled operation in VM");
+		break;
+	}
+	}
+
+	return false;
+}
+
+void VM::run(const Script& script)
+{
+	if constexpr (check(debug::vm_verbose_calls))
+	{
+		fmt::print(
+		    fmt::color::red,
+		    "Executing function '{}' ({}th nested call, {} bytes allocated on "
+		    "stack)\n",
+		    script.name,
+		    frames.offset + 1,
+		    stack.offset - frames.top().stack_offset);
+	}
+
+	// Calls count against the fuel, yielding before the script starts
+	if (--fuel == 0 && out_of_fuel())
+	{
+		suspend_frame(frames.offset, script, 0, false);
+		return;
+	}
+
+	if constexpr (opt::jit)
+	{
+		if (script.native_code != nullptr)
 		{
-			std::size_t argument_count = state.block & 0xFFFFu;
-			auto&       func = form.func.definitions[reader.next_block()];
-			call(func, argument_count);
-			break;
+			run_native(
+			    script,
+			    script.native_code->entry(),
+			    script.native_code->targets());
+			return;
 		}
+	}
+
+	interpret(script);
+}
+
+void VM::interpret(
+    const Script& script, std::size_t offset, bool compare_flag)
+{
+	BlockReader reader{script};
+	reader.relative_jump(s32(offset));
+
+	// Frames above this one are pushed by calls while it runs
+	auto depth = frames.offset;
 
-			// case Instr::opbreak: // TODO
+	Tiering::Counters* counters = nullptr;
+	if constexpr (opt::tiered)
+	{
+		counters = tiering.counters_of(script);
+	}
 
-		default:
+	u8* hits = nullptr;
+	if constexpr (check(debug::vm_coverage))
+	{
+		hits = coverage.hits_of(script);
+		if (hits != nullptr)
 		{
-			fmt::print(
-			    fmt::color::red, "Unhandled op ${:02x}\n", u8(state.opcode));
-			maybe_unreachable("Reached unhandled operation in VM");
-			break;
+			hits[offset] = 1;
 		}
+	}
+
+	for (;;)
+	{
+		if (execute(script, reader, compare_flag, counters, hits))
+		{
+			// Continues after the instruction that yielded once resumed
+			if (yielded)
+			{
+				suspend_frame(depth, script, reader.offset() + 1, compare_flag);
+			}
+
+			return;
 		}
 
 		reader.next_block();
@@ -473,6 +918,128 @@ void VM::run(const Script& script)
 	}
 }
 
+void VM::run_native(
+    const Script&      script,
+    void               (*entry)(JitContext*),
+    const void* const* targets)
+{
+	JitContext context{
+	    this,
+	    &script,
+	    stack.raw.data(),
+	    &stack.offset,
+	    &stack.raw[frames.top().local_offset()],
+	    targets,
+	    false,
+	    {}};
+
+	if constexpr (check(debug::jit_verify))
+	{
+		auto begin = frames.top().stack_offset;
+		std::vector<char> initial(
+		    stack.raw.begin() + begin, stack.raw.begin() + stack.offset);
+		auto initial_offset = stack.offset;
+
+		++native_depth;
+		entry(&context);
+		--native_depth;
+		if (context.error)
+		{
+			std::rethrow_exception(context.error);
+		}
+
+		std::vector<char> native(
+		    stack.raw.begin() + begin, stack.raw.begin() + stack.offset);
+
+		std::copy(initial.begin(), initial.end(), stack.raw.begin() + begin);
+		stack.offset = initial_offset;
+
+		interpret(script);
+
+		if (!std::equal(
+		        native.begin(),
+		        native.end(),
+		        stack.raw.begin() + begin,
+		        stack.raw.begin() + stack.offset))
+		{
+			throw std::runtime_error{fmt::format(
+			    "Native code and interpreter disagree on the result of '{}'",
+			    script.name)};
+		}
+
+		return;
+	}
+
+	// Scripts it calls cannot yield, as native code cannot be resumed.
+	// Errors are caught by the native code and rethrown below.
+	++native_depth;
+	entry(&context);
+	--native_depth;
+	if (context.error)
+	{
+		std::rethrow_exception(context.error);
+	}
+}
+
+bool VM::jit_step(JitContext* context, u32 offset)
+{
+	try
+	{
+		const auto& script = *context->script;
+
+		BlockReader reader{script};
+		reader.relative_jump(s32(offset));
+
+		if (context->vm->execute(
+		        script, reader, context->compare_flag, nullptr, nullptr))
+		{
+			return true;
+		}
+
+		// Native code steps over the bytecode with instruction_size(), which
+		// has to agree with the blocks the interpreter read
+		if constexpr (check(debug::vm_safer))
+		{
+			if (reader.offset() + 1
+			    != offset + instruction_size(&script.data[offset]))
+			{
+				throw std::logic_error{fmt::format(
+				    "Native code of '{}' stepped off an instruction at "
+				    "${:08x}",
+				    script.name,
+				    offset)};
+			}
+		}
+
+		return false;
+	}
+	catch (...)
+	{
+		context->error = std::current_exception();
+		return true;
+	}
+}
+
+u32 VM::jit_switch_target(JitContext* context, u32 offset)
+{
+	try
+	{
+		BlockReader reader{*context->script};
+		reader.relative_jump(s32(offset));
+
+		// Like the interpreter loop, land on the block following the one
+		// the reader was left on
+		context->vm->execute(
+		    *context->script, reader, context->compare_flag, nullptr, nullptr);
+		return u32(reader.offset() + 1);
+	}
+	catch (...)
+	{
+		context->error = std::current_exception();
+		return u32(context->script->data.size());
+	}
+}
+
 void VM::read_special(SpecialVar var)
 {
 	// argumentn
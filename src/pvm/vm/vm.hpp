@@ -3,17 +3,41 @@
 #include "pvm/bc/enums.hpp"
 #include "pvm/bc/types.hpp"
 #include "pvm/config.hpp"
+#include "pvm/jit/context.hpp"
 #include "pvm/unpack/chunk/form.hpp"
 #include "pvm/unpack/chunk/function.hpp"
 #include "pvm/util/compilersupport.hpp"
 #include "pvm/util/errormanagement.hpp"
 #include "pvm/vm/contextstack.hpp"
+#include "pvm/vm/coverage.hpp"
+#include "pvm/vm/datastructures.hpp"
+#include "pvm/vm/debugger.hpp"
 #include "pvm/vm/framestack.hpp"
+#include "pvm/vm/heap.hpp"
 #include "pvm/vm/instancemanager.hpp"
 #include "pvm/vm/mainstack.hpp"
+#include "pvm/vm/memotable.hpp"
+#include "pvm/vm/tiering.hpp"
 #include "pvm/vm/traits/variable.hpp"
 #include "pvm/vm/variableoperand.hpp"
 #include "pvm/vm/vmstate.hpp"
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+//! Outcome of a run that may yield (see VM::start()).
+struct RunResult
+{
+	//! Whether the run yielded before the entry point returned, in which
+	//! case it can be resumed.
+	bool yielded = false;
+
+	//! Value the entry point returned, if it finished and returned one.
+	std::optional<Variable> value;
+};
 
 #define DISPATCH_NEXT(appended_type)                                           \
 	dispatcher<Left - 1, F, Ts..., appended_type>(f, new_array)
@@ -28,11 +52,195 @@ class VM
 
 	InstanceManager instances;
 
+	Tiering tiering;
+
+	//! Results of the calls to pure scripts.
+	MemoTable memo;
+
+	//! Basic blocks that ran, with debug::vm_coverage.
+	Coverage coverage;
+
+	//! Strings and arrays created by the scripts.
+	Heap heap;
+
+	//! Containers of the ds_* builtins.
+	DataStructures structures;
+
+	//! Debugger the scripts run under, if any (see Debugger::run()). Only
+	//! checked on calls and on opbreak.
+	Debugger* debugger = nullptr;
+
+	static constexpr auto unlimited_fuel = std::numeric_limits<u64>::max();
+
+	//! Calls and backward branches left before yielding (see start()).
+	u64 fuel = unlimited_fuel;
+
+	//! Whether the run yielded, leaving its frames on the FrameStack.
+	bool yielded = false;
+
+	//! Amount of native code calls in progress, which cannot be suspended.
+	std::size_t native_depth = 0;
+
+	friend class Debugger;
+
 	VarId local_id_from_reference(u32 reference) const;
 
+	//! Returns the script to run when 'script' gets called.
+	const Script& script_to_run(const Script& script);
+
+	//! Runs 'script' with its 'argument_count' arguments already pushed,
+	//! yielding once 'budget' is spent.
+	//! @see invoke
+	//! @see start
+	RunResult invoke_pushed(
+		const Script& script, std::size_t argument_count, u64 budget);
+
+	void push_arguments(const std::vector<Variable>& arguments);
+
+	//! Pops the entry frame of a run that finished, and its result if any.
+	std::optional<Variable> finish_entry();
+
+	//! Called once out of fuel.
+	//! @returns whether the run yields, which it cannot do with native code
+	//! in progress.
+	bool out_of_fuel();
+
+	//! Records where the script of frame 'depth' continues from once
+	//! resumed.
+	void suspend_frame(
+		std::size_t   depth,
+		const Script& script,
+		std::size_t   offset,
+		bool          compare_flag);
+
+	//! Resumes frame 'depth' after the frames above it.
+	void resume_frame(std::size_t depth);
+
+	//! Marks the objects of the heap referenced by the stack and variables.
+	void mark_roots();
+
+	//! Does a step of garbage collection if enough was allocated since the
+	//! previous one. Only called where every value in use is on the stack or
+	//! in a variable.
+	void gc_safepoint();
+
+	//! Makes room for the locals of 'script' on the stack. Locals start out
+	//! as 0 rather than as whatever the stack held, which may be a stale
+	//! array reference.
+	void push_locals(const Script& script);
+
+	//! Returns the array held by the variable of 'inst_type' that
+	//! 'reference' refers to, if it holds one.
+	[[nodiscard]] HeapArray* array_of(InstType inst_type, u32 reference);
+
+	//! Same as above, for writing an element of it. A variable that holds no
+	//! array gets a new one, and one holding a shared array gets a copy.
+	[[nodiscard]] HeapArray& array_to_write(InstType inst_type, u32 reference);
+
+	//! Pops the index and the instance of an array access, which are pushed
+	//! as i32 after the value written if any.
+	//! @throws std::runtime_error when the index is negative.
+	[[nodiscard]] std::size_t pop_array_index();
+
+	//! Pushes the element at 'index' of the array held by the variable of
+	//! 'inst_type' that 'reference' refers to.
+	//! @throws std::runtime_error when it holds no array, or when 'index' is
+	//! out of its bounds.
+	void push_element(InstType inst_type, u32 reference, std::size_t index);
+
+	//! Writes 'value' at 'index' of the array held by the variable of
+	//! 'inst_type' that 'reference' refers to (see array_to_write()).
+	template<class T>
+	void write_element(
+		InstType inst_type, u32 reference, std::size_t index, T value);
+
 	public:
 	explicit VM(const Form& p_form);
 
+	//! Optimizes the scripts 'profile' found hot, before running anything.
+	void warm_up(const Profile& profile);
+
+	//! Records the scripts that got hot so far into 'profile'.
+	void record_profile(Profile& profile) const;
+
+	//! Adds the basic blocks that ran so far to 'into'.
+	void record_coverage(Coverage& into) const;
+
+	//! Runs 'script' as an entry point, passing it 'arguments'.
+	//! @returns the value it returned, if any.
+	template<class... Ts>
+	std::optional<Variable>
+	invoke(const Script& script, const Ts&... arguments);
+
+	//! Same as above, with arguments only known at runtime. Only numeric
+	//! arguments are supported.
+	//! @throws std::runtime_error when an argument is of another type.
+	std::optional<Variable>
+	invoke(const Script& script, const std::vector<Variable>& arguments);
+
+	//! Same as above, but yields once 'budget' calls and backward branches
+	//! were taken, so that runaway scripts cannot block the thread. A run
+	//! that yielded keeps its state on the stacks of the VM, and continues
+	//! with resume(). Native code cannot yield, so runs only yield once
+	//! back in interpreted code.
+	//! @throws std::runtime_error when the VM is suspended.
+	RunResult start(
+		const Script&                script,
+		const std::vector<Variable>& arguments,
+		u64                          budget);
+
+	//! Continues the run that yielded, for at most 'budget' more calls and
+	//! backward branches.
+	//! @throws std::runtime_error when the VM is not suspended.
+	RunResult resume(u64 budget);
+
+	//! Whether a run yielded and was not resumed to completion yet.
+	[[nodiscard]] bool suspended() const;
+
+	//! Collects every object of the heap that is not referenced anymore,
+	//! rather than spreading the work over steps.
+	void collect_garbage();
+
+	[[nodiscard]] const HeapStats& heap_stats() const;
+
+	//! Containers of the ds_* builtins, which reset() destroys.
+	[[nodiscard]] DataStructures& data_structures();
+
+	//! Amount of arguments passed to the running builtin or script.
+	[[nodiscard]] std::size_t argument_count() const;
+
+	//! Pops a stack variable, e.g. an argument of a builtin, which pops them
+	//! starting from the last one.
+	[[nodiscard]] Variable pop_variable();
+
+	//! Pushes 'variable' as a stack variable, e.g. the result of a builtin.
+	void push_variable(const Variable& variable);
+
+	//! Reads argument 'index' of the running builtin where it lies on the
+	//! stack, rather than popping it. 'T' is an arithmetic type, to which any
+	//! number converts, std::string_view, StringReference, ArrayReference or
+	//! Variable.
+	//! @throws std::runtime_error when the argument is not of a kind 'T'
+	//! accepts.
+	template<class T>
+	[[nodiscard]] T argument(std::size_t index);
+
+	//! Pops all the arguments of the running builtin at once, once they were
+	//! read with argument().
+	void drop_arguments();
+
+	//! Allocates a string on the heap, e.g. for the result of a builtin.
+	[[nodiscard]] StringReference make_string(std::string_view text);
+
+	//! Brings the VM back to its initial state so it can be reused, only
+	//! touching the state that was actually used. Optimized scripts,
+	//! memoized results and coverage are kept. A suspended run is dropped.
+	void reset();
+
+	//! Forgets the results of calls to pure scripts, so that later calls
+	//! run them again.
+	void clear_memoized();
+
 	//! Calls a function 'f' with parameter types corresponding to the given
 	//! 'types'. e.g. dispatcher(f, std::array{DataType::f32, DataType::f64})
 	//! will call f(0.0f, 0.0);
@@ -98,14 +306,74 @@ class VM
 	void call(const FunctionDefinition& func, std::size_t argument_count = 0);
 
 	void run(const Script& script);
+
+	//! Entry points for native code (see compile_native()), which execute
+	//! the instruction at block 'offset' of the running script.
+	//! @returns whether the script returned or threw.
+	static bool jit_step(JitContext* context, u32 offset);
+
+	//! @returns the block offset the switch at block 'offset' jumps to.
+	static u32 jit_switch_target(JitContext* context, u32 offset);
+
+	private:
+	//! Interprets 'script' from block 'offset', in the current frame.
+	void interpret(
+		const Script& script,
+		std::size_t   offset       = 0,
+		bool          compare_flag = false);
+	//! Runs native code compiled from 'script', either by the JIT or ahead of
+	//! time. 'targets' is only needed by code compiled by the JIT.
+	void run_native(
+		const Script&      script,
+		void               (*entry)(JitContext*),
+		const void* const* targets);
+
+	//! Executes the instruction 'reader' is on, leaving 'reader' on the last
+	//! block read (i.e. the caller moves on to the next instruction).
+	//! 'hits' is the coverage map of 'script', if recorded.
+	//! @returns whether the script returned.
+	bool execute(
+		const Script&      script,
+		BlockReader&       reader,
+		bool&              compare_flag,
+		Tiering::Counters* counters,
+		u8*                hits);
 };
 
-inline VM::VM(const Form& p_form) : form{p_form}
+inline VM::VM(const Form& p_form) :
+	form{p_form},
+	tiering{p_form},
+	coverage{p_form}
+{}
+
+inline const Script& VM::script_to_run(const Script& script)
 {
-	if constexpr (check(debug::vm_debug_stack))
+	if (debugger != nullptr)
+	{
+		return debugger->script_for(script);
+	}
+
+	if constexpr (check(debug::vm_coverage))
 	{
-		std::fill(stack.raw.begin(), stack.raw.end(), 0xAB);
+		return script;
 	}
+
+	return opt::tiered ? tiering.on_call(script) : script;
+}
+
+inline void VM::warm_up(const Profile& profile)
+{
+	tiering.warm_up(profile);
+}
+
+inline void VM::record_profile(Profile& profile) const
+{
+	tiering.record(profile);
+}
+
+inline void VM::record_coverage(Coverage& into) const
+{
+	into.merge(coverage);
 }
 
 template<std::size_t Left, class F, class... Ts>
@@ -129,6 +397,7 @@ VM::dispatcher(F f, [[maybe_unused]] std::array<DataType, Left> types) const
 		case DataType::i32: return DISPATCH_NEXT(s32);
 		case DataType::i16: return DISPATCH_NEXT(s16);
 		case DataType::str: return DISPATCH_NEXT(StringReference);
+		case DataType::array: return DISPATCH_NEXT(ArrayReference);
 		case DataType::var: return DISPATCH_NEXT(VariablePlaceholder);
 		default: maybe_unreachable("Unsupported DataType in dispatcher");
 		}
@@ -306,11 +575,32 @@ VM::write_variable(InstType inst_type, VarId var_id, VarType var_type, T value)
 		maybe_unreachable("Impossible to write_variable with this inst_type");
 
 	case InstType::global:
-		instances.global().variable(var_id).data = value;
-		break;
+	{
+		auto& variable = instances.global().variable(var_id);
+
+		// Shared first, in case the variable already holds it
+		if constexpr (std::is_same_v<T, ArrayReference>)
+		{
+			++value.array->shares;
+		}
+
+		if (auto* array = std::get_if<ArrayReference>(&variable.data))
+		{
+			--array->array->shares;
+		}
+
+		variable.data = value;
+	}
+	break;
 
 	case InstType::local:
 	{
+		// The array the local held is not released, see HeapArray::shares
+		if constexpr (std::is_same_v<T, ArrayReference>)
+		{
+			++value.array->shares;
+		}
+
 		auto local_offset
 			= frames.top().local_offset(local_id_from_reference(var_id));
 		MainStackReader reader = stack.temporary_reader(local_offset);
@@ -336,3 +626,332 @@ FORCE_INLINE auto VM::value(T& value)
 		return value;
 	}
 }
+
+template<class... Ts>
+std::optional<Variable>
+VM::invoke(const Script& script, const Ts&... arguments)
+{
+	(push_stack_variable(arguments), ...);
+	return invoke_pushed(script, sizeof...(arguments), unlimited_fuel).value;
+}
+
+inline std::optional<Variable>
+VM::invoke(const Script& script, const std::vector<Variable>& arguments)
+{
+	push_arguments(arguments);
+	return invoke_pushed(script, arguments.size(), unlimited_fuel).value;
+}
+
+inline RunResult VM::start(
+	const Script& script, const std::vector<Variable>& arguments, u64 budget)
+{
+	push_arguments(arguments);
+	return invoke_pushed(script, arguments.size(), budget);
+}
+
+inline bool VM::suspended() const
+{
+	return yielded;
+}
+
+inline void VM::gc_safepoint()
+{
+	if (heap.wants_step())
+	{
+		heap.step([&] { mark_roots(); });
+	}
+}
+
+inline void VM::collect_garbage()
+{
+	heap.collect([&] { mark_roots(); });
+}
+
+inline const HeapStats& VM::heap_stats() const
+{
+	return heap.stats();
+}
+
+inline DataStructures& VM::data_structures()
+{
+	return structures;
+}
+
+inline std::size_t VM::argument_count() const
+{
+	return frames.top().argument_count;
+}
+
+inline Variable VM::pop_variable()
+{
+	Variable variable;
+	pop_dispatch([&](auto v) { variable.data = value(v); });
+	return variable;
+}
+
+inline void VM::push_variable(const Variable& variable)
+{
+	std::visit([&](auto v) { push_stack_variable(v); }, variable.data);
+}
+
+template<class T>
+inline T VM::argument(std::size_t index)
+{
+	auto offset = frames.top().argument_offset(ArgId(index));
+
+	DataType type;
+	std::memcpy(&type, &stack.raw[offset + sizeof(s64)], sizeof(type));
+
+	auto read = [&](auto value) {
+		std::memcpy(&value, &stack.raw[offset], sizeof(value));
+		return value;
+	};
+
+	if constexpr (std::is_arithmetic_v<T>)
+	{
+		switch (type)
+		{
+		case DataType::f64: return T(read(f64{}));
+		case DataType::f32: return T(read(f32{}));
+		case DataType::i64: return T(read(s64{}));
+		case DataType::i32: return T(read(s32{}));
+		case DataType::i16: return T(read(s16{}));
+		default: break;
+		}
+
+		throw std::runtime_error{
+			fmt::format("Argument {} must be a number", index)};
+	}
+	else if constexpr (
+		std::is_same_v<T, std::string_view>
+		|| std::is_same_v<T, StringReference>)
+	{
+		if (type != DataType::str)
+		{
+			throw std::runtime_error{
+				fmt::format("Argument {} must be a string", index)};
+		}
+
+		auto string = read(StringReference{});
+		if constexpr (std::is_same_v<T, std::string_view>)
+		{
+			return string.string->view();
+		}
+		else
+		{
+			return string;
+		}
+	}
+	else if constexpr (std::is_same_v<T, ArrayReference>)
+	{
+		if (type != DataType::array)
+		{
+			throw std::runtime_error{
+				fmt::format("Argument {} must be an array", index)};
+		}
+
+		return read(ArrayReference{});
+	}
+	else
+	{
+		static_assert(
+			std::is_same_v<T, Variable>, "Unsupported type of argument");
+
+		Variable variable;
+		switch (type)
+		{
+		case DataType::f64: variable.data = read(f64{}); break;
+		case DataType::f32: variable.data = read(f32{}); break;
+		case DataType::i64: variable.data = read(s64{}); break;
+		case DataType::i32: variable.data = read(s32{}); break;
+		case DataType::i16: variable.data = read(s16{}); break;
+		case DataType::str: variable.data = read(StringReference{}); break;
+		case DataType::array: variable.data = read(ArrayReference{}); break;
+		default: maybe_unreachable("Unsupported DataType of argument");
+		}
+
+		return variable;
+	}
+}
+
+inline void VM::drop_arguments()
+{
+	stack.offset = frames.top().stack_offset;
+}
+
+inline StringReference VM::make_string(std::string_view text)
+{
+	return {heap.make_string(text)};
+}
+
+inline void VM::push_arguments(const std::vector<Variable>& arguments)
+{
+	for (auto& argument : arguments)
+	{
+		std::visit(
+			[&](auto v) {
+				using T = decltype(v);
+
+				if constexpr (
+					std::is_same_v<T, bool>
+					|| std::is_same_v<T, StringReference>
+					|| std::is_same_v<T, ArrayReference>)
+				{
+					throw std::runtime_error{
+						"Only numeric arguments can be passed to invoke"};
+				}
+				else
+				{
+					push_stack_variable(v);
+				}
+			},
+			argument.data);
+	}
+}
+
+inline RunResult VM::invoke_pushed(
+	const Script& script, std::size_t argument_count, u64 budget)
+{
+	if (yielded)
+	{
+		throw std::runtime_error{
+			"Cannot run a script on a suspended VM, resume or reset it first"};
+	}
+
+	// At least one call or backward branch runs between yields
+	fuel = std::max<u64>(budget, 1);
+
+	Frame& frame         = frames.push();
+	frame.argument_count = argument_count;
+	frame.stack_offset
+		= stack.offset - frame.argument_count * Variable::stack_variable_size;
+
+	stack.raw.ensure(stack.offset + stack_frame_headroom);
+
+	const Script& called_script = script_to_run(script);
+	push_locals(called_script);
+	run(called_script);
+
+	if (yielded)
+	{
+		return {true, std::nullopt};
+	}
+
+	return {false, finish_entry()};
+}
+
+inline std::optional<Variable> VM::finish_entry()
+{
+	auto begin = frames.top().stack_offset;
+	frames.pop();
+
+	if (stack.offset != begin + Variable::stack_variable_size)
+	{
+		stack.offset = begin;
+		return std::nullopt;
+	}
+
+	return pop_variable();
+}
+
+inline bool VM::out_of_fuel()
+{
+	if (native_depth != 0)
+	{
+		// Checks again on the next call or backward branch
+		fuel = 1;
+		return false;
+	}
+
+	yielded = true;
+	return true;
+}
+
+inline void VM::suspend_frame(
+	std::size_t   depth,
+	const Script& script,
+	std::size_t   offset,
+	bool          compare_flag)
+{
+	Frame& frame        = frames.frames[depth];
+	frame.script        = &script;
+	frame.resume_offset = offset;
+	frame.compare_flag  = compare_flag;
+}
+
+inline void VM::push_locals(const Script& script)
+{
+	auto bytes = script.local_count * Variable::stack_variable_size;
+
+	// Scripts with many locals may need more than the frame headroom
+	stack.raw.ensure(stack.offset + bytes + stack_frame_headroom);
+	std::memset(&stack.raw[stack.offset], 0, bytes);
+	stack.skip(-long(bytes));
+}
+
+inline HeapArray* VM::array_of(InstType inst_type, u32 reference)
+{
+	switch (inst_type)
+	{
+	case InstType::local:
+	{
+		auto offset
+			= frames.top().local_offset(local_id_from_reference(reference));
+
+		if (DataType(stack.raw[offset + sizeof(s64)]) != DataType::array)
+		{
+			return nullptr;
+		}
+
+		ArrayReference array;
+		std::memcpy(&array, &stack.raw[offset], sizeof(array));
+		return array.array;
+	}
+
+	case InstType::global:
+	{
+		auto& variable = instances.global().variable(reference & 0x00FFFFFFu);
+		auto* array    = std::get_if<ArrayReference>(&variable.data);
+		return array != nullptr ? array->array : nullptr;
+	}
+
+	default: maybe_unreachable("InstType not implemented for arrays");
+	}
+}
+
+inline std::size_t VM::pop_array_index()
+{
+	auto index = stack.pop<s32>();
+
+	// Only locals and globals are implemented, which ignore the instance
+	stack.pop<s32>();
+
+	if (index < 0)
+	{
+		throw std::runtime_error{
+			fmt::format("Negative array index {}", index)};
+	}
+
+	return std::size_t(index);
+}
+
+template<class T>
+FORCE_INLINE void
+VM::write_element(InstType inst_type, u32 reference, std::size_t index, T value)
+{
+	if constexpr (std::is_arithmetic_v<T>)
+	{
+		// Numbers stored in bounds of a numeric array that is not shared
+		auto* array = array_of(inst_type, reference);
+		if (array != nullptr && array->shares <= 1)
+		{
+			if (auto* number = array->number_at(index))
+			{
+				*number = f64(value);
+				return;
+			}
+		}
+	}
+
+	heap.store(array_to_write(inst_type, reference), index, Variable{value});
+}
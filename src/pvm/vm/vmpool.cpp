@@ -0,0 +1,27 @@
+#include "pvm/vm/vmpool.hpp"
+
+VMPool::VMPool(const Form& form) : _form{form} {}
+
+VMPool::Lease VMPool::acquire()
+{
+	{
+		std::lock_guard lock{_mutex};
+
+		if (!_idle.empty())
+		{
+			auto vm = std::move(_idle.back());
+			_idle.pop_back();
+			return {*this, std::move(vm)};
+		}
+	}
+
+	return {*this, std::make_unique<VM>(_form)};
+}
+
+void VMPool::release(std::unique_ptr<VM> vm)
+{
+	vm->reset();
+
+	std::lock_guard lock{_mutex};
+	_idle.push_back(std::move(vm));
+}
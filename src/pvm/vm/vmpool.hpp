@@ -0,0 +1,100 @@
+#pragma once
+
+#include "pvm/vm/vm.hpp"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//! Keeps VMs bound to a form around between runs, so that running a script
+//! does not need to set a new VM up every time. VMs are reset when given back
+//! to the pool, but keep their optimized scripts and memoized results.
+class VMPool
+{
+	public:
+	//! VM borrowed from the pool, given back to it on destruction.
+	class Lease
+	{
+		public:
+		Lease(Lease&&) = default;
+
+		//! Gives the VM held so far back to its pool first.
+		Lease& operator=(Lease&& other);
+
+		~Lease();
+
+		[[nodiscard]] VM& operator*();
+		[[nodiscard]] VM* operator->();
+
+		private:
+		friend class VMPool;
+		Lease(VMPool& pool, std::unique_ptr<VM> vm);
+
+		VMPool*             _pool;
+		std::unique_ptr<VM> _vm;
+	};
+
+	explicit VMPool(const Form& form);
+
+	//! Returns an idle VM, creating one when there is none.
+	[[nodiscard]] Lease acquire();
+
+	//! Runs 'script' on a VM of the pool.
+	//! @see VM::invoke
+	template<class... Ts>
+	std::optional<Variable> run(const Script& script, const Ts&... arguments);
+
+	private:
+	void release(std::unique_ptr<VM> vm);
+
+	const Form& _form;
+
+	std::mutex                       _mutex;
+	std::vector<std::unique_ptr<VM>> _idle;
+};
+
+inline VMPool::Lease::Lease(VMPool& pool, std::unique_ptr<VM> vm) :
+	_pool{&pool},
+	_vm{std::move(vm)}
+{}
+
+inline VMPool::Lease& VMPool::Lease::operator=(Lease&& other)
+{
+	if (this != &other)
+	{
+		if (_vm != nullptr)
+		{
+			_pool->release(std::move(_vm));
+		}
+
+		_pool = other._pool;
+		_vm   = std::move(other._vm);
+	}
+
+	return *this;
+}
+
+inline VMPool::Lease::~Lease()
+{
+	if (_vm != nullptr)
+	{
+		_pool->release(std::move(_vm));
+	}
+}
+
+inline VM& VMPool::Lease::operator*()
+{
+	return *_vm;
+}
+
+inline VM* VMPool::Lease::operator->()
+{
+	return _vm.get();
+}
+
+template<class... Ts>
+std::optional<Variable>
+VMPool::run(const Script& script, const Ts&... arguments)
+{
+	auto vm = acquire();
+	return vm->invoke(script, arguments...);
+}
@@ -0,0 +1,9 @@
+.script gml_Script_convtag ; conv chains ending in var keep the tag they box
+	pushspc        argument0
+	conv.var.i32
+	conv.i32.f64
+	conv.f64.var
+	push.i16       2
+	conv.i32.var
+	div.var.var
+	ret.var
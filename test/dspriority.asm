@@ -0,0 +1,27 @@
+.script gml_Script_dspriority ; ties come out of delete_min in insertion order
+	call.i32       ds_priority_create(0)
+	pop.var.var    local.q
+	pushloc.var    local.q
+	push.i16       10
+	conv.i32.var
+	push.i16       1
+	conv.i32.var
+	call.i32       ds_priority_add(3)
+	popz.var
+	pushloc.var    local.q
+	push.i16       20
+	conv.i32.var
+	push.i16       1
+	conv.i32.var
+	call.i32       ds_priority_add(3)
+	popz.var
+	pushloc.var    local.q
+	push.i16       30
+	conv.i32.var
+	push.i16       1
+	conv.i32.var
+	call.i32       ds_priority_add(3)
+	popz.var
+	pushloc.var    local.q
+	call.i32       ds_priority_delete_min(1)
+	ret.var
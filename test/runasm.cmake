@@ -0,0 +1,35 @@
+# Assembles SOURCE with phosphorvm-asm, then runs ENTRY enough times with
+# phosphorvm-run for its script to get promoted. Fails unless every run
+# returned EXPECTED.
+#
+# Usage: cmake -DASM=... -DRUN=... -DSOURCE=... -DENTRY=... -DEXPECTED=...
+#              -DWORK_DIRECTORY=... -P runasm.cmake
+
+file(MAKE_DIRECTORY "${WORK_DIRECTORY}")
+
+execute_process(
+	COMMAND "${ASM}" -o data.win "${SOURCE}"
+	WORKING_DIRECTORY "${WORK_DIRECTORY}"
+	RESULT_VARIABLE status
+)
+
+if(status)
+	message(FATAL_ERROR "Could not assemble '${SOURCE}'")
+endif()
+
+execute_process(
+	COMMAND "${RUN}" -n 10000 data.win "${ENTRY}"
+	WORKING_DIRECTORY "${WORK_DIRECTORY}"
+	RESULT_VARIABLE status
+	OUTPUT_VARIABLE output
+)
+
+message("${output}")
+
+if(status)
+	message(FATAL_ERROR "'${ENTRY}' did not return the same result on every run")
+endif()
+
+if(NOT output MATCHES " ${EXPECTED}\n")
+	message(FATAL_ERROR "'${ENTRY}' did not return ${EXPECTED}")
+endif()
@@ -0,0 +1,9 @@
+.script gml_Script_tierup ; a local retyped to f64 by infer_types
+	pushcst.f64    1.5
+	pop.var.f64    local.x
+	pushloc.var    local.x
+	conv.var.i32
+	push.i16       10
+	add.i32.i32
+	conv.i32.var
+	ret.var